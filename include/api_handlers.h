@@ -26,6 +26,11 @@ bool check_thumb_exists(const char* media_path, char* thumb_path, size_t thumb_p
 void ensure_thumbs_for_dir(const char* dir);
 void handle_api_add_folder(int c, const char* request_body, bool keep_alive);
 void handle_api_list_folders(int c, bool keep_alive);
+void handle_api_cache_stats(int c, bool keep_alive);
+void handle_api_ready(int c, bool keep_alive);
+void handle_api_hls_playlist(int c, char* qs, bool keep_alive);
+void handle_api_hls_segment(int c, char* qs, bool keep_alive);
+void api_invalidate_dir_caches(const char* dir);
 void handle_api_regenerate_thumbs(int c, char* qs, bool keep_alive);
 void start_background_thumb_generation(const char* dir_path);
 void create_placeholder_thumbnails(void);
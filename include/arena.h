@@ -1,7 +1,27 @@
 #pragma once
 #include "common.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_REQUEST_CHUNK (64 * 1024)
+#define ARENA_RETAIN_BYTES (256 * 1024)
+
 typedef struct arena arena_t;
+typedef struct { void* chunk; size_t off; } arena_mark_t;
+
 arena_t* arena_create(size_t initial_capacity);
 void arena_destroy(arena_t* a);
 void* arena_alloc(arena_t* a, size_t n);
-char* arena_strdup(arena_t* a, const char* s);
\ No newline at end of file
+void* arena_alloc_aligned(arena_t* a, size_t n, size_t align);
+void* arena_realloc(arena_t* a, void* p, size_t old_n, size_t new_n);
+char* arena_strdup(arena_t* a, const char* s);
+char* arena_strndup(arena_t* a, const char* s, size_t n);
+arena_mark_t arena_mark(arena_t* a);
+void arena_reset_to(arena_t* a, arena_mark_t m);
+void arena_reset(arena_t* a);
+arena_t* arena_request(void);
+/* Chunks this thread's arenas have taken from malloc. Only the arena's own
+ * allocations are counted: other heap calls are invisible here, since
+ * neither the MinGW CRT nor current glibc offer an allocation hook to count
+ * them with, so this is a diagnostic for chunk growth rather than proof that
+ * a request made no other mallocs. */
+size_t arena_chunk_count(void);
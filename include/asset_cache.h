@@ -0,0 +1,27 @@
+#pragma once
+#include "common.h"
+
+#define ASSET_CACHE_MAX_FILE (8L * 1024 * 1024)
+#define ASSET_FRAGMENT_MARKER "<!-- MEDIA_FRAGMENT -->"
+
+typedef struct asset {
+    char* key;
+    char* path;
+    uint32_t hash;
+    int dir_idx;
+    unsigned gen;
+    const char* mime;
+    char* data;
+    size_t len;
+    unsigned char* gz;
+    size_t gz_len;
+    long split;
+    char etag[32];
+    time_t mtime;
+    atomic_int refs;
+} asset_t;
+
+void asset_cache_init(void);
+asset_t* asset_cache_acquire(const char* key);
+void asset_cache_release(asset_t* a);
+int asset_cache_serve(int c, const char* key, const char* request_headers, int keep_alive);
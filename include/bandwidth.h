@@ -0,0 +1,14 @@
+#pragma once
+#include "common.h"
+
+typedef struct {
+    uint64_t client;
+    uint64_t key;
+    int active;
+} bw_flow_t;
+
+void bw_init(long bytes_per_sec);
+int bw_enabled(void);
+void bw_flow_open(bw_flow_t* f, int sock, const char* resource);
+void bw_flow_throttle(bw_flow_t* f, size_t bytes);
+void bw_flow_close(bw_flow_t* f);
@@ -1,4 +1,16 @@
 #pragma once
 #include "common.h"
 int compress_val(const char* in, size_t in_len, unsigned char** out, size_t* out_len);
-int decompress_val(const unsigned char* in, size_t in_len, unsigned char** out, size_t* out_len);
\ No newline at end of file
+int decompress_val(const unsigned char* in, size_t in_len, unsigned char** out, size_t* out_len);
+
+#define COMPRESS_LEVEL_FAST 1
+#define COMPRESS_LEVEL_DEFAULT 6
+#define COMPRESS_LEVEL_BEST 9
+
+typedef struct gz_stream gz_stream_t;
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len);
+gz_stream_t* gz_stream_create(int level);
+int gz_stream_write(gz_stream_t* z, const void* data, size_t len, int finish, const unsigned char** out, size_t* out_len);
+void gz_stream_destroy(gz_stream_t* z);
+int gzip_compress(const void* in, size_t in_len, int level, unsigned char** out, size_t* out_len);
\ No newline at end of file
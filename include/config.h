@@ -8,3 +8,10 @@ bool is_gallery_folder(const char* path);
 char** get_gallery_folders(size_t* count);
 extern int log_threads_enabled;
 extern int server_port;
+extern long stream_bandwidth;
+extern long thumb_cache_size;
+extern int thumb_pack_enabled;
+extern int scan_concurrency;
+extern long scan_io_bandwidth;
+extern long scan_iops;
+extern long long hls_cache_size;
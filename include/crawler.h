@@ -0,0 +1,27 @@
+#pragma once
+#include "common.h"
+
+#define CRAWLER_MAX_WORKERS 64
+#define CRAWLER_HDD_WORKERS 2
+#define CRAWLER_DEQUE_INITIAL 64
+#define SCAN_CONCURRENCY_SSD 0
+#define SCAN_CONCURRENCY_HDD -1
+
+typedef struct crawler_worker crawler_worker_t;
+typedef void (*crawler_visit_t)(crawler_worker_t* w, const char* dir, void* ctx);
+
+typedef struct crawler_stats {
+    size_t visited;
+    size_t steals;
+    int workers;
+    uint64_t elapsed_ms;
+} crawler_stats_t;
+
+/* Calls visit once per directory task, starting from roots, on a pool of
+ * workers that each own a deque: a worker pops its newest task and, when
+ * empty, steals the oldest task of another worker. visit queues more
+ * directories with crawler_push() on the worker it was handed. Blocks until
+ * every task has been visited. workers <= 0 uses crawler_default_workers(). */
+int crawler_run(const char* const* roots, size_t nroots, int workers, crawler_visit_t visit, void* ctx, crawler_stats_t* stats);
+void crawler_push(crawler_worker_t* w, const char* dir);
+int crawler_default_workers(void);
@@ -0,0 +1,31 @@
+#pragma once
+#include "common.h"
+
+#define FD_CACHE_MAX 256
+#define FD_CACHE_BUCKETS 512
+#define FD_CACHE_REVALIDATE_MS 1000
+
+typedef struct fd_cache_entry {
+    char* key;
+    char* path;
+    uint32_t hash;
+    int fd;
+    struct stat st;
+    int wd;
+    uint64_t checked_ms;
+    atomic_int refs;
+    struct fd_cache_entry* prev;
+    struct fd_cache_entry* next;
+    struct fd_cache_entry* hnext;
+} fd_cache_entry_t;
+
+void fd_cache_init(void);
+fd_cache_entry_t* fd_cache_acquire(const char* key);
+fd_cache_entry_t* fd_cache_insert(const char* key, const char* path, int fd, const struct stat* st);
+void fd_cache_release(fd_cache_entry_t* e);
+void fd_cache_invalidate(const char* path);
+/* True when an entry holds the file st describes (same device and inode),
+ * i.e. the file was served recently and may still be streaming. */
+int fd_cache_holds(const struct stat* st);
+void fd_cache_clear(void);
+void fd_cache_stats(size_t* hits, size_t* misses, size_t* entries);
@@ -0,0 +1,25 @@
+#pragma once
+#include "common.h"
+
+#define GOVERNOR_SAMPLE_MS 1000
+#define GOVERNOR_INITIAL_SLOTS 4
+#define GOVERNOR_MAX_SLOTS 16
+#define GOVERNOR_LATENCY_HIGH_MS 150
+#define GOVERNOR_LATENCY_LOW_MS 40
+#define GOVERNOR_CPU_LOW_PCT 60
+#define GOVERNOR_MIN_FREE_MB 512
+#define GOVERNOR_JOB_MEM_MB 256
+
+/* Background generation parallelism is re-derived every GOVERNOR_SAMPLE_MS
+ * from CPU utilization, run-queue length, available memory and the time to
+ * first byte of foreground HTTP requests. Slots halve and each job drops to
+ * one thread as soon as interactive traffic slows down or the machine is
+ * oversubscribed, and grow back one at a time while it stays idle. */
+void governor_init(void);
+void governor_request_begin(void);
+void governor_request_first_byte(void);
+void governor_request_end(void);
+int governor_gen_slots(void);
+int governor_magick_slots(void);
+int governor_job_threads(void);
+long governor_job_mem_mb(void);
@@ -0,0 +1,40 @@
+#pragma once
+#include "common.h"
+
+#define HLS_SEGMENT_SEC 6
+#define HLS_PREFETCH_SEGMENTS 2
+#define HLS_MAX_PREFETCH_JOBS 2
+#define HLS_CACHE_DEFAULT_BYTES (2048LL * 1024 * 1024)
+#define HLS_CACHE_DIR "hls-cache"
+#define HLS_CACHE_BUCKETS 1024
+#define HLS_PROBE_ENTRIES 64
+#define HLS_PROBE_TIMEOUT_SEC 15
+#define HLS_MAX_SEGMENTS 100000
+#define HLS_CUTS_FILE "cuts.txt"
+#define HLS_MAX_SEGMENT_SEC (HLS_SEGMENT_SEC * 2)
+#define HLS_SEGMENT_TIMEOUT_SEC 120
+#define HLS_MAX_INFLIGHT 16
+#define HLS_WAIT_POLL_MS 25
+
+/* Videos are offered as a VOD playlist of MPEG-TS segments of about
+ * HLS_SEGMENT_SEC, each cut on first request by seeking the source, so a
+ * seek only reads the part of the file it lands in. H.264 with AAC/MP3 (or
+ * no) audio in an MP4/MOV or Matroska file is remuxed with stream copy, cut
+ * on the first keyframe at or after every HLS_SEGMENT_SEC as listed by the
+ * container's index; when there is no index, a keyframe gap would stretch a
+ * segment past HLS_MAX_SEGMENT_SEC, or for any other codec, the video is
+ * transcoded to H.264/AAC on a fixed HLS_SEGMENT_SEC grid. Segments and
+ * the keyframe boundaries live under the thumbs root in HLS_CACHE_DIR and are
+ * evicted least recently used once they exceed the byte budget; serving a
+ * segment queues the next HLS_PREFETCH_SEGMENTS in the background. */
+void hls_init(long long cache_bytes);
+int hls_is_candidate(const char* name);
+
+/* Returns a malloc'd m3u8 for media whose segment URIs carry url_path
+ * back as the path query parameter, or NULL when media has no video. */
+char* hls_build_playlist(const char* media, const char* url_path, size_t* out_len);
+
+/* Produces segment index of media if it is not cached yet, waiting for a
+ * concurrent producer of the same segment, and writes its file path to
+ * out. Returns 0, -1 on failure, or -2 when index is out of range. */
+int hls_segment_path(const char* media, int index, char* out, size_t outlen);
@@ -1,5 +1,7 @@
 #pragma once
 #include "common.h"
+#include "platform.h"
+#include "arena.h"
 
 typedef struct {
     int is_range;
@@ -7,12 +9,48 @@ typedef struct {
     long end;
 } range_t;
 
+#define HTTP_MAX_RANGES 16
+#define RANGE_COALESCE_GAP 80
+
+typedef struct {
+    int count;
+    range_t r[HTTP_MAX_RANGES];
+} range_set_t;
+
+#define HTTP_STREAM_BUF_SIZE (32 * 1024)
+#define GZIP_ENCODING_HEADERS "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n"
+
+typedef struct {
+    int sock;
+    int failed;
+    struct gz_stream* gz;
+    char* ptr;
+    size_t rem;
+    char data[HTTP_STREAM_BUF_SIZE + 1];
+} http_stream_t;
+
+void http_init(void);
 const char* mime_for(const char* path);
+void http_negotiate_encoding(const char* request_headers);
 char* get_header_value(const char* request_buf, const char* header_name);
+char* get_header_value_arena(arena_t* a, const char* request_buf, const char* header_name);
 void send_header(int c,int status,const char* text,const char* ctype,long len,const range_t* range,long file_size,int keep_alive);
+void send_response(int c,int status,const char* text,const char* ctype,const void* body,size_t len,int keep_alive);
+int http_accepts_gzip(void);
+int http_is_compressible(const char* ctype);
+void send_response_parts(int c,int status,const char* text,const char* ctype,const platform_iovec_t* parts,int nparts,int keep_alive,const char* extra,int allow_gzip);
+void http_format_validators(const struct stat* st,char* etag,size_t etag_cap,char* lm,size_t lm_cap);
 void send_text(int c,int status,const char* text,const char* body,int keep_alive);
+void http_stream_begin(http_stream_t* s,int c,int status,const char* text,const char* ctype,int keep_alive);
+void http_stream_reserve(http_stream_t* s,size_t need);
+void http_stream_write(http_stream_t* s,const char* data,size_t len);
+void http_stream_end(http_stream_t* s);
 range_t parse_range_header(const char* header_value,long file_size);
+int parse_range_set(const char* header_value,long file_size,range_set_t* out);
 void send_file_stream(int c,const char* fs_path,const char* range_header,int keep_alive);
+void send_file_stream_ex(int c,const char* fs_path,const char* range_header,const char* if_range,int keep_alive);
+void send_file_fd_ex(int c,int fd,const struct stat* st,const char* fs_path,const char* range_header,const char* if_range,int keep_alive);
+void send_file_fd_at(int c,int fd,long base,const struct stat* st,const char* fs_path,const char* range_header,const char* if_range,int keep_alive);
 
 extern char g_request_url[PATH_MAX];
 
@@ -0,0 +1,27 @@
+#pragma once
+#include "common.h"
+
+#define IO_BUDGET_DEFAULT_BYTES (64L * 1024 * 1024)
+#define IO_BUDGET_DEFAULT_IOPS 400
+#define IO_BUDGET_BURST_MS 250
+#define IO_BUDGET_DECODE_CHARGE_MAX (16L * 1024 * 1024)
+
+/* Token buckets for background disk reads: one in bytes/s for sequential
+ * data and one in operations/s for opens and directory listings. Only
+ * threads that called io_budget_set_background(1) are charged, so request
+ * handlers, and with them media streaming, never wait on the budget.
+ * A rate of 0 disables that bucket. */
+void io_budget_init(long bytes_per_sec, long iops);
+void io_budget_set_background(int on);
+int io_budget_is_background(void);
+void io_budget_acquire(size_t bytes, int ops);
+
+/* Page-cache hints for a background reader: read_begin marks fd as a
+ * one-pass sequential read, read_end drops the pages it pulled in so a
+ * scan does not push hot thumbnails out of the cache. Files held by the fd
+ * cache are being served, so their pages are left alone for the streams
+ * reading them. All are no-ops on foreground threads and where
+ * posix_fadvise is unavailable. */
+void io_budget_read_begin(int fd);
+void io_budget_read_end(int fd);
+void io_budget_drop_cache(const char* path);
@@ -36,8 +36,9 @@ typedef enum {
 /**
  * @brief Initialize the logging system.
  *
- * Opens the default log file ("application.log") for appending.
- * If the file cannot be opened, output falls back to stderr.
+ * Opens the default log file ("application.log") for appending and
+ * starts the writer thread. If the file cannot be opened, output falls
+ * back to stderr.
  *
  * This function should be called once before using other logging functions.
  * If not called manually, it will be automatically invoked on first use.
@@ -67,12 +68,39 @@ void log_init(void);
  */
 void log_message(LogLevel level, const char* function, const char* format, ...);
 
+/**
+ * @brief Write out every queued log record before returning.
+ *
+ * Records are normally formatted and written by a background thread.
+ * Call this before the process exits abnormally so nothing is lost.
+ */
+void log_flush(void);
+
+/**
+ * @def LOG_COMPILE_LEVEL
+ * @brief Lowest level compiled into the binary.
+ *
+ * Calls below this level expand to dead code, so their arguments are
+ * never evaluated. Defaults to DEBUG in DEBUG_DIAGNOSTIC builds and
+ * INFO otherwise.
+ */
+#ifndef LOG_COMPILE_LEVEL
+#ifdef DEBUG_DIAGNOSTIC
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#define LOG_AT(level, format, ...) do { if ((level) >= LOG_COMPILE_LEVEL) log_message(level, __func__, format, ##__VA_ARGS__); } while (0)
+
 /**
  * @def LOG_DEBUG(format, ...)
  * @brief Log a DEBUG-level message.
  *
  * Expands to a call to log_message() with LOG_LEVEL_DEBUG
- * and automatically includes the current function name.
+ * and automatically includes the current function name. Compiled out
+ * unless LOG_COMPILE_LEVEL is DEBUG.
  *
  * @param format printf-style message format string.
  * @param ...    Optional arguments for the format string.
@@ -82,7 +110,7 @@ void log_message(LogLevel level, const char* function, const char* format, ...);
  *   LOG_DEBUG("Initializing module with id=%d", id);
  * @endcode
  */
-#define LOG_DEBUG(format, ...) log_message(LOG_LEVEL_DEBUG, __func__, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
 
  /**
   * @def LOG_INFO(format, ...)
@@ -95,7 +123,7 @@ void log_message(LogLevel level, const char* function, const char* format, ...);
   *   LOG_INFO("Server listening on port %d", port);
   * @endcode
   */
-#define LOG_INFO(format, ...)  log_message(LOG_LEVEL_INFO,  __func__, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...)  LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
 
   /**
    * @def LOG_WARN(format, ...)
@@ -109,7 +137,7 @@ void log_message(LogLevel level, const char* function, const char* format, ...);
    *   LOG_WARN("Configuration key '%s' missing, using default.", key);
    * @endcode
    */
-#define LOG_WARN(format, ...)  log_message(LOG_LEVEL_WARN,  __func__, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...)  LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
 
    /**
     * @def LOG_ERROR(format, ...)
@@ -122,4 +150,4 @@ void log_message(LogLevel level, const char* function, const char* format, ...);
     *   LOG_ERROR("Unable to open file: %s", filename);
     * @endcode
     */
-#define LOG_ERROR(format, ...) log_message(LOG_LEVEL_ERROR, __func__, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
@@ -0,0 +1,37 @@
+#pragma once
+#include "common.h"
+
+#define MEDIA_INFO_CACHE_ENTRIES 4096
+#define MEDIA_INFO_MAX_JPEG_SEGMENTS 64
+#define MEDIA_INFO_EXIF_SCAN 1024
+#define MEDIA_INFO_MAX_BOXES 1024
+#define MEDIA_INFO_MAX_ELEMENTS 256
+#define MEDIA_INFO_MAX_DIM (1u << 24)
+#define MEDIA_INFO_MAX_INDEX_BYTES (32u * 1024 * 1024)
+#define MEDIA_INFO_MAX_KEYFRAMES (1u << 20)
+
+typedef struct media_info {
+    int width;
+    int height;
+    uint64_t duration_ms;
+    char codec[16];
+} media_info_t;
+
+void media_info_init(void);
+
+/* Reads display width and height, duration and the codec of the first
+ * video track from the headers of JPEG, PNG, GIF, WebP, MP4/MOV, Matroska/
+ * WebM and AVI files, without decoding anything. Width and height already
+ * account for EXIF orientation and track rotation. Returns 0, or -1 when the
+ * format is not recognised or its headers are cut short. */
+int media_info_probe(const char* path, media_info_t* out);
+
+/* media_info_probe() behind a table keyed on path, size and mtime, so a
+ * listing only touches each file's headers once. */
+int media_info_get(const char* path, media_info_t* out);
+
+/* Presentation times in seconds of the first video track's keyframes, taken
+ * from the MP4 sync sample table or the Matroska Cues without reading any
+ * media data. Sets *times to a malloc'd ascending array of *count entries
+ * and returns 0, or -1 when the file keeps no such index. */
+int media_info_keyframes(const char* path, double** times, size_t* count);
@@ -0,0 +1,37 @@
+#pragma once
+#include "common.h"
+
+#define FASTSTART_SUFFIX ".faststart.mp4"
+#define FASTSTART_MOOV_MAX (64u * 1024 * 1024)
+#define FASTSTART_MAX_TOP_BOXES 256
+#define FASTSTART_MAX_DEPTH 8
+#define FASTSTART_COPY_CHUNK (1024 * 1024)
+
+/* MP4/MOV files whose moov box sits after mdat make a browser fetch the
+ * tail before it can start playback. For those, a copy with moov moved in
+ * front of the media data is kept in the directory's thumbs folder: the
+ * boxes are reordered and every stco/co64 chunk offset shifted, nothing is
+ * re-encoded. The copy has the source's size and an mtime one second past
+ * the source's, which is also how freshness is checked, so the two never
+ * share an ETag. */
+int faststart_is_candidate(const char* name);
+int faststart_is_sidecar_name(const char* name);
+int faststart_sidecar_path(const char* media_full, char* out, size_t outlen);
+
+/* 1 when path has exactly one moov, stored after its first mdat, and is
+ * not fragmented; 0 when it is already fast-start; -1 when it does not
+ * parse as a box stream. */
+int faststart_needs_relocation(const char* path);
+int faststart_write(const char* src, const char* dst);
+
+/* Writes or refreshes the sidecar of media_full when it needs one and
+ * removes a sidecar that no longer applies. Returns 1 when a sidecar was
+ * written, 0 when nothing had to change, -1 on failure. */
+int faststart_ensure(const char* media_full);
+/* 1 when faststart_ensure() would write or remove the sidecar of media_full. */
+int faststart_due(const char* media_full);
+
+/* Splits the fresh sidecar of media_full into the thumbs folder and the
+ * file name within it, ready for serving beneath that folder. Returns -1
+ * when there is no usable sidecar. */
+int faststart_lookup(const char* media_full, char* dir_out, size_t dir_len, char* name_out, size_t name_len);
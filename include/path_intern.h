@@ -0,0 +1,41 @@
+#pragma once
+#include "common.h"
+
+#define PATH_ID_NONE (-1)
+#define PATH_INTERN_SEG_BITS 10
+#define PATH_INTERN_MAX_SEGS 1024
+
+typedef int path_id_t;
+
+typedef struct gallery_root {
+    path_id_t id;
+    const char* real;
+    size_t len;
+    const char* safe;
+    char* rel_safe;
+    char* cfg;
+    int dir_fd;
+} gallery_root_t;
+
+typedef struct gallery_roots {
+    unsigned gen;
+    size_t count;
+    gallery_root_t* roots;
+    char base_real[PATH_MAX];
+    char thumbs_cfg[PATH_MAX];
+    char thumbs_real[PATH_MAX];
+    int thumbs_fd;
+    atomic_int refs;
+} gallery_roots_t;
+
+void path_intern_init(void);
+path_id_t path_intern(const char* canonical);
+const char* path_str(path_id_t id);
+size_t path_len(path_id_t id);
+const char* path_safe_name(path_id_t id);
+
+const gallery_roots_t* gallery_roots_acquire(void);
+void gallery_roots_release(const gallery_roots_t* g);
+int gallery_roots_find(const gallery_roots_t* g, const char* path_real);
+void gallery_roots_invalidate(void);
+int gallery_open_beneath(const char* base_dir, const char* sub_path, struct stat* st, char* out_path, size_t out_len);
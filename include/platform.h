@@ -2,18 +2,40 @@
 #include "common.h"
 int platform_maximize_window(void);
 void platform_sleep_ms(int ms);
+uint64_t platform_monotonic_ms(void);
 int platform_file_delete(const char* path);
 int platform_make_dir(const char* path);
 int platform_file_exists(const char* path);
+/* True for symbolic links and, on Windows, any reparse point (junctions). */
+int platform_is_symlink(const char* path);
 FILE* platform_fopen(const char* path, const char* mode);
 FILE* platform_popen(const char* cmd, const char* mode);
 int platform_pclose(FILE* f);
-FILE* platform_popen_direct(const char* cmd, const char* mode);
-int platform_pclose_direct(FILE* f);
 int platform_create_lockfile_exclusive(const char* lock_path);
 int platform_pid_is_running(int pid);
 int platform_run_command(const char* cmd, int timeout_seconds);
 int platform_run_command_redirect(const char* cmd, const char* out_err_path, int timeout_seconds);
+#define PLATFORM_SPAWN_CAPTURE_MAX (64 * 1024)
+#define PLATFORM_SPAWN_POLL_MS 20
+#define PLATFORM_SPAWN_CMDLINE_MAX 32768
+typedef struct {
+	int exit_code;
+	int timed_out;
+	char* out;
+	size_t out_len;
+	char* err;
+	size_t err_len;
+} platform_spawn_result_t;
+
+/* Runs argv[0], looked up on PATH, with argv passed through untouched (no
+ * shell). stdin is the null device. With capture set, stdout and stderr are
+ * collected into capture->out/err (each capped at PLATFORM_SPAWN_CAPTURE_MAX
+ * and NUL-terminated, released with platform_spawn_result_free()); otherwise
+ * both go to out_err_path, or the null device when it is NULL. The child is
+ * killed once timeout_ms elapses (<= 0 waits forever). Returns the exit code,
+ * or -1 when the process could not start, was killed or timed out. */
+int platform_spawn(const char* const* argv, const char* out_err_path, int timeout_ms, platform_spawn_result_t* capture);
+void platform_spawn_result_free(platform_spawn_result_t* res);
 typedef struct {
 	long long ts_ms;
 	int thread_id;
@@ -24,25 +46,47 @@ void platform_record_command(const char* cmd);
 const platform_recent_cmd_t* platform_get_recent_commands(size_t* out_count);
 typedef void (*platform_watcher_callback_t)(const char* dir);
 int platform_start_dir_watcher(const char* dir, platform_watcher_callback_t cb);
+#define PLATFORM_WATCH_CHANGED 1
+#define PLATFORM_WATCH_REMOVED 2
+#define PLATFORM_WATCH_RESYNC 4
+#define PLATFORM_WATCH_DIR 8
+#define PLATFORM_WATCH_COALESCE_MS 250
+#define PLATFORM_WATCH_POLL_MS 5000
+typedef void (*platform_watch_event_cb_t)(const char* root, const char* path, int flags, void* ctx);
+int platform_watch_tree(const char* root, platform_watch_event_cb_t cb, void* ctx);
 int platform_stream_file_payload(int client_socket, const char* path, long start, long len, int is_range);
+int platform_stream_fd_payload(int client_socket, int fd, const char* path, long start, long len);
 int platform_close_streams_for_path(const char* path);
+int platform_open_dir(const char* path);
+int platform_open_beneath(int dir_fd, const char* rel, struct stat* st);
+void platform_close_fd(int fd);
+int platform_open_rw(const char* path, int create);
+long platform_pread(int fd, void* buf, size_t len, uint64_t off);
+long platform_pwrite(int fd, const void* buf, size_t len, uint64_t off);
 int platform_stat(const char* path, struct stat* st);
 const char* platform_devnull(void);
 int platform_fsync(int fd);
-void platform_escape_path_for_cmd(const char* src, char* dst, size_t dstlen);
 void platform_enable_console_colors(void);
 int platform_should_use_colors(void);
 int platform_move_file(const char* src, const char* dst);
+int platform_set_mtime(const char* path, time_t mtime);
 int platform_localtime(time_t t, struct tm* tm_buf);
 unsigned int platform_get_pid(void);
 unsigned long platform_get_tid(void);
 void platform_init_network(void);
 void platform_cleanup_network(void);
 void platform_set_socket_options(int sock);
+#define PLATFORM_IOV_MAX 8
+typedef struct {
+	const void* base;
+	size_t len;
+} platform_iovec_t;
+int platform_send_vec(int sock, platform_iovec_t* iov, int count, int more);
 bool platform_is_file(const char* p);
 bool platform_is_dir(const char* p);
 bool platform_real_path(const char* in, char* out);
 bool platform_safe_under(const char* base_real, const char* path_real);
 int platform_copy_file(const char* src, const char* dst);
 int platform_get_cpu_count(void);
-long platform_get_physical_memory_mb(void);
\ No newline at end of file
+long platform_get_physical_memory_mb(void);
+long platform_get_available_memory_mb(void);
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 #include "common.h"
 
+#define SESSION_IDLE_TTL_MS (24ULL * 60 * 60 * 1000)
+#define SESSION_SWEEP_MS (10 * 60 * 1000)
+
 void session_store_init(void);
 char* session_create(void);
 uint64_t session_get_last(const char* session_id);
@@ -0,0 +1,30 @@
+#pragma once
+#include "common.h"
+
+#define STARTUP_FIRST_RESPONSE_BUDGET_MS 100
+
+typedef enum {
+    STARTUP_PHASE_BIND,
+    STARTUP_PHASE_WATCHERS,
+    STARTUP_PHASE_THUMBDB,
+    STARTUP_PHASE_SCAN,
+    STARTUP_PHASE_READY
+} startup_phase_t;
+
+typedef struct startup_status {
+    startup_phase_t phase;
+    size_t done;
+    size_t total;
+    uint64_t uptime_ms;
+    uint64_t listen_ms;
+    uint64_t first_ok_ms;
+    uint64_t ready_ms;
+} startup_status_t;
+
+void startup_begin(void);
+void startup_mark_listening(void);
+void startup_note_ok_response(void);
+int startup_run_background(void);
+bool startup_is_ready(void);
+void startup_get_status(startup_status_t* out);
+const char* startup_phase_name(startup_phase_t phase);
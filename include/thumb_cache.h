@@ -0,0 +1,25 @@
+#pragma once
+#include "common.h"
+
+#define THUMB_CACHE_SHARDS 16
+#define THUMB_CACHE_BUCKETS 256
+#define THUMB_CACHE_MAX_ITEM (256 * 1024)
+#define THUMB_CACHE_DEFAULT_BYTES (64L * 1024 * 1024)
+#define THUMB_CACHE_SKETCH_BITS 12
+#define THUMB_CACHE_SMALL_TAG "-small."
+
+typedef struct thumb_cache_stats {
+    size_t hits;
+    size_t misses;
+    size_t rejected;
+    size_t entries;
+    size_t bytes;
+    size_t budget;
+} thumb_cache_stats_t;
+
+void thumb_cache_init(long budget_bytes);
+int thumb_cache_serve(int c, const char* key, int keep_alive);
+void thumb_cache_offer_fd(const char* key, int fd, uint64_t off, const struct stat* st);
+void thumb_cache_put_file(const char* path);
+void thumb_cache_invalidate(const char* path);
+void thumb_cache_get_stats(thumb_cache_stats_t* out);
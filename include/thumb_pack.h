@@ -0,0 +1,21 @@
+#pragma once
+#include "common.h"
+
+#define THUMB_PACK_FILE "thumbs.pack"
+#define THUMB_PACK_INDEX "thumbs.pidx"
+#define THUMB_PACK_MAX_OPEN 64
+#define THUMB_PACK_PROBE_MS 2000
+#define THUMB_PACK_MAX_BLOB (16 * 1024 * 1024)
+#define THUMB_PACK_COMPACT_MIN_BYTES (1024 * 1024)
+
+void thumb_pack_init(void);
+int thumb_stat(const char* thumb_path, struct stat* st);
+bool thumb_exists(const char* thumb_path);
+unsigned char* thumb_read(const char* thumb_path, size_t max_len, size_t* out_len, struct stat* st);
+int thumb_delete(const char* thumb_path);
+int thumb_pack_import(const char* thumb_path);
+int thumb_pack_serve(int c, const char* thumb_path, const char* range, const char* if_range, int keep_alive);
+bool thumb_pack_find(const char* dir, const char* prefix, const char* tag, char* out, size_t outlen);
+char** thumb_pack_list(const char* dir, size_t* count);
+size_t thumb_pack_migrate_dir(const char* dir);
+int thumb_pack_compact(const char* dir, int force);
@@ -1,6 +1,8 @@
 #ifndef THUMBS_H
 #define THUMBS_H
 #include "common.h"
+#include "crawler.h"
+#include "platform.h"
 typedef struct skip_counter {
     char dir[PATH_MAX];
     int count;
@@ -12,25 +14,36 @@ typedef struct progress {
     size_t processed_files;
     size_t total_files;
 } progress_t;
+typedef struct thumb_pass_result {
+    size_t media;
+    size_t missing;
+    size_t orphans;
+    size_t sidecars;
+    size_t previews;
+} thumb_pass_result_t;
 void get_thumb_rel_names(const char* full_path, const char* filename, char* small_rel, size_t small_len, char* large_rel, size_t large_len);
 void get_thumb_rel_names_quick(const char* full_path, const char* filename, char* small_rel, size_t small_len, char* large_rel, size_t large_len);
+/* Display size from the file's headers; returns 1 when known, 0 otherwise. */
 int get_media_dimensions(const char* path, int* width, int* height);
 void start_background_thumb_generation(const char* dir_path);
+void request_background_thumb_generation(const char* dir_path, int force);
 int dir_has_missing_thumbs(const char* dir, int videos_only);
 int dir_has_missing_thumbs_shallow(const char* dir, int videos_only);
 bool check_thumb_exists(const char* media_path, char* thumb_path, size_t thumb_path_len);
 extern atomic_int ffmpeg_active;
+/* Waits for a free slot of argv[0] (ffmpeg, ffprobe or magick) before
+ * spawning it; timeout is in seconds. */
+int execute_command_with_limits(const char* const* argv, const char* out_log, int timeout, platform_spawn_result_t* capture);
 void make_safe_dir_name_from(const char* dir, char* out, size_t outlen);
 void make_thumb_fs_paths(const char* media_full, const char* filename, char* small_fs_out, size_t small_fs_out_len, char* large_fs_out, size_t large_fs_out_len);
 void start_periodic_thumb_maintenance(int interval_seconds);
 void start_auto_thumb_watcher(const char* dir_path);
 void run_thumb_generation(const char* dir);
-#ifndef MAX_FFMPEG
-#define MAX_FFMPEG 4
-#endif
-#ifndef MAX_THUMB_WORKERS
-#define MAX_THUMB_WORKERS 4
-#endif
+int is_media_sidecar_name(const char* name);
+int anim_preview_path(const char* media_full, char* out, size_t outlen);
+/* Names the looping video preview of an animated GIF/WebP when it is at
+ * least as new as the media and smaller than it. */
+bool anim_preview_lookup(const char* media_full, char* name_out, size_t name_len);
 #define DEBOUNCE_MS 250
 #define STALE_LOCK_SECONDS 300
 #define MAX_SHALLOW_CHECK 25
@@ -38,6 +51,16 @@ void run_thumb_generation(const char* dir);
 #define THUMB_LARGE_SCALE 1280
 #define THUMB_SMALL_QUALITY 75
 #define THUMB_LARGE_QUALITY 85
+#define GEN_CLEAN_TTL_MS 30000
+#define THUMB_PASS_GENERATE 1
+#define THUMB_PASS_CLEAN 2
+#define THUMB_PASS_RECURSE 4
+#define ANIM_PREVIEW_SUFFIX ".preview.mp4"
+#define ANIM_PREVIEW_MIN_BYTES (512L * 1024)
+#define ANIM_PREVIEW_MAX_WIDTH 960
+#define ANIM_PREVIEW_CRF 28
+#define ANIM_PREVIEW_TIMEOUT_SEC 300
+#define ANIM_PREVIEW_SCALE -1
 static void* debounce_generation_thread(void* args);
 static void* thumbnail_generation_thread(void* args);
 static void* thumb_job_thread(void* args);
@@ -48,5 +71,7 @@ void generate_folder_thumb(const char* dir);
 void print_skips(progress_t* prog);
 void clean_orphan_thumbs(const char* dir, progress_t* prog);
 void scan_and_generate_missing_thumbs(void);
+void scan_folder_for_missing_thumbs(const char* dir);
+int load_thumbdb_for_folder(const char* dir);
 void schedule_or_generate_thumb(const char* input, const char* output, progress_t* prog, int scale, int q);
 #endif // THUMBS_H
\ No newline at end of file
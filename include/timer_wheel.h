@@ -0,0 +1,23 @@
+#pragma once
+#include "common.h"
+
+#define TIMER_WHEEL_TICK_MS 10
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_ID_BUCKETS 256
+
+typedef uint64_t timer_id_t;
+typedef void (*timer_cb_t)(void* arg);
+
+/* Callbacks run on the single timer thread and must not block; long work
+ * should be handed to its own thread. timer_cancel() returns 0 only when
+ * the callback is guaranteed not to run again, in which case the caller
+ * owns arg. timer_rearm() pushes a pending timer's deadline out, and fails
+ * once the timer has fired or is firing. */
+void timer_wheel_init(void);
+timer_id_t timer_add(uint64_t delay_ms, timer_cb_t cb, void* arg);
+timer_id_t timer_add_periodic(uint64_t period_ms, timer_cb_t cb, void* arg);
+int timer_rearm(timer_id_t id, uint64_t delay_ms);
+int timer_cancel(timer_id_t id);
+size_t timer_wheel_count(void);
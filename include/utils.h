@@ -1,8 +1,10 @@
 #pragma once
 #include "common.h"
+#include "arena.h"
 
 void url_decode(char* s);
 char* query_get(char* qs, const char* key);
+char* query_get_arena(arena_t* a, const char* qs, const char* key);
 int p_strcmp(const void* a, const void* b);
 int ascii_stricmp(const char* a, const char* b);
 #ifdef DEBUG_DIAGNOSTIC
@@ -195,6 +195,57 @@
         else btn.classList.add("hidden");
     }
 
+    const HLS_JS_URL = "https://cdn.jsdelivr.net/npm/hls.js@1/dist/hls.min.js";
+    let hlsJsLoad = null;
+
+    // Browsers without native HLS (Chrome, Firefox, Edge) play the playlist
+    // through hls.js on Media Source Extensions, fetched on first use.
+    function loadHlsJs() {
+        if (window.Hls) return Promise.resolve(window.Hls);
+        if (!hlsJsLoad) {
+            hlsJsLoad = new Promise((resolve, reject) => {
+                const script = document.createElement("script");
+                script.src = HLS_JS_URL;
+                script.onload = () => window.Hls && window.Hls.isSupported() ? resolve(window.Hls) : reject(new Error("hls.js unsupported"));
+                script.onerror = () => { hlsJsLoad = null; reject(new Error("hls.js failed to load")); };
+                document.head.appendChild(script);
+            });
+        }
+        return hlsJsLoad;
+    }
+
+    function attachHlsFallback(video) {
+        if (video.dataset.hlsFallback) return;
+        video.dataset.hlsFallback = "1";
+        const native = !!video.canPlayType("application/vnd.apple.mpegurl");
+        if (!native && !window.MediaSource) return;
+        const switchToHls = () => {
+            if (video.dataset.hlsActive) return;
+            const srcEl = video.querySelector("source");
+            const current = (srcEl && srcEl.src) || video.currentSrc || video.src;
+            if (!current || current.includes("/api/hls/")) return;
+            video.dataset.hlsActive = "1";
+            const path = new URL(current, window.location.href).pathname;
+            const playlist = "/api/hls/playlist?path=" + encodeURIComponent(decodeURIComponent(path));
+            if (srcEl) srcEl.remove();
+            if (native) {
+                video.src = playlist;
+                video.load();
+                video.play().catch(() => { });
+                return;
+            }
+            loadHlsJs().then(Hls => {
+                const hls = new Hls();
+                video.hlsPlayer = hls;
+                hls.loadSource(playlist);
+                hls.attachMedia(video);
+                hls.on(Hls.Events.MANIFEST_PARSED, () => video.play().catch(() => { }));
+            }).catch(err => console.error("HLS playback unavailable", err));
+        };
+        video.addEventListener("error", switchToHls, true);
+        video.addEventListener("loadedmetadata", () => { if (!video.videoWidth) switchToHls(); });
+    }
+
     function initFancybox() {
         $('[data-fancybox="gallery"]').fancybox({
             buttons: ["close"],
@@ -206,13 +257,24 @@
                 if (video) {
                     const srcEl = video.querySelector("source");
                     if (srcEl && !srcEl.src) srcEl.src = srcEl.dataset.src || srcEl.getAttribute("data-src") || srcEl.src;
+                    if (obj.opts.$orig && obj.opts.$orig.attr("data-preview")) {
+                        Object.assign(video, { controls: false, preload: "auto", muted: true, loop: true, playsInline: true });
+                        video.load();
+                        video.play().catch(() => { });
+                        return;
+                    }
                     Object.assign(video, { controls: true, preload: "metadata", volume: galleryVolume, muted: false, loop: true });
+                    attachHlsFallback(video);
                     video.load();
                 }
             },
             afterClose: (inst, obj) => {
                 const video = obj.$content.find("video").get(0);
-                if (video) { video.pause(); video.currentTime = 0; }
+                if (video) {
+                    video.pause();
+                    if (video.hlsPlayer) { video.hlsPlayer.destroy(); video.hlsPlayer = null; }
+                    video.currentTime = 0;
+                }
             }
         });
     }
@@ -12,15 +12,15 @@
 #include "thread_pool.h"
 #include "platform.h"
 #include "websocket.h"
-
-static void* start_background_wrapper(void* arg) {
-	char* dir = (char*)arg;
-	if (dir) {
-		start_background_thumb_generation(dir);
-		free(dir);
-	}
-	return NULL;
-}
+#include "asset_cache.h"
+#include "arena.h"
+#include "path_intern.h"
+#include "fd_cache.h"
+#include "thumb_cache.h"
+#include "startup.h"
+#include "thumb_pack.h"
+#include "mp4_faststart.h"
+#include "hls.h"
 
 typedef struct { 
 	char* key; 
@@ -31,6 +31,7 @@ typedef struct {
 	size_t cap; 
 	size_t count; 
 	int err; 
+	arena_t* arena; 
 } api_collect_ctx_t;
 
 static void api_thumbdb_collect_cb(const char* key, const char* value, void* uctx) {
@@ -41,16 +42,16 @@ static void api_thumbdb_collect_cb(const char* key, const char* value, void* uct
 		return;
 	if (c->count + 1 > c->cap) {
 		size_t nc = c->cap ? c->cap * 2 : 256;
-		api_kv_t* tmp = realloc(c->arr, nc * sizeof(*tmp));
+		api_kv_t* tmp = arena_realloc(c->arena, c->arr, c->cap * sizeof(*tmp), nc * sizeof(*tmp));
 		if (!tmp) {
-			LOG_ERROR("Failed to realloc API KV array to size %zu", nc);
+			LOG_ERROR("Failed to grow API KV array to size %zu", nc);
 			c->err = 1;
 			return;
 		}
 		c->arr = tmp; c->cap = nc;
 	}
-	c->arr[c->count].key = key ? strdup(key) : NULL;
-	c->arr[c->count].val = value ? strdup(value) : NULL;
+	c->arr[c->count].key = arena_strdup(c->arena, key);
+	c->arr[c->count].val = value ? arena_strdup(c->arena, value) : NULL;
 	if ((c->arr[c->count].key && !c->arr[c->count].key) || (value && !c->arr[c->count].val)) { 
 		c->err = 1; 
 		return; 
@@ -98,6 +99,43 @@ static void get_parent_dir_local(const char* path, char* out, size_t outlen) {
 	}
 }
 
+static void thumb_dirpart_for(const gallery_roots_t* roots, const char* full_path, const char* relurl, bool relative, bool parent_fallback, char* out, size_t outlen) {
+	out[0] = '\0';
+	const char* first_slash = strchr(relurl, '/');
+	if (first_slash && first_slash != relurl) {
+		size_t dlen = (size_t)(first_slash - relurl);
+		if (dlen >= outlen) dlen = outlen - 1;
+		memcpy(out, relurl, dlen);
+		out[dlen] = '\0';
+		return;
+	}
+	int gi = gallery_roots_find(roots, full_path);
+	if (gi >= 0) {
+		const char* name = relative ? roots->roots[gi].rel_safe : roots->roots[gi].safe;
+		if (name) { strncpy(out, name, outlen - 1); out[outlen - 1] = '\0'; }
+	}
+	if (out[0] || !parent_fallback) return;
+	char parent[PATH_MAX];
+	get_parent_dir_local(full_path, parent, sizeof(parent));
+	make_safe_dir_name_from(parent, out, outlen);
+}
+
+/* Animated previews live in the same thumbs folder as the thumbnails. */
+static bool preview_url_for(const char* full_path, const char* thumb_url, char* out, size_t outlen) {
+	char name[PATH_MAX];
+	const char* slash = strrchr(thumb_url, '/');
+	if (!slash || !anim_preview_lookup(full_path, name, sizeof(name))) return false;
+	int n = snprintf(out, outlen, "%.*s/%s", (int)(slash - thumb_url), thumb_url, name);
+	return n > 0 && (size_t)n < outlen;
+}
+
+static void gallery_base_real(char* out) {
+	const gallery_roots_t* roots = gallery_roots_acquire();
+	if (roots && roots->base_real[0]) memcpy(out, roots->base_real, strlen(roots->base_real) + 1);
+	else if (!real_path(BASE_DIR, out)) out[0] = '\0';
+	gallery_roots_release(roots);
+}
+
 
 
 const char* IMAGE_EXTS[] = { ".jpg",".jpeg",".png",".gif",".webp",NULL };
@@ -109,6 +147,7 @@ static char* legacy_folders_cache = NULL;
 static size_t legacy_folders_cache_len = 0;
 static time_t legacy_folders_cache_time = 0;
 static thread_mutex_t legacy_folders_mutex;
+#define LEGACY_FOLDERS_CACHE_MAX (256 * 1024)
 static int legacy_folders_mutex_inited = 0;
 static void appendf(char** pbuf, size_t* pcap, size_t* pused, const char* fmt, ...);
 static void ensure_json_buf(char** pbuf, size_t* pcap, size_t used, size_t need) {
@@ -123,6 +162,34 @@ static void ensure_json_buf(char** pbuf, size_t* pcap, size_t used, size_t need)
 		*pcap = newcap;
 	}
 }
+/* Drops the folder tree cache and the rendered media fragments for one
+ * gallery directory after the watcher saw it change. */
+void api_invalidate_dir_caches(const char* dir) {
+	if (!dir || !*dir) return;
+	if (legacy_folders_mutex_inited) {
+		thread_mutex_lock(&legacy_folders_mutex);
+		legacy_folders_cache_time = 0;
+		thread_mutex_unlock(&legacy_folders_mutex);
+	}
+	size_t gf_count = 0; char** gfolders = get_gallery_folders(&gf_count);
+	for (size_t i = 0; i < gf_count; ++i) {
+		char root[PATH_MAX]; strncpy(root, gfolders[i], sizeof(root) - 1); root[sizeof(root) - 1] = '\0';
+		size_t rl = strlen(root);
+		while (rl > 1 && (root[rl - 1] == '/' || root[rl - 1] == '\\')) root[--rl] = '\0';
+		if (strncmp(dir, root, rl) != 0 || (dir[rl] && dir[rl] != '/' && dir[rl] != '\\')) continue;
+		const char* rel = dir + rl;
+		while (*rel == '/' || *rel == '\\') rel++;
+		char safe_name[PATH_MAX];
+		if (rel[0]) make_safe_dir_name_from(rel, safe_name, sizeof(safe_name));
+		else strncpy(safe_name, "root", sizeof(safe_name));
+		for (int page = 1; ; ++page) {
+			char cache_path[PATH_MAX];
+			snprintf(cache_path, sizeof(cache_path), "%s" DIR_SEP_STR "cache" DIR_SEP_STR "media" DIR_SEP_STR "%s-%d.html", BASE_DIR, safe_name, page);
+			if (!is_file(cache_path) || platform_file_delete(cache_path) != 0) break;
+			LOG_DEBUG("Invalidated media fragment cache %s", cache_path);
+		}
+	}
+}
 static bool has_nogallery(const char* dir) {
 	char p[PATH_MAX];
 	path_join(p, dir, ".nogallery");
@@ -205,12 +272,7 @@ char* generate_media_fragment(const char* base_dir, const char* dirparam, int pa
 		if (out_len) *out_len = 0;
 			return NULL; 
 	}
-	{
-		if (page <= 1) {
-			char* trg = strdup(target_real);
-			if (trg) thread_create_detached(start_background_wrapper, trg);
-		}
-	}
+	if (page <= 1) request_background_thumb_generation(target_real, 0);
 
 	char** files = NULL; size_t n = 0, alloc = 0;
 	diriter it; if (dir_open(&it, target_real)) {
@@ -218,21 +280,21 @@ char* generate_media_fragment(const char* base_dir, const char* dirparam, int pa
 			if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
 			if (has_ext(name, IMAGE_EXTS) || has_ext(name, VIDEO_EXTS)) {
 				if (n == alloc) {
+					size_t old = alloc;
 					alloc = alloc ? alloc * 2 : 64;
-					files = realloc(files, alloc * sizeof(char*));
+					files = arena_realloc(arena_request(), files, old * sizeof(char*), alloc * sizeof(char*));
 					if (!files) {
-						LOG_ERROR("Failed to realloc files array to size %zu", alloc);
-						alloc = 0;
+						LOG_ERROR("Failed to grow files array to size %zu", alloc);
+						n = alloc = 0;
 						break;
 					}
 				}
-				files[n++] = strdup(name);
+				files[n++] = arena_strdup(arena_request(), name);
 			}
 		}
 		dir_close(&it);
 	}
 	if (n == 0) { 
-		if (files) free(files); 
 		if (out_len) *out_len = 0; 
 		return NULL; 
 	}
@@ -247,8 +309,6 @@ char* generate_media_fragment(const char* base_dir, const char* dirparam, int pa
 	size_t hcap = 8192;
 	char* hbuf = malloc(hcap);
 	if (!hbuf) {
-		size_t i;
-		for (i = 0;i < n;i++) free(files[i]);
 		if (out_len) *out_len = 0;
 		return NULL;
 	}
@@ -298,6 +358,9 @@ char* generate_media_fragment(const char* base_dir, const char* dirparam, int pa
 			}
 		}
 	}
+	const gallery_roots_t* roots = gallery_roots_acquire();
+	const char* target_safe = path_safe_name(path_intern(target_real));
+	char thumbs_root[PATH_MAX]; get_thumbs_root(thumbs_root, sizeof(thumbs_root));
 	for (int i = start;i < end;i++) {
 		char full_path[PATH_MAX]; path_join(full_path, target_real, files[i]);
 		char relurl[PATH_MAX];
@@ -346,49 +409,14 @@ char* generate_media_fragment(const char* base_dir, const char* dirparam, int pa
 			}
 		}
 		char small_fs[PATH_MAX]; char large_fs[PATH_MAX];
-		char thumbs_root[PATH_MAX]; get_thumbs_root(thumbs_root, sizeof(thumbs_root));
 		if (dirparam[0]) {
-			char safe_dir[PATH_MAX]; make_safe_dir_name_from(target_real, safe_dir, sizeof(safe_dir));
-			char per_thumbs_root[PATH_MAX]; snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir);
+			char per_thumbs_root[PATH_MAX]; snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, target_safe);
 			snprintf(small_fs, sizeof(small_fs), "%s" DIR_SEP_STR "%s", per_thumbs_root, small_rel);
 			snprintf(large_fs, sizeof(large_fs), "%s" DIR_SEP_STR "%s", per_thumbs_root, large_rel);
 		}
 		else {
-			char dirpart[PATH_MAX] = "";
-			const char* first_slash = strchr(relurl, '/');
-			if (first_slash && first_slash != relurl) {
-				size_t dlen = (size_t)(first_slash - relurl);
-				if (dlen >= sizeof(dirpart)) dlen = sizeof(dirpart) - 1;
-				memcpy(dirpart, relurl, dlen);
-				dirpart[dlen] = '\0';
-			}
-			if (!dirpart[0]) {
-				size_t gf_count = 0; char** gfolders = get_gallery_folders(&gf_count);
-				char folder_real[PATH_MAX]; char base_real_local[PATH_MAX];
-				if (real_path(BASE_DIR, base_real_local)) {
-					size_t base_len = strlen(base_real_local);
-					for (size_t gi = 0; gi < gf_count; ++gi) {
-						if (!real_path(gfolders[gi], folder_real)) continue;
-						if (!safe_under(folder_real, full_path)) continue;
-						const char* r = folder_real + base_len + ((folder_real[base_len] == DIR_SEP) ? 1 : 0);
-						make_safe_dir_name_from(r, dirpart, sizeof(dirpart));
-						break;
-					}
-				}
-				if (!dirpart[0]) {
-					char parent[PATH_MAX];
-					strncpy(parent, full_path, sizeof(parent) - 1);
-					parent[sizeof(parent) - 1] = '\0';
-					char* s1 = strrchr(parent, '/');
-					char* s2 = strrchr(parent, '\\');
-					char* last = NULL;
-					if (s1 && s2) last = (s1 > s2) ? s1 : s2;
-					else if (s1) last = s1;
-					else if (s2) last = s2;
-					if (last) *last = '\0'; else { parent[0] = '.'; parent[1] = '\0'; }
-					make_safe_dir_name_from(parent, dirpart, sizeof(dirpart));
-				}
-			}
+			char dirpart[PATH_MAX];
+			thumb_dirpart_for(roots, full_path, relurl, true, true, dirpart, sizeof(dirpart));
 			char per_thumbs_root[PATH_MAX]; snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, dirpart[0] ? dirpart : "");
 			if (dirpart[0]) {
 				snprintf(small_fs, sizeof(small_fs), "%s" DIR_SEP_STR "%s", per_thumbs_root, small_rel);
@@ -399,59 +427,19 @@ char* generate_media_fragment(const char* base_dir, const char* dirparam, int pa
 				snprintf(large_fs, sizeof(large_fs), "%s" DIR_SEP_STR "%s", thumbs_root, large_rel);
 			}
 		}
-		if (!small_exists) small_exists = is_file(small_fs);
-		if (!large_exists) large_exists = is_file(large_fs);
+		if (!small_exists) small_exists = thumb_exists(small_fs);
+		if (!large_exists) large_exists = thumb_exists(large_fs);
 		char href[PATH_MAX]; if (dirparam && dirparam[0]) snprintf(href, sizeof(href), "/images/%s/%s", dirparam, relurl); else snprintf(href, sizeof(href), "/images/%s", relurl);
 		char href_esc[PATH_MAX]; html_escape(href, href_esc, sizeof(href_esc));
 		char small_url[PATH_MAX] = ""; char large_url[PATH_MAX] = "";
 		if (small_exists || large_exists) {
 			if (dirparam && dirparam[0]) {
-				char safe_dir[PATH_MAX]; make_safe_dir_name_from(target_real, safe_dir, sizeof(safe_dir));
-				snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", safe_dir, small_rel);
-				snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", safe_dir, large_rel);
+				snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", target_safe, small_rel);
+				snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", target_safe, large_rel);
 			}
 			else {
-				char dirpart[PATH_MAX] = "";
-				const char* first_slash = strchr(relurl, '/');
-				if (first_slash && first_slash != relurl) {
-					size_t dlen = (size_t)(first_slash - relurl);
-					if (dlen >= sizeof(dirpart)) dlen = sizeof(dirpart) - 1;
-					memcpy(dirpart, relurl, dlen);
-					dirpart[dlen] = '\0';
-				}
-				if (!dirpart[0]) {
-					size_t gf_count = 0; char** gfolders = get_gallery_folders(&gf_count);
-					char folder_real[PATH_MAX];
-					for (size_t gi = 0; gi < gf_count; ++gi) {
-						if (!real_path(gfolders[gi], folder_real)) continue;
-						if (!safe_under(folder_real, full_path)) continue;
-						size_t si = 0;
-						for (size_t ii = 0; folder_real[ii] && si < sizeof(dirpart) - 1; ++ii) {
-							char tmp_safe[PATH_MAX]; make_safe_dir_name_from(folder_real, tmp_safe, sizeof(tmp_safe));
-							size_t tlen = strlen(tmp_safe);
-							if (tlen >= sizeof(dirpart)) tlen = sizeof(dirpart) - 1;
-							memcpy(dirpart, tmp_safe, tlen);
-							dirpart[tlen] = '\0';
-							si = tlen;
-							break;
-						}
-						dirpart[si] = '\0';
-						break;
-					}
-					if (!dirpart[0]) {
-						char parent[PATH_MAX];
-						strncpy(parent, full_path, sizeof(parent) - 1);
-						parent[sizeof(parent) - 1] = '\0';
-						char* s1 = strrchr(parent, '/');
-						char* s2 = strrchr(parent, '\\');
-						char* last = NULL;
-						if (s1 && s2) last = (s1 > s2) ? s1 : s2;
-						else if (s1) last = s1;
-						else if (s2) last = s2;
-						if (last) *last = '\0'; else { parent[0] = '.'; parent[1] = '\0'; }
-						make_safe_dir_name_from(parent, dirpart, sizeof(dirpart));
-					}
-				}
+				char dirpart[PATH_MAX];
+				thumb_dirpart_for(roots, full_path, relurl, false, true, dirpart, sizeof(dirpart));
 				if (dirpart[0]) {
 					snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", dirpart, small_rel);
 					snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", dirpart, large_rel);
@@ -465,11 +453,18 @@ char* generate_media_fragment(const char* base_dir, const char* dirparam, int pa
 		char small_esc[PATH_MAX]; char large_esc[PATH_MAX]; html_escape(small_url, small_esc, sizeof(small_esc)); html_escape(large_url, large_esc, sizeof(large_esc));
 
 		char dim_attr[64]; dim_attr[0] = '\0';
+		int dim_w, dim_h;
+		if (get_media_dimensions(full_path, &dim_w, &dim_h)) snprintf(dim_attr, sizeof(dim_attr), " width=\"%d\" height=\"%d\"", dim_w, dim_h);
 		int is_video = has_ext(files[i], VIDEO_EXTS);
 		int thumb_status = small_exists ? 1 : 0;
+		char preview_url[PATH_MAX];
 		if (is_video) {
 			appendf(&hbuf, &hcap, &hused, "<div class=\"masonry-item\" data-type=\"video\"><a data-fancybox=\"gallery\" href=\"%s\" data-thumb-status=\"%d\" data-type=\"video\" data-src=\"%s\">", href_esc, thumb_status, href_esc);
 		}
+		else if (large_url[0] && preview_url_for(full_path, large_url, preview_url, sizeof(preview_url))) {
+			char preview_esc[PATH_MAX]; html_escape(preview_url, preview_esc, sizeof(preview_esc));
+			appendf(&hbuf, &hcap, &hused, "<div class=\"masonry-item\" data-type=\"image\"><a data-fancybox=\"gallery\" href=\"%s\" data-thumb-status=\"%d\" data-type=\"video\" data-src=\"%s\" data-preview=\"1\">", preview_esc, thumb_status, preview_esc);
+		}
 		else {
 			appendf(&hbuf, &hcap, &hused, "<div class=\"masonry-item\" data-type=\"image\"><a data-fancybox=\"gallery\" href=\"%s\" data-thumb-status=\"%d\">", href_esc, thumb_status);
 		}
@@ -479,22 +474,15 @@ char* generate_media_fragment(const char* base_dir, const char* dirparam, int pa
 			appendf(&hbuf, &hcap, &hused, "<img src=\"/images/placeholder.jpg\" class=\"thumb-img\"%s>", dim_attr);
 		appendf(&hbuf, &hcap, &hused, "</a></div>");
 	}
+	gallery_roots_release(roots);
 	appendf(&hbuf, &hcap, &hused, "</div>");
-	for (size_t ii = 0; ii < n; ++ii) free(files[ii]); free(files);
 	if (out_len) *out_len = hused; return hbuf;
 }
 
 static int is_under_gallery_root(const char* target_real) {
-	size_t count = 0;
-	char** folders = get_gallery_folders(&count);
-	if (!folders) return 0;
-	char folder_real[PATH_MAX];
-	int ok = 0;
-	for (size_t i = 0; i < count; ++i) {
-		if (!real_path(folders[i], folder_real)) continue;
-		if (safe_under(folder_real, target_real)) { ok = 1; break; }
-	}
-	(void)folders;
+	const gallery_roots_t* roots = gallery_roots_acquire();
+	int ok = gallery_roots_find(roots, target_real) >= 0;
+	gallery_roots_release(roots);
 	return ok;
 }
 
@@ -504,14 +492,17 @@ static int resolve_and_validate_target(const char* base_dir, const char* dirpara
 	if (!real_path(target, target_real_out)) return 0;
 	if (!is_dir(target_real_out)) return 0;
 	if (!is_under_gallery_root(target_real_out)) return 0;
-	if (base_real_out && base_outlen > 0) { real_path(base_dir, base_real_out); }
+	if (base_real_out && base_outlen > 0) {
+		if (strcmp(base_dir, BASE_DIR) == 0) gallery_base_real(base_real_out);
+		else real_path(base_dir, base_real_out);
+	}
 	return 1;
 }
 
 
 void handle_api_regenerate_thumbs(int c, char* qs, bool keep_alive) {
 	char dirparam[PATH_MAX] = { 0 };
-	if (qs) { char* v = query_get(qs, "dir");if (v) { strncpy(dirparam, v, PATH_MAX - 1);SAFE_FREE(v); } }
+	if (qs) { char* v = query_get_arena(arena_request(), qs, "dir");if (v) { strncpy(dirparam, v, PATH_MAX - 1); } }
 	sanitize_dirparam(dirparam);
 	char target[PATH_MAX]; snprintf(target, sizeof(target), "%s/%s", BASE_DIR, dirparam);
 	normalize_path(target);
@@ -519,14 +510,12 @@ void handle_api_regenerate_thumbs(int c, char* qs, bool keep_alive) {
 	char base_real[PATH_MAX];
 	if (!resolve_and_validate_target(BASE_DIR, dirparam, target_real, sizeof(target_real), base_real, sizeof(base_real))) {
 		const char* msg = "{\"error\":\"Invalid directory\"}";
-		send_header(c, 400, "Bad Request", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-		send(c, msg, (int)strlen(msg), 0);
+		send_response(c, 400, "Bad Request", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 		return;
 	}
-	if (dir_has_missing_thumbs_shallow(target_real, 0)) start_background_thumb_generation(target_real);
+	request_background_thumb_generation(target_real, 1);
 	const char* msg = "{\"status\":\"accepted\",\"message\":\"Thumbnail regeneration started.\"}";
-	send_header(c, 202, "Accepted", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-	send(c, msg, (int)strlen(msg), 0);
+	send_response(c, 202, "Accepted", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 }
 static char* json_comma_safe(char* ptr, size_t* remLen) {
 	if (*remLen < 10) return ptr;
@@ -534,20 +523,13 @@ static char* json_comma_safe(char* ptr, size_t* remLen) {
 	(*remLen)--;
 	return ptr;
 }
-static char* build_folder_tree_json(char** pbuf, size_t* cap, size_t* used, const char* dir, const char* root) {
-	ensure_json_buf(pbuf, cap, *used, 4096);
-	char* ptr = *pbuf + *used;
+static void build_folder_tree_json(http_stream_t* out, const char* dir, const char* root) {
 	if (!is_dir(dir) || has_nogallery(dir) || !has_media_rec(dir)) {
-		ptr = json_null(ptr, NULL, cap);
-		*used = ptr - *pbuf;
-		return ptr;
+		http_stream_write(out, "null", 4);
+		return;
 	}
-	ptr = json_objOpen(ptr, NULL, cap);
-	*used = ptr - *pbuf;
 	const char* base = strrchr(dir, DIR_SEP);
 	base = base ? base + 1 : dir;
-	ptr = json_str(ptr, "name", base, cap);
-	*used = ptr - *pbuf;
 	char rroot[PATH_MAX], rdir[PATH_MAX];
 	real_path(root, rroot);
 	real_path(dir, rdir);
@@ -559,10 +541,11 @@ static char* build_folder_tree_json(char** pbuf, size_t* cap, size_t* used, cons
 		char ch = r[i]; if (ch == '\\') ch = '/'; relurl[j++] = ch;
 	}
 	relurl[j] = '\0';
-	ptr = json_str(ptr, "path", relurl, cap);
-	*used = ptr - *pbuf;
-	ptr = json_arrOpen(ptr, "children", cap);
-	*used = ptr - *pbuf;
+	http_stream_reserve(out, (strlen(base) + strlen(relurl)) * 6 + 64);
+	out->ptr = json_objOpen(out->ptr, NULL, &out->rem);
+	out->ptr = json_str(out->ptr, "name", base, &out->rem);
+	out->ptr = json_str(out->ptr, "path", relurl, &out->rem);
+	out->ptr = json_arrOpen(out->ptr, "children", &out->rem);
 	char** names = NULL; size_t n = 0, alloc = 0;
 	diriter it;
 	if (dir_open(&it, dir)) {
@@ -577,70 +560,57 @@ static char* build_folder_tree_json(char** pbuf, size_t* cap, size_t* used, cons
 			if (is_dir(full) && !has_nogallery(full) && has_media_rec(full)) {
 				if (n == alloc) {
 					alloc = alloc ? alloc * 2 : 16;
-					names = realloc(names, alloc * sizeof(char*));
-					if (!names) {
-						size_t i;
-						for (i = 0; i < n; i++) free(names[i]);
-						alloc = 0;
-						break;
-					}
+					char** tmp = realloc(names, alloc * sizeof(char*));
+					if (!tmp) break;
+					names = tmp;
 				}
 				names[n++] = strdup(name);
 			}
 		}
 		dir_close(&it);
 	}
-	qsort(names, n, sizeof(char*), p_strcmp);
+	if (n > 0) qsort(names, n, sizeof(char*), p_strcmp);
 	for (size_t i = 0;i < n;i++) {
-		if (i > 0) {
-			ptr = *pbuf + *used;
-			ptr = json_comma_safe(ptr, cap);
-			*used = ptr - *pbuf;
-		}
+		if (i > 0) http_stream_write(out, ",", 1);
 		char child_full[PATH_MAX]; path_join(child_full, dir, names[i]);
-		ptr = *pbuf + *used;
-		ptr = build_folder_tree_json(pbuf, cap, used, child_full, root);
-		*used = ptr - *pbuf;
+		build_folder_tree_json(out, child_full, root);
 	}
 	for (size_t i = 0;i < n;i++) free(names[i]);
 	free(names);
-	ptr = json_arrClose(ptr, cap);
-	ptr = json_objClose(ptr, cap);
-	*used = ptr - *pbuf;
-	return ptr;
+	http_stream_reserve(out, 4);
+	out->ptr = json_arrClose(out->ptr, &out->rem);
+	out->ptr = json_objClose(out->ptr, &out->rem);
 }
 void handle_api_tree(int c, bool keep_alive) {
 	size_t count;
 	char** folders = get_gallery_folders(&count);
-	size_t cap = 8192;
-	char* buf = malloc(cap);
-	size_t used = 0;
+	http_stream_t* out = malloc(sizeof(*out));
+	if (!out) { send_text(c, 500, "Internal Server Error", "Out of memory", keep_alive); return; }
+	http_stream_begin(out, c, 200, "OK", "application/json; charset=utf-8", keep_alive);
 	if (count == 1) {
-		build_folder_tree_json(&buf, &cap, &used, folders[0], folders[0]);
+		build_folder_tree_json(out, folders[0], folders[0]);
 	}
 	else {
-		char* ptr = buf;
-		ptr = json_objOpen(ptr, NULL, &cap); used = ptr - buf;
-		ptr = json_str(ptr, "name", "root", &cap); used = ptr - buf;
-		ptr = json_str(ptr, "path", "", &cap); used = ptr - buf;
-		ptr = json_arrOpen(ptr, "children", &cap); used = ptr - buf;
-		size_t i;
-		for (i = 0; i < count; i++) {
-			if (i > 0) { ptr = json_comma_safe(ptr, &cap); used = ptr - buf; }
-			build_folder_tree_json(&buf, &cap, &used, folders[i], folders[i]);
-		}
-		ptr = json_arrClose(ptr, &cap); used = ptr - buf;
-		ptr = json_objClose(ptr, &cap); used = ptr - buf;
-	}
-	send_header(c, 200, "OK", "application/json; charset=utf-8", (long)used, NULL, 0, keep_alive);
-	send(c, buf, (int)used, 0);
-	free(buf);
+		out->ptr = json_objOpen(out->ptr, NULL, &out->rem);
+		out->ptr = json_str(out->ptr, "name", "root", &out->rem);
+		out->ptr = json_str(out->ptr, "path", "", &out->rem);
+		out->ptr = json_arrOpen(out->ptr, "children", &out->rem);
+		for (size_t i = 0; i < count; i++) {
+			if (i > 0) http_stream_write(out, ",", 1);
+			build_folder_tree_json(out, folders[i], folders[i]);
+		}
+		http_stream_reserve(out, 4);
+		out->ptr = json_arrClose(out->ptr, &out->rem);
+		out->ptr = json_objClose(out->ptr, &out->rem);
+	}
+	http_stream_end(out);
+	free(out);
 }
 void handle_api_folders(int c, char* qs, bool keep_alive) {
 	char dirparam[PATH_MAX] = { 0 };
 	if (qs) {
-		char* v = query_get(qs, "dir");
-		if (v) { strncpy(dirparam, v, PATH_MAX - 1); dirparam[PATH_MAX - 1] = '\0'; SAFE_FREE(v); }
+		char* v = query_get_arena(arena_request(), qs, "dir");
+		if (v) { strncpy(dirparam, v, PATH_MAX - 1); dirparam[PATH_MAX - 1] = '\0'; }
 	}
 	sanitize_dirparam(dirparam);
 	char target[PATH_MAX]; 
@@ -650,10 +620,7 @@ void handle_api_folders(int c, char* qs, bool keep_alive) {
 	if (!real_path(BASE_DIR, base_real) || !real_path(target, target_real)
 		|| !safe_under(base_real, target_real) || !is_dir(target_real)) {
 		const char* msg = "{\"error\":\"Invalid directory\"}";
-		send_header(c, 400, 
-			"Bad Request", 
-			"application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-		send(c, msg, (int)strlen(msg), 0);
+		send_response(c, 400, "Bad Request", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 		return;
 	}
 	char** names = NULL; size_t n = 0, alloc = 0;
@@ -699,8 +666,7 @@ void handle_api_folders(int c, char* qs, bool keep_alive) {
 	ptr = json_str(ptr, "currentDir", dirparam, &len);
 	ptr = json_bool(ptr, "isRoot", dirparam[0] == 0, &len);
 	ptr = json_objClose(ptr, &len);
-	send_header(c, 200, "OK", "application/json; charset=utf-8", (long)(ptr - buf), NULL, 0, keep_alive);
-	send(c, buf, (int)(ptr - buf), 0);
+	send_response(c, 200, "OK", "application/json; charset=utf-8", buf, (size_t)(ptr - buf), keep_alive);
 	free(buf);
 }
 void handle_api_media(int c, char* qs, bool keep_alive) {
@@ -708,12 +674,12 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 	int page = 1;
 	int render_html = 0;
 	if (qs) {
-		char* v = query_get(qs, "dir");
-		if (v) { strncpy(dirparam, v, PATH_MAX - 1); SAFE_FREE(v); }
-		char* p = query_get(qs, "page");
-		if (p) { int t = atoi(p); if (t > 0) page = t; SAFE_FREE(p); }
-		char* r = query_get(qs, "render");
-		if (r) { if (strcmp(r, "html") == 0) render_html = 1; SAFE_FREE(r); }
+		char* v = query_get_arena(arena_request(), qs, "dir");
+		if (v) { strncpy(dirparam, v, PATH_MAX - 1); }
+		char* p = query_get_arena(arena_request(), qs, "page");
+		if (p) { int t = atoi(p); if (t > 0) page = t; }
+		char* r = query_get_arena(arena_request(), qs, "render");
+		if (r) { if (strcmp(r, "html") == 0) render_html = 1; }
 	}
 	sanitize_dirparam(dirparam);
 	char target[PATH_MAX];
@@ -738,17 +704,11 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 	char base_real[PATH_MAX];
 	if (!real_path(target, target_real) || !is_dir(target_real) || !is_under_gallery_root(target_real)) {
 		const char* msg = "{\"error\":\"Invalid directory\"}";
-		send_header(c, 400, "Bad Request", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-		send(c, msg, (int)strlen(msg), 0);
+		send_response(c, 400, "Bad Request", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 		return;
 	}
-	if (!real_path(BASE_DIR, base_real)) base_real[0] = '\0';
-	{
-		if (page <= 1) {
-			char* trg = strdup(target_real);
-			if (trg) thread_create_detached(start_background_wrapper, trg);
-		}
-	}
+	gallery_base_real(base_real);
+	if (page <= 1) request_background_thumb_generation(target_real, 0);
 	char** files = NULL;
 	size_t n = 0, alloc = 0;
 	diriter it;
@@ -758,10 +718,12 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 			if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
 			if (has_ext(name, IMAGE_EXTS) || has_ext(name, VIDEO_EXTS)) {
 				if (n == alloc) {
+					size_t old = alloc;
 					alloc = alloc ? alloc * 2 : 64;
-					files = realloc(files, alloc * sizeof(char*));
+					files = arena_realloc(arena_request(), files, old * sizeof(char*), alloc * sizeof(char*));
+					if (!files) { n = alloc = 0; break; }
 				}
-				files[n++] = strdup(name);
+				files[n++] = arena_strdup(arena_request(), name);
 			}
 		}
 		dir_close(&it);
@@ -790,47 +752,31 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 			struct stat stc; if (stat(cache_path, &stc) == 0) {
 				char etag[128]; snprintf(etag, sizeof(etag), "\"%08lx-%08lx\"", (unsigned long)stc.st_mtime, (unsigned long)stc.st_size);
 				char lm[128]; struct tm* t = gmtime(&stc.st_mtime); if (t) strftime(lm, sizeof(lm), "%a, %d %b %Y %H:%M:%S GMT", t); else lm[0] = '\0';
-				char* if_none = get_header_value(g_request_headers, "If-None-Match:");
+				char* if_none = get_header_value_arena(arena_request(), g_request_headers, "If-None-Match:");
 				if (if_none && strstr(if_none, etag)) {
 					send_header(c, 304, "Not Modified", "text/plain; charset=utf-8", 0, NULL, 0, keep_alive);
-					if (files) {
-						for (size_t ii = 0; ii < n; ++ii) free(files[ii]);
-						free(files);
-						files = NULL;
-					}
-					SAFE_FREE(if_none);
 					return;
 				}
-				SAFE_FREE(if_none);
-				send_header(c, 200, "OK", "text/html; charset=utf-8", (long)stc.st_size, NULL, 0, keep_alive);
 				send_file_stream(c, cache_path, NULL, keep_alive);
-				if (files) {
-					for (size_t ii = 0; ii < n; ++ii) free(files[ii]);
-					free(files);
-					files = NULL;
-				}
 				return;
 			}
 
-			if (files) {
-				for (size_t ii = 0; ii < n; ++ii) free(files[ii]);
-				free(files);
-				files = NULL;
-			}
 			return;
 		}
 		size_t hcap = 8192;
 		char* hbuf = malloc(hcap);
 		if (!hbuf) {
 			const char* msg = "Out of memory";
-			send_header(c, 500, "Internal Server Error", "text/plain; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-			send(c, msg, (int)strlen(msg), 0);
+			send_response(c, 500, "Internal Server Error", "text/plain; charset=utf-8", msg, strlen(msg), keep_alive);
 			return;
 		}
 		size_t hused = 0;
 		appendf(&hbuf, &hcap, &hused, "<div class=\"masonry-fragment\" data-page=\"%d\" data-hasmore=\"%d\">", page, (page < totalPages) ? 1 : 0);
 		size_t cap = 0; char* buf = NULL;
 		(void)cap; (void)buf;
+		const gallery_roots_t* roots = gallery_roots_acquire();
+		const char* target_safe = path_safe_name(path_intern(target_real));
+		char thumbs_root[PATH_MAX]; get_thumbs_root(thumbs_root, sizeof(thumbs_root));
 		for (int i = start; i < end; i++) {
 			char full_path[PATH_MAX];
 			path_join(full_path, target_real, files[i]);
@@ -881,49 +827,14 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 				}
 			}
 			char small_fs[PATH_MAX]; char large_fs[PATH_MAX];
-			char thumbs_root[PATH_MAX]; get_thumbs_root(thumbs_root, sizeof(thumbs_root));
 			if (dirparam[0]) {
-				char safe_dir[PATH_MAX]; make_safe_dir_name_from(target_real, safe_dir, sizeof(safe_dir));
-				char per_thumbs_root[PATH_MAX]; snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir);
+				char per_thumbs_root[PATH_MAX]; snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, target_safe);
 				snprintf(small_fs, sizeof(small_fs), "%s" DIR_SEP_STR "%s", per_thumbs_root, small_rel);
 				snprintf(large_fs, sizeof(large_fs), "%s" DIR_SEP_STR "%s", per_thumbs_root, large_rel);
 			}
 			else {
-				char dirpart[PATH_MAX] = "";
-				const char* first_slash = strchr(relurl, '/');
-				if (first_slash && first_slash != relurl) {
-					size_t dlen = (size_t)(first_slash - relurl);
-					if (dlen >= sizeof(dirpart)) dlen = sizeof(dirpart) - 1;
-					memcpy(dirpart, relurl, dlen);
-					dirpart[dlen] = '\0';
-				}
-				if (!dirpart[0]) {
-					size_t gf_count = 0; char** gfolders = get_gallery_folders(&gf_count);
-					char folder_real[PATH_MAX]; char base_real_local[PATH_MAX];
-					if (real_path(BASE_DIR, base_real_local)) {
-						size_t base_len = strlen(base_real_local);
-						for (size_t gi = 0; gi < gf_count; ++gi) {
-							if (!real_path(gfolders[gi], folder_real)) continue;
-							if (!safe_under(folder_real, full_path)) continue;
-							const char* r = folder_real + base_len + ((folder_real[base_len] == DIR_SEP) ? 1 : 0);
-							make_safe_dir_name_from(r, dirpart, sizeof(dirpart));
-							break;
-						}
-					}
-					if (!dirpart[0]) {
-						char parent[PATH_MAX];
-						strncpy(parent, full_path, sizeof(parent) - 1);
-						parent[sizeof(parent) - 1] = '\0';
-						char* s1 = strrchr(parent, '/');
-						char* s2 = strrchr(parent, '\\');
-						char* last = NULL;
-						if (s1 && s2) last = (s1 > s2) ? s1 : s2;
-						else if (s1) last = s1;
-						else if (s2) last = s2;
-						if (last) *last = '\0'; else { parent[0] = '.'; parent[1] = '\0'; }
-						make_safe_dir_name_from(parent, dirpart, sizeof(dirpart));
-					}
-				}
+				char dirpart[PATH_MAX];
+				thumb_dirpart_for(roots, full_path, relurl, true, true, dirpart, sizeof(dirpart));
 				char per_thumbs_root[PATH_MAX]; snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, dirpart[0] ? dirpart : "");
 				if (dirpart[0]) {
 					snprintf(small_fs, sizeof(small_fs), "%s" DIR_SEP_STR "%s", per_thumbs_root, small_rel);
@@ -934,8 +845,8 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 					snprintf(large_fs, sizeof(large_fs), "%s" DIR_SEP_STR "%s", thumbs_root, large_rel);
 				}
 			}
-			if (!small_exists) small_exists = is_file(small_fs);
-			if (!large_exists) large_exists = is_file(large_fs);
+			if (!small_exists) small_exists = thumb_exists(small_fs);
+			if (!large_exists) large_exists = thumb_exists(large_fs);
 			char href[PATH_MAX];
 			if (dirparam[0]) snprintf(href, sizeof(href), "/images/%s/%s", dirparam, relurl);
 			else snprintf(href, sizeof(href), "/images/%s", relurl);
@@ -943,29 +854,12 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 			char small_url[PATH_MAX] = ""; char large_url[PATH_MAX] = "";
 			if (small_exists || large_exists) {
 				if (dirparam[0]) {
-					char safe_dir[PATH_MAX]; make_safe_dir_name_from(target_real, safe_dir, sizeof(safe_dir));
-					snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", safe_dir, small_rel);
-					snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", safe_dir, large_rel);
+					snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", target_safe, small_rel);
+					snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", target_safe, large_rel);
 				}
 				else {
-					char dirpart[PATH_MAX] = "";
-					const char* first_slash = strchr(relurl, '/');
-					if (first_slash && first_slash != relurl) {
-						size_t dlen = (size_t)(first_slash - relurl);
-						if (dlen >= sizeof(dirpart)) dlen = sizeof(dirpart) - 1;
-						memcpy(dirpart, relurl, dlen);
-						dirpart[dlen] = '\0';
-					}
-					if (!dirpart[0]) {
-						size_t gf_count = 0; char** gfolders = get_gallery_folders(&gf_count);
-						char folder_real[PATH_MAX];
-						for (size_t gi = 0; gi < gf_count; ++gi) {
-							if (!real_path(gfolders[gi], folder_real)) continue;
-							if (!safe_under(folder_real, full_path)) continue;
-							make_safe_dir_name_from(folder_real, dirpart, sizeof(dirpart));
-							break;
-						}
-					}
+					char dirpart[PATH_MAX];
+					thumb_dirpart_for(roots, full_path, relurl, false, false, dirpart, sizeof(dirpart));
 					if (dirpart[0]) {
 						snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", dirpart, small_rel);
 						snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", dirpart, large_rel);
@@ -977,20 +871,28 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 				}
 			}
 			char small_esc[PATH_MAX]; char large_esc[PATH_MAX]; html_escape(small_url, small_esc, sizeof(small_esc)); html_escape(large_url, large_esc, sizeof(large_esc));
-			appendf(&hbuf, &hcap, &hused, "<div class=\"masonry-item\"><a data-fancybox=\"gallery\" href=\"%s\">", href_esc);
+			char preview_url[PATH_MAX];
+			if (large_url[0] && preview_url_for(full_path, large_url, preview_url, sizeof(preview_url))) {
+				char preview_esc[PATH_MAX]; html_escape(preview_url, preview_esc, sizeof(preview_esc));
+				appendf(&hbuf, &hcap, &hused, "<div class=\"masonry-item\"><a data-fancybox=\"gallery\" href=\"%s\" data-type=\"video\" data-src=\"%s\" data-preview=\"1\">", preview_esc, preview_esc);
+			}
+			else
+				appendf(&hbuf, &hcap, &hused, "<div class=\"masonry-item\"><a data-fancybox=\"gallery\" href=\"%s\">", href_esc);
+			char dim_attr[64]; dim_attr[0] = '\0';
+			int dim_w, dim_h;
+			if (get_media_dimensions(full_path, &dim_w, &dim_h)) snprintf(dim_attr, sizeof(dim_attr), " width=\"%d\" height=\"%d\"", dim_w, dim_h);
 			if (small_exists)
-				appendf(&hbuf, &hcap, &hused, "<img src=\"%s\" loading=\"lazy\" data-thumb-small=\"%s\" data-thumb-large=\"%s\" class=\"thumb-img\">", small_esc, small_esc, large_esc);
+				appendf(&hbuf, &hcap, &hused, "<img src=\"%s\" loading=\"lazy\" data-thumb-small=\"%s\" data-thumb-large=\"%s\"%s class=\"thumb-img\">", small_esc, small_esc, large_esc, dim_attr);
 			else if (large_exists)
-				appendf(&hbuf, &hcap, &hused, "<img src=\"%s\" loading=\"lazy\" data-thumb-large=\"%s\" class=\"thumb-img\">", large_esc, large_esc);
+				appendf(&hbuf, &hcap, &hused, "<img src=\"%s\" loading=\"lazy\" data-thumb-large=\"%s\"%s class=\"thumb-img\">", large_esc, large_esc, dim_attr);
 			else
-				appendf(&hbuf, &hcap, &hused, "<img src=\"/images/placeholder.jpg\" class=\"thumb-img\">");
+				appendf(&hbuf, &hcap, &hused, "<img src=\"/images/placeholder.jpg\" class=\"thumb-img\"%s>", dim_attr);
 			appendf(&hbuf, &hcap, &hused, "</a></div>");
 		}
+		gallery_roots_release(roots);
 		appendf(&hbuf, &hcap, &hused, "</div>");
-		send_header(c, 200, "OK", "text/html; charset=utf-8", (long)hused, NULL, 0, keep_alive);
-		send(c, hbuf, (int)hused, 0);
+		send_response(c, 200, "OK", "text/html; charset=utf-8", hbuf, hused, keep_alive);
 		free(hbuf);
-		free(files);
 		return;
 	}
 
@@ -998,8 +900,7 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 	char* buf = malloc(cap);
 	if (!buf) {
 		const char* msg = "{\"error\":\"Out of memory\"}";
-		send_header(c, 500, "Internal Server Error", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-		send(c, msg, (int)strlen(msg), 0);
+		send_response(c, 500, "Internal Server Error", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 		return;
 	}
 	size_t len = cap; char* ptr = buf; size_t used = 0;
@@ -1008,6 +909,8 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 	used = ptr - buf;
 	ensure_json_buf(&buf, &cap, used, 4096);
 	ptr = buf + used; len = cap - used;
+	const gallery_roots_t* roots = gallery_roots_acquire();
+	const char* target_safe = path_safe_name(path_intern(target_real));
 	for (int i = start; i < end; i++) {
 
 		used = ptr - buf;
@@ -1067,52 +970,18 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 		get_thumb_rel_names(full_path, files[i], small_rel, sizeof(small_rel), large_rel, sizeof(large_rel));
 		char small_fs[PATH_MAX]; char large_fs[PATH_MAX];
 		make_thumb_fs_paths(full_path, files[i], small_fs, sizeof(small_fs), large_fs, sizeof(large_fs));
-		int small_exists = is_file(small_fs);
-		int large_exists = is_file(large_fs);
+		int small_exists = thumb_exists(small_fs);
+		int large_exists = thumb_exists(large_fs);
 
 		if (small_exists || large_exists) {
 			char small_url[PATH_MAX]; char large_url[PATH_MAX];
 			if (dirparam[0]) {
-				char safe_dir[PATH_MAX]; make_safe_dir_name_from(target_real, safe_dir, sizeof(safe_dir));
-				snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", safe_dir, small_rel);
-				snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", safe_dir, large_rel);
+				snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", target_safe, small_rel);
+				snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", target_safe, large_rel);
 			}
 			else {
-				char dirpart[PATH_MAX] = "";
-				const char* first_slash = strchr(relurl, '/');
-				if (first_slash && first_slash != relurl) {
-					size_t dlen = (size_t)(first_slash - relurl);
-					if (dlen >= sizeof(dirpart)) dlen = sizeof(dirpart) - 1;
-					memcpy(dirpart, relurl, dlen);
-					dirpart[dlen] = '\0';
-				}
-				if (!dirpart[0]) {
-					size_t gf_count = 0; char** gfolders = get_gallery_folders(&gf_count);
-					char folder_real[PATH_MAX]; char base_real_local[PATH_MAX];
-					if (real_path(BASE_DIR, base_real_local)) {
-						size_t base_len = strlen(base_real_local);
-						for (size_t gi = 0; gi < gf_count; ++gi) {
-							if (!real_path(gfolders[gi], folder_real)) continue;
-							if (!safe_under(folder_real, full_path)) continue;
-							const char* r = folder_real + base_len + ((folder_real[base_len] == DIR_SEP) ? 1 : 0);
-							make_safe_dir_name_from(r, dirpart, sizeof(dirpart));
-							break;
-						}
-					}
-					if (!dirpart[0]) {
-						char parent[PATH_MAX];
-						strncpy(parent, full_path, sizeof(parent) - 1);
-						parent[sizeof(parent) - 1] = '\0';
-						char* s1 = strrchr(parent, '/');
-						char* s2 = strrchr(parent, '\\');
-						char* last = NULL;
-						if (s1 && s2) last = (s1 > s2) ? s1 : s2;
-						else if (s1) last = s1;
-						else if (s2) last = s2;
-						if (last) *last = '\0'; else { parent[0] = '.'; parent[1] = '\0'; }
-						make_safe_dir_name_from(parent, dirpart, sizeof(dirpart));
-					}
-				}
+				char dirpart[PATH_MAX];
+				thumb_dirpart_for(roots, full_path, relurl, true, true, dirpart, sizeof(dirpart));
 				if (dirpart[0]) {
 					snprintf(small_url, sizeof(small_url), "/images/thumbs/%s/%s", dirpart, small_rel);
 					snprintf(large_url, sizeof(large_url), "/images/thumbs/%s/%s", dirpart, large_rel);
@@ -1125,18 +994,25 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 			ptr = json_str(ptr, "thumb", small_url, &len);
 			ptr = json_str(ptr, "thumb_small", small_url, &len);
 			ptr = json_str(ptr, "thumb_large", large_url, &len);
+			char preview_url[PATH_MAX];
+			if (!preview_url_for(full_path, large_url, preview_url, sizeof(preview_url))) preview_url[0] = '\0';
+			ptr = json_str(ptr, "preview", preview_url, &len);
 		}
 		else {
 			ptr = json_str(ptr, "thumb", "", &len);
 			ptr = json_str(ptr, "thumb_small", "", &len);
 			ptr = json_str(ptr, "thumb_large", "", &len);
+			ptr = json_str(ptr, "preview", "", &len);
 		}
+		int dim_w, dim_h;
+		get_media_dimensions(full_path, &dim_w, &dim_h);
+		ptr = json_int(ptr, "width", dim_w, &len);
+		ptr = json_int(ptr, "height", dim_h, &len);
 		ptr = json_int(ptr, "thumb_small_status", small_exists ? 1 : 0, &len);
 		ptr = json_int(ptr, "thumbStatus", thumb_status, &len);
 		ptr = json_objClose(ptr, &len);
-		free(files[i]);
 	}
-	free(files);
+	gallery_roots_release(roots);
 	used = ptr - buf;
 	ensure_json_buf(&buf, &cap, used, 512);
 	ptr = buf + used; len = cap - used;
@@ -1147,8 +1023,7 @@ void handle_api_media(int c, char* qs, bool keep_alive) {
 	ptr = json_int(ptr, "totalPages", totalPages, &len);
 	ptr = json_bool(ptr, "hasMore", page < totalPages, &len);
 	ptr = json_objClose(ptr, &len);
-	send_header(c, 200, "OK", "application/json; charset=utf-8", (long)(ptr - buf), NULL, 0, keep_alive);
-	send(c, buf, (int)(ptr - buf), 0);
+	send_response(c, 200, "OK", "application/json; charset=utf-8", buf, (size_t)(ptr - buf), keep_alive);
 	free(buf);
 }
 void handle_api_add_folder(int c, const char* body, bool keep_alive) {
@@ -1170,8 +1045,7 @@ void handle_api_add_folder(int c, const char* body, bool keep_alive) {
 	size_t cap = 512; char* buf = malloc(cap);
 	if (!buf) {
 		const char* msg = "{\"error\":\"Out of memory\"}";
-		send_header(c, 500, "Internal Server Error", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-		send(c, msg, (int)strlen(msg), 0);
+		send_response(c, 500, "Internal Server Error", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 		return;
 	}
 	size_t rlen = cap; char* ptr = buf;
@@ -1179,8 +1053,7 @@ void handle_api_add_folder(int c, const char* body, bool keep_alive) {
 	ptr = json_str(ptr, "status", "success", &rlen);
 	ptr = json_str(ptr, "message", path, &rlen);
 	ptr = json_objClose(ptr, &rlen);
-	send_header(c, 200, "OK", "application/json; charset=utf-8", (long)(ptr - buf), NULL, 0, keep_alive);
-	send(c, buf, (int)(ptr - buf), 0);
+	send_response(c, 200, "OK", "application/json; charset=utf-8", buf, (size_t)(ptr - buf), keep_alive);
 	free(buf);
 }
 void handle_api_list_folders(int c, bool keep_alive) {
@@ -1188,8 +1061,7 @@ void handle_api_list_folders(int c, bool keep_alive) {
 	size_t cap = 8192; char* buf = malloc(cap);
 	if (!buf) {
 		const char* msg = "{\"error\":\"Out of memory\"}";
-		send_header(c, 500, "Internal Server Error", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-		send(c, msg, (int)strlen(msg), 0);
+		send_response(c, 500, "Internal Server Error", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 		return;
 	}
 	size_t len = cap; char* ptr = buf;
@@ -1204,10 +1076,107 @@ void handle_api_list_folders(int c, bool keep_alive) {
 	}
 	ptr = json_arrClose(ptr, &len);
 	ptr = json_objClose(ptr, &len);
-	send_header(c, 200, "OK", "application/json; charset=utf-8", (long)(ptr - buf), NULL, 0, keep_alive);
-	send(c, buf, (int)(ptr - buf), 0);
+	send_response(c, 200, "OK", "application/json; charset=utf-8", buf, (size_t)(ptr - buf), keep_alive);
 	free(buf);
 }
+void handle_api_cache_stats(int c, bool keep_alive) {
+	thumb_cache_stats_t ts; thumb_cache_get_stats(&ts);
+	size_t fd_hits = 0, fd_misses = 0, fd_entries = 0;
+	fd_cache_stats(&fd_hits, &fd_misses, &fd_entries);
+	size_t lookups = ts.hits + ts.misses;
+	char buf[1024]; size_t len = sizeof(buf); char* ptr = buf;
+	ptr = json_objOpen(ptr, NULL, &len);
+	ptr = json_objOpen(ptr, "thumbs", &len);
+	ptr = json_verylong(ptr, "hits", (long long)ts.hits, &len);
+	ptr = json_verylong(ptr, "misses", (long long)ts.misses, &len);
+	ptr = json_double(ptr, "hitRatio", lookups ? (double)ts.hits / (double)lookups : 0.0, &len);
+	ptr = json_verylong(ptr, "rejected", (long long)ts.rejected, &len);
+	ptr = json_verylong(ptr, "entries", (long long)ts.entries, &len);
+	ptr = json_verylong(ptr, "bytes", (long long)ts.bytes, &len);
+	ptr = json_verylong(ptr, "budget", (long long)ts.budget, &len);
+	ptr = json_objClose(ptr, &len);
+	ptr = json_objOpen(ptr, "fds", &len);
+	ptr = json_verylong(ptr, "hits", (long long)fd_hits, &len);
+	ptr = json_verylong(ptr, "misses", (long long)fd_misses, &len);
+	ptr = json_verylong(ptr, "entries", (long long)fd_entries, &len);
+	ptr = json_objClose(ptr, &len);
+	ptr = json_objClose(ptr, &len);
+	send_response(c, 200, "OK", "application/json; charset=utf-8", buf, (size_t)(ptr - buf), keep_alive);
+}
+/* Maps the path query parameter, a media URL as used in the gallery markup
+ * (/images/<dir>/<file>), to the file it is served from, the same way the
+ * /images/ static route does. */
+static int resolve_hls_media(char* qs, char* url_out, size_t url_len, char* media_real) {
+	char* v = qs ? query_get_arena(arena_request(), qs, "path") : NULL;
+	if (!v || !*v) return 0;
+	snprintf(url_out, url_len, "%s", v);
+	const char* rel = v;
+	if (strncmp(rel, "/images/", 8) == 0) rel += 8;
+	else if (strncmp(rel, "/media/", 7) == 0) rel += 7;
+	while (*rel == '/' || *rel == '\\') rel++;
+	if (!*rel) return 0;
+	char full[PATH_MAX];
+	if (strchr(rel, '/')) snprintf(full, sizeof(full), "%s" DIR_SEP_STR "%s", BASE_DIR, rel);
+	else {
+		size_t gf_count = 0; char** gfolders = get_gallery_folders(&gf_count);
+		snprintf(full, sizeof(full), "%s" DIR_SEP_STR "%s", gf_count > 0 && gfolders[0] && gfolders[0][0] ? gfolders[0] : BASE_DIR, rel);
+	}
+	normalize_path(full);
+	char dir[PATH_MAX];
+	get_parent_dir_local(full, dir, sizeof(dir));
+	char dir_real[PATH_MAX];
+	if (!real_path(full, media_real) || !is_file(media_real)) return 0;
+	if (!real_path(dir, dir_real) || !is_under_gallery_root(dir_real)) return 0;
+	return hls_is_candidate(media_real);
+}
+void handle_api_hls_playlist(int c, char* qs, bool keep_alive) {
+	char url[PATH_MAX], media[PATH_MAX];
+	if (!resolve_hls_media(qs, url, sizeof(url), media)) {
+		const char* msg = "{\"error\":\"Invalid video path\"}";
+		send_response(c, 404, "Not Found", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
+		return;
+	}
+	size_t len = 0;
+	char* m3u8 = hls_build_playlist(media, url, &len);
+	if (!m3u8) {
+		const char* msg = "{\"error\":\"No playable video stream\"}";
+		send_response(c, 415, "Unsupported Media Type", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
+		return;
+	}
+	send_response(c, 200, "OK", "application/vnd.apple.mpegurl", m3u8, len, keep_alive);
+	free(m3u8);
+}
+void handle_api_hls_segment(int c, char* qs, bool keep_alive) {
+	char url[PATH_MAX], media[PATH_MAX], seg[PATH_MAX];
+	char* n = qs ? query_get_arena(arena_request(), qs, "n") : NULL;
+	if (!n || !*n || !resolve_hls_media(qs, url, sizeof(url), media)) {
+		send_text(c, 404, "Not Found", "Not found", keep_alive);
+		return;
+	}
+	int rc = hls_segment_path(media, atoi(n), seg, sizeof(seg));
+	if (rc == -2) { send_text(c, 404, "Not Found", "No such segment", keep_alive); return; }
+	if (rc != 0) { send_text(c, 500, "Internal Server Error", "Segment failed", keep_alive); return; }
+	char* range = get_header_value_arena(arena_request(), g_request_headers, "Range:");
+	char* if_range = range ? get_header_value_arena(arena_request(), g_request_headers, "If-Range:") : NULL;
+	send_file_stream_ex(c, seg, range, if_range, keep_alive);
+}
+void handle_api_ready(int c, bool keep_alive) {
+	startup_status_t st; startup_get_status(&st);
+	bool ready = st.phase == STARTUP_PHASE_READY;
+	char buf[512]; size_t len = sizeof(buf); char* ptr = buf;
+	ptr = json_objOpen(ptr, NULL, &len);
+	ptr = json_bool(ptr, "ready", ready, &len);
+	ptr = json_str(ptr, "phase", startup_phase_name(st.phase), &len);
+	ptr = json_verylong(ptr, "done", (long long)st.done, &len);
+	ptr = json_verylong(ptr, "total", (long long)st.total, &len);
+	ptr = json_verylong(ptr, "uptimeMs", (long long)st.uptime_ms, &len);
+	ptr = json_verylong(ptr, "listenMs", (long long)st.listen_ms, &len);
+	ptr = json_verylong(ptr, "firstResponseMs", (long long)st.first_ok_ms, &len);
+	ptr = json_verylong(ptr, "readyMs", (long long)st.ready_ms, &len);
+	ptr = json_objClose(ptr, &len);
+	if (ready) send_response(c, 200, "OK", "application/json; charset=utf-8", buf, (size_t)(ptr - buf), keep_alive);
+	else send_response(c, 503, "Service Unavailable", "application/json; charset=utf-8", buf, (size_t)(ptr - buf), keep_alive);
+}
 void handle_legacy_folders(int c, bool keep_alive) {
 	LOG_DEBUG("handle_legacy_folders requested");
 	const int STACK_INIT = 64; const int SUBDIR_INIT = 32; const int STACK_GROW = 64;
@@ -1216,8 +1185,7 @@ void handle_legacy_folders(int c, bool keep_alive) {
 	thread_mutex_lock(&legacy_folders_mutex);
 	if (legacy_folders_cache && (now - legacy_folders_cache_time) < 5) {
 		size_t used = legacy_folders_cache_len;
-		send_header(c, 200, "OK", "application/json; charset=utf-8", (long)used, NULL, 0, keep_alive);
-		send(c, legacy_folders_cache, (int)used, 0);
+		send_response(c, 200, "OK", "application/json; charset=utf-8", legacy_folders_cache, used, keep_alive);
 		thread_mutex_unlock(&legacy_folders_mutex);
 		return;
 	}
@@ -1227,8 +1195,12 @@ void handle_legacy_folders(int c, bool keep_alive) {
 	int sp = 0, stack_cap = STACK_INIT;
 	stack[sp++] = strdup(BASE_DIR);
 
-	size_t cap = 1024; char* out = malloc(cap); if (!out) { free(stack); send_text(c, 500, "Internal Server Error", "Memory error", keep_alive); return; }
-	size_t used = 0; out[used++] = '[';
+	http_stream_t* stream = malloc(sizeof(*stream));
+	if (!stream) { free(stack[0]); free(stack); send_text(c, 500, "Internal Server Error", "Memory error", keep_alive); return; }
+	size_t cap = 1024; char* out = malloc(cap);
+	size_t used = 0; if (out) out[used++] = '[';
+	http_stream_begin(stream, c, 200, "OK", "application/json; charset=utf-8", keep_alive);
+	http_stream_write(stream, "[", 1);
 	int first = 1;
 
 	while (sp > 0) {
@@ -1266,12 +1238,19 @@ void handle_legacy_folders(int c, bool keep_alive) {
 			const char* rel = d + strlen(BASE_DIR);
 			while (*rel == '/' || *rel == '\\') rel++;
 			if (*rel) {
-				if (!first) { ensure_json_buf(&out, &cap, used, 2); out[used++] = ','; }
+				char item[PATH_MAX + 4]; size_t il = 0;
+				if (!first) item[il++] = ',';
 				first = 0;
-				ensure_json_buf(&out, &cap, used, strlen(rel) + 4);
-				out[used++] = '"';
-				for (const char* p = rel; *p; ++p) { out[used++] = (*p == '\\') ? '/' : *p; }
-				out[used++] = '"';
+				item[il++] = '"';
+				for (const char* p = rel; *p && il < sizeof(item) - 2; ++p) { item[il++] = (*p == '\\') ? '/' : *p; }
+				item[il++] = '"';
+				http_stream_write(stream, item, il);
+				if (out && used + il + 1 <= LEGACY_FOLDERS_CACHE_MAX) {
+					ensure_json_buf(&out, &cap, used, il + 1);
+					if (cap - used > il) { memcpy(out + used, item, il); used += il; }
+					else SAFE_FREE(out);
+				}
+				else SAFE_FREE(out);
 			}
 		}
 
@@ -1296,30 +1275,29 @@ void handle_legacy_folders(int c, bool keep_alive) {
 		free(d);
 	}
 
-	ensure_json_buf(&out, &cap, used, 2);
-	out[used++] = ']';
-	thread_mutex_lock(&legacy_folders_mutex);
-	if (legacy_folders_cache) free(legacy_folders_cache);
-	legacy_folders_cache = malloc(used);
-	if (legacy_folders_cache) {
-		memcpy(legacy_folders_cache, out, used);
+	http_stream_write(stream, "]", 1);
+	http_stream_end(stream);
+	free(stream);
+	if (out) {
+		ensure_json_buf(&out, &cap, used, 2);
+		out[used++] = ']';
+		thread_mutex_lock(&legacy_folders_mutex);
+		if (legacy_folders_cache) free(legacy_folders_cache);
+		legacy_folders_cache = out;
 		legacy_folders_cache_len = used;
 		legacy_folders_cache_time = time(NULL);
+		thread_mutex_unlock(&legacy_folders_mutex);
 	}
-	thread_mutex_unlock(&legacy_folders_mutex);
-	send_header(c, 200, "OK", "application/json; charset=utf-8", (long)used, NULL, 0, keep_alive);
-	send(c, legacy_folders_cache ? legacy_folders_cache : out, (int)used, 0);
-	free(out); free(stack);
+	free(stack);
 }
 void handle_legacy_files(int c, char* qs, bool keep_alive) {
 	char dirparam[PATH_MAX] = { 0 };
 
 	if (qs) {
-		char* v = query_get(qs, "dir");
+		char* v = query_get_arena(arena_request(), qs, "dir");
 		if (v) {
 			strncpy(dirparam, v, PATH_MAX - 1);
 			dirparam[PATH_MAX - 1] = '\0';
-			SAFE_FREE(v);
 		}
 	}
 
@@ -1423,9 +1401,7 @@ void handle_legacy_files(int c, char* qs, bool keep_alive) {
 	ensure_json_buf(&out, &cap, used, 2);
 	out[used++] = ']';
 
-	send_header(c, 200, "OK", "application/json; charset=utf-8",
-		(long)used, NULL, 0, keep_alive);
-	send(c, out, (int)used, 0);
+	send_response(c, 200, "OK", "application/json; charset=utf-8", out, used, keep_alive);
 	free(out);
 }
 
@@ -1489,8 +1465,7 @@ void handle_legacy_move(int c, const char* body, bool keep_alive) {
 	if (platform_move_file(src, dest) == 0) {
 		LOG_INFO("handle_legacy_move: renamed %s -> %s", src, dest);
 		const char* ok = "{\"status\":\"ok\"}";
-		send_header(c, 200, "OK", "application/json; charset=utf-8", (long)strlen(ok), NULL, 0, keep_alive);
-		send(c, ok, (int)strlen(ok), 0);
+		send_response(c, 200, "OK", "application/json; charset=utf-8", ok, strlen(ok), keep_alive);
 		return;
 	}
 	platform_close_streams_for_path(src);
@@ -1499,20 +1474,17 @@ void handle_legacy_move(int c, const char* body, bool keep_alive) {
 		if (platform_file_delete(src) == 0) {
 			LOG_INFO("handle_legacy_move: deleted original %s", src);
 			const char* ok = "{\"status\":\"ok\"}";
-			send_header(c, 200, "OK", "application/json; charset=utf-8", (long)strlen(ok), NULL, 0, keep_alive);
-			send(c, ok, (int)strlen(ok), 0);
+			send_response(c, 200, "OK", "application/json; charset=utf-8", ok, strlen(ok), keep_alive);
 			return;
 		}
 		LOG_ERROR("handle_legacy_move: copied but failed to delete original %s", src);
 		const char* msg = "{\"error\":\"copied but delete failed\"}";
-		send_header(c, 500, "Internal Server Error", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-		send(c, msg, (int)strlen(msg), 0);
+		send_response(c, 500, "Internal Server Error", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 		return;
 	}
 	LOG_ERROR("handle_legacy_move: failed to move or copy %s -> %s", src, dest);
 	char emsg[128]; snprintf(emsg, sizeof(emsg), "{\"error\":\"move failed\"}");
-	send_header(c, 500, "Internal Server Error", "application/json; charset=utf-8", (long)strlen(emsg), NULL, 0, keep_alive);
-	send(c, emsg, (int)strlen(emsg), 0);
+	send_response(c, 500, "Internal Server Error", "application/json; charset=utf-8", emsg, strlen(emsg), keep_alive);
 }
 
 void handle_legacy_addfolder(int c, const char* body, bool keep_alive) {
@@ -1536,19 +1508,15 @@ void handle_legacy_addfolder(int c, const char* body, bool keep_alive) {
 		int rr = snprintf(msg, sizeof(msg), "{\"type\":\"folderAdded\",\"path\":\"%s\"}", dest);
 		if (rr > 0) websocket_broadcast_topic(dest, msg);
 		const char* ok = "{\"status\":\"ok\"}";
-		send_header(c, 200, "OK", "application/json; charset=utf-8", (long)strlen(ok), NULL, 0, keep_alive);
-		send(c, ok, (int)strlen(ok), 0);
+		send_response(c, 200, "OK", "application/json; charset=utf-8", ok, strlen(ok), keep_alive);
 		return;
 	}
 	LOG_ERROR("handle_legacy_addfolder mkdir failed for: %s", dest);
 	const char msg[128] = "{\"error\":\"mkdir failed\"}";
-	send_header(c, 500, "Internal Server Error", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-	send(c, msg, (int)strlen(msg), 0);
+	send_response(c, 500, "Internal Server Error", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 }
 typedef struct {
-	char* buf;
-	size_t cap;
-	size_t used;
+	http_stream_t* out;
 	int first;
 	int filter_enabled;
 	char per_thumbs_root[PATH_MAX];
@@ -1601,46 +1569,31 @@ static void thumbdb_list_cb(const char* key, const char* value, void* ctx) {
 	}
 	char formatted[PATH_MAX] = "";
 	format_thumbdb_value(value, c->base_real, formatted, sizeof(formatted));
-	size_t used = c->used;
-	ensure_json_buf(&c->buf, &c->cap, used, 256 + strlen(key) + strlen(formatted));
-	char* ptr = c->buf + used;
-	size_t rem = c->cap - used;
+	http_stream_t* out = c->out;
+	http_stream_reserve(out, 256 + (strlen(key) + strlen(formatted)) * 6);
 	if (!c->first) {
-		ptr = json_comma_safe(ptr, &rem);
+		out->ptr = json_comma_safe(out->ptr, &out->rem);
 	}
 	else {
 		c->first = 0;
 	}
-	ptr = json_objOpen(ptr, NULL, &rem);
-	ptr = json_str(ptr, "key", key, &rem);
-	ptr = json_str(ptr, "value", formatted, &rem);
-	ptr = json_objClose(ptr, &rem);
-	c->used = ptr - c->buf;
+	out->ptr = json_objOpen(out->ptr, NULL, &out->rem);
+	out->ptr = json_str(out->ptr, "key", key, &out->rem);
+	out->ptr = json_str(out->ptr, "value", formatted, &out->rem);
+	out->ptr = json_objClose(out->ptr, &out->rem);
 }
 
 void handle_api_thumbdb_list(int c, char* qs, bool keep_alive) {
-	size_t cap = 8192;
-	char* buf = malloc(cap);
-	if (!buf) { send_text(c, 500, "Internal Server Error", "Out of memory", keep_alive); return; }
-	size_t used = 0;
-	char* ptr = buf;
-	size_t rem = cap;
-	ptr = json_objOpen(ptr, NULL, &rem);
-	ptr = json_arrOpen(ptr, "items", &rem);
-	used = ptr - buf;
 	tdb_list_ctx_t ctx;
-	ctx.buf = buf; ctx.cap = cap; ctx.used = used; ctx.first = 1; ctx.filter_enabled = 0; ctx.per_thumbs_root[0] = '\0'; ctx.base_real[0] = '\0';
+	ctx.out = NULL; ctx.first = 1; ctx.filter_enabled = 0; ctx.per_thumbs_root[0] = '\0'; ctx.base_real[0] = '\0';
 	if (qs) {
-		char* dir = query_get(qs, "dir");
+		char* dir = query_get_arena(arena_request(), qs, "dir");
 		if (dir) {
 			char dircopy[PATH_MAX]; strncpy(dircopy, dir, sizeof(dircopy) - 1); dircopy[sizeof(dircopy) - 1] = '\0'; sanitize_dirparam(dircopy);
 			char target_real[PATH_MAX]; char base_real[PATH_MAX];
 			if (!resolve_and_validate_target(BASE_DIR, dircopy, target_real, sizeof(target_real), base_real, sizeof(base_real))) {
-				SAFE_FREE(dir);
-				free(buf);
 				const char* msg = "{\"error\":\"Invalid directory\"}";
-				send_header(c, 400, "Bad Request", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-				send(c, msg, (int)strlen(msg), 0);
+				send_response(c, 400, "Bad Request", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 				return;
 			}
 			{
@@ -1662,20 +1615,15 @@ void handle_api_thumbdb_list(int c, char* qs, bool keep_alive) {
 				snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", per_thumbs_root);
 				thumbdb_open_for_dir(per_db);
 			}
-			SAFE_FREE(dir);
 		}
 	}
 	char* plain_flag = NULL;
-	if (qs) plain_flag = query_get(qs, "plain");
+	if (qs) plain_flag = query_get_arena(arena_request(), qs, "plain");
 	if (plain_flag) {
-		SAFE_FREE(plain_flag);
 		{
-			api_collect_ctx_t cctx = { NULL, 0, 0, 0 };
+			api_collect_ctx_t cctx = { NULL, 0, 0, 0, arena_request() };
 			thumbdb_iterate(api_thumbdb_collect_cb, &cctx);
 			if (cctx.err) {
-				for (size_t i = 0; i < cctx.count; ++i) { free(cctx.arr[i].key); free(cctx.arr[i].val); }
-				free(cctx.arr);
-				free(buf);
 				send_text(c, 500, "Internal Server Error", "Memory error", keep_alive);
 				return;
 			}
@@ -1690,18 +1638,19 @@ void handle_api_thumbdb_list(int c, char* qs, bool keep_alive) {
 						int keep_j = 0;
 						if ((media_i[0] == '\0') && (media_j[0] != '\0')) keep_j = 1;
 						if (keep_j) {
-							free(cctx.arr[i].val); cctx.arr[i].val = cctx.arr[j].val; cctx.arr[j].val = NULL;
-							free(cctx.arr[j].key); cctx.arr[j].key = NULL;
+							cctx.arr[i].val = cctx.arr[j].val; cctx.arr[j].val = NULL;
+							cctx.arr[j].key = NULL;
 						}
 						else {
-							free(cctx.arr[j].val); cctx.arr[j].val = NULL; free(cctx.arr[j].key); cctx.arr[j].key = NULL;
+							cctx.arr[j].val = NULL; cctx.arr[j].key = NULL;
 						}
 					}
 				}
 			}
 			char encbuf[PATH_MAX];
-			size_t outcap = 4096; char* outbuf = malloc(outcap); if (!outbuf) { for (size_t i = 0;i < cctx.count;i++) { free(cctx.arr[i].key); free(cctx.arr[i].val); } free(cctx.arr); free(buf); send_text(c, 500, "Internal Server Error", "Memory error", keep_alive); return; }
-			size_t outs = 0;
+			http_stream_t* out = malloc(sizeof(*out));
+			if (!out) { send_text(c, 500, "Internal Server Error", "Memory error", keep_alive); return; }
+			http_stream_begin(out, c, 200, "OK", "text/plain; charset=utf-8", keep_alive);
 			for (size_t i = 0; i < cctx.count; ++i) {
 				if (!cctx.arr[i].key) continue;
 				char small_tok[64] = "null"; char large_tok[64] = "null"; char media_display[PATH_MAX] = "";
@@ -1721,30 +1670,19 @@ void handle_api_thumbdb_list(int c, char* qs, bool keep_alive) {
 					encbuf[oi] = '\0';
 				}
 				size_t need = strlen(cctx.arr[i].key) + 1 + strlen(small_tok) + 1 + strlen(large_tok) + 1 + strlen(encbuf) + 2;
-				if (outs + need > outcap) {
-					size_t nc = (outs + need) * 2;
-					char* tmp = realloc(outbuf, nc);
-					if (!tmp) break;
-					outbuf = tmp; outcap = nc;
-				}
-				outs += snprintf(outbuf + outs, outcap - outs, "%s;%s;%s;%s\n", cctx.arr[i].key, small_tok, large_tok, encbuf);
+				http_stream_reserve(out, need);
+				int wn = snprintf(out->ptr, out->rem, "%s;%s;%s;%s\n", cctx.arr[i].key, small_tok, large_tok, encbuf);
+				if (wn > 0 && (size_t)wn < out->rem) { out->ptr += wn; out->rem -= (size_t)wn; }
 			}
-			for (size_t i = 0; i < cctx.count; ++i) { free(cctx.arr[i].key); free(cctx.arr[i].val); }
-			free(cctx.arr);
-			free(buf);
-			send_header(c, 200, "OK", "text/plain; charset=utf-8", (long)outs, NULL, 0, keep_alive);
-			send(c, outbuf, (int)outs, 0);
-			free(outbuf);
+			http_stream_end(out);
+			free(out);
 			return;
 		}
 	}
 	{
-		api_collect_ctx_t cctx = { NULL, 0, 0, 0 };
+		api_collect_ctx_t cctx = { NULL, 0, 0, 0, arena_request() };
 		thumbdb_iterate(api_thumbdb_collect_cb, &cctx);
 		if (cctx.err) {
-			for (size_t i = 0; i < cctx.count; ++i) { free(cctx.arr[i].key); free(cctx.arr[i].val); }
-			free(cctx.arr);
-			free(buf);
 			send_text(c, 500, "Internal Server Error", "Memory error", keep_alive);
 			return;
 		}
@@ -1767,22 +1705,27 @@ void handle_api_thumbdb_list(int c, char* qs, bool keep_alive) {
 					int keep_j = 0;
 					if ((media_i[0] == '\0') && (media_j[0] != '\0')) keep_j = 1;
 					if (keep_j) {
-						free(cctx.arr[i].val);
 						cctx.arr[i].val = cctx.arr[j].val;
 						cctx.arr[j].val = NULL;
-						free(cctx.arr[j].key);
 						cctx.arr[j].key = NULL;
 					}
 					else {
-						free(cctx.arr[j].val);
 						cctx.arr[j].val = NULL;
-						free(cctx.arr[j].key);
 						cctx.arr[j].key = NULL;
 					}
 				}
 			}
 		}
 
+		http_stream_t* out = malloc(sizeof(*out));
+		if (!out) {
+			send_text(c, 500, "Internal Server Error", "Memory error", keep_alive);
+			return;
+		}
+		ctx.out = out;
+		http_stream_begin(out, c, 200, "OK", "application/json; charset=utf-8", keep_alive);
+		out->ptr = json_objOpen(out->ptr, NULL, &out->rem);
+		out->ptr = json_arrOpen(out->ptr, "items", &out->rem);
 		for (size_t i = 0; i < cctx.count; ++i) {
 			if (!cctx.arr[i].key) continue;
 			char small_tok[64] = "null"; char large_tok[64] = "null"; char media[PATH_MAX] = "";
@@ -1820,39 +1763,31 @@ void handle_api_thumbdb_list(int c, char* qs, bool keep_alive) {
 			else if (media[0]) {
 				strncpy(out_media, media, sizeof(out_media) - 1); out_media[sizeof(out_media) - 1] = '\0';
 			}
-			size_t used_local = ctx.used;
-			ensure_json_buf(&ctx.buf, &ctx.cap, used_local, 512 + strlen(cctx.arr[i].key) + strlen(small_tok) + strlen(large_tok) + strlen(out_media));
-			char* p = ctx.buf + ctx.used; size_t rem_local = ctx.cap - ctx.used;
-			if (!ctx.first) p = json_comma_safe(p, &rem_local); else ctx.first = 0;
-			p = json_objOpen(p, NULL, &rem_local);
-			p = json_str(p, "key", cctx.arr[i].key, &rem_local);
-			p = json_str(p, "small", small_tok, &rem_local);
-			p = json_str(p, "large", large_tok, &rem_local);
-			p = json_str(p, "value", out_media, &rem_local);
-			p = json_objClose(p, &rem_local);
-			ctx.used = p - ctx.buf;
-		}
-
-		for (size_t i = 0; i < cctx.count; ++i) { free(cctx.arr[i].key); free(cctx.arr[i].val); }
-		free(cctx.arr);
-
-		buf = ctx.buf; cap = ctx.cap; used = ctx.used;
-		ptr = buf + used; rem = cap - used;
-		ptr = json_arrClose(ptr, &rem);
-		ptr = json_objClose(ptr, &rem);
-		used = ptr - buf;
-		send_header(c, 200, "OK", "application/json; charset=utf-8", (long)used, NULL, 0, keep_alive);
-		send(c, buf, (int)used, 0);
-		free(buf);
+			http_stream_reserve(out, 512 + (strlen(cctx.arr[i].key) + strlen(small_tok) + strlen(large_tok) + strlen(out_media)) * 6);
+			if (!ctx.first) out->ptr = json_comma_safe(out->ptr, &out->rem); else ctx.first = 0;
+			out->ptr = json_objOpen(out->ptr, NULL, &out->rem);
+			out->ptr = json_str(out->ptr, "key", cctx.arr[i].key, &out->rem);
+			out->ptr = json_str(out->ptr, "small", small_tok, &out->rem);
+			out->ptr = json_str(out->ptr, "large", large_tok, &out->rem);
+			out->ptr = json_str(out->ptr, "value", out_media, &out->rem);
+			out->ptr = json_objClose(out->ptr, &out->rem);
+		}
+
+
+		http_stream_reserve(out, 4);
+		out->ptr = json_arrClose(out->ptr, &out->rem);
+		out->ptr = json_objClose(out->ptr, &out->rem);
+		http_stream_end(out);
+		free(out);
 	}
 }
 
 void handle_api_thumbdb_get(int c, char* qs, bool keep_alive) {
 	if (!qs) { send_text(c, 400, "Bad Request", "Missing query", keep_alive); return; }
-	char* k = query_get(qs, "key");
+	char* k = query_get_arena(arena_request(), qs, "key");
 	if (!k) { send_text(c, 400, "Bad Request", "Missing key", keep_alive); return; }
 	if (qs) {
-		char* dirq = query_get(qs, "dir");
+		char* dirq = query_get_arena(arena_request(), qs, "dir");
 		if (dirq) {
 			char dircopy[PATH_MAX]; strncpy(dircopy, dirq, sizeof(dircopy) - 1); dircopy[sizeof(dircopy) - 1] = '\0'; sanitize_dirparam(dircopy);
 			char target_real[PATH_MAX]; char base_real[PATH_MAX];
@@ -1868,14 +1803,12 @@ void handle_api_thumbdb_get(int c, char* qs, bool keep_alive) {
 				char per_db[PATH_MAX]; snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", per_thumbs_root);
 				thumbdb_open_for_dir(per_db);
 			}
-			SAFE_FREE(dirq);
 		}
 	}
 
 	char val[65536]; val[0] = '\0';
 	int r = thumbdb_get(k, val, sizeof(val));
 	if (r != 0) {
-		SAFE_FREE(k);
 		send_text(c, 404, "Not Found", "Key not found", keep_alive);
 		return;
 	}
@@ -1900,7 +1833,7 @@ void handle_api_thumbdb_get(int c, char* qs, bool keep_alive) {
 	size_t cap = val_len + 1024;
 	if (cap < 1024) cap = 1024;
 	char* buf = malloc(cap);
-	if (!buf) { SAFE_FREE(k); send_text(c, 500, "Internal Server Error", "Out of memory", keep_alive); return; }
+	if (!buf) { send_text(c, 500, "Internal Server Error", "Out of memory", keep_alive); return; }
 	size_t rem = cap; char* ptr = buf;
 	ptr = json_objOpen(ptr, NULL, &rem);
 	ptr = json_str(ptr, "key", k, &rem);
@@ -1909,15 +1842,14 @@ void handle_api_thumbdb_get(int c, char* qs, bool keep_alive) {
 	ptr = json_str(ptr, "value", media, &rem);
 	ptr = json_objClose(ptr, &rem);
 	size_t used = ptr - buf;
-	send_header(c, 200, "OK", "application/json; charset=utf-8", (long)used, NULL, 0, keep_alive);
-	send(c, buf, (int)used, 0);
-	free(buf); SAFE_FREE(k);
+	send_response(c, 200, "OK", "application/json; charset=utf-8", buf, used, keep_alive);
+	free(buf);
 }
 
 void handle_api_thumbdb_set(int c, const char* body, bool keep_alive) {
 	if (!body) { send_text(c, 400, "Bad Request", "Missing body", keep_alive); return; }
 	if (g_request_qs) {
-		char* dirq = query_get(g_request_qs, "dir");
+		char* dirq = query_get_arena(arena_request(), g_request_qs, "dir");
 		if (dirq) {
 			char dircopy[PATH_MAX]; strncpy(dircopy, dirq, sizeof(dircopy) - 1); dircopy[sizeof(dircopy) - 1] = '\0'; sanitize_dirparam(dircopy);
 			char target_real[PATH_MAX]; char base_real[PATH_MAX];
@@ -1933,7 +1865,6 @@ void handle_api_thumbdb_set(int c, const char* body, bool keep_alive) {
 				char per_db[PATH_MAX]; snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", per_thumbs_root);
 				thumbdb_open_for_dir(per_db);
 			}
-			SAFE_FREE(dirq);
 		}
 	}
 	const char* kstart = strstr(body, "\"key\":\"");
@@ -1958,7 +1889,7 @@ void handle_api_thumbdb_set(int c, const char* body, bool keep_alive) {
 void handle_api_thumbdb_delete(int c, const char* body, bool keep_alive) {
 	if (!body) { send_text(c, 400, "Bad Request", "Missing body", keep_alive); return; }
 	if (g_request_qs) {
-		char* dirq = query_get(g_request_qs, "dir");
+		char* dirq = query_get_arena(arena_request(), g_request_qs, "dir");
 		if (dirq) {
 			char dircopy[PATH_MAX]; strncpy(dircopy, dirq, sizeof(dircopy) - 1); dircopy[sizeof(dircopy) - 1] = '\0'; sanitize_dirparam(dircopy);
 			char target_real[PATH_MAX]; char base_real[PATH_MAX];
@@ -1974,7 +1905,6 @@ void handle_api_thumbdb_delete(int c, const char* body, bool keep_alive) {
 				char per_db[PATH_MAX]; snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", per_thumbs_root);
 				thumbdb_open_for_dir(per_db);
 			}
-			SAFE_FREE(dirq);
 		}
 	}
 	const char* kstart = strstr(body, "\"key\":\"");
@@ -1991,12 +1921,11 @@ void handle_api_thumbdb_delete(int c, const char* body, bool keep_alive) {
 
 void handle_api_thumbdb_thumbs_for_dir(int c, char* qs, bool keep_alive) {
 	if (!qs) { send_text(c, 400, "Bad Request", "Missing query", keep_alive); return; }
-	char* dir = query_get(qs, "dir");
+	char* dir = query_get_arena(arena_request(), qs, "dir");
 	if (!dir) { send_text(c, 400, "Bad Request", "Missing dir", keep_alive); return; }
 	char dircopy[PATH_MAX]; strncpy(dircopy, dir, sizeof(dircopy) - 1); dircopy[sizeof(dircopy) - 1] = '\0'; sanitize_dirparam(dircopy);
 	char target_real[PATH_MAX]; char base_real[PATH_MAX];
 	if (!resolve_and_validate_target(BASE_DIR, dircopy, target_real, sizeof(target_real), base_real, sizeof(base_real))) {
-		SAFE_FREE(dir);
 		send_text(c, 400, "Bad Request", "Invalid directory", keep_alive);
 		return;
 	}
@@ -2008,9 +1937,8 @@ void handle_api_thumbdb_thumbs_for_dir(int c, char* qs, bool keep_alive) {
 	ptr = json_str(ptr, "url", url, &rem);
 	ptr = json_objClose(ptr, &rem);
 	size_t used = ptr - buf;
-	send_header(c, 200, "OK", "application/json; charset=utf-8", (long)used, NULL, 0, keep_alive);
-	send(c, buf, (int)used, 0);
-	free(buf); SAFE_FREE(dir);
+	send_response(c, 200, "OK", "application/json; charset=utf-8", buf, used, keep_alive);
+	free(buf);
 }
 
 void handle_api_delete_file(int c, const char* body, bool keep_alive) {
@@ -2047,25 +1975,21 @@ void handle_api_delete_file(int c, const char* body, bool keep_alive) {
 	char dest[PATH_MAX]; path_join(dest, destFolder, fname);
 	if (platform_move_file(src, dest) == 0) {
 		const char* ok = "{\"status\":\"ok\"}";
-		send_header(c, 200, "OK", "application/json; charset=utf-8", (long)strlen(ok), NULL, 0, keep_alive);
-		send(c, ok, (int)strlen(ok), 0);
+		send_response(c, 200, "OK", "application/json; charset=utf-8", ok, strlen(ok), keep_alive);
 		return;
 	}
 	if (platform_copy_file(src, dest) == 0) {
 		if (platform_file_delete(src) == 0) {
 			const char* ok = "{\"status\":\"ok\"}";
-			send_header(c, 200, "OK", "application/json; charset=utf-8", (long)strlen(ok), NULL, 0, keep_alive);
-			send(c, ok, (int)strlen(ok), 0);
+			send_response(c, 200, "OK", "application/json; charset=utf-8", ok, strlen(ok), keep_alive);
 			return;
 		}
 		const char* msg = "{\"error\":\"copied but delete failed\"}";
-		send_header(c, 500, "Internal Server Error", "application/json; charset=utf-8", (long)strlen(msg), NULL, 0, keep_alive);
-		send(c, msg, (int)strlen(msg), 0);
+		send_response(c, 500, "Internal Server Error", "application/json; charset=utf-8", msg, strlen(msg), keep_alive);
 		return;
 	}
 	char emsg[128]; snprintf(emsg, sizeof(emsg), "{\"error\":\"delete failed\"}");
-	send_header(c, 500, "Internal Server Error", "application/json; charset=utf-8", (long)strlen(emsg), NULL, 0, keep_alive);
-	send(c, emsg, (int)strlen(emsg), 0);
+	send_response(c, 500, "Internal Server Error", "application/json; charset=utf-8", emsg, strlen(emsg), keep_alive);
 }
 typedef enum {
 	GET_SIMPLE, GET_QS, POST_BODY
@@ -2081,18 +2005,60 @@ typedef struct {
 	bool allow_range;
 } static_route_t;
 static void serve_file(int c, const char* base_dir, const char* sub_path, const char* range, bool keep_alive) {
+	char* if_range = range ? get_header_value_arena(arena_request(), g_request_headers, "If-Range:") : NULL;
+	char key[PATH_MAX];
+	snprintf(key, sizeof(key), "%s" DIR_SEP_STR "%s", base_dir, sub_path);
+	normalize_path(key);
+	char fs_dir[PATH_MAX], fs_name[PATH_MAX];
+	if (faststart_lookup(key, fs_dir, sizeof(fs_dir), fs_name, sizeof(fs_name)) == 0) {
+		serve_file(c, fs_dir, fs_name, range, keep_alive);
+		return;
+	}
+	if (!range && thumb_cache_serve(c, key, keep_alive)) return;
+	fd_cache_entry_t* fe = fd_cache_acquire(key);
+	if (fe) {
+		send_file_fd_ex(c, fe->fd, &fe->st, fe->path, range, if_range, keep_alive);
+		thumb_cache_offer_fd(key, fe->fd, 0, &fe->st);
+		fd_cache_release(fe);
+		return;
+	}
+	struct stat st;
+	char opened[PATH_MAX];
+	int fd = gallery_open_beneath(base_dir, sub_path, &st, opened, sizeof(opened));
+	if (fd >= 0) {
+		fe = fd_cache_insert(key, opened, fd, &st);
+		if (fe) {
+			send_file_fd_ex(c, fe->fd, &fe->st, fe->path, range, if_range, keep_alive);
+			thumb_cache_offer_fd(key, fe->fd, 0, &fe->st);
+			fd_cache_release(fe);
+		}
+		else {
+			send_file_fd_ex(c, fd, &st, opened, range, if_range, keep_alive);
+			thumb_cache_offer_fd(key, fd, 0, &st);
+			platform_close_fd(fd);
+		}
+		return;
+	}
+	if (errno == ENOENT || errno == ENOTDIR || errno == EISDIR || errno == EPERM || errno == ENAMETOOLONG) {
+		if (errno == ENOENT && thumb_pack_serve(c, key, range, if_range, keep_alive)) return;
+		send_text(c, 404, "Not Found", "Not found", keep_alive);
+		return;
+	}
+	/* No root fd covers this path, or a symlink needs the canonical check. */
 	char rel[1024], base_real[1024], target_real[1024];
 	snprintf(rel, sizeof(rel), "%s/%s", base_dir, sub_path);
 	normalize_path(rel);
 	if (real_path(base_dir, base_real) && real_path(rel, target_real) && safe_under(base_real, target_real) && is_file(target_real))
-		send_file_stream(c, target_real, range, keep_alive);
-	else
+		send_file_stream_ex(c, target_real, range, if_range, keep_alive);
+	else if (!thumb_pack_serve(c, key, range, if_range, keep_alive))
 		send_text(c, 404, "Not Found", "Not found", keep_alive);
 }
 int handle_single_request(int c, char* headers, char* body, size_t headers_len, size_t body_len, bool keep_alive) {
 	(void)headers_len;
 
+	arena_reset(arena_request());
 	g_request_headers = headers;
+	http_negotiate_encoding(headers);
 	char method[8] = { 0 }, url[PATH_MAX] = { 0 };
 	{
 		char* p = headers;
@@ -2113,11 +2079,11 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 	g_request_qs = NULL;
 	url_decode(url);
 	STRCPY(g_request_url, url);
-	char* range = get_header_value(headers, "Range:");
+	char* range = get_header_value_arena(arena_request(), headers, "Range:");
 
-	char* upgrade = get_header_value(headers, "Upgrade:");
+	char* upgrade = get_header_value_arena(arena_request(), headers, "Upgrade:");
 
-	char* connection_hdr = get_header_value(headers, "Connection:");
+	char* connection_hdr = get_header_value_arena(arena_request(), headers, "Connection:");
 
 	if (upgrade || connection_hdr) {
 		LOG_DEBUG("Incoming request headers: Upgrade=%s Connection=%s", upgrade ? upgrade : "(null)", connection_hdr ? connection_hdr : "(null)");
@@ -2127,14 +2093,10 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 		while (*p) { if (tolower((unsigned char)*p) == 'u' && strncasecmp(p, "upgrade", 7) == 0) { found = 1; break; } p++; }
 		if (found) {
 			if (websocket_register_socket(c, headers)) {
-				SAFE_FREE(upgrade);
-				SAFE_FREE(connection_hdr);
 				return 1;
 			}
 		}
 	}
-	SAFE_FREE(upgrade);
-	SAFE_FREE(connection_hdr);
 
 
 	static const route_t routes[] = {
@@ -2150,10 +2112,14 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 		{ "/api/delete-file", POST_BODY, handle_api_delete_file },
 		{ "/api/tree", GET_SIMPLE, handle_api_tree },
 		{ "/api/folders/list", GET_SIMPLE, handle_api_list_folders },
+		{ "/api/cache/stats", GET_SIMPLE, handle_api_cache_stats },
+		{ "/api/ready", GET_SIMPLE, handle_api_ready },
 		{ "/api/folders", GET_QS, handle_api_folders },
 		{ "/api/media", GET_QS, handle_api_media },
 		{ "/api/folders/add", POST_BODY, handle_api_add_folder },
 		{ "/api/regenerate-thumbs", GET_QS, handle_api_regenerate_thumbs },
+		{ "/api/hls/playlist", GET_QS, handle_api_hls_playlist },
+		{ "/api/hls/segment", GET_QS, handle_api_hls_segment },
 	};
 	static const static_route_t static_routes[] = {
 		{ "/images/", BASE_DIR, true },
@@ -2163,34 +2129,11 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 	};
 
 	if (strcmp(url, "/mover") == 0 || strcmp(url, "/mover/") == 0) {
-		char path[1024];
-		snprintf(path, sizeof(path), "%s" DIR_SEP_STR "mover.html", VIEWS_DIR);
-		LOG_DEBUG("Serving mover page: %s", path);
-		if (!is_file(path)) { send_text(c, 404, "Not Found", "mover.html not found", keep_alive); SAFE_FREE(range); return 0; }
-		FILE* f = fopen(path, "rb");
-		if (!f) { LOG_ERROR("Failed to open mover.html: %s", path); send_text(c, 500, "Internal Server Error", "failed to open mover.html", keep_alive); SAFE_FREE(range); return 0; }
-		fseek(f, 0, SEEK_END); long fsz = ftell(f); fseek(f, 0, SEEK_SET);
-		char* buf = malloc(fsz + 1); if (!buf) { fclose(f); send_text(c, 500, "Internal Server Error", "oom", keep_alive); SAFE_FREE(range); return 0; }
-		fread(buf, 1, fsz, f); buf[fsz] = '\0'; fclose(f);
-		send_header(c, 200, "OK", "text/html; charset=utf-8", (long)fsz, NULL, 0, keep_alive);
-		send(c, buf, (int)fsz, 0);
-		free(buf);
-		SAFE_FREE(range);
+		if (!asset_cache_serve(c, "/mover", headers, keep_alive)) send_text(c, 404, "Not Found", "mover.html not found", keep_alive);
 		return 0;
 	}
 	if (strcmp(url, "/thumbdb") == 0 || strcmp(url, "/thumbdb/") == 0) {
-		char path[1024];
-		snprintf(path, sizeof(path), "%s" DIR_SEP_STR "thumbdb.html", VIEWS_DIR);
-		if (!is_file(path)) { send_text(c, 404, "Not Found", "thumbdb.html not found", keep_alive); SAFE_FREE(range); return 0; }
-		FILE* f = fopen(path, "rb");
-		if (!f) { send_text(c, 500, "Internal Server Error", "failed to open thumbdb.html", keep_alive); SAFE_FREE(range); return 0; }
-		fseek(f, 0, SEEK_END); long fsz = ftell(f); fseek(f, 0, SEEK_SET);
-		char* buf = malloc(fsz + 1); if (!buf) { fclose(f); send_text(c, 500, "Internal Server Error", "oom", keep_alive); SAFE_FREE(range); return 0; }
-		fread(buf, 1, fsz, f); buf[fsz] = '\0'; fclose(f);
-		send_header(c, 200, "OK", "text/html; charset=utf-8", (long)fsz, NULL, 0, keep_alive);
-		send(c, buf, (int)fsz, 0);
-		free(buf);
-		SAFE_FREE(range);
+		if (!asset_cache_serve(c, "/thumbdb", headers, keep_alive)) send_text(c, 404, "Not Found", "thumbdb.html not found", keep_alive);
 		return 0;
 	}
 	for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); i++) {
@@ -2198,79 +2141,54 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 			if (strcmp(method, "GET") == 0 && (routes[i].type == GET_SIMPLE || routes[i].type == GET_QS)) {
 				if (routes[i].type == GET_SIMPLE) ((void (*)(int, bool))routes[i].handler)(c, keep_alive);
 				else ((void (*)(int, char*, bool))routes[i].handler)(c, qs, keep_alive);
-				SAFE_FREE(range);
 				return 0;
 			}
 			if (strcmp(method, "POST") == 0 && routes[i].type == POST_BODY) {
-				if (!body || body_len == 0) { send_text(c, 400, "Bad Request", "Empty POST body", false); SAFE_FREE(range); return 0; }
-				char* body_copy = malloc(body_len + 1);
-				memcpy(body_copy, body, body_len); body_copy[body_len] = '\0';
-				char* qs_copy = NULL;
-				if (qs) qs_copy = strdup(qs);
-				g_request_qs = qs_copy;
+				if (!body || body_len == 0) { send_text(c, 400, "Bad Request", "Empty POST body", false); return 0; }
+				char* body_copy = arena_strndup(arena_request(), body, body_len);
+				if (!body_copy) { send_text(c, 500, "Internal Server Error", "Out of memory", false); return 0; }
+				g_request_qs = qs ? arena_strdup(arena_request(), qs) : NULL;
 				((void (*)(int, const char*, bool))routes[i].handler)(c, body_copy, keep_alive);
-				free(body_copy);
-				SAFE_FREE(g_request_qs);
+				g_request_qs = NULL;
 				return 0;
 			}
 			send_text(c, 405, "Method Not Allowed", "Method not supported for this endpoint", false);
-			SAFE_FREE(range);
 			return 0;
 		}
 	}
 	if (strcmp(method, "GET") != 0) {
 		send_text(c, 405, "Method Not Allowed", "Only GET and POST supported", false);
-		SAFE_FREE(range);
 		return 0;
 	}
 	if (strcmp(url, "/") == 0) {
-		char path[1024];
-		snprintf(path, sizeof(path), "%s/index.html", VIEWS_DIR);
-		if (!is_file(path)) { send_text(c, 404, "Not Found", "index.html not found", keep_alive); SAFE_FREE(range); return 0; }
-		FILE* f = fopen(path, "rb");
-		if (!f) { send_text(c, 500, "Internal Server Error", "failed to open index.html", keep_alive); SAFE_FREE(range); return 0; }
-		fseek(f, 0, SEEK_END); long fsz = ftell(f); fseek(f, 0, SEEK_SET);
-		char* buf = malloc(fsz + 1); if (!buf) { fclose(f); send_text(c, 500, "Internal Server Error", "oom", keep_alive); SAFE_FREE(range); return 0; }
-		fread(buf, 1, fsz, f); buf[fsz] = '\0'; fclose(f);
-		char dirparam[PATH_MAX] = { 0 }; int page = 1;
-		if (qs) {
-			char* v = query_get(qs, "dir"); if (v) { strncpy(dirparam, v, PATH_MAX - 1); SAFE_FREE(v); }
-			char* p = query_get(qs, "page"); if (p) { int t = atoi(p); if (t > 0) page = t; SAFE_FREE(p); }
-		}
-		size_t frag_len = 0; char* frag = generate_media_fragment(BASE_DIR, dirparam, page, &frag_len);
-		if (frag) {
-			char* ph = strstr(buf, "<!-- MEDIA_FRAGMENT -->");
-			if (ph) {
-				size_t newlen = fsz + frag_len + 1024;
-				char* out = malloc(newlen);
-				if (out) {
-					size_t pre = (size_t)(ph - buf);
-					memcpy(out, buf, pre);
-					memcpy(out + pre, frag, frag_len);
-					memcpy(out + pre + frag_len, ph + 21, fsz - pre - 21);
-					send_header(c, 200, "OK", "text/html; charset=utf-8", (long)(pre + frag_len + (fsz - pre - 21)), NULL, 0, keep_alive);
-					send(c, out, (int)(pre + frag_len + (fsz - pre - 21)), 0);
-					free(out);
-				}
-				else {
-					send_header(c, 200, "OK", "text/html; charset=utf-8", (long)fsz, NULL, 0, keep_alive);
-					send(c, buf, (int)fsz, 0);
-				}
-			}
-			else {
-				send_header(c, 200, "OK", "text/html; charset=utf-8", (long)fsz, NULL, 0, keep_alive);
-				send(c, buf, (int)fsz, 0);
+		asset_t* page_asset = asset_cache_acquire("/");
+		if (!page_asset) { send_text(c, 404, "Not Found", "index.html not found", keep_alive); return 0; }
+		size_t frag_len = 0; char* frag = NULL;
+		if (page_asset->split >= 0) {
+			char dirparam[PATH_MAX] = { 0 }; int page = 1;
+			if (qs) {
+				char* v = query_get_arena(arena_request(), qs, "dir"); if (v) { strncpy(dirparam, v, PATH_MAX - 1); }
+				char* p = query_get_arena(arena_request(), qs, "page"); if (p) { int t = atoi(p); if (t > 0) page = t; }
 			}
+			frag = generate_media_fragment(BASE_DIR, dirparam, page, &frag_len);
+		}
+		if (frag) {
+			size_t post = (size_t)page_asset->split + strlen(ASSET_FRAGMENT_MARKER);
+			platform_iovec_t parts[3] = {
+				{ page_asset->data, (size_t)page_asset->split },
+				{ frag, frag_len },
+				{ page_asset->data + post, page_asset->len - post },
+			};
+			send_response_parts(c, 200, "OK", page_asset->mime, parts, 3, keep_alive, NULL, 1);
 			free(frag);
-			SAFE_FREE(range);
-			return 0;
 		}
 		else {
-			send_header(c, 200, "OK", "text/html; charset=utf-8", (long)fsz, NULL, 0, keep_alive);
-			send(c, buf, (int)fsz, 0);
+			asset_cache_serve(c, "/", headers, keep_alive);
 		}
-		free(buf);
-		SAFE_FREE(range);
+		asset_cache_release(page_asset);
+		return 0;
+	}
+	if ((strncmp(url, "/js/", 4) == 0 || strncmp(url, "/css/", 5) == 0) && asset_cache_serve(c, url, headers, keep_alive)) {
 		return 0;
 	}
 	for (size_t i = 0; i < sizeof(static_routes) / sizeof(static_routes[0]); i++) {
@@ -2290,12 +2208,10 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 							char base_buf[PATH_MAX];
 							snprintf(base_buf, sizeof(base_buf), "%s" DIR_SEP_STR "%s", BASE_DIR, first_comp);
 							normalize_path(base_buf);
-							base_for_route = strdup(base_buf);
+							base_for_route = base_buf;
 							sub_path = slash + 1;
 							while (*sub_path == '/') sub_path++;
 							serve_file(c, base_for_route, sub_path, static_routes[i].allow_range ? range : NULL, keep_alive);
-							free((void*)base_for_route);
-							SAFE_FREE(range);
 							return 0;
 						}
 					}
@@ -2304,17 +2220,18 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 						if (gf_count > 0 && gfolders[0] && gfolders[0][0]) {
 							base_for_route = gfolders[0];
 							serve_file(c, base_for_route, sub_path, static_routes[i].allow_range ? range : NULL, keep_alive);
-							SAFE_FREE(range);
 							return 0;
 						}
 					}
 				}
 			}
 			serve_file(c, base_for_route, sub_path, static_routes[i].allow_range ? range : NULL, keep_alive);
-			SAFE_FREE(range);
 			return 0;
 		}
 	}
+	if ((strcmp(url, "/bundled") == 0 || strncmp(url, "/bundled/", 9) == 0) && asset_cache_serve(c, url, headers, keep_alive)) {
+		return 0;
+	}
 	if (strcmp(url, "/bundled") == 0) {
 		const char* base_for_bundle = (BASE_DIR[0]) ? BASE_DIR : ".";
 		char path[PATH_MAX];
@@ -2333,7 +2250,6 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 			if (is_file(alt)) send_file_stream(c, alt, NULL, keep_alive);
 			else send_text(c, 404, "Not Found", "Not found", keep_alive);
 		}
-		SAFE_FREE(range);
 		return 0;
 	}
 	if (strncmp(url, "/bundled/", 9) == 0) {
@@ -2352,12 +2268,10 @@ int handle_single_request(int c, char* headers, char* body, size_t headers_len,
 			if (is_file(alt)) send_file_stream(c, alt, NULL, keep_alive);
 			else send_text(c, 404, "Not Found", "Not found", keep_alive);
 		}
-		SAFE_FREE(range);
 		return 0;
 	}
 
 
 	send_text(c, 404, "Not Found", "Not found", keep_alive);
-	SAFE_FREE(range);
 	return 0;
 }
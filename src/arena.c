@@ -1,7 +1,27 @@
 #include "arena.h"
 #include "logging.h"
 #include "common.h"
-struct arena { char* buf; size_t cap; size_t off; };
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    size_t cap;
+    size_t off;
+    _Alignas(ARENA_ALIGN) char data[];
+} arena_chunk_t;
+struct arena { arena_chunk_t* first; arena_chunk_t* cur; size_t chunk_size; void* last; };
+
+static _Thread_local size_t t_arena_chunks = 0;
+static _Thread_local arena_t* t_request_arena = NULL;
+
+static arena_chunk_t* chunk_new(size_t cap) {
+    arena_chunk_t* ch = malloc(sizeof(arena_chunk_t) + cap);
+    if (!ch) {
+        LOG_ERROR("Failed to allocate arena chunk of size %zu", cap);
+        return NULL;
+    }
+    t_arena_chunks++;
+    ch->next = NULL; ch->cap = cap; ch->off = 0;
+    return ch;
+}
 arena_t* arena_create(size_t initial_capacity) {
     arena_t* a = malloc(sizeof(arena_t));
     if (!a) {
@@ -9,39 +29,94 @@ arena_t* arena_create(size_t initial_capacity) {
         return NULL;
     }
     if (initial_capacity == 0) initial_capacity = 4096;
-    a->buf = malloc(initial_capacity);
-    if (!a->buf) {
-        LOG_ERROR("Failed to allocate arena buffer of size %zu", initial_capacity);
-        free(a);
-        return NULL;
-    }
-    a->cap = initial_capacity; a->off = 0; return a;
+    a->first = a->cur = chunk_new(initial_capacity);
+    if (!a->first) { free(a); return NULL; }
+    a->chunk_size = initial_capacity; a->last = NULL;
+    return a;
 }
 void arena_destroy(arena_t* a) {
-    if (!a) return; free(a->buf); free(a);
+    if (!a) return;
+    arena_chunk_t* ch = a->first;
+    while (ch) { arena_chunk_t* nx = ch->next; free(ch); ch = nx; }
+    free(a);
 }
-void* arena_alloc(arena_t* a, size_t n) {
+void* arena_alloc_aligned(arena_t* a, size_t n, size_t align) {
     if (!a || n == 0) return NULL;
-    if (a->off + n > a->cap) {
-        size_t nc = a->cap * 2;
-        while (nc < a->off + n) nc *= 2;
-        char* nb = realloc(a->buf, nc);
-        if (!nb) {
-            LOG_ERROR("Failed to realloc arena buffer to size %zu", nc);
-            return NULL;
+    if (align < ARENA_ALIGN) align = ARENA_ALIGN;
+    arena_chunk_t* ch = a->cur;
+    for (;;) {
+        size_t off = (ch->off + align - 1) & ~(align - 1);
+        if (off + n <= ch->cap) {
+            ch->off = off + n; a->cur = ch; a->last = ch->data + off;
+            return a->last;
         }
-        a->buf = nb; a->cap = nc;
+        if (!ch->next) break;
+        ch = ch->next; ch->off = 0;
     }
-    void* p = a->buf + a->off; a->off += n; return p;
+    size_t cap = a->chunk_size;
+    if (cap < n + align) cap = n + align;
+    arena_chunk_t* nc = chunk_new(cap);
+    if (!nc) return NULL;
+    nc->next = a->cur->next; a->cur->next = nc;
+    a->cur = nc;
+    nc->off = n; a->last = nc->data;
+    return a->last;
 }
-char* arena_strdup(arena_t* a, const char* s) {
+void* arena_alloc(arena_t* a, size_t n) {
+    return arena_alloc_aligned(a, n, ARENA_ALIGN);
+}
+void* arena_realloc(arena_t* a, void* p, size_t old_n, size_t new_n) {
+    if (!a) return NULL;
+    if (!p) return arena_alloc(a, new_n);
+    if (new_n <= old_n) return p;
+    if (p == a->last && (char*)p + new_n <= a->cur->data + a->cur->cap) {
+        a->cur->off = (size_t)((char*)p - a->cur->data) + new_n;
+        return p;
+    }
+    void* np = arena_alloc(a, new_n);
+    if (np) memcpy(np, p, old_n);
+    return np;
+}
+char* arena_strndup(arena_t* a, const char* s, size_t n) {
     if (!a || !s) return NULL;
-    size_t l = strlen(s) + 1;
-    char* p = arena_alloc(a, l);
+    char* p = arena_alloc_aligned(a, n + 1, 1);
     if (!p) {
         LOG_ERROR("Failed to allocate string duplicate in arena");
         return NULL;
     }
-    memcpy(p, s, l);
+    memcpy(p, s, n);
+    p[n] = '\0';
     return p;
-}
\ No newline at end of file
+}
+char* arena_strdup(arena_t* a, const char* s) {
+    if (!s) return NULL;
+    return arena_strndup(a, s, strlen(s));
+}
+arena_mark_t arena_mark(arena_t* a) {
+    arena_mark_t m = { a->cur, a->cur->off };
+    return m;
+}
+void arena_reset_to(arena_t* a, arena_mark_t m) {
+    a->cur = (arena_chunk_t*)m.chunk;
+    a->cur->off = m.off;
+    a->last = NULL;
+}
+void arena_reset(arena_t* a) {
+    if (!a) return;
+    size_t kept = 0;
+    arena_chunk_t* ch = a->first;
+    while (ch->next && kept + ch->cap + ch->next->cap <= ARENA_RETAIN_BYTES) { kept += ch->cap; ch = ch->next; }
+    arena_chunk_t* drop = ch->next;
+    ch->next = NULL;
+    while (drop) { arena_chunk_t* nx = drop->next; free(drop); drop = nx; }
+    a->cur = a->first;
+    a->cur->off = 0;
+    a->last = NULL;
+}
+arena_t* arena_request(void) {
+    if (!t_request_arena) t_request_arena = arena_create(ARENA_REQUEST_CHUNK);
+    return t_request_arena;
+}
+size_t arena_chunk_count(void) {
+    return t_arena_chunks;
+}
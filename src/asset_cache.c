@@ -0,0 +1,230 @@
+#include "asset_cache.h"
+#include "common.h"
+#include "logging.h"
+#include "directory.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "compress.h"
+#include "http.h"
+
+#define ASSET_CACHE_SLOTS 256
+#define ASSET_DIR_COUNT 4
+#define ASSET_GZIP_MIN_SIZE 512
+
+enum { ASSET_DIR_VIEWS = 0, ASSET_DIR_JS, ASSET_DIR_CSS, ASSET_DIR_BUNDLE };
+
+static const char* const asset_prefixes[ASSET_DIR_COUNT] = { NULL, "/js/", "/css/", "/bundled/" };
+static const struct { const char* file; const char* key; } view_routes[] = {
+    { "index.html", "/" },
+    { "mover.html", "/mover" },
+    { "thumbdb.html", "/thumbdb" },
+};
+
+static char asset_dirs[ASSET_DIR_COUNT][PATH_MAX];
+static asset_t* assets[ASSET_CACHE_SLOTS];
+static thread_mutex_t assets_mutex;
+static atomic_int assets_inited = ATOMIC_VAR_INIT(0);
+
+static uint32_t key_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static void asset_free(asset_t* a) {
+    if (!a) return;
+    free(a->key);
+    free(a->path);
+    free(a->data);
+    free(a->gz);
+    free(a);
+}
+
+void asset_cache_release(asset_t* a) {
+    if (a && atomic_fetch_sub(&a->refs, 1) == 1) asset_free(a);
+}
+
+static int find_slot_locked(const char* key, uint32_t h) {
+    for (int i = 0; i < ASSET_CACHE_SLOTS; i++)
+        if (assets[i] && assets[i]->hash == h && strcmp(assets[i]->key, key) == 0) return i;
+    return -1;
+}
+
+asset_t* asset_cache_acquire(const char* key) {
+    if (!key || !atomic_load(&assets_inited)) return NULL;
+    uint32_t h = key_hash(key);
+    asset_t* a = NULL;
+    thread_mutex_lock(&assets_mutex);
+    int i = find_slot_locked(key, h);
+    if (i >= 0) { a = assets[i]; atomic_fetch_add(&a->refs, 1); }
+    thread_mutex_unlock(&assets_mutex);
+    return a;
+}
+
+static asset_t* asset_load(const char* key, const char* path, const struct stat* st, int dir_idx) {
+    FILE* f = platform_fopen(path, "rb");
+    if (!f) { LOG_WARN("Asset cache: failed to open %s", path); return NULL; }
+    asset_t* a = calloc(1, sizeof(asset_t));
+    char* data = malloc((size_t)st->st_size + 1);
+    if (!a || !data) {
+        LOG_ERROR("Asset cache: failed to allocate %lld bytes for %s", (long long)st->st_size, path);
+        fclose(f); free(a); free(data);
+        return NULL;
+    }
+    size_t n = fread(data, 1, (size_t)st->st_size, f);
+    fclose(f);
+    data[n] = '\0';
+    a->key = strdup(key);
+    a->path = strdup(path);
+    if (!a->key || !a->path) { free(data); asset_free(a); return NULL; }
+    a->hash = key_hash(key);
+    a->dir_idx = dir_idx;
+    a->mime = mime_for(path);
+    a->data = data;
+    a->len = n;
+    a->mtime = st->st_mtime;
+    a->split = -1;
+    snprintf(a->etag, sizeof(a->etag), "\"%08x-%zx\"", (unsigned)crc32_update(0, data, n), n);
+    if (strncmp(a->mime, "text/html", 9) == 0) {
+        char* m = strstr(data, ASSET_FRAGMENT_MARKER);
+        if (m) a->split = (long)(m - data);
+    }
+    if (n >= ASSET_GZIP_MIN_SIZE && http_is_compressible(a->mime)) {
+        if (gzip_compress(data, n, COMPRESS_LEVEL_BEST, &a->gz, &a->gz_len) != 0 || a->gz_len >= n) {
+            SAFE_FREE(a->gz);
+            a->gz_len = 0;
+        }
+    }
+    atomic_init(&a->refs, 1);
+    return a;
+}
+
+static void asset_put(const char* key, const char* path, int dir_idx, unsigned gen) {
+    struct stat st;
+    if (platform_stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return;
+    if (st.st_size > ASSET_CACHE_MAX_FILE) {
+        LOG_DEBUG("Asset cache: skipping %s (%lld bytes)", path, (long long)st.st_size);
+        return;
+    }
+    uint32_t h = key_hash(key);
+    thread_mutex_lock(&assets_mutex);
+    int i = find_slot_locked(key, h);
+    if (i >= 0 && assets[i]->mtime == st.st_mtime && (long long)assets[i]->len == (long long)st.st_size
+        && strcmp(assets[i]->path, path) == 0) {
+        assets[i]->gen = gen;
+        thread_mutex_unlock(&assets_mutex);
+        return;
+    }
+    thread_mutex_unlock(&assets_mutex);
+
+    asset_t* a = asset_load(key, path, &st, dir_idx);
+    if (!a) return;
+    a->gen = gen;
+    asset_t* old = NULL;
+    thread_mutex_lock(&assets_mutex);
+    i = find_slot_locked(key, h);
+    if (i < 0) {
+        for (int j = 0; j < ASSET_CACHE_SLOTS; j++) if (!assets[j]) { i = j; break; }
+    }
+    if (i >= 0) { old = assets[i]; assets[i] = a; a = NULL; }
+    thread_mutex_unlock(&assets_mutex);
+    if (a) { LOG_WARN("Asset cache full, not caching %s", path); asset_free(a); }
+    asset_cache_release(old);
+}
+
+static void asset_dir_reload(int dir_idx) {
+    static atomic_uint gen_counter = ATOMIC_VAR_INIT(0);
+    const char* dir = asset_dirs[dir_idx];
+    if (!dir[0]) return;
+    unsigned gen = atomic_fetch_add(&gen_counter, 1) + 1;
+    char path[PATH_MAX], key[PATH_MAX];
+    if (dir_idx == ASSET_DIR_VIEWS) {
+        for (size_t i = 0; i < sizeof(view_routes) / sizeof(view_routes[0]); i++) {
+            snprintf(path, sizeof(path), "%s" DIR_SEP_STR "%s", dir, view_routes[i].file);
+            asset_put(view_routes[i].key, path, dir_idx, gen);
+        }
+    } else {
+        diriter it;
+        if (dir_open(&it, dir)) {
+            const char* name;
+            while ((name = dir_next(&it)) != NULL) {
+                if (name[0] == '.') continue;
+                snprintf(path, sizeof(path), "%s" DIR_SEP_STR "%s", dir, name);
+                snprintf(key, sizeof(key), "%s%s", asset_prefixes[dir_idx], name);
+                asset_put(key, path, dir_idx, gen);
+            }
+            dir_close(&it);
+        }
+        if (dir_idx == ASSET_DIR_BUNDLE) asset_put("/bundled", BUNDLED_FILE, dir_idx, gen);
+    }
+
+    asset_t* stale[ASSET_CACHE_SLOTS];
+    int nstale = 0;
+    thread_mutex_lock(&assets_mutex);
+    for (int i = 0; i < ASSET_CACHE_SLOTS; i++) {
+        if (assets[i] && assets[i]->dir_idx == dir_idx && assets[i]->gen != gen) {
+            stale[nstale++] = assets[i];
+            assets[i] = NULL;
+        }
+    }
+    thread_mutex_unlock(&assets_mutex);
+    for (int i = 0; i < nstale; i++) asset_cache_release(stale[i]);
+}
+
+static void asset_watch_cb(const char* dir) {
+    for (int i = 0; i < ASSET_DIR_COUNT; i++) {
+        if (strcmp(asset_dirs[i], dir) == 0) {
+            LOG_DEBUG("Asset cache: reloading %s", dir);
+            asset_dir_reload(i);
+            return;
+        }
+    }
+}
+
+void asset_cache_init(void) {
+    if (atomic_exchange(&assets_inited, 1)) return;
+    thread_mutex_init(&assets_mutex);
+    strncpy(asset_dirs[ASSET_DIR_VIEWS], VIEWS_DIR, PATH_MAX - 1);
+    strncpy(asset_dirs[ASSET_DIR_JS], JS_DIR, PATH_MAX - 1);
+    strncpy(asset_dirs[ASSET_DIR_CSS], CSS_DIR, PATH_MAX - 1);
+    strncpy(asset_dirs[ASSET_DIR_BUNDLE], BUNDLED_FILE, PATH_MAX - 1);
+    char* sep = strrchr(asset_dirs[ASSET_DIR_BUNDLE], DIR_SEP);
+    if (!sep) sep = strrchr(asset_dirs[ASSET_DIR_BUNDLE], '/');
+    if (sep) *sep = '\0'; else asset_dirs[ASSET_DIR_BUNDLE][0] = '\0';
+
+    size_t files = 0, bytes = 0, gz_bytes = 0;
+    for (int i = 0; i < ASSET_DIR_COUNT; i++) {
+        if (!asset_dirs[i][0] || !is_dir(asset_dirs[i])) continue;
+        asset_dir_reload(i);
+        if (platform_start_dir_watcher(asset_dirs[i], asset_watch_cb) != 0)
+            LOG_WARN("Asset cache: failed to watch %s", asset_dirs[i]);
+    }
+    thread_mutex_lock(&assets_mutex);
+    for (int i = 0; i < ASSET_CACHE_SLOTS; i++) {
+        if (!assets[i]) continue;
+        files++; bytes += assets[i]->len; gz_bytes += assets[i]->gz_len;
+    }
+    thread_mutex_unlock(&assets_mutex);
+    LOG_INFO("Asset cache: %zu files, %zu bytes (%zu gzip)", files, bytes, gz_bytes);
+}
+
+int asset_cache_serve(int c, const char* key, const char* request_headers, int keep_alive) {
+    asset_t* a = asset_cache_acquire(key);
+    if (!a) return 0;
+    char extra[160];
+    char* inm = request_headers ? get_header_value_arena(arena_request(), request_headers, "If-None-Match:") : NULL;
+    if (inm && strstr(inm, a->etag)) {
+        snprintf(extra, sizeof(extra), "ETag: %s\r\n", a->etag);
+        send_response_parts(c, 304, "Not Modified", a->mime, NULL, 0, keep_alive, extra, 0);
+    } else if (a->gz && http_accepts_gzip()) {
+        snprintf(extra, sizeof(extra), "ETag: %s\r\n" GZIP_ENCODING_HEADERS, a->etag);
+        platform_iovec_t part = { a->gz, a->gz_len };
+        send_response_parts(c, 200, "OK", a->mime, &part, 1, keep_alive, extra, 0);
+    } else {
+        snprintf(extra, sizeof(extra), "ETag: %s\r\n%s", a->etag, a->gz ? "Vary: Accept-Encoding\r\n" : "");
+        platform_iovec_t part = { a->data, a->len };
+        send_response_parts(c, 200, "OK", a->mime, &part, 1, keep_alive, extra, 0);
+    }
+    asset_cache_release(a);
+    return 1;
+}
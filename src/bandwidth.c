@@ -0,0 +1,166 @@
+#include "bandwidth.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "thread_pool.h"
+
+#define BW_FLOW_SLOTS 1024
+#define BW_CLIENT_SLOTS 256
+#define BW_MIN_BURST (256L * 1024)
+#define BW_MAX_SLEEP_MS 250
+
+typedef struct {
+    uint64_t key;
+    int refs;
+    double tokens;
+    uint64_t last_ms;
+} bw_entry_t;
+
+static bw_entry_t bw_flows[BW_FLOW_SLOTS];
+static bw_entry_t bw_clients[BW_CLIENT_SLOTS];
+static int bw_active_clients = 0;
+static long bw_rate = 0;
+static thread_mutex_t bw_mutex;
+static atomic_int bw_inited = ATOMIC_VAR_INIT(0);
+
+static uint64_t fnv1a64(const void* data, size_t len, uint64_t h) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) { h ^= p[i]; h *= 1099511628211ULL; }
+    return h;
+}
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static bw_entry_t* slot_find(bw_entry_t* t, size_t mask, uint64_t key, int create) {
+    size_t i = (size_t)key & mask;
+    for (size_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        if (t[i].key == key) return &t[i];
+        if (t[i].key == 0) {
+            if (!create) return NULL;
+            memset(&t[i], 0, sizeof(t[i]));
+            t[i].key = key;
+            return &t[i];
+        }
+    }
+    return NULL;
+}
+
+static void slot_remove(bw_entry_t* t, size_t mask, bw_entry_t* e) {
+    size_t i = (size_t)(e - t), j = i;
+    t[i].key = 0;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (t[j].key == 0) return;
+        size_t k = (size_t)t[j].key & mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            t[i] = t[j];
+            t[j].key = 0;
+            i = j;
+        }
+    }
+}
+
+static double flow_rate_locked(const bw_entry_t* client) {
+    int nclients = bw_active_clients > 0 ? bw_active_clients : 1;
+    int nflows = client && client->refs > 0 ? client->refs : 1;
+    return (double)bw_rate / nclients / nflows;
+}
+
+static double flow_burst(double rate) {
+    double b = rate / 4.0;
+    return b < (double)BW_MIN_BURST ? (double)BW_MIN_BURST : b;
+}
+
+void bw_init(long bytes_per_sec) {
+    if (atomic_exchange(&bw_inited, 1)) return;
+    thread_mutex_init(&bw_mutex);
+    bw_rate = bytes_per_sec > 0 ? bytes_per_sec : 0;
+    if (bw_rate) LOG_INFO("Stream bandwidth limited to %ld bytes/s, shared fairly between clients", bw_rate);
+}
+
+int bw_enabled(void) {
+    return atomic_load(&bw_inited) && bw_rate > 0;
+}
+
+void bw_flow_open(bw_flow_t* f, int sock, const char* resource) {
+    memset(f, 0, sizeof(*f));
+    if (!bw_enabled()) return;
+    struct sockaddr_storage ss; socklen_t sl = sizeof(ss);
+    uint64_t client = 14695981039346656037ULL;
+    if (getpeername(sock, (struct sockaddr*)&ss, &sl) == 0) {
+        if (ss.ss_family == AF_INET) {
+            struct sockaddr_in* a = (struct sockaddr_in*)&ss;
+            client = fnv1a64(&a->sin_addr, sizeof(a->sin_addr), client);
+        } else if (ss.ss_family == AF_INET6) {
+            struct sockaddr_in6* a = (struct sockaddr_in6*)&ss;
+            client = fnv1a64(&a->sin6_addr, sizeof(a->sin6_addr), client);
+        }
+    }
+    client |= 1;
+    uint64_t key = mix64(client ^ fnv1a64(resource ? resource : "", resource ? strlen(resource) : 0, 14695981039346656037ULL)) | 1;
+
+    thread_mutex_lock(&bw_mutex);
+    bw_entry_t* c = slot_find(bw_clients, BW_CLIENT_SLOTS - 1, client, 1);
+    if (!c) {
+        thread_mutex_unlock(&bw_mutex);
+        LOG_WARN("Bandwidth scheduler client table full, streaming unpaced");
+        return;
+    }
+    bw_entry_t* e = slot_find(bw_flows, BW_FLOW_SLOTS - 1, key, 1);
+    if (!e) {
+        if (c->refs == 0) { slot_remove(bw_clients, BW_CLIENT_SLOTS - 1, c); }
+        thread_mutex_unlock(&bw_mutex);
+        LOG_WARN("Bandwidth scheduler flow table full, streaming unpaced");
+        return;
+    }
+    if (e->refs++ == 0) {
+        if (c->refs++ == 0) bw_active_clients++;
+        e->tokens = flow_burst(flow_rate_locked(c));
+        e->last_ms = platform_monotonic_ms();
+    }
+    thread_mutex_unlock(&bw_mutex);
+    f->client = client;
+    f->key = key;
+    f->active = 1;
+}
+
+void bw_flow_throttle(bw_flow_t* f, size_t bytes) {
+    if (!f || !f->active) return;
+    long wait_ms = 0;
+    thread_mutex_lock(&bw_mutex);
+    bw_entry_t* c = slot_find(bw_clients, BW_CLIENT_SLOTS - 1, f->client, 0);
+    bw_entry_t* e = slot_find(bw_flows, BW_FLOW_SLOTS - 1, f->key, 0);
+    if (c && e) {
+        double rate = flow_rate_locked(c);
+        uint64_t now = platform_monotonic_ms();
+        e->tokens += rate * (double)(now - e->last_ms) / 1000.0;
+        e->last_ms = now;
+        double burst = flow_burst(rate);
+        if (e->tokens > burst) e->tokens = burst;
+        e->tokens -= (double)bytes;
+        if (e->tokens < 0) wait_ms = (long)(-e->tokens * 1000.0 / rate) + 1;
+    }
+    thread_mutex_unlock(&bw_mutex);
+    if (wait_ms > 0) platform_sleep_ms(wait_ms > BW_MAX_SLEEP_MS ? BW_MAX_SLEEP_MS : (int)wait_ms);
+}
+
+void bw_flow_close(bw_flow_t* f) {
+    if (!f || !f->active) return;
+    thread_mutex_lock(&bw_mutex);
+    bw_entry_t* e = slot_find(bw_flows, BW_FLOW_SLOTS - 1, f->key, 0);
+    if (e && --e->refs <= 0) {
+        slot_remove(bw_flows, BW_FLOW_SLOTS - 1, e);
+        bw_entry_t* c = slot_find(bw_clients, BW_CLIENT_SLOTS - 1, f->client, 0);
+        if (c && --c->refs <= 0) {
+            slot_remove(bw_clients, BW_CLIENT_SLOTS - 1, c);
+            bw_active_clients--;
+        }
+    }
+    thread_mutex_unlock(&bw_mutex);
+    f->active = 0;
+}
@@ -281,4 +281,442 @@ int decompress_val(const unsigned char* in, size_t in_len, unsigned char** out,
     if (tb) exp = tb;
     exp[expi] = '\0';
     *out = exp; *out_len = expi; return 0;
-}
\ No newline at end of file
+}
+
+#define DEFL_WSIZE 32768
+#define DEFL_WMASK (DEFL_WSIZE - 1)
+#define DEFL_HASH_BITS 15
+#define DEFL_HASH_SIZE (1 << DEFL_HASH_BITS)
+#define DEFL_HASH_MASK (DEFL_HASH_SIZE - 1)
+#define DEFL_MIN_MATCH 3
+#define DEFL_MAX_MATCH 258
+#define DEFL_SYM_BUF 16384
+#define DEFL_L_CODES 286
+#define DEFL_D_CODES 30
+#define DEFL_BL_CODES 19
+#define DEFL_MAX_BITS 15
+#define DEFL_MAX_BL_BITS 7
+
+typedef struct { int max_chain; int nice_len; int lazy_len; } defl_config_t;
+
+static const defl_config_t defl_levels[10] = {
+    { 0, 0, 0 },
+    { 4, 16, 0 }, { 8, 32, 0 }, { 16, 64, 0 },
+    { 32, 64, 8 }, { 64, 128, 16 }, { 128, 128, 16 },
+    { 256, 196, 32 }, { 1024, 258, 128 }, { 4096, 258, 258 }
+};
+
+static const uint16_t len_base[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+static const uint8_t len_extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const uint16_t dist_base[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+static const uint8_t dist_extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+static const uint8_t bl_order[DEFL_BL_CODES] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+
+typedef struct { uint16_t ll; uint16_t dist; } defl_sym_t;
+
+struct gz_stream {
+    const defl_config_t* cfg;
+    unsigned char win[2 * DEFL_WSIZE];
+    int head[DEFL_HASH_SIZE];
+    int prev[DEFL_WSIZE];
+    int fill;
+    int pos;
+    defl_sym_t syms[DEFL_SYM_BUF];
+    int nsyms;
+    uint64_t bitbuf;
+    int bitcnt;
+    unsigned char* out;
+    size_t out_len;
+    size_t out_cap;
+    uint32_t crc;
+    uint32_t isize;
+    int header_done;
+    int finished;
+    int oom;
+};
+
+static uint32_t crc_table[256];
+static atomic_int crc_table_ready = ATOMIC_VAR_INIT(0);
+
+static void crc_init(void) {
+    if (atomic_load(&crc_table_ready)) return;
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+    atomic_store(&crc_table_ready, 1);
+}
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len) {
+    crc_init();
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void gz_out_reserve(gz_stream_t* z, size_t more) {
+    if (z->out_len + more <= z->out_cap) return;
+    size_t nc = z->out_cap ? z->out_cap : 4096;
+    while (nc < z->out_len + more) nc *= 2;
+    unsigned char* nb = realloc(z->out, nc);
+    if (!nb) {
+        LOG_ERROR("Failed to grow gzip output buffer to %zu bytes", nc);
+        z->oom = 1;
+        return;
+    }
+    z->out = nb; z->out_cap = nc;
+}
+
+static void put_bits(gz_stream_t* z, uint32_t value, int n) {
+    z->bitbuf |= (uint64_t)value << z->bitcnt;
+    z->bitcnt += n;
+    if (z->bitcnt >= 32) {
+        gz_out_reserve(z, 4);
+        if (z->oom) return;
+        for (int i = 0; i < 4; ++i) { z->out[z->out_len++] = (unsigned char)(z->bitbuf & 0xFF); z->bitbuf >>= 8; }
+        z->bitcnt -= 32;
+    }
+}
+
+static void flush_whole_bytes(gz_stream_t* z) {
+    gz_out_reserve(z, 8);
+    if (z->oom) return;
+    while (z->bitcnt >= 8) { z->out[z->out_len++] = (unsigned char)(z->bitbuf & 0xFF); z->bitbuf >>= 8; z->bitcnt -= 8; }
+}
+
+static void flush_all_bits(gz_stream_t* z) {
+    flush_whole_bytes(z);
+    if (z->bitcnt > 0 && !z->oom) {
+        z->out[z->out_len++] = (unsigned char)(z->bitbuf & 0xFF);
+        z->bitbuf = 0; z->bitcnt = 0;
+    }
+}
+
+static void put_bytes(gz_stream_t* z, const unsigned char* p, size_t n) {
+    gz_out_reserve(z, n);
+    if (z->oom) return;
+    memcpy(z->out + z->out_len, p, n);
+    z->out_len += n;
+}
+
+static int len_code(int len) {
+    int c = 0;
+    while (c < 28 && len_base[c + 1] <= len) c++;
+    return c;
+}
+
+static int dist_code(int dist) {
+    int lo = 0, hi = 29;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) >> 1;
+        if (dist_base[mid] <= dist) lo = mid; else hi = mid - 1;
+    }
+    return lo;
+}
+
+typedef struct { uint32_t freq; int left, right; } defl_node_t;
+
+static int tree_depths(const defl_node_t* nodes, int root, int nleaves, uint8_t* lens) {
+    int stack[2 * DEFL_L_CODES], depth[2 * DEFL_L_CODES], sp = 0, maxd = 0;
+    stack[sp] = root; depth[sp] = 0; sp++;
+    while (sp > 0) {
+        sp--; int idx = stack[sp]; int d = depth[sp];
+        if (idx < nleaves) { lens[idx] = (uint8_t)(d ? d : 1); if (d > maxd) maxd = d; continue; }
+        stack[sp] = nodes[idx].left; depth[sp] = d + 1; sp++;
+        stack[sp] = nodes[idx].right; depth[sp] = d + 1; sp++;
+    }
+    return maxd;
+}
+
+static void build_limited_lengths(const uint32_t* freq_in, int n, int max_bits, uint8_t* lens) {
+    uint32_t freq[DEFL_L_CODES];
+    for (int i = 0; i < n; ++i) freq[i] = freq_in[i];
+    for (;;) {
+        defl_node_t nodes[2 * DEFL_L_CODES];
+        int sym_of[DEFL_L_CODES];
+        int leaves = 0;
+        memset(lens, 0, (size_t)n);
+        for (int i = 0; i < n; ++i) if (freq[i]) { nodes[leaves].freq = freq[i]; nodes[leaves].left = nodes[leaves].right = -1; sym_of[leaves] = i; leaves++; }
+        if (leaves == 0) return;
+        if (leaves == 1) { lens[sym_of[0]] = 1; return; }
+        int alive[2 * DEFL_L_CODES], nalive = leaves, count = leaves;
+        for (int i = 0; i < leaves; ++i) alive[i] = i;
+        while (nalive > 1) {
+            int a = 0, b = 1;
+            if (nodes[alive[b]].freq < nodes[alive[a]].freq) { a = 1; b = 0; }
+            for (int i = 2; i < nalive; ++i) {
+                uint32_t f = nodes[alive[i]].freq;
+                if (f < nodes[alive[a]].freq) { b = a; a = i; }
+                else if (f < nodes[alive[b]].freq) b = i;
+            }
+            nodes[count].freq = nodes[alive[a]].freq + nodes[alive[b]].freq;
+            nodes[count].left = alive[a]; nodes[count].right = alive[b];
+            int hi = a > b ? a : b, lo = a > b ? b : a;
+            alive[hi] = alive[--nalive];
+            alive[lo] = count++;
+        }
+        uint8_t leaf_lens[DEFL_L_CODES];
+        int maxd = tree_depths(nodes, alive[0], leaves, leaf_lens);
+        if (maxd <= max_bits) {
+            for (int i = 0; i < leaves; ++i) lens[sym_of[i]] = leaf_lens[i];
+            return;
+        }
+        for (int i = 0; i < n; ++i) if (freq[i]) freq[i] = (freq[i] >> 1) | 1;
+    }
+}
+
+static void canonical_codes(const uint8_t* lens, int n, uint16_t* codes) {
+    uint16_t bl_count[DEFL_MAX_BITS + 1] = { 0 }, next[DEFL_MAX_BITS + 2] = { 0 };
+    for (int i = 0; i < n; ++i) bl_count[lens[i]]++;
+    bl_count[0] = 0;
+    uint16_t code = 0;
+    for (int b = 1; b <= DEFL_MAX_BITS; ++b) { code = (uint16_t)((code + bl_count[b - 1]) << 1); next[b] = code; }
+    for (int i = 0; i < n; ++i) {
+        int l = lens[i];
+        if (!l) { codes[i] = 0; continue; }
+        uint16_t c = next[l]++, r = 0;
+        for (int k = 0; k < l; ++k) { r = (uint16_t)((r << 1) | (c & 1)); c >>= 1; }
+        codes[i] = r;
+    }
+}
+
+static void emit_block(gz_stream_t* z, int final) {
+    uint32_t lfreq[DEFL_L_CODES] = { 0 }, dfreq[DEFL_D_CODES] = { 0 };
+    for (int i = 0; i < z->nsyms; ++i) {
+        if (z->syms[i].dist == 0) lfreq[z->syms[i].ll]++;
+        else { lfreq[257 + len_code(z->syms[i].ll)]++; dfreq[dist_code(z->syms[i].dist)]++; }
+    }
+    lfreq[256] = 1;
+    int nz = 0; for (int i = 0; i < DEFL_L_CODES; ++i) if (lfreq[i]) nz++;
+    if (nz < 2) lfreq[lfreq[0] ? 1 : 0] = 1;
+    nz = 0; for (int i = 0; i < DEFL_D_CODES; ++i) if (dfreq[i]) nz++;
+    if (nz < 2) { if (!dfreq[0]) dfreq[0] = 1; if (!dfreq[1]) dfreq[1] = 1; }
+
+    uint8_t llens[DEFL_L_CODES], dlens[DEFL_D_CODES];
+    uint16_t lcodes[DEFL_L_CODES], dcodes[DEFL_D_CODES];
+    build_limited_lengths(lfreq, DEFL_L_CODES, DEFL_MAX_BITS, llens);
+    build_limited_lengths(dfreq, DEFL_D_CODES, DEFL_MAX_BITS, dlens);
+    canonical_codes(llens, DEFL_L_CODES, lcodes);
+    canonical_codes(dlens, DEFL_D_CODES, dcodes);
+
+    int hlit = DEFL_L_CODES; while (hlit > 257 && llens[hlit - 1] == 0) hlit--;
+    int hdist = DEFL_D_CODES; while (hdist > 1 && dlens[hdist - 1] == 0) hdist--;
+    uint8_t all[DEFL_L_CODES + DEFL_D_CODES];
+    memcpy(all, llens, (size_t)hlit);
+    memcpy(all + hlit, dlens, (size_t)hdist);
+    int total = hlit + hdist;
+
+    uint8_t rle_sym[DEFL_L_CODES + DEFL_D_CODES], rle_ext[DEFL_L_CODES + DEFL_D_CODES];
+    int nrle = 0;
+    uint32_t bfreq[DEFL_BL_CODES] = { 0 };
+    for (int i = 0; i < total;) {
+        int v = all[i], run = 1;
+        while (i + run < total && all[i + run] == v) run++;
+        if (v == 0 && run >= 3) {
+            int r = run > 138 ? 138 : run;
+            if (r >= 11) { rle_sym[nrle] = 18; rle_ext[nrle++] = (uint8_t)(r - 11); }
+            else { rle_sym[nrle] = 17; rle_ext[nrle++] = (uint8_t)(r - 3); }
+            i += r;
+        } else if (v != 0 && run >= 4) {
+            rle_sym[nrle] = (uint8_t)v; rle_ext[nrle++] = 0;
+            int r = run - 1 > 6 ? 6 : run - 1;
+            rle_sym[nrle] = 16; rle_ext[nrle++] = (uint8_t)(r - 3);
+            i += 1 + r;
+        } else {
+            rle_sym[nrle] = (uint8_t)v; rle_ext[nrle++] = 0;
+            i++;
+        }
+    }
+    for (int i = 0; i < nrle; ++i) bfreq[rle_sym[i]]++;
+    uint8_t blens[DEFL_BL_CODES]; uint16_t bcodes[DEFL_BL_CODES];
+    build_limited_lengths(bfreq, DEFL_BL_CODES, DEFL_MAX_BL_BITS, blens);
+    canonical_codes(blens, DEFL_BL_CODES, bcodes);
+    int hclen = DEFL_BL_CODES; while (hclen > 4 && blens[bl_order[hclen - 1]] == 0) hclen--;
+
+    put_bits(z, final ? 1 : 0, 1);
+    put_bits(z, 2, 2);
+    put_bits(z, (uint32_t)(hlit - 257), 5);
+    put_bits(z, (uint32_t)(hdist - 1), 5);
+    put_bits(z, (uint32_t)(hclen - 4), 4);
+    for (int i = 0; i < hclen; ++i) put_bits(z, blens[bl_order[i]], 3);
+    for (int i = 0; i < nrle; ++i) {
+        int s = rle_sym[i];
+        put_bits(z, bcodes[s], blens[s]);
+        if (s == 16) put_bits(z, rle_ext[i], 2);
+        else if (s == 17) put_bits(z, rle_ext[i], 3);
+        else if (s == 18) put_bits(z, rle_ext[i], 7);
+    }
+    for (int i = 0; i < z->nsyms; ++i) {
+        const defl_sym_t* s = &z->syms[i];
+        if (s->dist == 0) { put_bits(z, lcodes[s->ll], llens[s->ll]); continue; }
+        int lc = len_code(s->ll);
+        put_bits(z, lcodes[257 + lc], llens[257 + lc]);
+        if (len_extra[lc]) put_bits(z, (uint32_t)(s->ll - len_base[lc]), len_extra[lc]);
+        int dc = dist_code(s->dist);
+        put_bits(z, dcodes[dc], dlens[dc]);
+        if (dist_extra[dc]) put_bits(z, (uint32_t)(s->dist - dist_base[dc]), dist_extra[dc]);
+    }
+    put_bits(z, lcodes[256], llens[256]);
+    z->nsyms = 0;
+}
+
+static inline int hash3(const unsigned char* p) {
+    return (int)((((uint32_t)p[0] << 10) ^ ((uint32_t)p[1] << 5) ^ p[2]) & DEFL_HASH_MASK);
+}
+
+static inline int insert_string(gz_stream_t* z, int pos) {
+    int h = hash3(z->win + pos);
+    int cand = z->head[h];
+    z->prev[pos & DEFL_WMASK] = cand;
+    z->head[h] = pos;
+    return cand;
+}
+
+static int longest_match(gz_stream_t* z, int pos, int cand, int prev_len, int* match_pos) {
+    int limit = pos - DEFL_WSIZE + 1;
+    int max_len = z->fill - pos;
+    if (max_len > DEFL_MAX_MATCH) max_len = DEFL_MAX_MATCH;
+    int best = prev_len, chain = z->cfg->max_chain;
+    if (prev_len >= z->cfg->lazy_len && z->cfg->lazy_len) chain >>= 2;
+    const unsigned char* s = z->win + pos;
+    while (cand >= 0 && cand >= limit && chain-- > 0) {
+        const unsigned char* m = z->win + cand;
+        if (m[best] == s[best] && m[0] == s[0] && m[1] == s[1]) {
+            int l = 2;
+            while (l < max_len && m[l] == s[l]) l++;
+            if (l > best) {
+                best = l; *match_pos = cand;
+                if (l >= z->cfg->nice_len || l >= max_len) break;
+            }
+        }
+        int nxt = z->prev[cand & DEFL_WMASK];
+        if (nxt >= cand) break;
+        cand = nxt;
+    }
+    return best;
+}
+
+static void push_sym(gz_stream_t* z, int ll, int dist) {
+    z->syms[z->nsyms].ll = (uint16_t)ll;
+    z->syms[z->nsyms].dist = (uint16_t)dist;
+    if (++z->nsyms == DEFL_SYM_BUF) emit_block(z, 0);
+}
+
+static void slide_window(gz_stream_t* z) {
+    memmove(z->win, z->win + DEFL_WSIZE, DEFL_WSIZE);
+    z->fill -= DEFL_WSIZE;
+    z->pos -= DEFL_WSIZE;
+    for (int i = 0; i < DEFL_HASH_SIZE; ++i) z->head[i] = z->head[i] >= DEFL_WSIZE ? z->head[i] - DEFL_WSIZE : -1;
+    for (int i = 0; i < DEFL_WSIZE; ++i) z->prev[i] = z->prev[i] >= DEFL_WSIZE ? z->prev[i] - DEFL_WSIZE : -1;
+}
+
+static void deflate_window(gz_stream_t* z) {
+    int lazy = z->cfg->lazy_len > 0;
+    int prev_len = 0, prev_match = 0, have_prev = 0;
+    while (z->pos < z->fill) {
+        int pos = z->pos;
+        int mlen = 0, mpos = 0;
+        if (z->fill - pos >= DEFL_MIN_MATCH) {
+            int cand = insert_string(z, pos);
+            if (!(have_prev && prev_len >= z->cfg->lazy_len))
+                mlen = longest_match(z, pos, cand, DEFL_MIN_MATCH - 1, &mpos);
+            if (mlen < DEFL_MIN_MATCH) mlen = 0;
+        }
+        if (!lazy) {
+            if (mlen) {
+                push_sym(z, mlen, pos - mpos);
+                for (int i = 1; i < mlen; ++i) if (pos + i + DEFL_MIN_MATCH <= z->fill) insert_string(z, pos + i);
+                z->pos += mlen;
+            } else {
+                push_sym(z, z->win[pos], 0);
+                z->pos++;
+            }
+            continue;
+        }
+        if (have_prev && prev_len >= mlen) {
+            push_sym(z, prev_len, (pos - 1) - prev_match);
+            for (int i = 1; i < prev_len - 1; ++i) if (pos + i + DEFL_MIN_MATCH <= z->fill) insert_string(z, pos + i);
+            z->pos = pos - 1 + prev_len;
+            have_prev = 0;
+            continue;
+        }
+        if (have_prev) push_sym(z, z->win[pos - 1], 0);
+        if (mlen) { have_prev = 1; prev_len = mlen; prev_match = mpos; }
+        else { have_prev = 0; push_sym(z, z->win[pos], 0); }
+        z->pos++;
+    }
+    if (have_prev) push_sym(z, z->win[z->pos - 1], 0);
+}
+
+gz_stream_t* gz_stream_create(int level) {
+    if (level < 1) level = 1;
+    if (level > 9) level = 9;
+    gz_stream_t* z = calloc(1, sizeof(*z));
+    if (!z) {
+        LOG_ERROR("Failed to allocate gzip stream state");
+        return NULL;
+    }
+    z->cfg = &defl_levels[level];
+    memset(z->head, 0xFF, sizeof(z->head));
+    memset(z->prev, 0xFF, sizeof(z->prev));
+    return z;
+}
+
+void gz_stream_destroy(gz_stream_t* z) {
+    if (!z) return;
+    free(z->out);
+    free(z);
+}
+
+int gz_stream_write(gz_stream_t* z, const void* data, size_t len, int finish, const unsigned char** out, size_t* out_len) {
+    if (!z || z->finished) return -1;
+    z->out_len = 0;
+    if (!z->header_done) {
+        static const unsigned char hdr[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+        put_bytes(z, hdr, sizeof(hdr));
+        z->header_done = 1;
+    }
+    const unsigned char* p = (const unsigned char*)data;
+    if (len) {
+        z->crc = crc32_update(z->crc, p, len);
+        z->isize += (uint32_t)len;
+    }
+    while (len > 0) {
+        size_t n = len > DEFL_WSIZE ? DEFL_WSIZE : len;
+        if (z->fill + (int)n > 2 * DEFL_WSIZE) slide_window(z);
+        memcpy(z->win + z->fill, p, n);
+        z->fill += (int)n;
+        p += n; len -= n;
+        deflate_window(z);
+    }
+    if (finish) {
+        emit_block(z, 1);
+        flush_all_bits(z);
+        unsigned char trailer[8];
+        write_u32(trailer, z->crc);
+        write_u32(trailer + 4, z->isize);
+        put_bytes(z, trailer, sizeof(trailer));
+        z->finished = 1;
+    } else {
+        if (z->nsyms > 0) emit_block(z, 0);
+        flush_whole_bytes(z);
+    }
+    if (z->oom) return -1;
+    if (out) *out = z->out;
+    if (out_len) *out_len = z->out_len;
+    return 0;
+}
+
+int gzip_compress(const void* in, size_t in_len, int level, unsigned char** out, size_t* out_len) {
+    if (!out || !out_len) return -1;
+    gz_stream_t* z = gz_stream_create(level);
+    if (!z) return -1;
+    const unsigned char* res = NULL; size_t res_len = 0;
+    if (gz_stream_write(z, in, in_len, 1, &res, &res_len) != 0) { gz_stream_destroy(z); return -1; }
+    *out = z->out; *out_len = res_len;
+    z->out = NULL;
+    gz_stream_destroy(z);
+    return 0;
+}
@@ -3,12 +3,44 @@
 #include "logging.h"
 #include "directory.h"
 #include "utils.h"
+#include "path_intern.h"
+#include "fd_cache.h"
+#include "thumb_cache.h"
+#include "crawler.h"
+#include "io_budget.h"
+#include "hls.h"
 
 #define CONFIG_FILE "galleria.conf"
 
 static char** gallery_folders = NULL;
 static size_t gallery_folder_count = 0;
 int server_port = 3000;
+long stream_bandwidth = 0;
+long thumb_cache_size = THUMB_CACHE_DEFAULT_BYTES;
+int thumb_pack_enabled = 0;
+int scan_concurrency = SCAN_CONCURRENCY_SSD;
+long scan_io_bandwidth = IO_BUDGET_DEFAULT_BYTES;
+long scan_iops = IO_BUDGET_DEFAULT_IOPS;
+long long hls_cache_size = HLS_CACHE_DEFAULT_BYTES;
+
+/* 64-bit so budgets of 2 GiB and more survive where long is 32 bits. */
+static long long parse_byte_size(const char* v) {
+	char* end = NULL;
+	double n = strtod(v, &end);
+	if (!end || end == v || n < 0) return 0;
+	while (*end && isspace((unsigned char)*end)) end++;
+	switch (toupper((unsigned char)*end)) {
+		case 'K': n *= 1024.0; break;
+		case 'M': n *= 1024.0 * 1024.0; break;
+		case 'G': n *= 1024.0 * 1024.0 * 1024.0; break;
+	}
+	return n > (double)LLONG_MAX ? LLONG_MAX : (long long)n;
+}
+
+static long parse_byte_rate(const char* v) {
+	long long n = parse_byte_size(v);
+	return n > LONG_MAX ? LONG_MAX : (long)n;
+}
 
 void load_config(void) {
 	FILE* f = fopen(CONFIG_FILE, "r");
@@ -35,6 +67,39 @@ void load_config(void) {
 				if (p > 0 && p < 65536) server_port = p;
 				LOG_INFO("Loaded server port from config: %d", server_port);
 			}
+			else if (ascii_stricmp(key, "stream_bandwidth") == 0) {
+				stream_bandwidth = parse_byte_rate(val);
+				LOG_INFO("Loaded stream bandwidth from config: %ld bytes/s", stream_bandwidth);
+			}
+			else if (ascii_stricmp(key, "thumb_cache_size") == 0) {
+				thumb_cache_size = parse_byte_rate(val);
+				LOG_INFO("Loaded thumb cache size from config: %ld bytes", thumb_cache_size);
+			}
+			else if (ascii_stricmp(key, "thumb_storage") == 0) {
+				if (ascii_stricmp(val, "pack") == 0) thumb_pack_enabled = 1;
+				else if (ascii_stricmp(val, "files") == 0) thumb_pack_enabled = 0;
+				else LOG_WARN("Unknown thumb_storage value: %s", val);
+				LOG_INFO("Loaded thumb storage from config: %s", thumb_pack_enabled ? "pack" : "files");
+			}
+			else if (ascii_stricmp(key, "scan_concurrency") == 0) {
+				if (ascii_stricmp(val, "ssd") == 0) scan_concurrency = SCAN_CONCURRENCY_SSD;
+				else if (ascii_stricmp(val, "hdd") == 0) scan_concurrency = SCAN_CONCURRENCY_HDD;
+				else if (atoi(val) > 0) scan_concurrency = atoi(val);
+				else LOG_WARN("Unknown scan_concurrency value: %s", val);
+				LOG_INFO("Loaded scan concurrency from config: %d worker(s)", crawler_default_workers());
+			}
+			else if (ascii_stricmp(key, "scan_io_bandwidth") == 0) {
+				scan_io_bandwidth = parse_byte_rate(val);
+				LOG_INFO("Loaded scan I/O bandwidth from config: %ld bytes/s", scan_io_bandwidth);
+			}
+			else if (ascii_stricmp(key, "scan_iops") == 0) {
+				scan_iops = atol(val) > 0 ? atol(val) : 0;
+				LOG_INFO("Loaded scan IOPS from config: %ld", scan_iops);
+			}
+			else if (ascii_stricmp(key, "hls_cache_size") == 0) {
+				hls_cache_size = parse_byte_size(val);
+				LOG_INFO("Loaded HLS segment cache size from config: %lld bytes", hls_cache_size);
+			}
 			else {
 				LOG_WARN("Unknown config key: %s", key);
 			}
@@ -59,6 +124,8 @@ void load_config(void) {
 		BASE_DIR[PATH_MAX-1] = '\0';
 		normalize_path(BASE_DIR);
 	}
+	gallery_roots_invalidate();
+	fd_cache_clear();
 }
 
 void save_config(void) {
@@ -70,9 +137,23 @@ void save_config(void) {
 
 	fprintf(f, "# Galleria configuration file\n");
 	fprintf(f, "# Key=value entries supported (e.g. port=3000)\n");
+	fprintf(f, "# stream_bandwidth caps total media streaming in bytes/s (K/M/G suffix, 0 = unlimited)\n");
+	fprintf(f, "# thumb_cache_size is the RAM budget for hot small thumbnails in bytes (K/M/G suffix, 0 = disabled)\n");
+	fprintf(f, "# thumb_storage=pack keeps each folder's thumbnails in one pack file instead of loose files\n");
+	fprintf(f, "# scan_concurrency sets gallery scan workers: ssd (default, 2 per core), hdd (%d) or a number\n", CRAWLER_HDD_WORKERS);
+	fprintf(f, "# scan_io_bandwidth and scan_iops cap background hashing/scanning reads in bytes/s and ops/s (0 = unlimited)\n");
+	fprintf(f, "# hls_cache_size is the disk budget for on-demand HLS video segments in bytes (K/M/G suffix)\n");
 	fprintf(f, "# Each other non-comment line should contain a path to a gallery folder\n\n");
 
 	fprintf(f, "port=%d\n", server_port);
+	if (stream_bandwidth > 0) fprintf(f, "stream_bandwidth=%ld\n", stream_bandwidth);
+	if (thumb_cache_size != THUMB_CACHE_DEFAULT_BYTES) fprintf(f, "thumb_cache_size=%ld\n", thumb_cache_size);
+	if (thumb_pack_enabled) fprintf(f, "thumb_storage=pack\n");
+	if (scan_concurrency == SCAN_CONCURRENCY_HDD) fprintf(f, "scan_concurrency=hdd\n");
+	else if (scan_concurrency > 0) fprintf(f, "scan_concurrency=%d\n", scan_concurrency);
+	if (scan_io_bandwidth != IO_BUDGET_DEFAULT_BYTES) fprintf(f, "scan_io_bandwidth=%ld\n", scan_io_bandwidth);
+	if (scan_iops != IO_BUDGET_DEFAULT_IOPS) fprintf(f, "scan_iops=%ld\n", scan_iops);
+	if (hls_cache_size != HLS_CACHE_DEFAULT_BYTES) fprintf(f, "hls_cache_size=%lld\n", hls_cache_size);
 
 	for (size_t i = 0; i < gallery_folder_count; i++) {
 		fprintf(f, "%s\n", gallery_folders[i]);
@@ -103,6 +184,8 @@ void add_gallery_folder(const char* path) {
 		return;
 	}
 	LOG_DEBUG("Added gallery folder: %s", path);
+	gallery_roots_invalidate();
+	fd_cache_clear();
 
 	save_config();
 }
@@ -113,16 +196,10 @@ bool is_gallery_folder(const char* path) {
 		return false;
 	}
 
-	for (size_t i = 0; i < gallery_folder_count; i++) {
-		char folder_real[PATH_MAX];
-		if (real_path(gallery_folders[i], folder_real)) {
-			if (safe_under(folder_real, path_real)) {
-				return true;
-			}
-		}
-	}
-
-	return false;
+	const gallery_roots_t* gr = gallery_roots_acquire();
+	bool found = gallery_roots_find(gr, path_real) >= 0;
+	gallery_roots_release(gr);
+	return found;
 }
 
 char** get_gallery_folders(size_t* count) {
@@ -0,0 +1,203 @@
+#include "crawler.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "config.h"
+#include "io_budget.h"
+
+/* The owner pushes and pops at the tail so a worker goes depth-first
+ * through its own subtree; thieves take from the head, which holds the
+ * shallowest and usually largest pending subtrees. */
+typedef struct crawl_deque {
+    char** items;
+    size_t head;
+    size_t tail;
+    size_t cap;
+    thread_mutex_t mutex;
+} crawl_deque_t;
+
+typedef struct crawler {
+    crawler_worker_t* workers;
+    int nworkers;
+    crawler_visit_t visit;
+    void* ctx;
+    int background;
+    atomic_size_t pending;
+    atomic_size_t visited;
+    atomic_size_t steals;
+    atomic_int live;
+} crawler_t;
+
+struct crawler_worker {
+    crawler_t* c;
+    int index;
+    crawl_deque_t dq;
+};
+
+static int deque_push(crawl_deque_t* dq, char* dir) {
+    thread_mutex_lock(&dq->mutex);
+    if (dq->tail == dq->cap) {
+        size_t live = dq->tail - dq->head;
+        if (dq->head > 0 && live < dq->cap / 2) {
+            memmove(dq->items, dq->items + dq->head, live * sizeof(char*));
+        } else {
+            size_t nc = dq->cap ? dq->cap * 2 : CRAWLER_DEQUE_INITIAL;
+            char** tmp = malloc(nc * sizeof(char*));
+            if (!tmp) {
+                thread_mutex_unlock(&dq->mutex);
+                return -1;
+            }
+            if (live) memcpy(tmp, dq->items + dq->head, live * sizeof(char*));
+            free(dq->items);
+            dq->items = tmp;
+            dq->cap = nc;
+        }
+        dq->head = 0;
+        dq->tail = live;
+    }
+    dq->items[dq->tail++] = dir;
+    thread_mutex_unlock(&dq->mutex);
+    return 0;
+}
+
+static char* deque_pop_tail(crawl_deque_t* dq) {
+    char* dir = NULL;
+    thread_mutex_lock(&dq->mutex);
+    if (dq->tail > dq->head) dir = dq->items[--dq->tail];
+    thread_mutex_unlock(&dq->mutex);
+    return dir;
+}
+
+static char* deque_steal_head(crawl_deque_t* dq) {
+    char* dir = NULL;
+    thread_mutex_lock(&dq->mutex);
+    if (dq->tail > dq->head) dir = dq->items[dq->head++];
+    thread_mutex_unlock(&dq->mutex);
+    return dir;
+}
+
+void crawler_push(crawler_worker_t* w, const char* dir) {
+    if (!w || !dir) return;
+    char* copy = strdup(dir);
+    if (!copy) {
+        LOG_ERROR("Crawler: failed to allocate task for %s", dir);
+        return;
+    }
+    atomic_fetch_add(&w->c->pending, 1);
+    if (deque_push(&w->dq, copy) != 0) {
+        LOG_ERROR("Crawler: failed to grow deque, visiting %s inline", dir);
+        w->c->visit(w, copy, w->c->ctx);
+        free(copy);
+        atomic_fetch_add(&w->c->visited, 1);
+        atomic_fetch_sub(&w->c->pending, 1);
+    }
+}
+
+static char* steal_task(crawler_worker_t* w) {
+    crawler_t* c = w->c;
+    for (int i = 1; i < c->nworkers; i++) {
+        crawler_worker_t* victim = &c->workers[(w->index + i) % c->nworkers];
+        char* dir = deque_steal_head(&victim->dq);
+        if (dir) {
+            atomic_fetch_add(&c->steals, 1);
+            return dir;
+        }
+    }
+    return NULL;
+}
+
+/* pending counts tasks queued or being visited, and a visit pushes its
+ * children before it finishes, so zero pending means the crawl is done. */
+static void* crawl_worker_thread(void* arg) {
+    crawler_worker_t* w = (crawler_worker_t*)arg;
+    crawler_t* c = w->c;
+    int idle = 0;
+    io_budget_set_background(c->background);
+    for (;;) {
+        char* dir = deque_pop_tail(&w->dq);
+        if (!dir) dir = steal_task(w);
+        if (!dir) {
+            if (atomic_load(&c->pending) == 0) break;
+            if (++idle > 64) platform_sleep_ms(1);
+            continue;
+        }
+        idle = 0;
+        io_budget_acquire(0, 1);
+        c->visit(w, dir, c->ctx);
+        free(dir);
+        atomic_fetch_add(&c->visited, 1);
+        atomic_fetch_sub(&c->pending, 1);
+    }
+    atomic_fetch_sub(&c->live, 1);
+    return NULL;
+}
+
+int crawler_default_workers(void) {
+    if (scan_concurrency > 0) return scan_concurrency > CRAWLER_MAX_WORKERS ? CRAWLER_MAX_WORKERS : scan_concurrency;
+    if (scan_concurrency == SCAN_CONCURRENCY_HDD) return CRAWLER_HDD_WORKERS;
+    int n = platform_get_cpu_count() * 2;
+    if (n < 2) n = 2;
+    return n > CRAWLER_MAX_WORKERS ? CRAWLER_MAX_WORKERS : n;
+}
+
+int crawler_run(const char* const* roots, size_t nroots, int workers, crawler_visit_t visit, void* ctx, crawler_stats_t* stats) {
+    if (!visit) return -1;
+    if (workers <= 0) workers = crawler_default_workers();
+    if (workers > CRAWLER_MAX_WORKERS) workers = CRAWLER_MAX_WORKERS;
+    uint64_t t0 = platform_monotonic_ms();
+
+    crawler_t c;
+    memset(&c, 0, sizeof(c));
+    c.visit = visit;
+    c.ctx = ctx;
+    c.background = io_budget_is_background();
+    c.workers = calloc((size_t)workers, sizeof(crawler_worker_t));
+    if (!c.workers) {
+        LOG_ERROR("Crawler: failed to allocate %d workers", workers);
+        return -1;
+    }
+    c.nworkers = workers;
+    atomic_init(&c.pending, 0);
+    atomic_init(&c.visited, 0);
+    atomic_init(&c.steals, 0);
+    atomic_init(&c.live, 1);
+    for (int i = 0; i < workers; i++) {
+        c.workers[i].c = &c;
+        c.workers[i].index = i;
+        thread_mutex_init(&c.workers[i].dq.mutex);
+    }
+    for (size_t i = 0; i < nroots; i++)
+        if (roots[i] && roots[i][0]) crawler_push(&c.workers[i % (size_t)workers], roots[i]);
+
+    int started = 1;
+    for (int i = 1; i < workers; i++) {
+        atomic_fetch_add(&c.live, 1);
+        if (thread_create_detached(crawl_worker_thread, &c.workers[i]) != 0) {
+            atomic_fetch_sub(&c.live, 1);
+            LOG_WARN("Crawler: could only start %d of %d workers", started, workers);
+            break;
+        }
+        started++;
+    }
+    crawl_worker_thread(&c.workers[0]);
+    while (atomic_load(&c.live) > 0) platform_sleep_ms(1);
+
+    /* Tasks left on deques of workers that never started are handled by
+     * stealing, so every deque is empty here. */
+    for (int i = 0; i < workers; i++) {
+        free(c.workers[i].dq.items);
+        thread_mutex_destroy(&c.workers[i].dq.mutex);
+    }
+    free(c.workers);
+
+    crawler_stats_t st;
+    st.visited = atomic_load(&c.visited);
+    st.steals = atomic_load(&c.steals);
+    st.workers = started;
+    st.elapsed_ms = platform_monotonic_ms() - t0;
+    LOG_DEBUG("Crawler: visited %zu director%s with %d worker(s), %zu steal(s), %llu ms",
+        st.visited, st.visited == 1 ? "y" : "ies", st.workers, st.steals, (unsigned long long)st.elapsed_ms);
+    if (stats) *stats = st;
+    return 0;
+}
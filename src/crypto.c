@@ -1,5 +1,6 @@
 #include "crypto.h"
 #include "common.h"
+#include "io_budget.h"
 
 
 #define F(x,y,z) ((x & y) | (~x & z))
@@ -248,14 +249,18 @@ size_t crypto_base64_decode(const char* encoded_in, size_t len, uint8_t* decoded
 
 int crypto_md5_file(const char* path, uint8_t* digest_out) {
 	if (!path || !digest_out) return -1;
+	io_budget_acquire(0, 1);
 	FILE* f = fopen(path, "rb");
 	if (!f) return -1;
+	io_budget_read_begin(fileno(f));
 	MD5_CTX ctx; MD5_Init(&ctx);
-	unsigned char buf[4096]; size_t r;
+	unsigned char buf[65536]; size_t r;
 	while ((r = fread(buf, 1, sizeof(buf), f)) > 0) {
+		io_budget_acquire(r, 0);
 		MD5_Update(&ctx, buf, r);
 	}
 	MD5_Final(digest_out, &ctx);
+	io_budget_read_end(fileno(f));
 	fclose(f);
 	return 0;
 }
\ No newline at end of file
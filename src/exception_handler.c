@@ -242,6 +242,7 @@ static LONG WINAPI exception_filter(EXCEPTION_POINTERS* ep) {
     write_minidump_with_filename(ep);
 
     LOG_ERROR("Press Enter to exit the process due to unhandled exception...");
+    log_flush();
     fflush(stderr);
     getchar();
 
@@ -304,7 +305,7 @@ static void signal_handler(int sig) {
     LOG_ERROR("Process=%u Thread=%lu", pid, tid);
 
     write_backtrace();
-    LOG_ERROR("Press Enter to exit..."); fflush(stderr); getchar();
+    LOG_ERROR("Press Enter to exit..."); log_flush(); fflush(stderr); getchar();
     _exit(1);
 }
 
@@ -0,0 +1,294 @@
+#include "fd_cache.h"
+#include "common.h"
+#include "logging.h"
+#include "directory.h"
+#include "platform.h"
+#include "thread_pool.h"
+#if defined(__linux__)
+#include <sys/inotify.h>
+
+#define FD_CACHE_WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+    | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+/* Entries are linked into a hash chain and an LRU list owned by the cache.
+ * The cache holds one reference; each acquire adds one, and the fd is closed
+ * when the last reference is dropped after eviction or invalidation. */
+static fd_cache_entry_t* buckets[FD_CACHE_BUCKETS];
+static fd_cache_entry_t* lru_head;
+static fd_cache_entry_t* lru_tail;
+static size_t entry_count;
+static thread_mutex_t cache_mutex;
+static atomic_int cache_inited = ATOMIC_VAR_INIT(0);
+static atomic_size_t stat_hits = ATOMIC_VAR_INIT(0);
+static atomic_size_t stat_misses = ATOMIC_VAR_INIT(0);
+
+typedef struct { int wd; char* dir; } fd_watch_t;
+static fd_watch_t watches[FD_CACHE_MAX];
+static int watch_count;
+static int inotify_fd = -1;
+
+static uint32_t key_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static void entry_free(fd_cache_entry_t* e) {
+    platform_close_fd(e->fd);
+    free(e->key);
+    free(e->path);
+    free(e);
+}
+
+void fd_cache_release(fd_cache_entry_t* e) {
+    if (e && atomic_fetch_sub(&e->refs, 1) == 1) entry_free(e);
+}
+
+static void lru_unlink(fd_cache_entry_t* e) {
+    if (e->prev) e->prev->next = e->next; else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(fd_cache_entry_t* e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+/* Unlinks e from the table; the caller releases the cache's reference
+ * after dropping the lock. */
+static void unlink_locked(fd_cache_entry_t* e) {
+    fd_cache_entry_t** pp = &buckets[e->hash % FD_CACHE_BUCKETS];
+    while (*pp && *pp != e) pp = &(*pp)->hnext;
+    if (*pp) *pp = e->hnext;
+    e->hnext = NULL;
+    lru_unlink(e);
+    entry_count--;
+}
+
+static fd_cache_entry_t* find_locked(const char* key, uint32_t h) {
+    for (fd_cache_entry_t* e = buckets[h % FD_CACHE_BUCKETS]; e; e = e->hnext)
+        if (e->hash == h && strcmp(e->key, key) == 0) return e;
+    return NULL;
+}
+
+static int same_file(const struct stat* a, const struct stat* b) {
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size && a->st_mtime == b->st_mtime;
+}
+
+fd_cache_entry_t* fd_cache_acquire(const char* key) {
+    if (!key || !atomic_load(&cache_inited)) return NULL;
+    uint32_t h = key_hash(key);
+    fd_cache_entry_t* stale = NULL;
+    thread_mutex_lock(&cache_mutex);
+    fd_cache_entry_t* e = find_locked(key, h);
+    if (e && e->wd < 0) {
+        uint64_t now = platform_monotonic_ms();
+        if (now - e->checked_ms >= FD_CACHE_REVALIDATE_MS) {
+            struct stat cur;
+            if (platform_stat(e->path, &cur) != 0 || !same_file(&cur, &e->st)) {
+                unlink_locked(e);
+                stale = e;
+                e = NULL;
+            } else {
+                e->checked_ms = now;
+            }
+        }
+    }
+    if (e) {
+        atomic_fetch_add(&e->refs, 1);
+        if (e != lru_head) { lru_unlink(e); lru_push_front(e); }
+    }
+    thread_mutex_unlock(&cache_mutex);
+    fd_cache_release(stale);
+    atomic_fetch_add(e ? &stat_hits : &stat_misses, 1);
+    return e;
+}
+
+static void parent_dir(const char* path, char* out, size_t outlen) {
+    snprintf(out, outlen, "%s", path);
+    char* s = strrchr(out, DIR_SEP);
+    if (s && s != out) *s = '\0';
+    else if (outlen > 1) { out[0] = '.'; out[1] = '\0'; }
+}
+
+static int watch_dir_locked(const char* path) {
+#if defined(__linux__)
+    if (inotify_fd < 0) return -1;
+    char dir[PATH_MAX];
+    parent_dir(path, dir, sizeof(dir));
+    int wd = inotify_add_watch(inotify_fd, dir, FD_CACHE_WATCH_MASK);
+    if (wd < 0) return -1;
+    for (int i = 0; i < watch_count; i++) if (watches[i].wd == wd) return wd;
+    if (watch_count >= FD_CACHE_MAX) { inotify_rm_watch(inotify_fd, wd); return -1; }
+    char* d = strdup(dir);
+    if (!d) { inotify_rm_watch(inotify_fd, wd); return -1; }
+    watches[watch_count].wd = wd;
+    watches[watch_count].dir = d;
+    watch_count++;
+    return wd;
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+fd_cache_entry_t* fd_cache_insert(const char* key, const char* path, int fd, const struct stat* st) {
+    if (!key || !path || fd < 0 || !st || !atomic_load(&cache_inited)) return NULL;
+    fd_cache_entry_t* e = calloc(1, sizeof(fd_cache_entry_t));
+    if (!e) return NULL;
+    e->key = strdup(key);
+    e->path = strdup(path);
+    if (!e->key || !e->path) { free(e->key); free(e->path); free(e); return NULL; }
+    e->hash = key_hash(key);
+    e->fd = fd;
+    e->st = *st;
+    e->checked_ms = platform_monotonic_ms();
+    atomic_init(&e->refs, 2);
+
+    fd_cache_entry_t* evicted[2] = { NULL, NULL };
+    thread_mutex_lock(&cache_mutex);
+    e->wd = watch_dir_locked(path);
+    /* A watched entry is never revalidated, so a change between the caller's
+     * open and the watch would go unseen. Re-stat now that the watch is in
+     * place; invalidations from it wait on cache_mutex until e is linked. */
+    struct stat cur;
+    if (e->wd >= 0 && (platform_stat(path, &cur) != 0 || !same_file(&cur, st))) {
+        thread_mutex_unlock(&cache_mutex);
+        free(e->key);
+        free(e->path);
+        free(e);
+        return NULL;
+    }
+    fd_cache_entry_t* old = find_locked(key, e->hash);
+    if (old) { unlink_locked(old); evicted[0] = old; }
+    if (entry_count >= FD_CACHE_MAX && lru_tail) {
+        evicted[1] = lru_tail;
+        unlink_locked(lru_tail);
+    }
+    e->hnext = buckets[e->hash % FD_CACHE_BUCKETS];
+    buckets[e->hash % FD_CACHE_BUCKETS] = e;
+    lru_push_front(e);
+    entry_count++;
+    thread_mutex_unlock(&cache_mutex);
+    fd_cache_release(evicted[0]);
+    fd_cache_release(evicted[1]);
+    return e;
+}
+
+/* Drops every entry whose resolved path equals path or lies beneath it. */
+void fd_cache_invalidate(const char* path) {
+    if (!path || !atomic_load(&cache_inited)) return;
+    fd_cache_entry_t* dead = NULL;
+    thread_mutex_lock(&cache_mutex);
+    for (fd_cache_entry_t* e = lru_head; e; ) {
+        fd_cache_entry_t* next = e->next;
+        if (safe_under(path, e->path)) {
+            unlink_locked(e);
+            e->hnext = dead;
+            dead = e;
+        }
+        e = next;
+    }
+    thread_mutex_unlock(&cache_mutex);
+    while (dead) {
+        fd_cache_entry_t* next = dead->hnext;
+        LOG_DEBUG("fd cache: invalidated %s", dead->path);
+        fd_cache_release(dead);
+        dead = next;
+    }
+}
+
+int fd_cache_holds(const struct stat* st) {
+    if (!st || !atomic_load(&cache_inited)) return 0;
+    int found = 0;
+    thread_mutex_lock(&cache_mutex);
+    for (fd_cache_entry_t* e = lru_head; e && !found; e = e->next)
+        found = e->st.st_ino == st->st_ino && e->st.st_dev == st->st_dev;
+    thread_mutex_unlock(&cache_mutex);
+    return found;
+}
+
+void fd_cache_clear(void) {
+    if (!atomic_load(&cache_inited)) return;
+    fd_cache_entry_t* dead = NULL;
+    thread_mutex_lock(&cache_mutex);
+    while (lru_head) {
+        fd_cache_entry_t* e = lru_head;
+        unlink_locked(e);
+        e->hnext = dead;
+        dead = e;
+    }
+    thread_mutex_unlock(&cache_mutex);
+    while (dead) {
+        fd_cache_entry_t* next = dead->hnext;
+        fd_cache_release(dead);
+        dead = next;
+    }
+}
+
+void fd_cache_stats(size_t* hits, size_t* misses, size_t* entries) {
+    if (hits) *hits = atomic_load(&stat_hits);
+    if (misses) *misses = atomic_load(&stat_misses);
+    if (entries) {
+        if (!atomic_load(&cache_inited)) { *entries = 0; return; }
+        thread_mutex_lock(&cache_mutex);
+        *entries = entry_count;
+        thread_mutex_unlock(&cache_mutex);
+    }
+}
+
+#if defined(__linux__)
+static void* fd_cache_watch_thread(void* arg) {
+    (void)arg;
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            LOG_WARN("fd cache: inotify read failed: %s", strerror(errno));
+            break;
+        }
+        for (ssize_t off = 0; off < len; ) {
+            struct inotify_event* ev = (struct inotify_event*)(buf + off);
+            off += (ssize_t)sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) { fd_cache_clear(); continue; }
+            char target[PATH_MAX]; target[0] = '\0';
+            thread_mutex_lock(&cache_mutex);
+            for (int i = 0; i < watch_count; i++) {
+                if (watches[i].wd != ev->wd) continue;
+                if (ev->len > 0 && !(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+                    snprintf(target, sizeof(target), "%s" DIR_SEP_STR "%s", watches[i].dir, ev->name);
+                else
+                    snprintf(target, sizeof(target), "%s", watches[i].dir);
+                if (ev->mask & IN_IGNORED) {
+                    free(watches[i].dir);
+                    watches[i] = watches[--watch_count];
+                }
+                break;
+            }
+            thread_mutex_unlock(&cache_mutex);
+            if (target[0]) fd_cache_invalidate(target);
+        }
+    }
+    return NULL;
+}
+#endif
+
+void fd_cache_init(void) {
+    if (atomic_load(&cache_inited)) return;
+    thread_mutex_init(&cache_mutex);
+#if defined(__linux__)
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd >= 0 && thread_create_detached(fd_cache_watch_thread, NULL) != 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    if (inotify_fd < 0) LOG_WARN("fd cache: inotify unavailable, revalidating entries every %d ms", FD_CACHE_REVALIDATE_MS);
+#endif
+    atomic_store(&cache_inited, 1);
+}
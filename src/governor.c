@@ -0,0 +1,157 @@
+#include "governor.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "timer_wheel.h"
+
+static atomic_int gov_slots = ATOMIC_VAR_INIT(GOVERNOR_INITIAL_SLOTS);
+static atomic_int gov_threads = ATOMIC_VAR_INIT(1);
+static atomic_long gov_job_mem_mb = ATOMIC_VAR_INIT(GOVERNOR_JOB_MEM_MB);
+static atomic_int gov_state = ATOMIC_VAR_INIT(0);
+static atomic_int inflight = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t lat_sum = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t lat_count = ATOMIC_VAR_INIT(0);
+static _Thread_local uint64_t t_request_start;
+static int cpus = 1;
+static int max_slots = 1;
+static uint64_t latency_ewma;
+static uint64_t prev_busy, prev_total;
+
+static int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/* Whole-machine CPU busy percentage since the previous sample, or -1 when
+ * the platform does not expose it. run_queue gets the number of runnable
+ * tasks where known, else -1. */
+static int sample_cpu(int* run_queue) {
+    uint64_t busy = 0, total = 0;
+    *run_queue = -1;
+#ifdef _WIN32
+    FILETIME fi, fk, fu;
+    if (!GetSystemTimes(&fi, &fk, &fu)) return -1;
+    uint64_t idle = ((uint64_t)fi.dwHighDateTime << 32) | fi.dwLowDateTime;
+    uint64_t kern = ((uint64_t)fk.dwHighDateTime << 32) | fk.dwLowDateTime;
+    uint64_t user = ((uint64_t)fu.dwHighDateTime << 32) | fu.dwLowDateTime;
+    total = kern + user;
+    busy = total - idle;
+#elif defined(__linux__)
+    FILE* f = fopen("/proc/stat", "r");
+    if (!f) return -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long v[8] = { 0 };
+        if (strncmp(line, "cpu ", 4) == 0 &&
+            sscanf(line + 4, "%llu %llu %llu %llu %llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) >= 4) {
+            for (int i = 0; i < 8; i++) total += v[i];
+            busy = total - v[3] - v[4];
+        } else if (strncmp(line, "procs_running ", 14) == 0) {
+            *run_queue = atoi(line + 14);
+        }
+    }
+    fclose(f);
+    if (total == 0) return -1;
+#else
+    double load = 0;
+    if (getloadavg(&load, 1) == 1) *run_queue = (int)(load + 0.5);
+    return -1;
+#endif
+    int pct = -1;
+    if (prev_total && total > prev_total && busy >= prev_busy)
+        pct = (int)((busy - prev_busy) * 100 / (total - prev_total));
+    prev_busy = busy;
+    prev_total = total;
+    return pct;
+}
+
+static void governor_tick(void* arg) {
+    (void)arg;
+    int run_queue = -1;
+    int cpu = sample_cpu(&run_queue);
+    long avail_mb = platform_get_available_memory_mb();
+    uint64_t n = atomic_exchange(&lat_count, 0);
+    uint64_t sum = atomic_exchange(&lat_sum, 0);
+    if (n) latency_ewma = (latency_ewma * 3 + sum / n) / 4;
+    else latency_ewma /= 2;
+
+    int slots = atomic_load(&gov_slots);
+    int next = slots;
+    const char* why = NULL;
+    if (latency_ewma > GOVERNOR_LATENCY_HIGH_MS) why = "foreground latency";
+    else if (run_queue > cpus * 2) why = "run queue";
+    else if (avail_mb >= 0 && avail_mb < GOVERNOR_MIN_FREE_MB) why = "memory";
+
+    if (why) {
+        next = slots / 2;
+    } else if (latency_ewma < GOVERNOR_LATENCY_LOW_MS && (cpu < 0 || cpu < GOVERNOR_CPU_LOW_PCT) &&
+        (run_queue < 0 || run_queue <= cpus) &&
+        (avail_mb < 0 || avail_mb >= GOVERNOR_MIN_FREE_MB + (long)(slots + 1) * GOVERNOR_JOB_MEM_MB)) {
+        next = slots + 1;
+    }
+    next = clamp_int(next, 1, max_slots);
+    int threads = why ? 1 : clamp_int(cpus / next, 1, cpus);
+
+    long job_mb = GOVERNOR_JOB_MEM_MB;
+    if (avail_mb > GOVERNOR_MIN_FREE_MB) job_mb = (avail_mb - GOVERNOR_MIN_FREE_MB) / next;
+    if (job_mb < GOVERNOR_JOB_MEM_MB) job_mb = GOVERNOR_JOB_MEM_MB;
+    atomic_store(&gov_job_mem_mb, job_mb);
+
+    if (next != slots || threads != atomic_load(&gov_threads)) {
+        LOG_DEBUG("governor: slots %d -> %d, %d thread(s)/job (cpu=%d%% runq=%d avail=%ldMB ttfb=%llums inflight=%d%s%s)",
+            slots, next, threads, cpu, run_queue, avail_mb, (unsigned long long)latency_ewma, atomic_load(&inflight),
+            why ? ", backing off for " : "", why ? why : "");
+        atomic_store(&gov_slots, next);
+        atomic_store(&gov_threads, threads);
+    }
+}
+
+void governor_init(void) {
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&gov_state, &expected, 1)) return;
+    cpus = platform_get_cpu_count();
+    if (cpus < 1) cpus = 1;
+    max_slots = clamp_int(cpus, 1, GOVERNOR_MAX_SLOTS);
+    int slots = clamp_int(GOVERNOR_INITIAL_SLOTS, 1, max_slots);
+    atomic_store(&gov_slots, slots);
+    atomic_store(&gov_threads, clamp_int(cpus / slots, 1, cpus));
+    int rq;
+    sample_cpu(&rq);
+    if (!timer_add_periodic(GOVERNOR_SAMPLE_MS, governor_tick, NULL))
+        LOG_WARN("governor: no timer, generation stays at %d slot(s)", slots);
+    LOG_INFO("Generation governor: %d slot(s) of %d, %d thread(s)/job", slots, max_slots, atomic_load(&gov_threads));
+}
+
+void governor_request_begin(void) {
+    t_request_start = platform_monotonic_ms();
+    atomic_fetch_add(&inflight, 1);
+}
+
+void governor_request_first_byte(void) {
+    if (!t_request_start) return;
+    uint64_t now = platform_monotonic_ms();
+    atomic_fetch_add(&lat_sum, now > t_request_start ? now - t_request_start : 0);
+    atomic_fetch_add(&lat_count, 1);
+    t_request_start = 0;
+}
+
+void governor_request_end(void) {
+    t_request_start = 0;
+    atomic_fetch_sub(&inflight, 1);
+}
+
+int governor_gen_slots(void) {
+    return atomic_load(&gov_slots);
+}
+
+int governor_magick_slots(void) {
+    int s = atomic_load(&gov_slots) / 2;
+    return s > 0 ? s : 1;
+}
+
+int governor_job_threads(void) {
+    return atomic_load(&gov_threads);
+}
+
+long governor_job_mem_mb(void) {
+    return atomic_load(&gov_job_mem_mb);
+}
@@ -0,0 +1,623 @@
+#include "hls.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "directory.h"
+#include "utils.h"
+#include "thread_pool.h"
+#include "governor.h"
+#include "io_budget.h"
+#include "media_info.h"
+#include "thumbs.h"
+
+typedef enum { HLS_MODE_COPY, HLS_MODE_TRANSCODE } hls_mode_t;
+
+typedef struct hls_probe {
+    char path[PATH_MAX];
+    time_t mtime;
+    long long size;
+    double duration;
+    int segments;
+    hls_mode_t mode;
+    double* cuts; /* segments + 1 keyframe boundaries in copy mode, else NULL */
+    char key[17];
+} hls_probe_t;
+
+typedef struct hls_seg {
+    char* path;
+    uint32_t hash;
+    size_t bytes;
+    struct hls_seg* hnext;
+    struct hls_seg* prev;
+    struct hls_seg* next;
+} hls_seg_t;
+
+typedef struct hls_prefetch_args {
+    char media[PATH_MAX];
+    int index;
+} hls_prefetch_args_t;
+
+static const char* const candidate_exts[] = { ".mp4", ".m4v", ".mov", ".mkv", ".webm", ".avi", ".ts", NULL };
+
+/* One mutex covers the probe table, the in-flight list and the segment
+ * index; the index is rebuilt from disk on first use rather than at
+ * startup. */
+static thread_mutex_t hls_mutex;
+static atomic_int hls_inited = ATOMIC_VAR_INIT(0);
+static uint64_t cache_budget = HLS_CACHE_DEFAULT_BYTES;
+static uint64_t cache_bytes;
+static int index_loaded;
+static hls_seg_t* seg_buckets[HLS_CACHE_BUCKETS];
+static hls_seg_t* lru_head;
+static hls_seg_t* lru_tail;
+static hls_probe_t probes[HLS_PROBE_ENTRIES];
+static int probe_count;
+static int probe_next;
+static char inflight[HLS_MAX_INFLIGHT][PATH_MAX];
+static atomic_int prefetch_active = ATOMIC_VAR_INIT(0);
+
+static uint32_t path_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static void cache_root(char* out, size_t outlen) {
+    char thumbs_root[PATH_MAX];
+    get_thumbs_root(thumbs_root, sizeof(thumbs_root));
+    snprintf(out, outlen, "%s" DIR_SEP_STR HLS_CACHE_DIR, thumbs_root);
+}
+
+int hls_is_candidate(const char* name) {
+    return name && has_ext(name, candidate_exts);
+}
+
+void hls_init(long long bytes) {
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&hls_inited, &expected, 1)) return;
+    thread_mutex_init(&hls_mutex);
+    cache_budget = bytes > 0 ? (uint64_t)bytes : (uint64_t)HLS_CACHE_DEFAULT_BYTES;
+    LOG_DEBUG("HLS segment cache budget %llu bytes", (unsigned long long)cache_budget);
+}
+
+static hls_seg_t* seg_find_locked(const char* path, uint32_t h) {
+    for (hls_seg_t* e = seg_buckets[h % HLS_CACHE_BUCKETS]; e; e = e->hnext)
+        if (e->hash == h && strcmp(e->path, path) == 0) return e;
+    return NULL;
+}
+
+static void lru_unlink_locked(hls_seg_t* e) {
+    if (e->prev) e->prev->next = e->next;
+    else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front_locked(hls_seg_t* e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+static void seg_touch_locked(const char* path, size_t bytes) {
+    uint32_t h = path_hash(path);
+    hls_seg_t* e = seg_find_locked(path, h);
+    if (e) {
+        if (e != lru_head) { lru_unlink_locked(e); lru_push_front_locked(e); }
+        return;
+    }
+    e = calloc(1, sizeof(hls_seg_t));
+    if (!e || !(e->path = strdup(path))) {
+        free(e);
+        return;
+    }
+    e->hash = h;
+    e->bytes = bytes;
+    e->hnext = seg_buckets[h % HLS_CACHE_BUCKETS];
+    seg_buckets[h % HLS_CACHE_BUCKETS] = e;
+    lru_push_front_locked(e);
+    cache_bytes += bytes;
+}
+
+/* Unlinks least recently used segments until the cache fits its budget,
+ * always keeping the newest one, and returns them chained through next so
+ * the files can be deleted outside the lock. */
+static hls_seg_t* evict_locked(void) {
+    hls_seg_t* victims = NULL;
+    while (cache_bytes > cache_budget && lru_tail && lru_tail != lru_head) {
+        hls_seg_t* e = lru_tail;
+        lru_unlink_locked(e);
+        hls_seg_t** pp = &seg_buckets[e->hash % HLS_CACHE_BUCKETS];
+        while (*pp && *pp != e) pp = &(*pp)->hnext;
+        if (*pp) *pp = e->hnext;
+        cache_bytes -= e->bytes;
+        e->next = victims;
+        victims = e;
+    }
+    return victims;
+}
+
+static void delete_victims(hls_seg_t* v) {
+    while (v) {
+        hls_seg_t* n = v->next;
+        if (platform_file_delete(v->path) != 0) LOG_WARN("HLS: failed to evict %s", v->path);
+        free(v->path);
+        free(v);
+        v = n;
+    }
+}
+
+typedef struct hls_disk_seg {
+    char* path;
+    size_t bytes;
+    time_t mtime;
+} hls_disk_seg_t;
+
+static int cmp_disk_seg_mtime(const void* a, const void* b) {
+    time_t ta = ((const hls_disk_seg_t*)a)->mtime, tb = ((const hls_disk_seg_t*)b)->mtime;
+    return ta < tb ? -1 : ta > tb;
+}
+
+/* Segments left by an earlier run re-enter the index oldest first, so the
+ * most recently written ones end up at the head of the LRU list. */
+static void load_index_locked(void) {
+    if (index_loaded) return;
+    index_loaded = 1;
+    char root[PATH_MAX];
+    cache_root(root, sizeof(root));
+    diriter it;
+    if (!dir_open(&it, root)) return;
+    hls_disk_seg_t* segs = NULL;
+    size_t n = 0, cap = 0;
+    const char* dname;
+    while ((dname = dir_next(&it))) {
+        if (!strcmp(dname, ".") || !strcmp(dname, "..")) continue;
+        char sub[PATH_MAX];
+        path_join(sub, root, dname);
+        diriter sit;
+        if (!dir_open(&sit, sub)) {
+            size_t dl = strlen(dname);
+            if (dl > 4 && strcmp(dname + dl - 4, ".tmp") == 0) platform_file_delete(sub);
+            continue;
+        }
+        const char* fname;
+        while ((fname = dir_next(&sit))) {
+            char full[PATH_MAX];
+            path_join(full, sub, fname);
+            size_t fl = strlen(fname);
+            struct stat st;
+            if (fl < 4 || strcmp(fname + fl - 3, ".ts") != 0 || platform_stat(full, &st) != 0) {
+                if (fl > 4 && strcmp(fname + fl - 4, ".tmp") == 0) platform_file_delete(full);
+                continue;
+            }
+            if (n == cap) {
+                size_t nc = cap ? cap * 2 : 256;
+                hls_disk_seg_t* tmp = realloc(segs, nc * sizeof(hls_disk_seg_t));
+                if (!tmp) break;
+                segs = tmp;
+                cap = nc;
+            }
+            segs[n].path = strdup(full);
+            if (!segs[n].path) continue;
+            segs[n].bytes = (size_t)st.st_size;
+            segs[n].mtime = st.st_mtime;
+            n++;
+        }
+        dir_close(&sit);
+    }
+    dir_close(&it);
+    if (n) qsort(segs, n, sizeof(hls_disk_seg_t), cmp_disk_seg_mtime);
+    for (size_t i = 0; i < n; ++i) {
+        seg_touch_locked(segs[i].path, segs[i].bytes);
+        free(segs[i].path);
+    }
+    free(segs);
+    LOG_INFO("HLS: indexed %zu cached segment(s), %llu bytes", n, (unsigned long long)cache_bytes);
+}
+
+static int inflight_find_locked(const char* path) {
+    for (int i = 0; i < HLS_MAX_INFLIGHT; ++i)
+        if (inflight[i][0] && strcmp(inflight[i], path) == 0) return i;
+    return -1;
+}
+
+static int inflight_claim_locked(const char* path) {
+    for (int i = 0; i < HLS_MAX_INFLIGHT; ++i) {
+        if (!inflight[i][0]) {
+            snprintf(inflight[i], sizeof(inflight[i]), "%s", path);
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* The mode is part of the key because copy and transcode segments are cut
+ * on different boundaries. */
+static void key_for(const char* path, time_t mtime, long long size, hls_mode_t mode, char* out) {
+    uint64_t h = 1469598103934665603ULL;
+    char tail[64];
+    snprintf(tail, sizeof(tail), "|%lld|%lld|%s", (long long)mtime, size, mode == HLS_MODE_COPY ? "kf" : "tc");
+    for (const char* s = path; *s; ++s) { h ^= (unsigned char)*s; h *= 1099511628211ULL; }
+    for (const char* s = tail; *s; ++s) { h ^= (unsigned char)*s; h *= 1099511628211ULL; }
+    snprintf(out, 17, "%016llx", (unsigned long long)h);
+}
+
+static void cuts_file(const hls_probe_t* p, char* out, size_t outlen) {
+    char root[PATH_MAX];
+    cache_root(root, sizeof(root));
+    snprintf(out, outlen, "%s" DIR_SEP_STR "%s" DIR_SEP_STR HLS_CUTS_FILE, root, p->key);
+}
+
+/* The boundaries are kept beside the segments as a count followed by one
+ * time per line, so a probe table miss never has to read the index again. */
+static int load_cuts(hls_probe_t* p) {
+    char path[PATH_MAX];
+    cuts_file(p, path, sizeof(path));
+    FILE* f = platform_fopen(path, "r");
+    if (!f) return -1;
+    int n = 0;
+    double* cuts = NULL;
+    if (fscanf(f, "%d", &n) == 1 && n > 0 && n <= HLS_MAX_SEGMENTS && (cuts = malloc((size_t)(n + 1) * sizeof(double)))) {
+        for (int i = 0; i <= n; ++i) {
+            if (fscanf(f, "%lf", &cuts[i]) != 1 || (i > 0 && cuts[i] <= cuts[i - 1])) {
+                free(cuts);
+                cuts = NULL;
+                break;
+            }
+        }
+    }
+    fclose(f);
+    if (!cuts) return -1;
+    p->cuts = cuts;
+    p->segments = n;
+    return 0;
+}
+
+static void save_cuts(const hls_probe_t* p) {
+    char path[PATH_MAX], dir[PATH_MAX], tmp[PATH_MAX];
+    cuts_file(p, path, sizeof(path));
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* sep = strrchr(dir, DIR_SEP);
+    if (!sep) return;
+    *sep = '\0';
+    char root[PATH_MAX];
+    cache_root(root, sizeof(root));
+    if (!is_dir(root)) platform_make_dir(root);
+    if (!is_dir(dir)) platform_make_dir(dir);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* f = platform_fopen(tmp, "w");
+    if (!f) return;
+    int ok = fprintf(f, "%d\n", p->segments) > 0;
+    for (int i = 0; ok && i <= p->segments; ++i) ok = fprintf(f, "%.6f\n", p->cuts[i]) > 0;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || platform_move_file(tmp, path) != 0) {
+        LOG_WARN("HLS: could not save keyframe boundaries of %s", p->path);
+        platform_file_delete(tmp);
+    }
+}
+
+/* Places a boundary on the first keyframe at or after each HLS_SEGMENT_SEC
+ * step, with the keyframe times read from the container's own index (MP4
+ * sync samples, Matroska Cues) rather than by demuxing the file. Returns 0
+ * and sets p->cuts and p->segments, or -1 when the container has no index
+ * or a keyframe gap would make a segment longer than HLS_MAX_SEGMENT_SEC. */
+static int keyframe_cuts(hls_probe_t* p) {
+    if (load_cuts(p) == 0) return 0;
+    double* kf;
+    size_t nkf;
+    if (media_info_keyframes(p->path, &kf, &nkf) != 0) {
+        LOG_DEBUG("HLS: no keyframe index in %s", p->path);
+        return -1;
+    }
+    size_t n = 1;
+    double* cuts = malloc((nkf + 2) * sizeof(double));
+    int ok = cuts != NULL;
+    if (ok) cuts[0] = 0.0;
+    for (size_t i = 0; ok && i < nkf; ++i) {
+        double t = kf[i];
+        if (t < cuts[n - 1] + HLS_SEGMENT_SEC || t >= p->duration) continue;
+        if (t - cuts[n - 1] > HLS_MAX_SEGMENT_SEC) ok = 0;
+        else cuts[n++] = t;
+    }
+    free(kf);
+    if (ok && (p->duration - cuts[n - 1] > HLS_MAX_SEGMENT_SEC || n > HLS_MAX_SEGMENTS)) ok = 0;
+    if (!ok) {
+        free(cuts);
+        return -1;
+    }
+    cuts[n] = p->duration;
+    p->cuts = cuts;
+    p->segments = (int)n;
+    save_cuts(p);
+    return 0;
+}
+
+/* Reads duration and the first video and audio codec with ffprobe. */
+static int run_probe(const char* media, hls_probe_t* p) {
+    const char* argv[] = { "ffprobe", "-v", "error", "-show_entries", "format=duration:stream=codec_type,codec_name",
+        "-of", "default=noprint_wrappers=1", media, NULL };
+    platform_spawn_result_t res;
+    int rc = platform_spawn(argv, NULL, HLS_PROBE_TIMEOUT_SEC * 1000, &res);
+    if (rc != 0 || !res.out) {
+        LOG_WARN("HLS: ffprobe failed for %s (rc=%d)", media, rc);
+        platform_spawn_result_free(&res);
+        return -1;
+    }
+    char vcodec[32] = { 0 }, acodec[32] = { 0 }, last[32] = { 0 };
+    double duration = 0.0;
+    for (char *line = res.out, *next; *line; line = next) {
+        next = line + strcspn(line, "\r\n");
+        if (*next) *next++ = '\0';
+        if (strncmp(line, "codec_name=", 11) == 0) snprintf(last, sizeof(last), "%s", line + 11);
+        else if (strcmp(line, "codec_type=video") == 0 && !vcodec[0]) snprintf(vcodec, sizeof(vcodec), "%s", last);
+        else if (strcmp(line, "codec_type=audio") == 0 && !acodec[0]) snprintf(acodec, sizeof(acodec), "%s", last);
+        else if (strncmp(line, "duration=", 9) == 0) duration = atof(line + 9);
+    }
+    platform_spawn_result_free(&res);
+    if (!vcodec[0] || !(duration > 0.0)) return -1;
+    int copy_audio = !acodec[0] || strcmp(acodec, "aac") == 0 || strcmp(acodec, "mp3") == 0;
+    p->mode = strcmp(vcodec, "h264") == 0 && copy_audio ? HLS_MODE_COPY : HLS_MODE_TRANSCODE;
+    p->duration = duration;
+    key_for(media, p->mtime, p->size, p->mode, p->key);
+    if (p->mode == HLS_MODE_COPY && keyframe_cuts(p) != 0) {
+        p->mode = HLS_MODE_TRANSCODE;
+        key_for(media, p->mtime, p->size, p->mode, p->key);
+    }
+    if (p->mode == HLS_MODE_TRANSCODE) p->segments = (int)ceil(duration / HLS_SEGMENT_SEC);
+    LOG_DEBUG("HLS: %s video=%s audio=%s %.1fs -> %d segment(s), %s", media, vcodec, acodec[0] ? acodec : "none",
+        duration, p->segments, p->mode == HLS_MODE_COPY ? "copy" : "transcode");
+    return 0;
+}
+
+/* Callers get their own copy of the boundaries, since the table entry can be
+ * replaced while they cut; probe_release() frees it. */
+static int probe_dup_cuts(hls_probe_t* p) {
+    if (!p->cuts) return 0;
+    double* cuts = malloc((size_t)(p->segments + 1) * sizeof(double));
+    if (!cuts) return -1;
+    memcpy(cuts, p->cuts, (size_t)(p->segments + 1) * sizeof(double));
+    p->cuts = cuts;
+    return 0;
+}
+
+static int probe_get(const char* media, hls_probe_t* out) {
+    struct stat st;
+    if (platform_stat(media, &st) != 0) return -1;
+    thread_mutex_lock(&hls_mutex);
+    for (int i = 0; i < probe_count; ++i) {
+        hls_probe_t* p = &probes[i];
+        if (strcmp(p->path, media) == 0 && p->mtime == st.st_mtime && p->size == (long long)st.st_size) {
+            *out = *p;
+            int rc = probe_dup_cuts(out);
+            thread_mutex_unlock(&hls_mutex);
+            return rc;
+        }
+    }
+    thread_mutex_unlock(&hls_mutex);
+    hls_probe_t p;
+    memset(&p, 0, sizeof(p));
+    snprintf(p.path, sizeof(p.path), "%s", media);
+    p.mtime = st.st_mtime;
+    p.size = (long long)st.st_size;
+    if (run_probe(media, &p) != 0) return -1;
+    hls_probe_t copy = p;
+    if (probe_dup_cuts(&copy) != 0) {
+        free(p.cuts);
+        return -1;
+    }
+    thread_mutex_lock(&hls_mutex);
+    int slot = -1;
+    for (int i = 0; i < probe_count; ++i)
+        if (strcmp(probes[i].path, media) == 0) slot = i;
+    if (slot < 0 && probe_count < HLS_PROBE_ENTRIES) slot = probe_count++;
+    if (slot < 0) { slot = probe_next; probe_next = (probe_next + 1) % HLS_PROBE_ENTRIES; }
+    free(probes[slot].cuts);
+    probes[slot] = p;
+    thread_mutex_unlock(&hls_mutex);
+    *out = copy;
+    return 0;
+}
+
+static void probe_release(hls_probe_t* p) {
+    free(p->cuts);
+    p->cuts = NULL;
+}
+
+static void segment_file(const hls_probe_t* p, int index, char* out, size_t outlen) {
+    char root[PATH_MAX];
+    cache_root(root, sizeof(root));
+    snprintf(out, outlen, "%s" DIR_SEP_STR "%s" DIR_SEP_STR "%d.ts", root, p->key, index);
+}
+
+static void segment_bounds(const hls_probe_t* p, int index, double* start, double* len) {
+    if (p->cuts) {
+        *start = p->cuts[index];
+        *len = p->cuts[index + 1] - p->cuts[index];
+        return;
+    }
+    *start = (double)index * HLS_SEGMENT_SEC;
+    *len = p->duration - *start < HLS_SEGMENT_SEC ? p->duration - *start : HLS_SEGMENT_SEC;
+}
+
+/* -ss ahead of -i seeks the demuxer, so only the region around the segment
+ * is read. Copy segments start on a keyframe, so the seek lands exactly on
+ * the boundary; -output_ts_offset keeps timestamps on the playlist's
+ * timeline either way. Cuts take an ffmpeg slot and the thread count of a
+ * generation job, so playback and thumbnailing share the governor's budget. */
+static int cut_segment(const hls_probe_t* p, int index, const char* out) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", out);
+    char* sep = strrchr(dir, DIR_SEP);
+    if (sep) {
+        *sep = '\0';
+        char root[PATH_MAX];
+        cache_root(root, sizeof(root));
+        if (!is_dir(root)) platform_make_dir(root);
+        if (!is_dir(dir)) platform_make_dir(dir);
+    }
+    double start, len;
+    segment_bounds(p, index, &start, &len);
+    char ss[32], tt[32], thr[16], tmp[PATH_MAX];
+    snprintf(ss, sizeof(ss), "%.6f", start);
+    snprintf(tt, sizeof(tt), "%.6f", len);
+    snprintf(thr, sizeof(thr), "%d", governor_job_threads());
+    snprintf(tmp, sizeof(tmp), "%s.tmp", out);
+    const char* argv[48];
+    int n = 0;
+    argv[n++] = "ffmpeg"; argv[n++] = "-hide_banner"; argv[n++] = "-loglevel"; argv[n++] = "error"; argv[n++] = "-y";
+    argv[n++] = "-ss"; argv[n++] = ss; argv[n++] = "-i"; argv[n++] = p->path; argv[n++] = "-t"; argv[n++] = tt;
+    argv[n++] = "-map"; argv[n++] = "0:v:0"; argv[n++] = "-map"; argv[n++] = "0:a:0?";
+    argv[n++] = "-threads"; argv[n++] = thr;
+    if (p->mode == HLS_MODE_COPY) {
+        argv[n++] = "-c"; argv[n++] = "copy";
+    }
+    else {
+        argv[n++] = "-c:v"; argv[n++] = "libx264"; argv[n++] = "-preset"; argv[n++] = "veryfast"; argv[n++] = "-crf"; argv[n++] = "23";
+        argv[n++] = "-pix_fmt"; argv[n++] = "yuv420p"; argv[n++] = "-c:a"; argv[n++] = "aac"; argv[n++] = "-b:a"; argv[n++] = "128k";
+        argv[n++] = "-ac"; argv[n++] = "2";
+    }
+    argv[n++] = "-output_ts_offset"; argv[n++] = ss; argv[n++] = "-muxdelay"; argv[n++] = "0";
+    argv[n++] = "-f"; argv[n++] = "mpegts"; argv[n++] = tmp;
+    argv[n] = NULL;
+    uint64_t t0 = platform_monotonic_ms();
+    int rc = execute_command_with_limits(argv, NULL, HLS_SEGMENT_TIMEOUT_SEC, NULL);
+    if (rc != 0 || platform_move_file(tmp, out) != 0) {
+        LOG_WARN("HLS: failed to cut segment %d of %s (rc=%d)", index, p->path, rc);
+        platform_file_delete(tmp);
+        return -1;
+    }
+    LOG_DEBUG("HLS: cut segment %d of %s in %llu ms (%s)", index, p->path,
+        (unsigned long long)(platform_monotonic_ms() - t0), p->mode == HLS_MODE_COPY ? "copy" : "transcode");
+    return 0;
+}
+
+static int ensure_segment(const hls_probe_t* p, int index, char* out, size_t outlen) {
+    segment_file(p, index, out, outlen);
+    uint64_t deadline = platform_monotonic_ms() + (uint64_t)HLS_SEGMENT_TIMEOUT_SEC * 1000;
+    int slot = -1;
+    for (;;) {
+        thread_mutex_lock(&hls_mutex);
+        load_index_locked();
+        if (inflight_find_locked(out) < 0) {
+            struct stat st;
+            if (platform_stat(out, &st) == 0) {
+                seg_touch_locked(out, (size_t)st.st_size);
+                thread_mutex_unlock(&hls_mutex);
+                return 0;
+            }
+            slot = inflight_claim_locked(out);
+        }
+        thread_mutex_unlock(&hls_mutex);
+        if (slot >= 0) break;
+        if (platform_monotonic_ms() > deadline) return -1;
+        platform_sleep_ms(HLS_WAIT_POLL_MS);
+    }
+    int rc = cut_segment(p, index, out);
+    struct stat st;
+    hls_seg_t* victims = NULL;
+    thread_mutex_lock(&hls_mutex);
+    inflight[slot][0] = '\0';
+    if (rc == 0 && platform_stat(out, &st) == 0) {
+        seg_touch_locked(out, (size_t)st.st_size);
+        victims = evict_locked();
+    }
+    thread_mutex_unlock(&hls_mutex);
+    delete_victims(victims);
+    return rc;
+}
+
+static void* prefetch_thread(void* arg) {
+    hls_prefetch_args_t* a = (hls_prefetch_args_t*)arg;
+    io_budget_set_background(1);
+    hls_probe_t p;
+    char out[PATH_MAX];
+    if (probe_get(a->media, &p) == 0) {
+        if (a->index < p.segments) ensure_segment(&p, a->index, out, sizeof(out));
+        probe_release(&p);
+    }
+    atomic_fetch_sub(&prefetch_active, 1);
+    free(a);
+    return NULL;
+}
+
+static void queue_prefetch(const hls_probe_t* p, int index) {
+    for (int i = index + 1; i <= index + HLS_PREFETCH_SEGMENTS && i < p->segments; ++i) {
+        char path[PATH_MAX];
+        segment_file(p, i, path, sizeof(path));
+        thread_mutex_lock(&hls_mutex);
+        int known = seg_find_locked(path, path_hash(path)) != NULL || inflight_find_locked(path) >= 0;
+        thread_mutex_unlock(&hls_mutex);
+        if (known) continue;
+        if (atomic_fetch_add(&prefetch_active, 1) >= HLS_MAX_PREFETCH_JOBS) {
+            atomic_fetch_sub(&prefetch_active, 1);
+            return;
+        }
+        hls_prefetch_args_t* a = malloc(sizeof(hls_prefetch_args_t));
+        if (a) {
+            snprintf(a->media, sizeof(a->media), "%s", p->path);
+            a->index = i;
+        }
+        if (!a || thread_create_detached(prefetch_thread, a) != 0) {
+            free(a);
+            atomic_fetch_sub(&prefetch_active, 1);
+            return;
+        }
+    }
+}
+
+int hls_segment_path(const char* media, int index, char* out, size_t outlen) {
+    if (!media || !out || atomic_load(&hls_inited) != 1) return -1;
+    hls_probe_t p;
+    if (probe_get(media, &p) != 0) return -1;
+    int rc = 0;
+    if (index < 0 || index >= p.segments) rc = -2;
+    else if (ensure_segment(&p, index, out, outlen) != 0) rc = -1;
+    else queue_prefetch(&p, index);
+    probe_release(&p);
+    return rc;
+}
+
+static void append_url_encoded(char** buf, size_t* cap, size_t* len, const char* s) {
+    char enc[PATH_MAX * 3];
+    size_t j = 0;
+    for (; *s && j + 4 < sizeof(enc); ++s) {
+        unsigned char ch = (unsigned char)*s;
+        if (isalnum(ch) || ch == '-' || ch == '_' || ch == '.' || ch == '~' || ch == '/') enc[j++] = (char)ch;
+        else j += (size_t)snprintf(enc + j, sizeof(enc) - j, "%%%02X", ch);
+    }
+    enc[j] = '\0';
+    sb_append(buf, cap, len, enc);
+}
+
+char* hls_build_playlist(const char* media, const char* url_path, size_t* out_len) {
+    if (!media || !url_path || atomic_load(&hls_inited) != 1) return NULL;
+    hls_probe_t p;
+    if (probe_get(media, &p) != 0) return NULL;
+    char* buf = NULL;
+    size_t cap = 0, len = 0;
+    char line[128];
+    double start, dur, longest = HLS_SEGMENT_SEC;
+    for (int i = 0; i < p.segments; ++i) {
+        segment_bounds(&p, i, &start, &dur);
+        if (dur > longest) longest = dur;
+    }
+    snprintf(line, sizeof(line), "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n#EXT-X-MEDIA-SEQUENCE:0\n#EXT-X-PLAYLIST-TYPE:VOD\n",
+        (int)ceil(longest));
+    sb_append(&buf, &cap, &len, line);
+    for (int i = 0; i < p.segments; ++i) {
+        segment_bounds(&p, i, &start, &dur);
+        snprintf(line, sizeof(line), "#EXTINF:%.3f,\nsegment?path=", dur);
+        sb_append(&buf, &cap, &len, line);
+        append_url_encoded(&buf, &cap, &len, url_path);
+        snprintf(line, sizeof(line), "&n=%d\n", i);
+        sb_append(&buf, &cap, &len, line);
+    }
+    sb_append(&buf, &cap, &len, "#EXT-X-ENDLIST\n");
+    probe_release(&p);
+    if (!buf) return NULL;
+    if (out_len) *out_len = len;
+    return buf;
+}
@@ -4,6 +4,10 @@
 #include "platform.h"
 #include "common.h"
 #include "thread_pool.h"
+#include "compress.h"
+#include "arena.h"
+#include "startup.h"
+#include "governor.h"
 
 static void fmt_size(long b, char* out, size_t n) {
 	const char* units[] = {"B","KB","MB","GB","TB"};
@@ -28,10 +32,12 @@ const char* mime_for(const char* p) {
 	if(!strcasecmp(e, "mp4"))return"video/mp4";
 	if(!strcasecmp(e, "webm"))return"video/webm";
 	if(!strcasecmp(e, "ogg"))return"video/ogg";
+	if(!strcasecmp(e, "ts"))return"video/mp2t";
+	if(!strcasecmp(e, "m3u8"))return"application/vnd.apple.mpegurl";
 	return"application/octet-stream";
 }
 
-char* get_header_value(const char* buf, const char* header) {
+static const char* find_header_value(const char* buf, const char* header, size_t* out_len) {
     if (!buf || !header) return NULL;
     size_t hl = strlen(header);
 
@@ -47,15 +53,8 @@ char* get_header_value(const char* buf, const char* header) {
             const char* end = line + linelen - 1;
             while (end > val && isspace((unsigned char)*end)) end--;
 
-            size_t vlen = (size_t)(end - val + 1);
-            char* result = malloc(vlen + 1);
-            if (!result) {
-                LOG_ERROR("Failed to allocate result buffer of size %zu", vlen + 1);
-                return NULL;
-            }
-            memcpy(result, val, vlen);
-            result[vlen] = '\0';
-            return result;
+            *out_len = (size_t)(end - val + 1);
+            return val;
         }
 
         if (!next) break;
@@ -64,6 +63,26 @@ char* get_header_value(const char* buf, const char* header) {
     return NULL;
 }
 
+char* get_header_value(const char* buf, const char* header) {
+    size_t vlen = 0;
+    const char* val = find_header_value(buf, header, &vlen);
+    if (!val) return NULL;
+    char* result = malloc(vlen + 1);
+    if (!result) {
+        LOG_ERROR("Failed to allocate result buffer of size %zu", vlen + 1);
+        return NULL;
+    }
+    memcpy(result, val, vlen);
+    result[vlen] = '\0';
+    return result;
+}
+
+char* get_header_value_arena(arena_t* a, const char* buf, const char* header) {
+    size_t vlen = 0;
+    const char* val = find_header_value(buf, header, &vlen);
+    return val ? arena_strndup(a, val, vlen) : NULL;
+}
+
 
 static inline char* simd_strchr(const char* s, char c) {
 	__m256i set=_mm256_set1_epi8(c);const char* p=s;
@@ -109,16 +128,11 @@ static inline int parse_decimal_trimmed(const char* s, const char* e, long* out)
 	*out=(long)val; return 1;
 }
 
-range_t parse_range_header(const char* header_value, long file_size) {
+static range_t parse_range_spec(const char* p, const char* spec_end, long file_size) {
 	range_t range = { 0, 0, 0 };
-	if (!header_value || strncmp(header_value, "bytes=", 6)) {
-		LOG_DEBUG("No valid Range header: %s", header_value ? header_value : "(null)");
-		return range;
-	}
-	const char* p = header_value + 6;
-	const char* dash = strchr(p, '-');
+	const char* dash = memchr(p, '-', (size_t)(spec_end - p));
 	if (!dash) {
-		LOG_DEBUG("Range header missing dash: %s", header_value);
+		LOG_DEBUG("Range spec missing dash: %.*s", (int)(spec_end - p), p);
 		return range;
 	}
 
@@ -128,7 +142,7 @@ range_t parse_range_header(const char* header_value, long file_size) {
 	while (s_end > s_begin && isspace((unsigned char)*(s_end - 1))) s_end--;
 
 	const char* e_begin = dash + 1;
-	const char* e_end = header_value + strlen(header_value);
+	const char* e_end = spec_end;
 	while (e_begin < e_end && isspace((unsigned char)*e_begin)) e_begin++;
 	while (e_end > e_begin && isspace((unsigned char)*(e_end - 1))) e_end--;
 
@@ -179,7 +193,7 @@ range_t parse_range_header(const char* header_value, long file_size) {
 		e_val = file_size - 1;
 	}
 	else {
-		LOG_DEBUG("Range header both start and end missing: %s", header_value);
+		LOG_DEBUG("Range spec both start and end missing: %.*s", (int)(spec_end - p), p);
 		return range;
 	}
 
@@ -193,141 +207,471 @@ range_t parse_range_header(const char* header_value, long file_size) {
 	return range;
 }
 
-static thread_mutex_t g_range_req_mutex;
-typedef struct { int sock; char path[PATH_MAX]; long last_ts_ms; int count; } range_req_entry_t;
-static range_req_entry_t g_range_reqs[256];
-static int g_range_reqs_inited = 0;
+range_t parse_range_header(const char* header_value, long file_size) {
+	range_t range = { 0, 0, 0 };
+	if (!header_value || strncmp(header_value, "bytes=", 6)) {
+		LOG_DEBUG("No valid Range header: %s", header_value ? header_value : "(null)");
+		return range;
+	}
+	const char* p = header_value + 6;
+	return parse_range_spec(p, p + strlen(p), file_size);
+}
 
-static long now_ms_local(void) {
-#if defined(_WIN32)
-	FILETIME ft; GetSystemTimeAsFileTime(&ft);
-	unsigned long long t=((unsigned long long)ft.dwHighDateTime<<32)|ft.dwLowDateTime;
-	return (long)((t-116444736000000000ULL)/10000ULL);
-#else
-	struct timespec ts; clock_gettime(CLOCK_REALTIME,&ts);
-	return (long)(ts.tv_sec*1000LL+ts.tv_nsec/1000000LL);
-#endif
+static int range_cmp(const void* a, const void* b) {
+	long sa = ((const range_t*)a)->start, sb = ((const range_t*)b)->start;
+	return (sa > sb) - (sa < sb);
 }
 
-static void ensure_range_reqs_init(void) {
-	if (g_range_reqs_inited) return;
-	g_range_reqs_inited = 1;
-	thread_mutex_init(&g_range_req_mutex);
-	for (int i = 0; i < (int)(sizeof(g_range_reqs)/sizeof(g_range_reqs[0])); ++i) g_range_reqs[i].sock = -1;
-}
-
-static int range_request_allowed(int sock, const char* path) {
-	const long WINDOW_MS = 60 * 1000L;
-	const int MAX_PER_WINDOW = 6;
-	long now = now_ms_local();
-	ensure_range_reqs_init();
-	thread_mutex_lock(&g_range_req_mutex);
-	int free_idx = -1;
-	for (int i = 0; i < (int)(sizeof(g_range_reqs)/sizeof(g_range_reqs[0])); ++i) {
-		if (g_range_reqs[i].sock == sock && g_range_reqs[i].path[0] && strcmp(g_range_reqs[i].path, path) == 0) {
-			if (now - g_range_reqs[i].last_ts_ms > WINDOW_MS) {
-				g_range_reqs[i].count = 1;
-				g_range_reqs[i].last_ts_ms = now;
-				thread_mutex_unlock(&g_range_req_mutex);
-				return 1;
+int parse_range_set(const char* header_value, long file_size, range_set_t* out) {
+	out->count = 0;
+	if (!header_value || strncmp(header_value, "bytes=", 6)) return 0;
+	const char* p = header_value + 6;
+	int specs = 0;
+	while (*p) {
+		const char* e = strchr(p, ',');
+		if (!e) e = p + strlen(p);
+		const char* q = p;
+		while (q < e && isspace((unsigned char)*q)) q++;
+		if (q < e) {
+			specs++;
+			range_t r = parse_range_spec(q, e, file_size);
+			if (r.is_range) {
+				if (out->count == HTTP_MAX_RANGES) {
+					LOG_DEBUG("Too many ranges requested, serving the full entity");
+					out->count = 0;
+					return 0;
+				}
+				out->r[out->count++] = r;
 			}
-			g_range_reqs[i].count++;
-			g_range_reqs[i].last_ts_ms = now;
-			int ok = (g_range_reqs[i].count <= MAX_PER_WINDOW);
-			thread_mutex_unlock(&g_range_req_mutex);
-			return ok;
 		}
-		if (g_range_reqs[i].sock == -1 && free_idx == -1) free_idx = i;
+		p = *e ? e + 1 : e;
 	}
-	if (free_idx >= 0) {
-		g_range_reqs[free_idx].sock = sock;
-		g_range_reqs[free_idx].path[0] = '\0';
-		strncpy(g_range_reqs[free_idx].path, path, PATH_MAX-1);
-		g_range_reqs[free_idx].path[PATH_MAX-1] = '\0';
-		g_range_reqs[free_idx].count = 1;
-		g_range_reqs[free_idx].last_ts_ms = now;
-		thread_mutex_unlock(&g_range_req_mutex);
-		return 1;
+	if (out->count == 0) return (specs > 0 && file_size <= 0) ? -1 : 0;
+	qsort(out->r, (size_t)out->count, sizeof(range_t), range_cmp);
+	int n = 0;
+	for (int i = 1; i < out->count; i++) {
+		if (out->r[i].start <= out->r[n].end + 1 + RANGE_COALESCE_GAP) {
+			if (out->r[i].end > out->r[n].end) out->r[n].end = out->r[i].end;
+		}
+		else out->r[++n] = out->r[i];
 	}
-	thread_mutex_unlock(&g_range_req_mutex);
-	return 0;
+	out->count = n + 1;
+	return out->count;
 }
 
+#define HTTP_HEADER_BUF_SIZE 1024
+#define GZIP_MIN_SIZE 512
+#define GZIP_STATIC_MAX_SIZE (8L * 1024 * 1024)
+#define GZIP_STATIC_CACHE_SLOTS 32
 
-void send_header(int c, int status, const char* text, const char* ctype, long len, const range_t* r, long fs, int keep) {
-	char hbuf[1024];
-	int off=snprintf(hbuf, sizeof(hbuf),
+static _Thread_local char t_header_buf[HTTP_HEADER_BUF_SIZE];
+static _Thread_local int t_accept_gzip = 0;
+
+void http_negotiate_encoding(const char* headers) {
+	t_accept_gzip = 0;
+	size_t ae_len = 0;
+	const char* ae_val = find_header_value(headers, "Accept-Encoding:", &ae_len);
+	if (!ae_val) return;
+	char ae[512];
+	if (ae_len >= sizeof(ae)) ae_len = sizeof(ae) - 1;
+	memcpy(ae, ae_val, ae_len); ae[ae_len] = '\0';
+	const char* p = ae;
+	while (*p) {
+		while (*p == ' ' || *p == '\t' || *p == ',') p++;
+		const char* tok = p;
+		while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+		size_t tl = (size_t)(p - tok);
+		double q = 1.0;
+		const char* end = strchr(p, ',');
+		if (!end) end = p + strlen(p);
+		const char* qp = strstr(p, "q=");
+		if (qp && qp < end) q = atof(qp + 2);
+		if (q > 0.0 && ((tl == 4 && strncasecmp(tok, "gzip", 4) == 0) || (tl == 6 && strncasecmp(tok, "x-gzip", 6) == 0))) {
+			t_accept_gzip = 1;
+			break;
+		}
+		p = end;
+	}
+}
+
+int http_is_compressible(const char* ctype) {
+	if (!ctype) return 0;
+	return strncmp(ctype, "text/", 5) == 0 || strncmp(ctype, "application/json", 16) == 0
+		|| strncmp(ctype, "application/javascript", 22) == 0 || strncmp(ctype, "image/svg+xml", 13) == 0;
+}
+
+static int format_header(char* hbuf, size_t cap, int status, const char* text, const char* ctype, long len, const range_t* r, long fs, int keep, const char* extra) {
+	if (status == 200) startup_note_ok_response();
+	governor_request_first_byte();
+	int off=snprintf(hbuf, cap,
 		"HTTP/1.1 %d %s\r\nConnection: %s\r\nContent-Type: %s\r\n",
 		status, text, keep ? "keep-alive" : "close", ctype);
 	if (ctype && (strstr(ctype, "image/") || strstr(ctype, "video/")))
-		off+=snprintf(hbuf+off, sizeof(hbuf)-off, "Content-Disposition: inline\r\n");
-	if(keep)off+=snprintf(hbuf+off, sizeof(hbuf)-off, "Keep-Alive: timeout=%d, max=100\r\n", 5);
+		off+=snprintf(hbuf+off, cap-off, "Content-Disposition: inline\r\n");
+	if(keep)off+=snprintf(hbuf+off, cap-off, "Keep-Alive: timeout=%d, max=100\r\n", 5);
 	if(r&&r->is_range) {
-		off+=snprintf(hbuf+off, sizeof(hbuf)-off, "Content-Range: bytes %ld-%ld/%ld\r\n", r->start, r->end, fs);
-		off+=snprintf(hbuf+off, sizeof(hbuf)-off, "Content-Length: %ld\r\n", r->end-r->start+1);
+		off+=snprintf(hbuf+off, cap-off, "Content-Range: bytes %ld-%ld/%ld\r\n", r->start, r->end, fs);
+		off+=snprintf(hbuf+off, cap-off, "Content-Length: %ld\r\n", r->end-r->start+1);
 	}
-	else off+=snprintf(hbuf+off, sizeof(hbuf)-off, "Content-Length: %ld\r\n", len);
+	else if(len<0)off+=snprintf(hbuf+off, cap-off, "Transfer-Encoding: chunked\r\n");
+	else off+=snprintf(hbuf+off, cap-off, "Content-Length: %ld\r\n", len);
 	if (g_request_url[0] && strncmp(g_request_url, "/images/", 8) == 0) {
-		off += snprintf(hbuf+off, sizeof(hbuf)-off, "Cache-Control: no-store, no-cache, must-revalidate, proxy-revalidate, max-age=0\r\n");
-		off += snprintf(hbuf+off, sizeof(hbuf)-off, "Pragma: no-cache\r\n");
-		off += snprintf(hbuf+off, sizeof(hbuf)-off, "Expires: 0\r\n");
+		off += snprintf(hbuf+off, cap-off, "Cache-Control: no-store, no-cache, must-revalidate, proxy-revalidate, max-age=0\r\n");
+		off += snprintf(hbuf+off, cap-off, "Pragma: no-cache\r\n");
+		off += snprintf(hbuf+off, cap-off, "Expires: 0\r\n");
+	}
+	if (extra) off += snprintf(hbuf+off, cap-off, "%s", extra);
+	off += snprintf(hbuf+off, cap-off, "\r\n");
+	if (off < 0) return 0;
+	if ((size_t)off >= cap) {
+		LOG_WARN("Response header truncated (%d bytes)", off);
+		off = (int)cap - 1;
+	}
+	return off;
+}
+
+static void send_header_ex(int c, int status, const char* text, const char* ctype, long len, const range_t* r, long fs, int keep, int more, const char* extra) {
+	int hlen = format_header(t_header_buf, sizeof(t_header_buf), status, text, ctype, len, r, fs, keep, extra);
+	platform_iovec_t iov[1] = { { t_header_buf, (size_t)hlen } };
+	if (platform_send_vec(c, iov, 1, more) != 0)
+		LOG_DEBUG("Failed to send response header to socket %d", c);
+}
+
+void send_header(int c, int status, const char* text, const char* ctype, long len, const range_t* r, long fs, int keep) {
+	send_header_ex(c, status, text, ctype, len, r, fs, keep, 0, NULL);
+}
+
+int http_accepts_gzip(void) {
+	return t_accept_gzip;
+}
+
+void send_response_parts(int c, int status, const char* text, const char* ctype, const platform_iovec_t* parts, int nparts, int keep, const char* extra, int allow_gzip) {
+	if (nparts < 0) nparts = 0;
+	if (nparts > PLATFORM_IOV_MAX - 1) nparts = PLATFORM_IOV_MAX - 1;
+	size_t total = 0;
+	for (int i = 0; i < nparts; i++) total += parts[i].len;
+	unsigned char* gz = NULL; size_t gz_len = 0;
+	if (allow_gzip && t_accept_gzip && total >= GZIP_MIN_SIZE && http_is_compressible(ctype)) {
+		const void* src = nparts == 1 ? parts[0].base : NULL;
+		char* joined = NULL;
+		if (nparts > 1 && (joined = malloc(total)) != NULL) {
+			size_t off = 0;
+			for (int i = 0; i < nparts; i++) { memcpy(joined + off, parts[i].base, parts[i].len); off += parts[i].len; }
+			src = joined;
+		}
+		if (src && (gzip_compress(src, total, COMPRESS_LEVEL_FAST, &gz, &gz_len) != 0 || gz_len >= total)) {
+			SAFE_FREE(gz);
+		}
+		free(joined);
 	}
-	snprintf(hbuf+off, sizeof(hbuf)-off, "\r\n");
-	send(c, hbuf, (int)strlen(hbuf), 0);
+	char ebuf[512];
+	if (gz) {
+		snprintf(ebuf, sizeof(ebuf), "%s%s", extra ? extra : "", GZIP_ENCODING_HEADERS);
+		extra = ebuf;
+	}
+	int hlen = format_header(t_header_buf, sizeof(t_header_buf), status, text, ctype, gz ? (long)gz_len : (long)total, NULL, 0, keep, extra);
+	platform_iovec_t iov[PLATFORM_IOV_MAX];
+	int n = 0;
+	iov[n].base = t_header_buf; iov[n].len = (size_t)hlen; n++;
+	if (gz) { iov[n].base = gz; iov[n].len = gz_len; n++; }
+	else for (int i = 0; i < nparts; i++) if (parts[i].len) iov[n++] = parts[i];
+	if (platform_send_vec(c, iov, n, 0) != 0)
+		LOG_DEBUG("Failed to send %d response to socket %d", status, c);
+	free(gz);
+}
+
+void send_response(int c, int status, const char* text, const char* ctype, const void* body, size_t len, int keep) {
+	platform_iovec_t part = { body, body ? len : 0 };
+	send_response_parts(c, status, text, ctype, &part, 1, keep, NULL, 1);
 }
 
 void send_text(int c, int status, const char* text, const char* body, int keep) {
-	send_header(c, status, text, "text/plain; charset=utf-8", (long)strlen(body), NULL, 0, keep);
-	send(c, body, (int)strlen(body), 0);
+	send_response(c, status, text, "text/plain; charset=utf-8", body, strlen(body), keep);
 }
 
-void send_file_stream(int c, const char* path, const char* range, int keep) {
-	LOG_DEBUG("Serving file: %s", path);
-	struct stat st;
-	if (platform_stat(path, &st) < 0) {
-		LOG_ERROR("Failed to stat file: %s", path);
-		send_text(c, 404, "Not Found", "Not found", keep);
-		return;
+/* Chunked writer: tinyjson writes straight into s->ptr/s->rem. Trailing commas
+ * are held back on flush so json_objClose/json_arrClose can still retract them. */
+static char* stream_base(http_stream_t* s) { return s->data + 1; }
+
+static void stream_send_chunk(http_stream_t* s, const void* data, size_t n) {
+	if (n == 0 || s->failed) return;
+	char szhdr[24];
+	int hl = snprintf(szhdr, sizeof(szhdr), "%zx\r\n", n);
+	platform_iovec_t iov[3] = { { szhdr, (size_t)hl }, { data, n }, { "\r\n", 2 } };
+	if (platform_send_vec(s->sock, iov, 3, 0) != 0) {
+		LOG_DEBUG("Chunked write failed on socket %d", s->sock);
+		s->failed = 1;
 	}
-	long fsz=(long)st.st_size;
-	range_t r=parse_range_header(range, fsz);
-	const char* ctype=mime_for(path);
-	long start=0, sz=fsz;int code=200;const char* txt="OK";
-	if(r.is_range) {
-		if (!range_request_allowed(c, path)) {
-			LOG_WARN("Too many Range requests from socket %d for %s", c, path);
-			char hbuf[256];
-			snprintf(hbuf, sizeof(hbuf), "HTTP/1.1 429 Too Many Requests\r\nConnection: %s\r\nContent-Length: 0\r\n\r\n", keep ? "keep-alive" : "close");
-			send(c, hbuf, (int)strlen(hbuf), 0);
-			return;
+}
+
+static void stream_flush(http_stream_t* s, int all) {
+	char* base = stream_base(s);
+	size_t used = (size_t)(s->ptr - base);
+	size_t n = used;
+	if (!all) while (n > 0 && base[n - 1] == ',') n--;
+	if (n > 0 && !s->failed) {
+		if (s->gz) {
+			const unsigned char* zout = NULL; size_t zlen = 0;
+			if (gz_stream_write(s->gz, base, n, 0, &zout, &zlen) != 0) s->failed = 1;
+			else stream_send_chunk(s, zout, zlen);
 		}
-		if (r.start < 0) r.start = 0;
-		if (fsz <= 0) {
-			char hbuf[256];
-			int off = snprintf(hbuf, sizeof(hbuf), 
-			"HTTP/1.1 416 Range Not Satisfiable\r\nConnection: %s\r\nContent-Range: bytes */%ld\r\nContent-Length: 0\r\n\r\n", 
-			keep ? "keep-alive" : "close", fsz);
-			send(c, hbuf, (int)strlen(hbuf), 0);
+		else stream_send_chunk(s, base, n);
+	}
+	if (n < used) memmove(base, base + n, used - n);
+	s->ptr = base + (used - n);
+	*s->ptr = '\0';
+	s->rem = HTTP_STREAM_BUF_SIZE - 1 - (used - n);
+}
+
+void http_stream_begin(http_stream_t* s, int c, int status, const char* text, const char* ctype, int keep) {
+	s->sock = c;
+	s->failed = 0;
+	s->gz = NULL;
+	s->data[0] = '\0';
+	s->ptr = stream_base(s);
+	*s->ptr = '\0';
+	s->rem = HTTP_STREAM_BUF_SIZE - 1;
+	if (t_accept_gzip && http_is_compressible(ctype)) s->gz = gz_stream_create(COMPRESS_LEVEL_FAST);
+	send_header_ex(c, status, text, ctype, -1, NULL, 0, keep, 1, s->gz ? GZIP_ENCODING_HEADERS : NULL);
+}
+
+void http_stream_reserve(http_stream_t* s, size_t need) {
+	if (s->rem <= need) stream_flush(s, 0);
+}
+
+void http_stream_write(http_stream_t* s, const char* data, size_t len) {
+	while (len > 0) {
+		if (s->rem <= 1) stream_flush(s, 0);
+		size_t n = MIN(len, s->rem - 1);
+		memcpy(s->ptr, data, n);
+		s->ptr += n; s->rem -= n;
+		data += n; len -= n;
+	}
+	*s->ptr = '\0';
+}
+
+void http_stream_end(http_stream_t* s) {
+	stream_flush(s, 1);
+	if (s->gz) {
+		const unsigned char* zout = NULL; size_t zlen = 0;
+		if (!s->failed && gz_stream_write(s->gz, NULL, 0, 1, &zout, &zlen) == 0) stream_send_chunk(s, zout, zlen);
+		gz_stream_destroy(s->gz);
+		s->gz = NULL;
+	}
+	if (!s->failed) {
+		platform_iovec_t iov[1] = { { "0\r\n\r\n", 5 } };
+		if (platform_send_vec(s->sock, iov, 1, 0) != 0) s->failed = 1;
+	}
+}
+
+static void send_raw(int c, const char* buf, size_t len) {
+	platform_iovec_t iov[1] = { { buf, len } };
+	platform_send_vec(c, iov, 1, 0);
+}
+
+typedef struct {
+	char path[PATH_MAX];
+	time_t mtime;
+	long size;
+	unsigned char* gz;
+	size_t gz_len;
+	unsigned long last_use;
+} gz_static_entry_t;
+
+static gz_static_entry_t g_gz_static[GZIP_STATIC_CACHE_SLOTS];
+static thread_mutex_t g_gz_static_mutex;
+static atomic_int g_gz_static_inited = ATOMIC_VAR_INIT(0);
+static unsigned long g_gz_static_tick = 0;
+
+static unsigned char* gz_static_copy(const gz_static_entry_t* e, size_t* out_len) {
+	unsigned char* copy = malloc(e->gz_len);
+	if (!copy) return NULL;
+	memcpy(copy, e->gz, e->gz_len);
+	*out_len = e->gz_len;
+	return copy;
+}
+
+void http_init(void) {
+	if (atomic_load(&g_gz_static_inited)) return;
+	thread_mutex_init(&g_gz_static_mutex);
+	atomic_store(&g_gz_static_inited, 1);
+}
+
+static unsigned char* gz_static_get(const char* path, const struct stat* st, size_t* out_len) {
+	if (!atomic_load(&g_gz_static_inited)) return NULL;
+	thread_mutex_lock(&g_gz_static_mutex);
+	for (int i = 0; i < GZIP_STATIC_CACHE_SLOTS; ++i) {
+		gz_static_entry_t* e = &g_gz_static[i];
+		if (e->gz && e->mtime == st->st_mtime && e->size == (long)st->st_size && strcmp(e->path, path) == 0) {
+			e->last_use = ++g_gz_static_tick;
+			unsigned char* copy = gz_static_copy(e, out_len);
+			thread_mutex_unlock(&g_gz_static_mutex);
+			return copy;
+		}
+	}
+	thread_mutex_unlock(&g_gz_static_mutex);
+
+	FILE* f = platform_fopen(path, "rb");
+	if (!f) return NULL;
+	size_t sz = (size_t)st->st_size;
+	char* raw = malloc(sz ? sz : 1);
+	if (!raw) { fclose(f); return NULL; }
+	size_t rd = fread(raw, 1, sz, f);
+	fclose(f);
+	if (rd != sz) { free(raw); return NULL; }
+	unsigned char* gz = NULL; size_t gz_len = 0;
+	int rc = gzip_compress(raw, sz, COMPRESS_LEVEL_BEST, &gz, &gz_len);
+	free(raw);
+	if (rc != 0) return NULL;
+	if (gz_len >= sz) { free(gz); return NULL; }
+	LOG_DEBUG("Precompressed %s: %zu -> %zu bytes", path, sz, gz_len);
+
+	thread_mutex_lock(&g_gz_static_mutex);
+	int slot = 0;
+	for (int i = 0; i < GZIP_STATIC_CACHE_SLOTS; ++i) {
+		if (strcmp(g_gz_static[i].path, path) == 0) { slot = i; break; }
+		if (g_gz_static[i].last_use < g_gz_static[slot].last_use) slot = i;
+	}
+	gz_static_entry_t* e = &g_gz_static[slot];
+	free(e->gz);
+	strncpy(e->path, path, PATH_MAX - 1);
+	e->path[PATH_MAX - 1] = '\0';
+	e->mtime = st->st_mtime;
+	e->size = (long)st->st_size;
+	e->gz = gz;
+	e->gz_len = gz_len;
+	e->last_use = ++g_gz_static_tick;
+	unsigned char* copy = gz_static_copy(e, out_len);
+	thread_mutex_unlock(&g_gz_static_mutex);
+	return copy;
+}
+
+void http_format_validators(const struct stat* st, char* etag, size_t etag_cap, char* lm, size_t lm_cap) {
+	snprintf(etag, etag_cap, "\"%llx-%llx\"", (unsigned long long)st->st_mtime, (unsigned long long)st->st_size);
+	time_t t = st->st_mtime;
+	struct tm tm;
+#ifdef _WIN32
+	if (gmtime_s(&tm, &t) != 0) { lm[0] = '\0'; return; }
+#else
+	if (!gmtime_r(&t, &tm)) { lm[0] = '\0'; return; }
+#endif
+	strftime(lm, lm_cap, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+static int if_range_matches(const char* if_range, const char* etag, const char* lm) {
+	if (!if_range) return 1;
+	if (if_range[0] == 'W' && if_range[1] == '/') return 0;
+	if (if_range[0] == '"') return strcmp(if_range, etag) == 0;
+	return lm[0] && strcmp(if_range, lm) == 0;
+}
+
+static int stream_payload(int c, int fd, long base, const char* path, long start, long len, int is_range) {
+	if (fd >= 0) return platform_stream_fd_payload(c, fd, path, base + start, len);
+	return platform_stream_file_payload(c, path, start, len, is_range);
+}
+
+static void send_multipart_ranges(int c, int fd, long base, const char* path, const char* ctype, long fsz, const range_set_t* rs, int keep, const char* extra) {
+	static atomic_uint boundary_seq = ATOMIC_VAR_INIT(0);
+	char boundary[40], mtype[96], tail[64];
+	char heads[HTTP_MAX_RANGES][256];
+	int hl[HTTP_MAX_RANGES];
+	snprintf(boundary, sizeof(boundary), "galleria_%08lx%08x", (unsigned long)time(NULL), atomic_fetch_add(&boundary_seq, 1));
+	snprintf(mtype, sizeof(mtype), "multipart/byteranges; boundary=%s", boundary);
+	int tl = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", boundary);
+	long total = tl;
+	for (int i = 0; i < rs->count; i++) {
+		hl[i] = snprintf(heads[i], sizeof(heads[i]), "%s--%s\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+			i ? "\r\n" : "", boundary, ctype, rs->r[i].start, rs->r[i].end, fsz);
+		total += hl[i] + (rs->r[i].end - rs->r[i].start + 1);
+	}
+	LOG_INFO("Multi-range request: %d ranges of %s", rs->count, path);
+	send_header_ex(c, 206, "Partial Content", mtype, total, NULL, 0, keep, 1, extra);
+	for (int i = 0; i < rs->count; i++) {
+		platform_iovec_t iov[1] = { { heads[i], (size_t)hl[i] } };
+		if (platform_send_vec(c, iov, 1, 1) != 0
+			|| stream_payload(c, fd, base, path, rs->r[i].start, rs->r[i].end - rs->r[i].start + 1, 1) != 0) {
+			LOG_DEBUG("Multipart transfer incomplete or failed for %s", path);
 			return;
 		}
-		if (r.end >= fsz) r.end = fsz - 1;
-		if (r.start > r.end) {
-			char hbuf[256];
-			int off = snprintf(hbuf, sizeof(hbuf),
-			"HTTP/1.1 416 Range Not Satisfiable\r\nConnection: %s\r\nContent-Range: bytes */%ld\r\nContent-Length: 0\r\n\r\n", 
+	}
+	send_raw(c, tail, (size_t)tl);
+}
+
+void send_file_stream(int c, const char* path, const char* range, int keep) {
+	send_file_stream_ex(c, path, range, NULL, keep);
+}
+
+static void send_file_common(int c, int fd, long base, const char* path, const struct stat* st, const char* range, const char* if_range, int keep) {
+	long fsz=(long)st->st_size;
+	const char* ctype=mime_for(path);
+	char etag[48], lm[40];
+	http_format_validators(st, etag, sizeof(etag), lm, sizeof(lm));
+	range_set_t rs;
+	int nr = 0;
+	if (range) {
+		if (if_range_matches(if_range, etag, lm)) nr = parse_range_set(range, fsz, &rs);
+		else LOG_DEBUG("If-Range validator changed for %s, sending full entity", path);
+	}
+	if (nr < 0) {
+		char hbuf[256];
+		snprintf(hbuf, sizeof(hbuf),
+			"HTTP/1.1 416 Range Not Satisfiable\r\nConnection: %s\r\nContent-Range: bytes */%ld\r\nContent-Length: 0\r\n\r\n",
 			keep ? "keep-alive" : "close", fsz);
-			send(c, hbuf, (int)strlen(hbuf), 0);
+		send_raw(c, hbuf, strlen(hbuf));
+		return;
+	}
+	if (nr == 0 && t_accept_gzip && http_is_compressible(ctype) && fsz >= GZIP_MIN_SIZE && fsz <= GZIP_STATIC_MAX_SIZE) {
+		size_t gz_len = 0;
+		unsigned char* gz = gz_static_get(path, st, &gz_len);
+		if (gz) {
+			int hlen = format_header(t_header_buf, sizeof(t_header_buf), 200, "OK", ctype, (long)gz_len, NULL, 0, keep, GZIP_ENCODING_HEADERS);
+			platform_iovec_t iov[2] = { { t_header_buf, (size_t)hlen }, { gz, gz_len } };
+			if (platform_send_vec(c, iov, 2, 0) != 0) LOG_DEBUG("Failed to send compressed %s", path);
+			free(gz);
 			return;
 		}
-		start=r.start;sz=r.end-r.start+1;code=206;txt="Partial Content";
+	}
+	char extra[256];
+	snprintf(extra, sizeof(extra), "Accept-Ranges: bytes\r\nETag: %s\r\nLast-Modified: %s\r\n%s",
+		etag, lm, http_is_compressible(ctype) ? "Vary: Accept-Encoding\r\n" : "");
+	if (nr > 1) {
+		send_multipart_ranges(c, fd, base, path, ctype, fsz, &rs, keep, extra);
+		return;
+	}
+	long start=0, sz=fsz;int code=200;const char* txt="OK";
+	range_t* r = nr == 1 ? &rs.r[0] : NULL;
+	if (r) {
+		start=r->start;sz=r->end-r->start+1;code=206;txt="Partial Content";
 		{
 			char ssz[32]; fmt_size(sz, ssz, sizeof(ssz));
-			LOG_INFO("Range request: %ld-%ld (%s)", r.start, r.end, ssz);
+			LOG_INFO("Range request: %ld-%ld (%s)", r->start, r->end, ssz);
 		}
 	}
-	(void)0; 
-	send_header(c, code, txt, ctype, sz, r.is_range ? &r : NULL, fsz, keep);
-	if (platform_stream_file_payload(c, path, start, sz, r.is_range) != 0) {
+	send_header_ex(c, code, txt, ctype, sz, r, fsz, keep, sz > 0, extra);
+	if (stream_payload(c, fd, base, path, start, sz, r != NULL) != 0) {
 		LOG_DEBUG("File transfer incomplete or failed for %s", path);
 	}
 }
+
+void send_file_stream_ex(int c, const char* path, const char* range, const char* if_range, int keep) {
+	LOG_DEBUG("Serving file: %s", path);
+	struct stat st;
+	if (platform_stat(path, &st) < 0) {
+		LOG_ERROR("Failed to stat file: %s", path);
+		send_text(c, 404, "Not Found", "Not found", keep);
+		return;
+	}
+	send_file_common(c, -1, 0, path, &st, range, if_range, keep);
+}
+
+void send_file_fd_ex(int c, int fd, const struct stat* st, const char* path, const char* range, const char* if_range, int keep) {
+	LOG_DEBUG("Serving file: %s (fd %d)", path, fd);
+	send_file_common(c, fd, 0, path, st, range, if_range, keep);
+}
+
+/* Serves the st->st_size bytes at offset base of fd as if they were the
+ * file named path, e.g. one blob inside a thumbnail pack. */
+void send_file_fd_at(int c, int fd, long base, const struct stat* st, const char* path, const char* range, const char* if_range, int keep) {
+	LOG_DEBUG("Serving file: %s (fd %d at %ld)", path, fd, base);
+	send_file_common(c, fd, base, path, st, range, if_range, keep);
+}
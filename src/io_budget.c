@@ -0,0 +1,104 @@
+#include "io_budget.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "fd_cache.h"
+
+typedef struct {
+    double rate;
+    double tokens;
+    uint64_t last_ms;
+} io_bucket_t;
+
+static io_bucket_t bucket_bytes;
+static io_bucket_t bucket_ops;
+static thread_mutex_t io_mutex;
+static atomic_int io_inited = ATOMIC_VAR_INIT(0);
+static _Thread_local int t_background = 0;
+
+static void bucket_reset(io_bucket_t* b, long rate, uint64_t now) {
+    b->rate = rate > 0 ? (double)rate : 0.0;
+    b->tokens = b->rate * IO_BUDGET_BURST_MS / 1000.0;
+    b->last_ms = now;
+}
+
+/* Takes need tokens, going into debt if necessary, and returns how long the
+ * caller must sleep for the debt to be repaid. */
+static long bucket_take_locked(io_bucket_t* b, double need, uint64_t now) {
+    if (b->rate <= 0.0 || need <= 0.0) return 0;
+    double burst = b->rate * IO_BUDGET_BURST_MS / 1000.0;
+    b->tokens += b->rate * (double)(now - b->last_ms) / 1000.0;
+    b->last_ms = now;
+    if (b->tokens > burst) b->tokens = burst;
+    b->tokens -= need;
+    return b->tokens < 0 ? (long)(-b->tokens * 1000.0 / b->rate) + 1 : 0;
+}
+
+void io_budget_init(long bytes_per_sec, long iops) {
+    if (atomic_exchange(&io_inited, 1)) return;
+    thread_mutex_init(&io_mutex);
+    uint64_t now = platform_monotonic_ms();
+    bucket_reset(&bucket_bytes, bytes_per_sec, now);
+    bucket_reset(&bucket_ops, iops, now);
+    if (bytes_per_sec > 0 || iops > 0)
+        LOG_INFO("Background I/O limited to %ld bytes/s and %ld ops/s (0 = unlimited)", bytes_per_sec > 0 ? bytes_per_sec : 0, iops > 0 ? iops : 0);
+}
+
+void io_budget_set_background(int on) {
+    t_background = on ? 1 : 0;
+}
+
+int io_budget_is_background(void) {
+    return t_background;
+}
+
+void io_budget_acquire(size_t bytes, int ops) {
+    if (!t_background || !atomic_load(&io_inited)) return;
+    thread_mutex_lock(&io_mutex);
+    uint64_t now = platform_monotonic_ms();
+    long wb = bucket_take_locked(&bucket_bytes, (double)bytes, now);
+    long wo = bucket_take_locked(&bucket_ops, (double)ops, now);
+    thread_mutex_unlock(&io_mutex);
+    long wait_ms = wb > wo ? wb : wo;
+    if (wait_ms > 0) platform_sleep_ms((int)wait_ms);
+}
+
+void io_budget_read_begin(int fd) {
+#if defined(POSIX_FADV_SEQUENTIAL) && !defined(_WIN32)
+    if (!t_background || fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+#else
+    (void)fd;
+#endif
+}
+
+#if defined(POSIX_FADV_DONTNEED) && !defined(_WIN32)
+static void drop_unless_served(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || fd_cache_holds(&st)) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+#endif
+
+void io_budget_read_end(int fd) {
+#if defined(POSIX_FADV_DONTNEED) && !defined(_WIN32)
+    if (!t_background || fd < 0) return;
+    drop_unless_served(fd);
+#else
+    (void)fd;
+#endif
+}
+
+void io_budget_drop_cache(const char* path) {
+#if defined(POSIX_FADV_DONTNEED) && !defined(_WIN32)
+    if (!t_background || !path) return;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    drop_unless_served(fd);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
@@ -5,6 +5,12 @@
 #include "platform.h"
 #define LOG_DIR "logs"
 #define MAX_LOG_MESSAGE_LENGTH 256
+#define LOG_RING_SLOTS 128
+#define LOG_RECORD_ARGS 472
+#define LOG_MAX_RINGS 128
+#define LOG_BATCH_BYTES 65536
+#define LOG_IDLE_SLEEP_MS 2
+#define LOG_FULL_SPINS 1000
 #ifdef DEBUG_DIAGNOSTIC
 LogLevel current_log_level=LOG_LEVEL_DEBUG;
 #else
@@ -14,46 +20,241 @@ FILE* log_file=NULL;
 
 thread_mutex_t log_mutex;
 
-void log_init(void) {
-	if(mk_dir(LOG_DIR)!=0) {
-		if(errno!=EEXIST) {
-			fprintf(stderr, "WARN: Could not create log directory %s\n", LOG_DIR);
+/* Callers only capture the format pointer and a packed copy of the
+ * arguments into a per-thread single-producer ring; the writer thread does
+ * the vsnprintf-equivalent work, the localtime call and the I/O, merging
+ * rings by sequence number so the file keeps a global order. */
+typedef struct {
+	uint64_t seq;
+	time_t ts;
+	const char* function;
+	const char* format;	/* NULL when args already holds the formatted text */
+	uint16_t arg_len;
+	uint8_t level;
+	unsigned char args[LOG_RECORD_ARGS];
+} log_record_t;
+
+enum { RING_FREE, RING_OWNED, RING_RELEASED };
+
+typedef struct {
+	atomic_size_t head;
+	char pad0[64 - sizeof(atomic_size_t)];
+	atomic_size_t tail;
+	char pad1[64 - sizeof(atomic_size_t)];
+	atomic_int state;
+	unsigned long tid;
+	log_record_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+static log_ring_t* rings[LOG_MAX_RINGS];
+static atomic_int ring_count = ATOMIC_VAR_INIT(0);
+static thread_mutex_t ring_mutex;
+static _Thread_local log_ring_t* t_ring = NULL;
+static _Thread_local int t_ring_failed = 0;
+static atomic_uint_fast64_t log_seq = ATOMIC_VAR_INIT(0);
+static atomic_size_t log_dropped = ATOMIC_VAR_INIT(0);
+static atomic_int log_async = ATOMIC_VAR_INIT(0);
+static atomic_flag log_draining = ATOMIC_FLAG_INIT;
+#ifdef _WIN32
+static DWORD ring_fls = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t ring_key;
+#endif
+
+enum { ARG_INT, ARG_LONG, ARG_LLONG, ARG_SIZE, ARG_INTMAX, ARG_PTRDIFF, ARG_DOUBLE, ARG_LDOUBLE, ARG_PTR, ARG_STR, ARG_SKIP, ARG_BAD };
+
+typedef struct {
+	const char* end;	/* one past the conversion character */
+	int stars;
+	int prec;
+	int type;
+} fmt_spec_t;
+
+static const char* parse_spec(const char* p, fmt_spec_t* s) {
+	s->stars = 0;
+	s->prec = -1;
+	while (*p && strchr("-+ #0'", *p)) p++;
+	if (*p == '*') { s->stars++; p++; }
+	else while (isdigit((unsigned char)*p)) p++;
+	if (*p == '.') {
+		p++;
+		s->prec = 0;
+		if (*p == '*') { s->stars++; s->prec = -2; p++; }
+		else while (isdigit((unsigned char)*p)) s->prec = s->prec * 10 + (*p++ - '0');
+	}
+	int len = ARG_INT;
+	if (*p == 'h') { p++; if (*p == 'h') p++; }
+	else if (*p == 'l') { p++; len = ARG_LONG; if (*p == 'l') { p++; len = ARG_LLONG; } }
+	else if (*p == 'z') { p++; len = ARG_SIZE; }
+	else if (*p == 'j') { p++; len = ARG_INTMAX; }
+	else if (*p == 't') { p++; len = ARG_PTRDIFF; }
+	else if (*p == 'L') { p++; len = ARG_LDOUBLE; }
+	switch (*p) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+			s->type = len == ARG_LDOUBLE ? ARG_BAD : len;
+			break;
+		case 'c':
+			s->type = ARG_INT;
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			s->type = len == ARG_LDOUBLE ? ARG_LDOUBLE : ARG_DOUBLE;
+			break;
+		case 's':
+			s->type = len == ARG_LONG ? ARG_BAD : ARG_STR;
+			break;
+		case 'p':
+			s->type = ARG_PTR;
+			break;
+		case 'n':
+			s->type = ARG_SKIP;
+			break;
+		default:
+			s->type = ARG_BAD;
+			return p;
+	}
+	s->end = p + 1;
+	return s->end;
+}
+
+#define PACK(T, v) do { T v_ = (v); if (n + sizeof(T) > cap) return -1; memcpy(out + n, &v_, sizeof(T)); n += sizeof(T); } while (0)
+
+/* Copies the arguments named by fmt into out. Returns the packed length,
+ * or -1 when they do not fit or the format uses an unsupported conversion. */
+static int pack_args(const char* fmt, va_list ap, unsigned char* out, size_t cap) {
+	size_t n = 0;
+	for (const char* p = fmt; *p; ) {
+		if (*p++ != '%') continue;
+		if (*p == '%') { p++; continue; }
+		fmt_spec_t s;
+		const char* q = p;
+		while (*q && strchr("-+ #0'", *q)) q++;
+		if (*q == '*') PACK(int, va_arg(ap, int));
+		p = parse_spec(p, &s);
+		int prec = s.prec;
+		if (s.prec == -2) { prec = va_arg(ap, int); PACK(int, prec); }
+		switch (s.type) {
+			case ARG_INT: PACK(int, va_arg(ap, int)); break;
+			case ARG_LONG: PACK(long, va_arg(ap, long)); break;
+			case ARG_LLONG: PACK(long long, va_arg(ap, long long)); break;
+			case ARG_SIZE: PACK(size_t, va_arg(ap, size_t)); break;
+			case ARG_INTMAX: PACK(intmax_t, va_arg(ap, intmax_t)); break;
+			case ARG_PTRDIFF: PACK(ptrdiff_t, va_arg(ap, ptrdiff_t)); break;
+			case ARG_DOUBLE: PACK(double, va_arg(ap, double)); break;
+			case ARG_LDOUBLE: PACK(long double, va_arg(ap, long double)); break;
+			case ARG_PTR: PACK(void*, va_arg(ap, void*)); break;
+			case ARG_SKIP: (void)va_arg(ap, void*); break;
+			case ARG_STR: {
+				const char* str = va_arg(ap, const char*);
+				if (!str) str = "(null)";
+				size_t len = 0;
+				while (str[len] && (prec < 0 || len < (size_t)prec)) len++;
+				if (n + len + 1 > cap) return -1;
+				memcpy(out + n, str, len);
+				out[n + len] = '\0';
+				n += len + 1;
+				break;
+			}
+			default: return -1;
 		}
 	}
-	char log_path[PATH_MAX];
-	time_t t=time(NULL);
-	struct tm* tm=localtime(&t);
-	snprintf(log_path, PATH_MAX, "%s/%04d-%02d-%02d_%02d-%02d-%02d.log",
-		LOG_DIR, tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday,
-		tm->tm_hour, tm->tm_min, tm->tm_sec);
-	log_file=platform_fopen(log_path, "a");
-	if(!log_file) {
-		fprintf(stderr, "WARN: Could not open log file %s\n", log_path);
+	return (int)n;
+}
+
+#define EMIT(T) do { T v_; memcpy(&v_, a + off, sizeof(T)); off += sizeof(T); \
+	w = s.stars == 0 ? snprintf(o, rem, spec, v_) : s.stars == 1 ? snprintf(o, rem, spec, st[0], v_) : snprintf(o, rem, spec, st[0], st[1], v_); } while (0)
+
+static size_t format_record(const log_record_t* r, char* out, size_t cap) {
+	if (!r->format) {
+		size_t len = strnlen((const char*)r->args, r->arg_len);
+		if (len >= cap) len = cap - 1;
+		memcpy(out, r->args, len);
+		out[len] = '\0';
+		return len;
 	}
-	platform_enable_console_colors();
-	thread_mutex_init(&log_mutex);
+	const unsigned char* a = r->args;
+	size_t off = 0, pos = 0;
+	char spec[32];
+	for (const char* p = r->format; *p && pos + 1 < cap; ) {
+		if (*p != '%') { out[pos++] = *p++; continue; }
+		if (p[1] == '%') { out[pos++] = '%'; p += 2; continue; }
+		fmt_spec_t s;
+		const char* end = parse_spec(p + 1, &s);
+		size_t sl = (size_t)(end - p);
+		if (s.type == ARG_BAD || sl >= sizeof(spec)) break;
+		memcpy(spec, p, sl);
+		spec[sl] = '\0';
+		p = end;
+		int st[2] = { 0, 0 };
+		for (int i = 0; i < s.stars; i++) { memcpy(&st[i], a + off, sizeof(int)); off += sizeof(int); }
+		char* o = out + pos;
+		size_t rem = cap - pos;
+		int w = 0;
+		switch (s.type) {
+			case ARG_INT: EMIT(int); break;
+			case ARG_LONG: EMIT(long); break;
+			case ARG_LLONG: EMIT(long long); break;
+			case ARG_SIZE: EMIT(size_t); break;
+			case ARG_INTMAX: EMIT(intmax_t); break;
+			case ARG_PTRDIFF: EMIT(ptrdiff_t); break;
+			case ARG_DOUBLE: EMIT(double); break;
+			case ARG_LDOUBLE: EMIT(long double); break;
+			case ARG_PTR: EMIT(void*); break;
+			case ARG_STR: {
+				const char* v = (const char*)a + off;
+				off += strlen(v) + 1;
+				w = s.stars == 0 ? snprintf(o, rem, spec, v) : s.stars == 1 ? snprintf(o, rem, spec, st[0], v) : snprintf(o, rem, spec, st[0], st[1], v);
+				break;
+			}
+			default: break;
+		}
+		if (w > 0) pos += (size_t)w < rem ? (size_t)w : rem - 1;
+	}
+	out[pos] = '\0';
+	if (pos + 1 >= cap && cap > 4) memcpy(out + cap - 4, "...", 4);
+	return pos;
 }
 
-void log_message(LogLevel level, const char* function, const char* format, ...) {
-	if (level < current_log_level) return;
-	thread_mutex_lock(&log_mutex);
-	time_t t = time(NULL);
+typedef struct {
+	char con[LOG_BATCH_BYTES];
+	size_t con_len;
+	char file[LOG_BATCH_BYTES];
+	size_t file_len;
+	time_t last_ts;
 	char time_str[32];
-	struct tm tm_buf;
-	if (platform_localtime(t, &tm_buf) == 0) {
-		strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_buf);
-	} else {
-		strncpy(time_str, "1970-01-01 00:00:00", sizeof(time_str));
-		time_str[sizeof(time_str)-1] = '\0';
+} log_batch_t;
+
+static void batch_flush(log_batch_t* b) {
+	if (b->con_len) fwrite(b->con, 1, b->con_len, stderr);
+	if (b->file_len && log_file) {
+		fwrite(b->file, 1, b->file_len, log_file);
+		fflush(log_file);
 	}
+	b->con_len = b->file_len = 0;
+}
 
+static void batch_append(log_batch_t* b, const log_record_t* r, unsigned long tid) {
+#ifdef DEBUG_DIAGNOSTIC
 	unsigned int pid = platform_get_pid();
-	unsigned long tid = platform_get_tid();
+#else
+	(void)tid;
+#endif
+	if (r->ts != b->last_ts || !b->time_str[0]) {
+		struct tm tm_buf;
+		if (platform_localtime(r->ts, &tm_buf) == 0) {
+			strftime(b->time_str, sizeof(b->time_str), "%Y-%m-%d %H:%M:%S", &tm_buf);
+		} else {
+			strncpy(b->time_str, "1970-01-01 00:00:00", sizeof(b->time_str));
+			b->time_str[sizeof(b->time_str)-1] = '\0';
+		}
+		b->last_ts = r->ts;
+	}
+	const char* time_str = b->time_str;
+	const char* function = r->function;
 
 	const char* level_str;
 	const char* level_color_str=ANSI_COLOR_RESET;
 
-	switch(level) {
+	switch(r->level) {
 		case LOG_LEVEL_DEBUG:
 			level_str="DBG";
 			level_color_str=ANSI_COLOR_CYAN;
@@ -75,28 +276,21 @@ void log_message(LogLevel level, const char* function, const char* format, ...)
 	}
 
 	char message_buffer[MAX_LOG_MESSAGE_LENGTH+4];
-	va_list args;
-	va_start(args, format);
-	size_t required_size=vsnprintf(message_buffer, sizeof(message_buffer), format, args);
-	va_end(args);
+	format_record(r, message_buffer, sizeof(message_buffer));
 
-	if(required_size>=sizeof(message_buffer)-1) {
-		message_buffer[sizeof(message_buffer)-4]='.';
-		message_buffer[sizeof(message_buffer)-3]='.';
-		message_buffer[sizeof(message_buffer)-2]='.';
-		message_buffer[sizeof(message_buffer)-1]='\0';
-	}
 	int use_color = platform_should_use_colors();
 	const char* color_reset = use_color ? ANSI_COLOR_RESET : "";
 	const char* ts_color = use_color ? ANSI_COLOR_BRIGHT_BLUE : "";
-	const char* func_color = use_color ? ANSI_COLOR_MAGENTA : ""; 
-	const char* pid_color = use_color ? ANSI_COLOR_BRIGHT_YELLOW : ""; 
+	const char* func_color = use_color ? ANSI_COLOR_MAGENTA : "";
+	const char* pid_color = use_color ? ANSI_COLOR_BRIGHT_YELLOW : "";
 	const char* level_prefix = use_color ? level_color_str : "";
-	char outbuf[512 + MAX_LOG_MESSAGE_LENGTH];
+	size_t need = 512 + MAX_LOG_MESSAGE_LENGTH;
+	if (b->con_len + need > sizeof(b->con) || b->file_len + need > sizeof(b->file)) batch_flush(b);
+	char* outbuf = b->con + b->con_len;
 	int out_len = 0;
 #ifdef DEBUG_DIAGNOSTIC
 	if (use_color) {
-		out_len = snprintf(outbuf, sizeof(outbuf), "%s[%s]%s %s[%u:%lu]%s %s[%s]%s %s%s%s: %s\n",
+		out_len = snprintf(outbuf, need, "%s[%s]%s %s[%u:%lu]%s %s[%s]%s %s%s%s: %s\n",
 			ts_color, time_str, color_reset,
 			pid_color, pid, tid, color_reset,
 			level_prefix, level_str, color_reset,
@@ -104,32 +298,210 @@ void log_message(LogLevel level, const char* function, const char* format, ...)
 			message_buffer);
 	}
 	else {
-		out_len = snprintf(outbuf, sizeof(outbuf), "[%s] [%u:%lu] [%s] %s: %s\n",
+		out_len = snprintf(outbuf, need, "[%s] [%u:%lu] [%s] %s: %s\n",
 			time_str, pid, tid, level_str, function, message_buffer);
 	}
 #else
 	if (use_color) {
-		out_len = snprintf(outbuf, sizeof(outbuf), "%s[%s]%s %s[%s]%s %s\n",
+		out_len = snprintf(outbuf, need, "%s[%s]%s %s[%s]%s %s\n",
 			ts_color, time_str, color_reset,
 			level_prefix, level_str, color_reset,
 			message_buffer);
 	}
 	else {
-		out_len = snprintf(outbuf, sizeof(outbuf), "[%s] [%s] %s: %s\n",
+		out_len = snprintf(outbuf, need, "[%s] [%s] %s: %s\n",
 			time_str, level_str, function, message_buffer);
 	}
 #endif
 	if(out_len < 0) out_len = 0;
-	if((size_t)out_len >= sizeof(outbuf)) out_len = sizeof(outbuf) - 1;
-	fwrite(outbuf, 1, out_len, stderr);
+	if((size_t)out_len >= need) out_len = (int)need - 1;
+	b->con_len += (size_t)out_len;
 	if(log_file) {
 #ifdef DEBUG_DIAGNOSTIC
-		fprintf(log_file, "[%s] [%u:%lu] [%s] %s: %s\n", time_str, pid, tid, level_str, function, message_buffer);
+		out_len = snprintf(b->file + b->file_len, need, "[%s] [%u:%lu] [%s] %s: %s\n", time_str, pid, tid, level_str, function, message_buffer);
 #else
-		fprintf(log_file, "[%s] [%s] %s: %s\n", time_str, level_str, function, message_buffer);
+		out_len = snprintf(b->file + b->file_len, need, "[%s] [%s] %s: %s\n", time_str, level_str, function, message_buffer);
 #endif
-		fflush(log_file);
+		if(out_len < 0) out_len = 0;
+		if((size_t)out_len >= need) out_len = (int)need - 1;
+		b->file_len += (size_t)out_len;
+	}
+}
+
+/* Writes every published record, oldest sequence first. Only one thread
+ * drains at a time; returns the number of records written, or -1 when
+ * another thread already holds the drain. */
+static long drain_rings(void) {
+	static log_batch_t batch;
+	if (atomic_flag_test_and_set(&log_draining)) return -1;
+	long written = 0;
+	size_t dropped = atomic_exchange(&log_dropped, 0);
+	if (dropped) {
+		log_record_t note = { 0 };
+		note.ts = time(NULL);
+		note.function = __func__;
+		note.level = LOG_LEVEL_WARN;
+		note.arg_len = (uint16_t)snprintf((char*)note.args, sizeof(note.args), "%zu log records dropped, writer fell behind", dropped);
+		batch_append(&batch, &note, platform_get_tid());
+	}
+	for (;;) {
+		int n = atomic_load(&ring_count);
+		log_ring_t* best = NULL;
+		size_t best_tail = 0;
+		for (int i = 0; i < n; i++) {
+			log_ring_t* r = rings[i];
+			size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+			size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+			if (tail == head) {
+				int st = RING_RELEASED;
+				atomic_compare_exchange_strong(&r->state, &st, RING_FREE);
+				continue;
+			}
+			if (!best || r->slots[tail % LOG_RING_SLOTS].seq < best->slots[best_tail % LOG_RING_SLOTS].seq) {
+				best = r;
+				best_tail = tail;
+			}
+		}
+		if (!best) break;
+		batch_append(&batch, &best->slots[best_tail % LOG_RING_SLOTS], best->tid);
+		atomic_store_explicit(&best->tail, best_tail + 1, memory_order_release);
+		written++;
 	}
+	batch_flush(&batch);
+	atomic_flag_clear(&log_draining);
+	return written;
+}
+
+static void ring_release(void* p) {
+	log_ring_t* r = p;
+	if (r) atomic_store(&r->state, RING_RELEASED);
+}
 
+#ifdef _WIN32
+static void NTAPI ring_fls_release(void* p) { ring_release(p); }
+#endif
+
+static log_ring_t* ring_claim(void) {
+	log_ring_t* r = NULL;
+	int n = atomic_load(&ring_count);
+	for (int i = 0; i < n && !r; i++) {
+		int st = RING_FREE;
+		if (atomic_compare_exchange_strong(&rings[i]->state, &st, RING_OWNED)) r = rings[i];
+	}
+	if (!r) {
+		thread_mutex_lock(&ring_mutex);
+		n = atomic_load(&ring_count);
+		if (n < LOG_MAX_RINGS && (r = calloc(1, sizeof(log_ring_t)))) {
+			atomic_init(&r->state, RING_OWNED);
+			rings[n] = r;
+			atomic_store(&ring_count, n + 1);
+		}
+		thread_mutex_unlock(&ring_mutex);
+	}
+	if (!r) return NULL;
+	r->tid = platform_get_tid();
+#ifdef _WIN32
+	FlsSetValue(ring_fls, r);
+#else
+	pthread_setspecific(ring_key, r);
+#endif
+	return r;
+}
+
+static void* log_writer_thread(void* arg) {
+	(void)arg;
+	for (;;) {
+		if (drain_rings() <= 0) platform_sleep_ms(LOG_IDLE_SLEEP_MS);
+	}
+	return NULL;
+}
+
+void log_flush(void) {
+	if (!atomic_load(&log_async)) return;
+	for (int i = 0; i < 200 && drain_rings() < 0; i++) platform_sleep_ms(1);
+}
+
+void log_init(void) {
+	if(mk_dir(LOG_DIR)!=0) {
+		if(errno!=EEXIST) {
+			fprintf(stderr, "WARN: Could not create log directory %s\n", LOG_DIR);
+		}
+	}
+	char log_path[PATH_MAX];
+	time_t t=time(NULL);
+	struct tm* tm=localtime(&t);
+	snprintf(log_path, PATH_MAX, "%s/%04d-%02d-%02d_%02d-%02d-%02d.log",
+		LOG_DIR, tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday,
+		tm->tm_hour, tm->tm_min, tm->tm_sec);
+	log_file=platform_fopen(log_path, "a");
+	if(!log_file) {
+		fprintf(stderr, "WARN: Could not open log file %s\n", log_path);
+	}
+	platform_enable_console_colors();
+	thread_mutex_init(&log_mutex);
+	thread_mutex_init(&ring_mutex);
+#ifdef _WIN32
+	ring_fls = FlsAlloc(ring_fls_release);
+	int have_key = ring_fls != FLS_OUT_OF_INDEXES;
+#else
+	int have_key = pthread_key_create(&ring_key, ring_release) == 0;
+#endif
+	if (have_key && thread_create_detached(log_writer_thread, NULL) == 0) {
+		atomic_store(&log_async, 1);
+		atexit(log_flush);
+	} else {
+		fprintf(stderr, "WARN: Could not start log writer thread, logging synchronously\n");
+	}
+}
+
+void log_message(LogLevel level, const char* function, const char* format, ...) {
+	if (level < current_log_level) return;
+	log_ring_t* r = NULL;
+	if (atomic_load_explicit(&log_async, memory_order_relaxed)) {
+		r = t_ring;
+		if (!r && !t_ring_failed) {
+			r = t_ring = ring_claim();
+			t_ring_failed = r == NULL;
+		}
+	}
+	log_record_t local;
+	log_record_t* rec = &local;
+	size_t head = 0;
+	if (r) {
+		head = atomic_load_explicit(&r->head, memory_order_relaxed);
+		for (int spins = 0; head - atomic_load_explicit(&r->tail, memory_order_acquire) >= LOG_RING_SLOTS; spins++) {
+			if (spins >= LOG_FULL_SPINS) {
+				atomic_fetch_add(&log_dropped, 1);
+				return;
+			}
+			platform_sleep_ms(0);
+		}
+		rec = &r->slots[head % LOG_RING_SLOTS];
+	}
+	rec->seq = atomic_fetch_add_explicit(&log_seq, 1, memory_order_relaxed);
+	rec->ts = time(NULL);
+	rec->function = function;
+	rec->format = format;
+	rec->level = (uint8_t)level;
+	va_list args, copy;
+	va_start(args, format);
+	va_copy(copy, args);
+	int n = pack_args(format, args, rec->args, sizeof(rec->args));
+	if (n < 0) {
+		rec->format = NULL;
+		vsnprintf((char*)rec->args, sizeof(rec->args), format, copy);
+		n = (int)strnlen((const char*)rec->args, sizeof(rec->args));
+	}
+	va_end(copy);
+	va_end(args);
+	rec->arg_len = (uint16_t)n;
+	if (r) {
+		atomic_store_explicit(&r->head, head + 1, memory_order_release);
+		return;
+	}
+	static log_batch_t sync_batch;
+	thread_mutex_lock(&log_mutex);
+	batch_append(&sync_batch, rec, platform_get_tid());
+	batch_flush(&sync_batch);
 	thread_mutex_unlock(&log_mutex);
-}
\ No newline at end of file
+}
@@ -11,45 +11,50 @@
 #include "exception_handler.h"
 #include "platform.h"
 #include "websocket.h"
+#include "asset_cache.h"
+#include "bandwidth.h"
+#include "path_intern.h"
+#include "fd_cache.h"
+#include "thumb_cache.h"
+#include "thumb_pack.h"
+#include "startup.h"
+#include "timer_wheel.h"
+#include "governor.h"
+#include "io_budget.h"
+#include "hls.h"
+#include "media_info.h"
 
 int main(int argc, char** argv) {
+    startup_begin();
     log_init();
     install_exception_handlers();
     LOG_DEBUG("startup: installed exception handlers");
     LOG_DEBUG("startup: after log_init");
     platform_init_network();
     LOG_DEBUG("startup: after INIT_NETWORK");
+    timer_wheel_init();
     websocket_init();
     derive_paths(argc > 0 ? argv[0] : NULL);
     LOG_DEBUG("startup: after derive_paths");
+    path_intern_init();
+    fd_cache_init();
     load_config();
     LOG_DEBUG("startup: after load_config");
+    asset_cache_init();
+    http_init();
+    bw_init(stream_bandwidth);
+    io_budget_init(scan_io_bandwidth, scan_iops);
+    thumb_cache_init(thumb_cache_size);
+    thumb_pack_init();
+    hls_init(hls_cache_size);
+    media_info_init();
+    governor_init();
     if (platform_maximize_window() == 0) {
         LOG_DEBUG("startup: platform_maximize_window succeeded");
     }
     else {
         LOG_DEBUG("startup: platform_maximize_window not available or failed");
     }
-    LOG_DEBUG("Registering gallery folder watchers and starting thumbnail maintenance on startup...");
-    LOG_DEBUG("startup: about to get_gallery_folders");
-    {
-        size_t count = 0;
-        char** folders = get_gallery_folders(&count);
-        LOG_DEBUG("startup: get_gallery_folders returned count=%zu", count);
-        if (count == 0) {
-            LOG_WARN("No gallery folders configured.");
-        }
-        else {
-            LOG_DEBUG("Registering directory watcher for %zu folder(s)", count);
-            for (size_t i = 0; i < count; ++i) {
-                LOG_DEBUG("startup: registering watcher for folder[%zu]=%s", i, folders[i]);
-                start_auto_thumb_watcher(folders[i]);
-                LOG_DEBUG("startup: watcher registered for folder[%zu]", i);
-            }
-        }
-    }
-    LOG_DEBUG("Scanning for missing thumbnails on startup...");
-    scan_and_generate_missing_thumbs();
     LOG_DEBUG("startup: about to create_listen_socket");
     int port = 3000;
     int s = create_listen_socket(port);
@@ -59,10 +64,13 @@ int main(int argc, char** argv) {
         platform_cleanup_network();
         return 1;
     }
+    startup_mark_listening();
     LOG_INFO("Gallery server running on http://localhost:%d", port);
     LOG_DEBUG("startup: about to start_thread_pool");
     start_thread_pool(0);
     LOG_DEBUG("startup: after start_thread_pool");
+    LOG_DEBUG("Registering gallery folder watchers, loading thumbdbs and scanning for missing thumbnails in the background...");
+    startup_run_background();
     int wait_ct = 0;
     for (;;) {
         struct sockaddr_in ca;
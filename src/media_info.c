@@ -0,0 +1,745 @@
+#include "media_info.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#define FOURCC(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+#define MKV_EBML 0x1A45DFA3u
+#define MKV_SEGMENT 0x18538067u
+#define MKV_INFO 0x1549A966u
+#define MKV_TIMECODE_SCALE 0x2AD7B1u
+#define MKV_DURATION 0x4489u
+#define MKV_TRACKS 0x1654AE6Bu
+#define MKV_TRACK_ENTRY 0xAEu
+#define MKV_TRACK_TYPE 0x83u
+#define MKV_CODEC_ID 0x86u
+#define MKV_VIDEO 0xE0u
+#define MKV_PIXEL_WIDTH 0xB0u
+#define MKV_PIXEL_HEIGHT 0xBAu
+#define MKV_CLUSTER 0x1F43B675u
+#define MKV_SEEK_HEAD 0x114D9B74u
+#define MKV_SEEK 0x4DBBu
+#define MKV_SEEK_ID 0x53ABu
+#define MKV_SEEK_POSITION 0x53ACu
+#define MKV_TRACK_NUMBER 0xD7u
+#define MKV_CUES 0x1C53BB6Bu
+#define MKV_CUE_POINT 0xBBu
+#define MKV_CUE_TIME 0xB3u
+#define MKV_CUE_TRACK_POSITIONS 0xB7u
+#define MKV_CUE_TRACK 0xF7u
+
+/* Reads from fd, or from buf when an index has been loaded into memory. */
+typedef struct media_reader {
+    int fd;
+    uint64_t size;
+    const unsigned char* buf;
+} media_reader_t;
+
+typedef struct media_info_entry {
+    char* path;
+    long long size;
+    time_t mtime;
+    int rc;
+    media_info_t info;
+} media_info_entry_t;
+
+typedef struct codec_alias {
+    const char* tag;
+    const char* name;
+} codec_alias_t;
+
+static const codec_alias_t fourcc_aliases[] = {
+    { "avc1", "h264" }, { "avc3", "h264" }, { "h264", "h264" }, { "x264", "h264" },
+    { "hvc1", "hevc" }, { "hev1", "hevc" }, { "av01", "av1" }, { "vp09", "vp9" }, { "vp08", "vp8" },
+    { "mp4v", "mpeg4" }, { "xvid", "mpeg4" }, { "divx", "mpeg4" }, { "dx50", "mpeg4" }, { "fmp4", "mpeg4" },
+    { "mjpg", "mjpeg" }, { NULL, NULL }
+};
+
+static const codec_alias_t mkv_aliases[] = {
+    { "V_VP8", "vp8" }, { "V_VP9", "vp9" }, { "V_AV1", "av1" },
+    { "V_MPEG4/ISO/AVC", "h264" }, { "V_MPEGH/ISO/HEVC", "hevc" }, { "V_MPEG4/ISO/ASP", "mpeg4" },
+    { NULL, NULL }
+};
+
+/* Direct-mapped: a path hashing onto an occupied slot simply replaces it. */
+static thread_mutex_t cache_mutex;
+static atomic_int cache_ready = ATOMIC_VAR_INIT(0);
+static media_info_entry_t cache[MEDIA_INFO_CACHE_ENTRIES];
+
+static uint32_t path_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static uint32_t be16(const unsigned char* p) { return ((uint32_t)p[0] << 8) | p[1]; }
+static uint32_t be32(const unsigned char* p) { return (be16(p) << 16) | be16(p + 2); }
+static uint64_t be64(const unsigned char* p) { return ((uint64_t)be32(p) << 32) | be32(p + 4); }
+static uint32_t le16(const unsigned char* p) { return ((uint32_t)p[1] << 8) | p[0]; }
+static uint32_t le24(const unsigned char* p) { return ((uint32_t)p[2] << 16) | le16(p); }
+static uint32_t le32(const unsigned char* p) { return ((uint32_t)p[3] << 24) | le24(p); }
+
+static int read_at(const media_reader_t* r, uint64_t off, void* buf, size_t len) {
+    if (off > r->size || len > r->size - off) return -1;
+    if (r->buf) {
+        memcpy(buf, r->buf + off, len);
+        return 0;
+    }
+    return platform_pread(r->fd, buf, len, off) == (long)len ? 0 : -1;
+}
+
+static int set_dims(media_info_t* mi, uint32_t w, uint32_t h, int swap) {
+    if (w == 0 || h == 0 || w > MEDIA_INFO_MAX_DIM || h > MEDIA_INFO_MAX_DIM) return -1;
+    mi->width = (int)(swap ? h : w);
+    mi->height = (int)(swap ? w : h);
+    return 0;
+}
+
+static void set_codec(media_info_t* mi, const char* tag, const codec_alias_t* aliases, int fold) {
+    for (size_t i = 0; aliases[i].tag; ++i) {
+        if ((fold ? ascii_stricmp(tag, aliases[i].tag) : strcmp(tag, aliases[i].tag)) == 0) {
+            snprintf(mi->codec, sizeof(mi->codec), "%s", aliases[i].name);
+            return;
+        }
+    }
+    size_t n = 0;
+    for (const char* p = tag; *p && n < sizeof(mi->codec) - 1; ++p)
+        if (isalnum((unsigned char)*p)) mi->codec[n++] = (char)tolower((unsigned char)*p);
+    mi->codec[n] = '\0';
+}
+
+static void set_codec_fourcc(media_info_t* mi, uint32_t cc) {
+    char tag[5] = { (char)(cc >> 24), (char)(cc >> 16), (char)(cc >> 8), (char)cc, '\0' };
+    set_codec(mi, tag, fourcc_aliases, 1);
+}
+
+/* Orientation tag of the IFD0 inside an APP1 payload; 1 when absent. */
+static int exif_orientation(const media_reader_t* r, uint64_t off, size_t len) {
+    unsigned char b[MEDIA_INFO_EXIF_SCAN];
+    size_t n = len < sizeof(b) ? len : sizeof(b);
+    if (n < 16 || read_at(r, off, b, n) != 0 || memcmp(b, "Exif\0\0", 6) != 0) return 1;
+    const unsigned char* t = b + 6;
+    size_t tn = n - 6;
+    int le = t[0] == 'I' && t[1] == 'I';
+    if (!le && !(t[0] == 'M' && t[1] == 'M')) return 1;
+    size_t ifd = le ? le32(t + 4) : be32(t + 4);
+    if (ifd + 2 > tn) return 1;
+    uint32_t count = le ? le16(t + ifd) : be16(t + ifd);
+    for (uint32_t i = 0; i < count; ++i) {
+        size_t e = ifd + 2 + (size_t)i * 12;
+        if (e + 12 > tn) break;
+        if ((le ? le16(t + e) : be16(t + e)) == 0x0112) return (int)(le ? le16(t + e + 8) : be16(t + e + 8));
+    }
+    return 1;
+}
+
+/* Steps over marker segments up to the first SOFn, which carries the frame
+ * size; an EXIF orientation of 5-8 means the image is displayed rotated. */
+static int probe_jpeg(const media_reader_t* r, media_info_t* mi) {
+    uint64_t off = 2;
+    int orientation = 1;
+    for (int n = 0; n < MEDIA_INFO_MAX_JPEG_SEGMENTS; ++n) {
+        unsigned char m[2];
+        if (read_at(r, off, m, 2) != 0 || m[0] != 0xFF) return -1;
+        if (m[1] == 0xFF) { off++; continue; }
+        unsigned char marker = m[1];
+        off += 2;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+        if (marker == 0xD9 || marker == 0xDA) return -1;
+        if (read_at(r, off, m, 2) != 0) return -1;
+        uint32_t seg_len = be16(m);
+        if (seg_len < 2) return -1;
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            unsigned char sof[5];
+            if (read_at(r, off + 2, sof, sizeof(sof)) != 0) return -1;
+            snprintf(mi->codec, sizeof(mi->codec), "jpeg");
+            return set_dims(mi, be16(sof + 3), be16(sof + 1), orientation >= 5 && orientation <= 8);
+        }
+        if (marker == 0xE1) orientation = exif_orientation(r, off + 2, seg_len - 2);
+        off += seg_len;
+    }
+    return -1;
+}
+
+static int probe_png(const media_reader_t* r, media_info_t* mi) {
+    unsigned char b[24];
+    if (read_at(r, 0, b, sizeof(b)) != 0 || memcmp(b + 12, "IHDR", 4) != 0) return -1;
+    snprintf(mi->codec, sizeof(mi->codec), "png");
+    return set_dims(mi, be32(b + 16), be32(b + 20), 0);
+}
+
+static int probe_gif(const media_reader_t* r, media_info_t* mi) {
+    unsigned char b[10];
+    if (read_at(r, 0, b, sizeof(b)) != 0) return -1;
+    snprintf(mi->codec, sizeof(mi->codec), "gif");
+    return set_dims(mi, le16(b + 6), le16(b + 8), 0);
+}
+
+/* The first chunk is VP8 (lossy key frame header), VP8L (lossless header
+ * bits) or VP8X (canvas size, used by animated and alpha files). */
+static int probe_webp(const media_reader_t* r, media_info_t* mi) {
+    unsigned char b[30];
+    if (read_at(r, 0, b, sizeof(b)) != 0) return -1;
+    snprintf(mi->codec, sizeof(mi->codec), "webp");
+    if (memcmp(b + 12, "VP8 ", 4) == 0) {
+        if (b[23] != 0x9D || b[24] != 0x01 || b[25] != 0x2A) return -1;
+        return set_dims(mi, le16(b + 26) & 0x3FFF, le16(b + 28) & 0x3FFF, 0);
+    }
+    if (memcmp(b + 12, "VP8L", 4) == 0) {
+        if (b[20] != 0x2F) return -1;
+        uint32_t bits = le32(b + 21);
+        return set_dims(mi, (bits & 0x3FFF) + 1, ((bits >> 14) & 0x3FFF) + 1, 0);
+    }
+    if (memcmp(b + 12, "VP8X", 4) == 0)
+        return set_dims(mi, le24(b + 24) + 1, le24(b + 27) + 1, 0);
+    return -1;
+}
+
+/* Main AVI header and the first stream header, which RIFF writers always
+ * put at fixed offsets at the start of the hdrl list. */
+static int probe_avi(const media_reader_t* r, media_info_t* mi) {
+    unsigned char b[116];
+    if (read_at(r, 0, b, sizeof(b)) != 0) return -1;
+    if (memcmp(b + 12, "LIST", 4) != 0 || memcmp(b + 20, "hdrl", 4) != 0 || memcmp(b + 24, "avih", 4) != 0) return -1;
+    uint64_t frame_us = le32(b + 32), frames = le32(b + 48);
+    mi->duration_ms = frame_us * frames / 1000;
+    if (memcmp(b + 100, "strh", 4) == 0 && memcmp(b + 108, "vids", 4) == 0) set_codec_fourcc(mi, be32(b + 112));
+    return set_dims(mi, le32(b + 64), le32(b + 68), 0);
+}
+
+/* Finds the first box of type in [off, end) and returns its payload. */
+static int mp4_find(const media_reader_t* r, uint64_t off, uint64_t end, uint32_t type, uint64_t* body, uint64_t* body_end) {
+    for (int n = 0; off + 8 <= end && n < MEDIA_INFO_MAX_BOXES; ++n) {
+        unsigned char h[16];
+        size_t avail = end - off < sizeof(h) ? (size_t)(end - off) : sizeof(h);
+        if (read_at(r, off, h, avail) != 0) return -1;
+        uint64_t size = be32(h);
+        size_t hlen = 8;
+        if (size == 1) {
+            if (avail < 16) return -1;
+            size = be64(h + 8);
+            hlen = 16;
+        }
+        else if (size == 0) {
+            size = end - off;
+        }
+        if (size < hlen || size > end - off) return -1;
+        if (be32(h + 4) == type) {
+            *body = off + hlen;
+            *body_end = off + size;
+            return 0;
+        }
+        off += size;
+    }
+    return -1;
+}
+
+static int mp4_find_path(const media_reader_t* r, uint64_t off, uint64_t end, const uint32_t* types, int n, uint64_t* body, uint64_t* body_end) {
+    for (int i = 0; i < n; ++i) {
+        if (mp4_find(r, off, end, types[i], body, body_end) != 0) return -1;
+        off = *body;
+        end = *body_end;
+    }
+    return 0;
+}
+
+/* tkhd holds the presentation size as 16.16 fixed point after a 3x3
+ * matrix; a matrix with a == 0 and b != 0 rotates by 90 or 270 degrees.
+ * Tracks that leave the size at zero fall back to the sample entry. */
+static int mp4_video_track(const media_reader_t* r, uint64_t trak, uint64_t trak_end, media_info_t* mi) {
+    static const uint32_t hdlr_path[] = { FOURCC('m', 'd', 'i', 'a'), FOURCC('h', 'd', 'l', 'r') };
+    static const uint32_t stsd_path[] = { FOURCC('m', 'd', 'i', 'a'), FOURCC('m', 'i', 'n', 'f'), FOURCC('s', 't', 'b', 'l'), FOURCC('s', 't', 's', 'd') };
+    uint64_t b, e;
+    unsigned char h[96];
+    if (mp4_find_path(r, trak, trak_end, hdlr_path, 2, &b, &e) != 0 || e - b < 12 || read_at(r, b, h, 12) != 0) return -1;
+    if (be32(h + 8) != FOURCC('v', 'i', 'd', 'e')) return -1;
+    uint32_t w = 0, hh = 0;
+    int swap = 0;
+    if (mp4_find(r, trak, trak_end, FOURCC('t', 'k', 'h', 'd'), &b, &e) == 0 && e > b && read_at(r, b, h, 1) == 0) {
+        size_t mx = h[0] == 1 ? 52 : 40;
+        if (e - b >= mx + 44 && read_at(r, b, h, mx + 44) == 0) {
+            w = be32(h + mx + 36) >> 16;
+            hh = be32(h + mx + 40) >> 16;
+            swap = be32(h + mx) == 0 && be32(h + mx + 4) != 0;
+        }
+    }
+    if (mp4_find_path(r, trak, trak_end, stsd_path, 4, &b, &e) == 0 && e - b >= 44 && read_at(r, b, h, 44) == 0) {
+        set_codec_fourcc(mi, be32(h + 12));
+        if (!w || !hh) {
+            w = be16(h + 40);
+            hh = be16(h + 42);
+            swap = 0;
+        }
+    }
+    return set_dims(mi, w, hh, swap);
+}
+
+static int probe_mp4(const media_reader_t* r, media_info_t* mi) {
+    uint64_t moov, moov_end, b, e;
+    if (mp4_find(r, 0, r->size, FOURCC('m', 'o', 'o', 'v'), &moov, &moov_end) != 0) return -1;
+    unsigned char h[32];
+    if (mp4_find(r, moov, moov_end, FOURCC('m', 'v', 'h', 'd'), &b, &e) == 0 && e - b >= 32 && read_at(r, b, h, 32) == 0) {
+        uint32_t scale = h[0] == 1 ? be32(h + 20) : be32(h + 12);
+        uint64_t dur = h[0] == 1 ? be64(h + 24) : be32(h + 16);
+        if (scale && dur != UINT64_MAX && dur != 0xFFFFFFFFu) mi->duration_ms = dur / scale * 1000 + dur % scale * 1000 / scale;
+    }
+    uint64_t off = moov, trak, trak_end;
+    while (mp4_find(r, off, moov_end, FOURCC('t', 'r', 'a', 'k'), &trak, &trak_end) == 0) {
+        off = trak_end;
+        if (mp4_video_track(r, trak, trak_end, mi) == 0) return 0;
+    }
+    return -1;
+}
+
+/* Reads an EBML variable-length integer. Element IDs keep their length
+ * marker, sizes drop it. Returns the encoded length, or 0 when malformed. */
+static int ebml_vint(const media_reader_t* r, uint64_t off, int max_len, int keep_marker, uint64_t* out, int* unknown) {
+    unsigned char b[8];
+    if (read_at(r, off, b, 1) != 0 || b[0] == 0) return 0;
+    int len = 1;
+    while (!(b[0] & (0x80 >> (len - 1)))) len++;
+    if (len > max_len || (len > 1 && read_at(r, off + 1, b + 1, (size_t)len - 1) != 0)) return 0;
+    uint64_t v = keep_marker ? b[0] : (uint64_t)(b[0] & (0xFF >> len));
+    int all_ones = v == (uint64_t)(0xFF >> len);
+    for (int i = 1; i < len; ++i) {
+        v = (v << 8) | b[i];
+        all_ones = all_ones && b[i] == 0xFF;
+    }
+    if (unknown) *unknown = !keep_marker && all_ones;
+    *out = v;
+    return len;
+}
+
+/* Element header at off inside a parent ending at end. An unknown size
+ * (live-written files) extends the element to the end of its parent. */
+static int mkv_element(const media_reader_t* r, uint64_t off, uint64_t end, uint32_t* id, uint64_t* body, uint64_t* body_end, int* unknown) {
+    uint64_t v, size;
+    int a = ebml_vint(r, off, 4, 1, &v, NULL);
+    if (!a) return -1;
+    int b = ebml_vint(r, off + (uint64_t)a, 8, 0, &size, unknown);
+    if (!b) return -1;
+    *id = (uint32_t)v;
+    *body = off + (uint64_t)a + (uint64_t)b;
+    if (*body > end) return -1;
+    if (*unknown) size = end - *body;
+    if (size > end - *body) return -1;
+    *body_end = *body + size;
+    return 0;
+}
+
+static uint64_t mkv_uint(const media_reader_t* r, uint64_t off, uint64_t end) {
+    unsigned char b[8];
+    size_t n = end - off > 8 ? 8 : (size_t)(end - off);
+    uint64_t v = 0;
+    if (read_at(r, off, b, n) != 0) return 0;
+    for (size_t i = 0; i < n; ++i) v = (v << 8) | b[i];
+    return v;
+}
+
+static double mkv_float(const media_reader_t* r, uint64_t off, uint64_t end) {
+    uint64_t bits = mkv_uint(r, off, end);
+    if (end - off == 4) {
+        uint32_t b32 = (uint32_t)bits;
+        float f;
+        memcpy(&f, &b32, sizeof(f));
+        return f;
+    }
+    if (end - off != 8) return 0;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static int mkv_track(const media_reader_t* r, uint64_t off, uint64_t end, media_info_t* mi) {
+    uint64_t type = 0, w = 0, h = 0;
+    char codec[32] = "";
+    for (int n = 0; off < end && n < MEDIA_INFO_MAX_ELEMENTS; ++n) {
+        uint32_t id;
+        uint64_t b, e;
+        int unknown;
+        if (mkv_element(r, off, end, &id, &b, &e, &unknown) != 0) return -1;
+        if (id == MKV_TRACK_TYPE) type = mkv_uint(r, b, e);
+        else if (id == MKV_CODEC_ID) {
+            size_t len = e - b < sizeof(codec) - 1 ? (size_t)(e - b) : sizeof(codec) - 1;
+            if (read_at(r, b, codec, len) == 0) codec[len] = '\0';
+        }
+        else if (id == MKV_VIDEO) {
+            uint64_t vo = b;
+            for (int k = 0; vo < e && k < MEDIA_INFO_MAX_ELEMENTS; ++k) {
+                uint32_t vid;
+                uint64_t vb, ve;
+                if (mkv_element(r, vo, e, &vid, &vb, &ve, &unknown) != 0) break;
+                if (vid == MKV_PIXEL_WIDTH) w = mkv_uint(r, vb, ve);
+                else if (vid == MKV_PIXEL_HEIGHT) h = mkv_uint(r, vb, ve);
+                vo = ve;
+            }
+        }
+        off = e;
+    }
+    if (type != 1 || w > MEDIA_INFO_MAX_DIM || h > MEDIA_INFO_MAX_DIM) return -1;
+    if (codec[0]) set_codec(mi, codec, mkv_aliases, 0);
+    return set_dims(mi, (uint32_t)w, (uint32_t)h, 0);
+}
+
+/* Walks the Segment's top-level elements, taking duration from Info and
+ * the first video TrackEntry from Tracks; Clusters are skipped by size, so
+ * only a tail-indexed file reads past the first few KB. */
+static int probe_mkv(const media_reader_t* r, media_info_t* mi) {
+    uint32_t id;
+    uint64_t b, e, off;
+    int unknown;
+    if (mkv_element(r, 0, r->size, &id, &b, &e, &unknown) != 0 || id != MKV_EBML) return -1;
+    if (mkv_element(r, e, r->size, &id, &b, &e, &unknown) != 0 || id != MKV_SEGMENT) return -1;
+    uint64_t seg_end = e;
+    uint64_t scale = 1000000;
+    double duration = 0;
+    int have_track = 0;
+    off = b;
+    for (int n = 0; off < seg_end && n < MEDIA_INFO_MAX_ELEMENTS; ++n) {
+        if (mkv_element(r, off, seg_end, &id, &b, &e, &unknown) != 0) break;
+        if (id == MKV_INFO) {
+            for (uint64_t io = b; io < e;) {
+                uint32_t iid;
+                uint64_t ib, ie;
+                if (mkv_element(r, io, e, &iid, &ib, &ie, &unknown) != 0) break;
+                if (iid == MKV_TIMECODE_SCALE) scale = mkv_uint(r, ib, ie);
+                else if (iid == MKV_DURATION) duration = mkv_float(r, ib, ie);
+                io = ie;
+            }
+        }
+        else if (id == MKV_TRACKS && !have_track) {
+            for (uint64_t to = b; to < e && !have_track;) {
+                uint32_t tid;
+                uint64_t tb, te;
+                if (mkv_element(r, to, e, &tid, &tb, &te, &unknown) != 0) break;
+                if (tid == MKV_TRACK_ENTRY && mkv_track(r, tb, te, mi) == 0) have_track = 1;
+                to = te;
+            }
+        }
+        else if (id == MKV_CLUSTER && (have_track || unknown)) {
+            break;
+        }
+        off = e;
+    }
+    if (duration > 0 && scale) mi->duration_ms = (uint64_t)(duration * (double)scale / 1000000.0);
+    return have_track ? 0 : -1;
+}
+
+/* Loads a sample table (version and flags, entry count, then entries of esz
+ * bytes) in one read. A missing table leaves *out NULL and is not an error. */
+static int mp4_table(const media_reader_t* r, uint64_t stbl, uint64_t stbl_end, uint32_t type, size_t esz, unsigned char** out, uint32_t* entries) {
+    uint64_t b, e;
+    *out = NULL;
+    *entries = 0;
+    if (mp4_find(r, stbl, stbl_end, type, &b, &e) != 0) return 0;
+    if (e - b < 8 || e - b > MEDIA_INFO_MAX_INDEX_BYTES) return -1;
+    unsigned char* t = malloc((size_t)(e - b));
+    if (!t) return -1;
+    if (read_at(r, b, t, (size_t)(e - b)) != 0 || be32(t + 4) > (e - b - 8) / esz) {
+        free(t);
+        return -1;
+    }
+    *out = t;
+    *entries = be32(t + 4);
+    return 0;
+}
+
+/* Sync samples from stss, or every sample when the track has none, timed
+ * through stts and ctts less the media time the first edit skips. */
+static int mp4_keyframes(const media_reader_t* r, double** times, size_t* count) {
+    static const uint32_t hdlr_path[] = { FOURCC('m', 'd', 'i', 'a'), FOURCC('h', 'd', 'l', 'r') };
+    static const uint32_t mdhd_path[] = { FOURCC('m', 'd', 'i', 'a'), FOURCC('m', 'd', 'h', 'd') };
+    static const uint32_t stbl_path[] = { FOURCC('m', 'd', 'i', 'a'), FOURCC('m', 'i', 'n', 'f'), FOURCC('s', 't', 'b', 'l') };
+    static const uint32_t elst_path[] = { FOURCC('e', 'd', 't', 's'), FOURCC('e', 'l', 's', 't') };
+    uint64_t moov, moov_end, trak = 0, trak_end = 0, b, e, stbl, stbl_end;
+    unsigned char h[24];
+    if (mp4_find(r, 0, r->size, FOURCC('m', 'o', 'o', 'v'), &moov, &moov_end) != 0) return -1;
+    int found = 0;
+    for (uint64_t off = moov; !found && mp4_find(r, off, moov_end, FOURCC('t', 'r', 'a', 'k'), &trak, &trak_end) == 0; off = trak_end)
+        found = mp4_find_path(r, trak, trak_end, hdlr_path, 2, &b, &e) == 0 && e - b >= 12 && read_at(r, b, h, 12) == 0 &&
+            be32(h + 8) == FOURCC('v', 'i', 'd', 'e');
+    if (!found) return -1;
+    uint32_t scale = 0;
+    if (mp4_find_path(r, trak, trak_end, mdhd_path, 2, &b, &e) == 0 && e - b >= 24 && read_at(r, b, h, 24) == 0)
+        scale = h[0] == 1 ? be32(h + 20) : be32(h + 12);
+    if (!scale || mp4_find_path(r, trak, trak_end, stbl_path, 3, &stbl, &stbl_end) != 0) return -1;
+    int64_t skip = 0;
+    if (mp4_find_path(r, trak, trak_end, elst_path, 2, &b, &e) == 0 && e - b >= 8 && read_at(r, b, h, 8) == 0) {
+        int wide = h[0] == 1;
+        uint64_t esz = wide ? 20 : 12;
+        uint32_t edits = be32(h + 4);
+        for (uint32_t i = 0; i < edits && b + 8 + (i + 1) * esz <= e && read_at(r, b + 8 + i * esz, h, (size_t)esz) == 0; ++i) {
+            int64_t media_time = wide ? (int64_t)be64(h + 8) : (int64_t)(int32_t)be32(h + 4);
+            if (media_time >= 0) {
+                skip = media_time;
+                break;
+            }
+        }
+    }
+    unsigned char *stts = NULL, *stss = NULL, *ctts = NULL;
+    uint32_t n_stts, n_stss, n_ctts;
+    double* out = NULL;
+    int rc = -1;
+    if (mp4_table(r, stbl, stbl_end, FOURCC('s', 't', 't', 's'), 8, &stts, &n_stts) != 0 || !stts ||
+        mp4_table(r, stbl, stbl_end, FOURCC('s', 't', 's', 's'), 4, &stss, &n_stss) != 0 ||
+        mp4_table(r, stbl, stbl_end, FOURCC('c', 't', 't', 's'), 8, &ctts, &n_ctts) != 0)
+        goto done;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < n_stts; ++i) total += be32(stts + 8 + 8 * i);
+    uint64_t want = stss ? n_stss : total;
+    if (want == 0 || want > MEDIA_INFO_MAX_KEYFRAMES || !(out = malloc((size_t)want * sizeof(double)))) goto done;
+    uint32_t ti = 0, ci = 0;
+    uint64_t t_first = 1, c_first = 1, dts = 0;
+    size_t n = 0;
+    for (uint64_t k = 0; k < want; ++k) {
+        uint64_t s = stss ? be32(stss + 8 + 4 * k) : k + 1;
+        if (s < t_first) break;
+        while (ti < n_stts && s >= t_first + be32(stts + 8 + 8 * ti)) {
+            dts += (uint64_t)be32(stts + 8 + 8 * ti) * be32(stts + 12 + 8 * ti);
+            t_first += be32(stts + 8 + 8 * ti);
+            ti++;
+        }
+        if (ti == n_stts) break;
+        int64_t cts = 0;
+        while (ctts && ci < n_ctts && s >= c_first + be32(ctts + 8 + 8 * ci)) c_first += be32(ctts + 8 + 8 * ci++);
+        if (ctts && ci < n_ctts) cts = (int32_t)be32(ctts + 12 + 8 * ci);
+        double t = ((double)(dts + (s - t_first) * be32(stts + 12 + 8 * ti)) + (double)cts - (double)skip) / scale;
+        out[n++] = t > 0 ? t : 0;
+    }
+    if (n == want) {
+        *times = out;
+        *count = n;
+        out = NULL;
+        rc = 0;
+    }
+done:
+    free(out);
+    free(stts);
+    free(stss);
+    free(ctts);
+    return rc;
+}
+
+/* CueTime of every CuePoint with a position on track, or on any track when
+ * track is 0. The Cues body is read into memory first, since a long video
+ * has thousands of small entries. */
+static int mkv_cue_times(const media_reader_t* r, uint64_t cues, uint64_t end, uint64_t track, uint64_t scale, double** times, size_t* count) {
+    uint32_t id;
+    uint64_t b, e;
+    int unknown;
+    if (mkv_element(r, cues, end, &id, &b, &e, &unknown) != 0 || id != MKV_CUES || e - b > MEDIA_INFO_MAX_INDEX_BYTES) return -1;
+    unsigned char* body = malloc((size_t)(e - b) + 1);
+    if (!body || read_at(r, b, body, (size_t)(e - b)) != 0) {
+        free(body);
+        return -1;
+    }
+    media_reader_t m = { -1, e - b, body };
+    double* out = NULL;
+    size_t n = 0, cap = 0;
+    int rc = 0;
+    for (uint64_t off = 0; off < m.size && rc == 0;) {
+        uint64_t pb, pe;
+        if (mkv_element(&m, off, m.size, &id, &pb, &pe, &unknown) != 0) break;
+        off = pe;
+        if (id != MKV_CUE_POINT) continue;
+        uint64_t t = 0;
+        int have_time = 0, on_track = track == 0;
+        for (uint64_t po = pb; po < pe;) {
+            uint64_t cb, ce;
+            if (mkv_element(&m, po, pe, &id, &cb, &ce, &unknown) != 0) break;
+            if (id == MKV_CUE_TIME) {
+                t = mkv_uint(&m, cb, ce);
+                have_time = 1;
+            }
+            else if (id == MKV_CUE_TRACK_POSITIONS) {
+                for (uint64_t qo = cb; qo < ce && !on_track;) {
+                    uint64_t qb, qe;
+                    if (mkv_element(&m, qo, ce, &id, &qb, &qe, &unknown) != 0) break;
+                    if (id == MKV_CUE_TRACK) on_track = mkv_uint(&m, qb, qe) == track;
+                    qo = qe;
+                }
+            }
+            po = ce;
+        }
+        if (!have_time || !on_track) continue;
+        if (n == cap) {
+            size_t nc = cap ? cap * 2 : 256;
+            double* tmp = nc <= MEDIA_INFO_MAX_KEYFRAMES ? realloc(out, nc * sizeof(double)) : NULL;
+            if (!tmp) {
+                rc = -1;
+                break;
+            }
+            out = tmp;
+            cap = nc;
+        }
+        out[n++] = (double)t * (double)scale / 1e9;
+    }
+    free(body);
+    if (rc != 0 || n == 0) {
+        free(out);
+        return -1;
+    }
+    *times = out;
+    *count = n;
+    return 0;
+}
+
+/* Takes the video track number from Tracks and the Cues position from the
+ * SeekHead, or from the Cues element itself when it precedes the Clusters. */
+static int mkv_keyframes(const media_reader_t* r, double** times, size_t* count) {
+    uint32_t id;
+    uint64_t b, e;
+    int unknown;
+    if (mkv_element(r, 0, r->size, &id, &b, &e, &unknown) != 0 || id != MKV_EBML) return -1;
+    if (mkv_element(r, e, r->size, &id, &b, &e, &unknown) != 0 || id != MKV_SEGMENT) return -1;
+    uint64_t seg = b, seg_end = e, scale = 1000000, video = 0, cues = 0;
+    uint64_t off = seg;
+    for (int n = 0; off < seg_end && n < MEDIA_INFO_MAX_ELEMENTS; ++n) {
+        if (mkv_element(r, off, seg_end, &id, &b, &e, &unknown) != 0) break;
+        if (id == MKV_INFO) {
+            for (uint64_t io = b; io < e;) {
+                uint32_t iid;
+                uint64_t ib, ie;
+                if (mkv_element(r, io, e, &iid, &ib, &ie, &unknown) != 0) break;
+                if (iid == MKV_TIMECODE_SCALE) scale = mkv_uint(r, ib, ie);
+                io = ie;
+            }
+        }
+        else if (id == MKV_TRACKS && !video) {
+            for (uint64_t to = b; to < e && !video;) {
+                uint32_t tid;
+                uint64_t tb, te;
+                if (mkv_element(r, to, e, &tid, &tb, &te, &unknown) != 0) break;
+                uint64_t type = 0, number = 0;
+                for (uint64_t eo = tb; tid == MKV_TRACK_ENTRY && eo < te;) {
+                    uint32_t eid;
+                    uint64_t eb, ee;
+                    if (mkv_element(r, eo, te, &eid, &eb, &ee, &unknown) != 0) break;
+                    if (eid == MKV_TRACK_TYPE) type = mkv_uint(r, eb, ee);
+                    else if (eid == MKV_TRACK_NUMBER) number = mkv_uint(r, eb, ee);
+                    eo = ee;
+                }
+                if (type == 1) video = number;
+                to = te;
+            }
+        }
+        else if (id == MKV_SEEK_HEAD && !cues) {
+            for (uint64_t so = b; so < e;) {
+                uint32_t sid;
+                uint64_t sb, se;
+                if (mkv_element(r, so, e, &sid, &sb, &se, &unknown) != 0) break;
+                uint64_t target = 0, pos = 0;
+                int have_pos = 0;
+                for (uint64_t ko = sb; sid == MKV_SEEK && ko < se;) {
+                    uint32_t kid;
+                    uint64_t kb, ke;
+                    if (mkv_element(r, ko, se, &kid, &kb, &ke, &unknown) != 0) break;
+                    if (kid == MKV_SEEK_ID) target = mkv_uint(r, kb, ke);
+                    else if (kid == MKV_SEEK_POSITION) {
+                        pos = mkv_uint(r, kb, ke);
+                        have_pos = 1;
+                    }
+                    ko = ke;
+                }
+                if (target == MKV_CUES && have_pos && pos < seg_end - seg) cues = seg + pos;
+                so = se;
+            }
+        }
+        else if (id == MKV_CUES) {
+            cues = off;
+        }
+        else if (id == MKV_CLUSTER && (cues || unknown)) {
+            break;
+        }
+        off = e;
+    }
+    if (!cues || !scale) return -1;
+    return mkv_cue_times(r, cues, seg_end, video, scale, times, count);
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+int media_info_keyframes(const char* path, double** times, size_t* count) {
+    if (!path || !times || !count) return -1;
+    *times = NULL;
+    *count = 0;
+    FILE* f = platform_fopen(path, "rb");
+    if (!f) return -1;
+    struct stat st;
+    media_reader_t r = { fileno(f), 0, NULL };
+    unsigned char m[8];
+    int rc = -1;
+    if (platform_stat(path, &st) == 0 && (r.size = (uint64_t)st.st_size, read_at(&r, 0, m, sizeof(m)) == 0)) {
+        if (be32(m) == MKV_EBML) rc = mkv_keyframes(&r, times, count);
+        else if (memcmp(m + 4, "ftyp", 4) == 0 || memcmp(m + 4, "moov", 4) == 0 || memcmp(m + 4, "mdat", 4) == 0 ||
+            memcmp(m + 4, "wide", 4) == 0 || memcmp(m + 4, "free", 4) == 0) rc = mp4_keyframes(&r, times, count);
+    }
+    fclose(f);
+    if (rc == 0) qsort(*times, *count, sizeof(double), cmp_double);
+    LOG_DEBUG("media_info_keyframes: %s rc=%d %zu keyframe(s)", path, rc, *count);
+    return rc;
+}
+
+int media_info_probe(const char* path, media_info_t* out) {
+    if (!path || !out) return -1;
+    memset(out, 0, sizeof(*out));
+    FILE* f = platform_fopen(path, "rb");
+    if (!f) return -1;
+    struct stat st;
+    media_reader_t r = { fileno(f), 0, NULL };
+    unsigned char m[12];
+    int rc = -1;
+    if (platform_stat(path, &st) == 0 && (r.size = (uint64_t)st.st_size, read_at(&r, 0, m, sizeof(m)) == 0)) {
+        if (m[0] == 0xFF && m[1] == 0xD8 && m[2] == 0xFF) rc = probe_jpeg(&r, out);
+        else if (memcmp(m, "\x89PNG\r\n\x1a\n", 8) == 0) rc = probe_png(&r, out);
+        else if (memcmp(m, "GIF8", 4) == 0) rc = probe_gif(&r, out);
+        else if (memcmp(m, "RIFF", 4) == 0 && memcmp(m + 8, "WEBP", 4) == 0) rc = probe_webp(&r, out);
+        else if (memcmp(m, "RIFF", 4) == 0 && memcmp(m + 8, "AVI ", 4) == 0) rc = probe_avi(&r, out);
+        else if (be32(m) == MKV_EBML) rc = probe_mkv(&r, out);
+        else if (memcmp(m + 4, "ftyp", 4) == 0 || memcmp(m + 4, "moov", 4) == 0 || memcmp(m + 4, "mdat", 4) == 0 ||
+            memcmp(m + 4, "wide", 4) == 0 || memcmp(m + 4, "free", 4) == 0) rc = probe_mp4(&r, out);
+    }
+    fclose(f);
+    if (rc != 0) memset(out, 0, sizeof(*out));
+    LOG_DEBUG("media_info_probe: %s rc=%d %dx%d %llu ms codec=%s", path, rc, out->width, out->height, (unsigned long long)out->duration_ms, out->codec);
+    return rc;
+}
+
+void media_info_init(void) {
+    if (atomic_load(&cache_ready)) return;
+    thread_mutex_init(&cache_mutex);
+    atomic_store(&cache_ready, 1);
+}
+
+int media_info_get(const char* path, media_info_t* out) {
+    struct stat st;
+    if (!path || !out || platform_stat(path, &st) != 0) return -1;
+    if (!atomic_load(&cache_ready)) return media_info_probe(path, out);
+    media_info_entry_t* e = &cache[path_hash(path) % MEDIA_INFO_CACHE_ENTRIES];
+    thread_mutex_lock(&cache_mutex);
+    if (e->path && e->size == (long long)st.st_size && e->mtime == st.st_mtime && strcmp(e->path, path) == 0) {
+        int rc = e->rc;
+        *out = e->info;
+        thread_mutex_unlock(&cache_mutex);
+        return rc;
+    }
+    thread_mutex_unlock(&cache_mutex);
+    int rc = media_info_probe(path, out);
+    char* copy = strdup(path);
+    if (!copy) return rc;
+    thread_mutex_lock(&cache_mutex);
+    free(e->path);
+    e->path = copy;
+    e->size = (long long)st.st_size;
+    e->mtime = st.st_mtime;
+    e->rc = rc;
+    e->info = *out;
+    thread_mutex_unlock(&cache_mutex);
+    return rc;
+}
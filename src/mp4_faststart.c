@@ -0,0 +1,339 @@
+#include "mp4_faststart.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "directory.h"
+#include "utils.h"
+#include "thumbs.h"
+#include "io_budget.h"
+
+#define BOX(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+typedef struct mp4_box {
+    uint64_t off;
+    uint64_t size;
+    uint64_t new_off;
+    uint32_t type;
+} mp4_box_t;
+
+typedef struct mp4_layout {
+    mp4_box_t boxes[FASTSTART_MAX_TOP_BOXES];
+    int count;
+    int moov;
+    int mdat;
+    int fragmented;
+} mp4_layout_t;
+
+static const char* const candidate_exts[] = { ".mp4", ".m4v", ".mov", NULL };
+
+static uint32_t rd32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t rd64(const unsigned char* p) {
+    return ((uint64_t)rd32(p) << 32) | rd32(p + 4);
+}
+
+static void wr32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void wr64(unsigned char* p, uint64_t v) {
+    wr32(p, (uint32_t)(v >> 32));
+    wr32(p + 4, (uint32_t)v);
+}
+
+/* Decodes the box header at hdr (avail bytes, at least 8) inside a parent
+ * that ends end - off bytes later. Returns the header length, or 0 when the
+ * box is malformed or runs past its parent. */
+static size_t parse_header(const unsigned char* hdr, size_t avail, uint64_t off, uint64_t end, uint64_t* size, uint32_t* type) {
+    if (avail < 8) return 0;
+    uint64_t sz = rd32(hdr);
+    size_t hlen = 8;
+    *type = rd32(hdr + 4);
+    if (sz == 1) {
+        if (avail < 16) return 0;
+        sz = rd64(hdr + 8);
+        hlen = 16;
+    }
+    else if (sz == 0) {
+        sz = end - off;
+    }
+    if (sz < hlen || sz > end - off) return 0;
+    *size = sz;
+    return hlen;
+}
+
+static int read_layout(int fd, uint64_t file_size, mp4_layout_t* l) {
+    l->count = 0;
+    l->moov = l->mdat = -1;
+    l->fragmented = 0;
+    uint64_t off = 0;
+    while (off + 8 <= file_size) {
+        unsigned char hdr[16];
+        long got = platform_pread(fd, hdr, sizeof(hdr), off);
+        if (got < 8) return -1;
+        mp4_box_t b;
+        if (!parse_header(hdr, (size_t)got, off, file_size, &b.size, &b.type)) return -1;
+        if (l->count == FASTSTART_MAX_TOP_BOXES) return -1;
+        b.off = off;
+        b.new_off = off;
+        if (b.type == BOX('m', 'o', 'o', 'v')) {
+            if (l->moov >= 0) return -1;
+            l->moov = l->count;
+        }
+        else if (b.type == BOX('m', 'd', 'a', 't')) {
+            if (l->mdat < 0) l->mdat = l->count;
+        }
+        else if (b.type == BOX('m', 'o', 'o', 'f')) {
+            l->fragmented = 1;
+        }
+        l->boxes[l->count++] = b;
+        off += b.size;
+    }
+    return off == file_size && l->count > 0 ? 0 : -1;
+}
+
+static int layout_needs_relocation(const mp4_layout_t* l) {
+    return l->moov >= 0 && l->mdat >= 0 && !l->fragmented && l->moov > l->mdat;
+}
+
+int faststart_is_candidate(const char* name) {
+    return name && has_ext(name, candidate_exts) && !faststart_is_sidecar_name(name);
+}
+
+int faststart_is_sidecar_name(const char* name) {
+    if (!name) return 0;
+    size_t n = strlen(name), s = strlen(FASTSTART_SUFFIX);
+    return n > s && ascii_stricmp(name + n - s, FASTSTART_SUFFIX) == 0;
+}
+
+int faststart_needs_relocation(const char* path) {
+    FILE* f = platform_fopen(path, "rb");
+    if (!f) return -1;
+    io_budget_acquire(0, 1);
+    mp4_layout_t* l = malloc(sizeof(mp4_layout_t));
+    struct stat st;
+    int rc = -1;
+    if (l && platform_stat(path, &st) == 0 && read_layout(fileno(f), (uint64_t)st.st_size, l) == 0)
+        rc = layout_needs_relocation(l);
+    free(l);
+    fclose(f);
+    return rc;
+}
+
+/* Where the byte at old offset o ends up once the boxes are reordered. */
+static int map_offset(const mp4_layout_t* l, uint64_t o, uint64_t* out) {
+    for (int i = 0; i < l->count; ++i) {
+        const mp4_box_t* b = &l->boxes[i];
+        if (o >= b->off && o < b->off + b->size) {
+            *out = o - b->off + b->new_off;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Rewrites the chunk offset tables under the moov held in buf. Only the
+ * containers on the path to stbl are entered. */
+static int patch_chunk_offsets(unsigned char* buf, uint64_t len, const mp4_layout_t* l, int depth) {
+    if (depth > FASTSTART_MAX_DEPTH) return -1;
+    uint64_t off = 0;
+    while (off + 8 <= len) {
+        uint64_t size;
+        uint32_t type;
+        size_t hlen = parse_header(buf + off, (size_t)(len - off < 16 ? len - off : 16), off, len, &size, &type);
+        if (!hlen) return -1;
+        unsigned char* body = buf + off + hlen;
+        uint64_t blen = size - hlen;
+        if (type == BOX('t', 'r', 'a', 'k') || type == BOX('m', 'd', 'i', 'a') ||
+            type == BOX('m', 'i', 'n', 'f') || type == BOX('s', 't', 'b', 'l')) {
+            if (patch_chunk_offsets(body, blen, l, depth + 1) != 0) return -1;
+        }
+        else if (type == BOX('s', 't', 'c', 'o') || type == BOX('c', 'o', '6', '4')) {
+            int wide = type == BOX('c', 'o', '6', '4');
+            size_t esz = wide ? 8 : 4;
+            if (blen < 8) return -1;
+            uint64_t entries = rd32(body + 4);
+            if (entries > (blen - 8) / esz) return -1;
+            unsigned char* p = body + 8;
+            for (uint64_t i = 0; i < entries; ++i, p += esz) {
+                uint64_t mapped;
+                if (map_offset(l, wide ? rd64(p) : rd32(p), &mapped) != 0) return -1;
+                if (wide) wr64(p, mapped);
+                else if (mapped > UINT32_MAX) return -1;
+                else wr32(p, (uint32_t)mapped);
+            }
+        }
+        off += size;
+    }
+    return off == len ? 0 : -1;
+}
+
+static int copy_range(int fd, FILE* out, uint64_t off, uint64_t len, unsigned char* buf) {
+    while (len > 0) {
+        size_t want = len < FASTSTART_COPY_CHUNK ? (size_t)len : FASTSTART_COPY_CHUNK;
+        io_budget_acquire(want, 1);
+        long got = platform_pread(fd, buf, want, off);
+        if (got <= 0) return -1;
+        if (fwrite(buf, 1, (size_t)got, out) != (size_t)got) return -1;
+        off += (uint64_t)got;
+        len -= (uint64_t)got;
+    }
+    return 0;
+}
+
+static int write_relocated(int fd, FILE* out, const mp4_layout_t* l, const unsigned char* moov) {
+    unsigned char* buf = malloc(FASTSTART_COPY_CHUNK);
+    if (!buf) return -1;
+    int rc = 0;
+    for (int i = 0; i < l->mdat && rc == 0; ++i)
+        rc = copy_range(fd, out, l->boxes[i].off, l->boxes[i].size, buf);
+    if (rc == 0 && fwrite(moov, 1, (size_t)l->boxes[l->moov].size, out) != (size_t)l->boxes[l->moov].size) rc = -1;
+    for (int i = l->mdat; i < l->count && rc == 0; ++i)
+        if (i != l->moov) rc = copy_range(fd, out, l->boxes[i].off, l->boxes[i].size, buf);
+    free(buf);
+    return rc;
+}
+
+int faststart_write(const char* src, const char* dst) {
+    if (!src || !dst) return -1;
+    FILE* in = platform_fopen(src, "rb");
+    if (!in) return -1;
+    int fd = fileno(in);
+    io_budget_acquire(0, 1);
+    io_budget_read_begin(fd);
+    int rc = -1;
+    unsigned char* moov = NULL;
+    mp4_layout_t* l = malloc(sizeof(mp4_layout_t));
+    struct stat st_src;
+    if (!l || platform_stat(src, &st_src) != 0 || read_layout(fd, (uint64_t)st_src.st_size, l) != 0) {
+        LOG_DEBUG("faststart: %s does not parse as MP4", src);
+        goto done;
+    }
+    if (!layout_needs_relocation(l)) goto done;
+    mp4_box_t* mb = &l->boxes[l->moov];
+    if (mb->size > FASTSTART_MOOV_MAX) {
+        LOG_WARN("faststart: moov of %s is %llu bytes, leaving it in place", src, (unsigned long long)mb->size);
+        goto done;
+    }
+
+    /* Boxes ahead of the first mdat keep their place, moov follows them and
+     * everything from mdat on slides back by moov's size. */
+    uint64_t pos = l->boxes[l->mdat].off;
+    mb->new_off = pos;
+    pos += mb->size;
+    for (int i = l->mdat; i < l->count; ++i) {
+        if (i == l->moov) continue;
+        l->boxes[i].new_off = pos;
+        pos += l->boxes[i].size;
+    }
+
+    moov = malloc((size_t)mb->size);
+    if (!moov) goto done;
+    io_budget_acquire((size_t)mb->size, 1);
+    if (platform_pread(fd, moov, (size_t)mb->size, mb->off) != (long)mb->size) goto done;
+    uint64_t size_field;
+    uint32_t type;
+    size_t hlen = parse_header(moov, (size_t)mb->size, 0, mb->size, &size_field, &type);
+    if (!hlen || patch_chunk_offsets(moov + hlen, mb->size - hlen, l, 0) != 0) {
+        LOG_WARN("faststart: cannot rewrite chunk offsets of %s, serving it as is", src);
+        goto done;
+    }
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+    FILE* out = platform_fopen(tmp, "wb");
+    if (!out) {
+        LOG_WARN("faststart: cannot create %s", tmp);
+        goto done;
+    }
+    int wrc = write_relocated(fd, out, l, moov);
+    if (fflush(out) != 0) wrc = -1;
+    if (fclose(out) != 0) wrc = -1;
+    if (wrc != 0 || platform_set_mtime(tmp, st_src.st_mtime + 1) != 0 || platform_move_file(tmp, dst) != 0) {
+        LOG_WARN("faststart: failed to write %s", dst);
+        platform_file_delete(tmp);
+        goto done;
+    }
+    io_budget_drop_cache(dst);
+    rc = 0;
+done:
+    io_budget_read_end(fd);
+    free(moov);
+    free(l);
+    fclose(in);
+    return rc;
+}
+
+int faststart_sidecar_path(const char* media_full, char* out, size_t outlen) {
+    if (!media_full || !out || outlen == 0) return -1;
+    char media[PATH_MAX];
+    snprintf(media, sizeof(media), "%s", media_full);
+    normalize_path(media);
+    char* sep = strrchr(media, DIR_SEP);
+    if (!sep || !faststart_is_candidate(sep + 1)) return -1;
+    *sep = '\0';
+    char thumbs_root[PATH_MAX];
+    get_thumbs_root(thumbs_root, sizeof(thumbs_root));
+    char safe_dir_name[PATH_MAX];
+    make_safe_dir_name_from(media, safe_dir_name, sizeof(safe_dir_name));
+    int n = snprintf(out, outlen, "%s" DIR_SEP_STR "%s" DIR_SEP_STR "%s" FASTSTART_SUFFIX, thumbs_root, safe_dir_name, sep + 1);
+    return n > 0 && (size_t)n < outlen ? 0 : -1;
+}
+
+static int sidecar_fresh(const struct stat* st_media, const struct stat* st_side) {
+    return st_side->st_size == st_media->st_size && st_side->st_mtime == st_media->st_mtime + 1;
+}
+
+int faststart_due(const char* media_full) {
+    char side[PATH_MAX];
+    if (faststart_sidecar_path(media_full, side, sizeof(side)) != 0) return 0;
+    struct stat st_media, st_side;
+    if (platform_stat(media_full, &st_media) != 0) return 0;
+    int have_side = platform_stat(side, &st_side) == 0;
+    if (have_side && sidecar_fresh(&st_media, &st_side)) return 0;
+    return have_side || faststart_needs_relocation(media_full) == 1;
+}
+
+int faststart_ensure(const char* media_full) {
+    char side[PATH_MAX];
+    if (faststart_sidecar_path(media_full, side, sizeof(side)) != 0) return 0;
+    struct stat st_media, st_side;
+    if (platform_stat(media_full, &st_media) != 0) return -1;
+    int have_side = platform_stat(side, &st_side) == 0;
+    if (have_side && sidecar_fresh(&st_media, &st_side)) return 0;
+    int need = faststart_needs_relocation(media_full);
+    if (need != 1) {
+        if (have_side && platform_file_delete(side) == 0) LOG_DEBUG("faststart: removed stale sidecar %s", side);
+        return need < 0 ? -1 : 0;
+    }
+    char side_dir[PATH_MAX];
+    snprintf(side_dir, sizeof(side_dir), "%s", side);
+    char* sep = strrchr(side_dir, DIR_SEP);
+    if (sep) {
+        *sep = '\0';
+        if (!is_dir(side_dir)) platform_make_dir(side_dir);
+    }
+    uint64_t t0 = platform_monotonic_ms();
+    if (faststart_write(media_full, side) != 0) return -1;
+    LOG_INFO("faststart: moved moov to the front of %s in %llu ms", media_full, (unsigned long long)(platform_monotonic_ms() - t0));
+    return 1;
+}
+
+int faststart_lookup(const char* media_full, char* dir_out, size_t dir_len, char* name_out, size_t name_len) {
+    char side[PATH_MAX];
+    if (faststart_sidecar_path(media_full, side, sizeof(side)) != 0) return -1;
+    struct stat st_media, st_side;
+    if (platform_stat(side, &st_side) != 0) return -1;
+    if (platform_stat(media_full, &st_media) != 0 || !sidecar_fresh(&st_media, &st_side)) return -1;
+    char* sep = strrchr(side, DIR_SEP);
+    if (!sep) return -1;
+    *sep = '\0';
+    int a = snprintf(dir_out, dir_len, "%s", side);
+    int b = snprintf(name_out, name_len, "%s", sep + 1);
+    return a > 0 && (size_t)a < dir_len && b > 0 && (size_t)b < name_len ? 0 : -1;
+}
@@ -0,0 +1,274 @@
+#include "path_intern.h"
+#include "common.h"
+#include "logging.h"
+#include "directory.h"
+#include "thread_pool.h"
+#include "thumbs.h"
+#include "config.h"
+#include "platform.h"
+#include "utils.h"
+
+#define PATH_INTERN_SEG_SIZE (1 << PATH_INTERN_SEG_BITS)
+#define PATH_INTERN_INITIAL_BUCKETS 256
+
+typedef struct path_entry {
+    char* path;
+    size_t len;
+    char* safe;
+    uint32_t hash;
+} path_entry_t;
+
+/* Entries live in fixed segments that are never moved or freed, so the
+ * strings behind an id stay valid for the life of the process and can be
+ * read without the lock. Only the hash index is resized. */
+static path_entry_t* segs[PATH_INTERN_MAX_SEGS];
+static atomic_int entry_count = ATOMIC_VAR_INIT(0);
+static path_id_t* buckets;
+static size_t bucket_mask;
+static thread_mutex_t intern_mutex;
+
+static gallery_roots_t* current_roots;
+static atomic_uint roots_gen = ATOMIC_VAR_INIT(1);
+static thread_mutex_t roots_mutex;
+static atomic_int intern_inited = ATOMIC_VAR_INIT(0);
+
+static uint32_t path_hash(const char* s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+    return h;
+}
+
+static path_entry_t* entry_at(path_id_t id) {
+    return &segs[id >> PATH_INTERN_SEG_BITS][id & (PATH_INTERN_SEG_SIZE - 1)];
+}
+
+void path_intern_init(void) {
+    if (atomic_exchange(&intern_inited, 1)) return;
+    thread_mutex_init(&intern_mutex);
+    thread_mutex_init(&roots_mutex);
+    buckets = malloc(PATH_INTERN_INITIAL_BUCKETS * sizeof(path_id_t));
+    if (!buckets) {
+        LOG_ERROR("Path intern: failed to allocate index");
+        return;
+    }
+    for (size_t i = 0; i < PATH_INTERN_INITIAL_BUCKETS; i++) buckets[i] = PATH_ID_NONE;
+    bucket_mask = PATH_INTERN_INITIAL_BUCKETS - 1;
+}
+
+static int grow_index_locked(void) {
+    size_t nb = (bucket_mask + 1) * 2;
+    path_id_t* nbk = malloc(nb * sizeof(path_id_t));
+    if (!nbk) return -1;
+    for (size_t i = 0; i < nb; i++) nbk[i] = PATH_ID_NONE;
+    int n = atomic_load(&entry_count);
+    for (path_id_t id = 0; id < n; id++) {
+        size_t b = entry_at(id)->hash & (nb - 1);
+        while (nbk[b] != PATH_ID_NONE) b = (b + 1) & (nb - 1);
+        nbk[b] = id;
+    }
+    free(buckets);
+    buckets = nbk;
+    bucket_mask = nb - 1;
+    return 0;
+}
+
+path_id_t path_intern(const char* canonical) {
+    if (!canonical || !buckets) return PATH_ID_NONE;
+    size_t len = strlen(canonical);
+    uint32_t h = path_hash(canonical, len);
+    path_id_t id = PATH_ID_NONE;
+    thread_mutex_lock(&intern_mutex);
+    size_t b = h & bucket_mask;
+    for (; buckets[b] != PATH_ID_NONE; b = (b + 1) & bucket_mask) {
+        path_entry_t* e = entry_at(buckets[b]);
+        if (e->hash == h && e->len == len && memcmp(e->path, canonical, len) == 0) {
+            id = buckets[b];
+            goto out;
+        }
+    }
+    int n = atomic_load(&entry_count);
+    int seg = n >> PATH_INTERN_SEG_BITS;
+    if (seg >= PATH_INTERN_MAX_SEGS) {
+        LOG_WARN("Path intern table full, not interning %s", canonical);
+        goto out;
+    }
+    if (!segs[seg]) {
+        segs[seg] = calloc(PATH_INTERN_SEG_SIZE, sizeof(path_entry_t));
+        if (!segs[seg]) { LOG_ERROR("Path intern: failed to allocate segment %d", seg); goto out; }
+    }
+    char safe[PATH_MAX]; safe[0] = '\0';
+    make_safe_dir_name_from(canonical, safe, sizeof(safe));
+    path_entry_t* e = entry_at(n);
+    e->path = strdup(canonical);
+    e->safe = strdup(safe);
+    if (!e->path || !e->safe) {
+        LOG_ERROR("Path intern: failed to duplicate %s", canonical);
+        SAFE_FREE(e->path); SAFE_FREE(e->safe);
+        goto out;
+    }
+    e->len = len;
+    e->hash = h;
+    buckets[b] = n;
+    id = n;
+    atomic_store(&entry_count, n + 1);
+    if ((size_t)(n + 1) * 4 > (bucket_mask + 1) * 3 && grow_index_locked() != 0)
+        LOG_WARN("Path intern: failed to grow index past %zu buckets", bucket_mask + 1);
+out:
+    thread_mutex_unlock(&intern_mutex);
+    return id;
+}
+
+const char* path_str(path_id_t id) {
+    if (id < 0 || id >= atomic_load(&entry_count)) return NULL;
+    return entry_at(id)->path;
+}
+
+size_t path_len(path_id_t id) {
+    if (id < 0 || id >= atomic_load(&entry_count)) return 0;
+    return entry_at(id)->len;
+}
+
+const char* path_safe_name(path_id_t id) {
+    if (id < 0 || id >= atomic_load(&entry_count)) return "";
+    return entry_at(id)->safe;
+}
+
+static void strip_trailing_seps(char* p) {
+    size_t n = strlen(p);
+    while (n > 1 && (p[n - 1] == '/' || p[n - 1] == '\\')) p[--n] = '\0';
+}
+
+static void roots_free(gallery_roots_t* g) {
+    if (!g) return;
+    for (size_t i = 0; i < g->count; i++) {
+        free(g->roots[i].rel_safe);
+        free(g->roots[i].cfg);
+        platform_close_fd(g->roots[i].dir_fd);
+    }
+    platform_close_fd(g->thumbs_fd);
+    free(g->roots);
+    free(g);
+}
+
+void gallery_roots_release(const gallery_roots_t* g) {
+    gallery_roots_t* m = (gallery_roots_t*)g;
+    if (m && atomic_fetch_sub(&m->refs, 1) == 1) roots_free(m);
+}
+
+static gallery_roots_t* roots_build(unsigned gen) {
+    gallery_roots_t* g = calloc(1, sizeof(gallery_roots_t));
+    if (!g) return NULL;
+    g->gen = gen;
+    if (!real_path(BASE_DIR, g->base_real)) g->base_real[0] = '\0';
+    get_thumbs_root(g->thumbs_cfg, sizeof(g->thumbs_cfg));
+    strip_trailing_seps(g->thumbs_cfg);
+    if (real_path(g->thumbs_cfg, g->thumbs_real)) g->thumbs_fd = platform_open_dir(g->thumbs_real);
+    else g->thumbs_fd = -1;
+    size_t gf_count = 0; char** gfolders = get_gallery_folders(&gf_count);
+    g->roots = gf_count ? calloc(gf_count, sizeof(gallery_root_t)) : NULL;
+    if (gf_count && !g->roots) { free(g); return NULL; }
+    size_t base_len = strlen(g->base_real);
+    char folder_real[PATH_MAX];
+    for (size_t i = 0; i < gf_count; i++) {
+        if (!gfolders[i] || !real_path(gfolders[i], folder_real)) continue;
+        path_id_t id = path_intern(folder_real);
+        if (id == PATH_ID_NONE) continue;
+        gallery_root_t* r = &g->roots[g->count++];
+        r->id = id;
+        r->real = path_str(id);
+        r->len = path_len(id);
+        r->safe = path_safe_name(id);
+        r->cfg = strdup(gfolders[i]);
+        if (r->cfg) { normalize_path(r->cfg); strip_trailing_seps(r->cfg); }
+        r->dir_fd = platform_open_dir(folder_real);
+        if (g->base_real[0]) {
+            const char* rel = r->real + (r->len >= base_len ? base_len : r->len);
+            if (*rel == DIR_SEP) rel++;
+            char safe[PATH_MAX]; safe[0] = '\0';
+            make_safe_dir_name_from(rel, safe, sizeof(safe));
+            r->rel_safe = strdup(safe);
+        }
+    }
+    atomic_init(&g->refs, 1);
+    LOG_DEBUG("Gallery roots resolved: %zu folders (generation %u)", g->count, gen);
+    return g;
+}
+
+const gallery_roots_t* gallery_roots_acquire(void) {
+    if (!atomic_load(&intern_inited)) return NULL;
+    unsigned gen = atomic_load(&roots_gen);
+    thread_mutex_lock(&roots_mutex);
+    if (!current_roots || current_roots->gen != gen) {
+        gallery_roots_t* g = roots_build(gen);
+        if (g) {
+            gallery_roots_release(current_roots);
+            current_roots = g;
+        }
+    }
+    gallery_roots_t* g = current_roots;
+    if (g) atomic_fetch_add(&g->refs, 1);
+    thread_mutex_unlock(&roots_mutex);
+    return g;
+}
+
+int gallery_roots_find(const gallery_roots_t* g, const char* path_real) {
+    if (!g || !path_real) return -1;
+    for (size_t i = 0; i < g->count; i++)
+        if (safe_under(g->roots[i].real, path_real)) return (int)i;
+    return -1;
+}
+
+void gallery_roots_invalidate(void) {
+    atomic_fetch_add(&roots_gen, 1);
+}
+
+static bool has_dotdot(const char* rel) {
+    for (const char* p = rel; *p; ) {
+        const char* end = p + strcspn(p, "/\\");
+        if (end - p == 2 && p[0] == '.' && p[1] == '.') return true;
+        p = *end ? end + 1 : end;
+    }
+    return false;
+}
+
+/* Opens base_dir/sub_path relative to the directory fd of the gallery or
+ * thumbs root that lexically contains it, so the kernel enforces that the
+ * result stays beneath the root. out_path receives the root's canonical
+ * path joined with the remainder. Fails with EOPNOTSUPP when no root covers
+ * the path and ENOSYS where directory fds are unavailable. */
+int gallery_open_beneath(const char* base_dir, const char* sub_path, struct stat* st, char* out_path, size_t out_len) {
+    if (!base_dir || !sub_path || !st) { errno = EINVAL; return -1; }
+    const gallery_roots_t* g = gallery_roots_acquire();
+    if (!g) { errno = ENOSYS; return -1; }
+    char full[PATH_MAX];
+    snprintf(full, sizeof(full), "%s" DIR_SEP_STR "%s", base_dir, sub_path);
+    normalize_path(full);
+    int dir_fd = -1;
+    size_t best = 0;
+    const char* root_real = NULL;
+    if (g->thumbs_fd >= 0 && safe_under(g->thumbs_cfg, full)) {
+        dir_fd = g->thumbs_fd;
+        best = strlen(g->thumbs_cfg);
+        root_real = g->thumbs_real;
+    }
+    for (size_t i = 0; i < g->count; i++) {
+        const gallery_root_t* r = &g->roots[i];
+        if (r->dir_fd < 0 || !r->cfg) continue;
+        size_t n = strlen(r->cfg);
+        if (n > best && safe_under(r->cfg, full)) { dir_fd = r->dir_fd; best = n; root_real = r->real; }
+    }
+    int fd = -1;
+    if (dir_fd < 0) {
+        errno = EOPNOTSUPP;
+    } else {
+        const char* rel = full + best;
+        while (*rel == '/' || *rel == '\\') rel++;
+        if (has_dotdot(rel)) errno = EPERM;
+        else fd = platform_open_beneath(dir_fd, rel, st);
+        if (fd >= 0 && out_path && out_len) snprintf(out_path, out_len, "%s" DIR_SEP_STR "%s", root_real, rel);
+    }
+    int err = errno;
+    gallery_roots_release(g);
+    errno = err;
+    return fd;
+}
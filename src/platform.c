@@ -1,9 +1,32 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include "platform.h"
 #include "common.h"
 #include "thread_pool.h"
 #include "logging.h"
 #include "directory.h"
 #include "utils.h"
+#include "bandwidth.h"
+#include "fd_cache.h"
+#include "thumb_cache.h"
+#include "timer_wheel.h"
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <poll.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#endif
+#endif
+#else
+#include <sys/utime.h>
+#endif
 
 static thread_mutex_t g_streams_mutex;
 typedef struct { char path[PATH_MAX]; int sock; } active_stream_t;
@@ -50,6 +73,8 @@ static void unregister_stream_by_sock(int sock) {
 int platform_close_streams_for_path(const char* path) {
     if (!path) return 0;
     init_streams();
+    fd_cache_invalidate(path);
+    thumb_cache_invalidate(path);
     char thumbs_root[PATH_MAX];
     get_thumbs_root(thumbs_root, sizeof(thumbs_root));
     normalize_path((char*)path);
@@ -83,8 +108,18 @@ void platform_sleep_ms(int ms) {
 #endif
 }
 
+uint64_t platform_monotonic_ms(void) {
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+#endif
+}
+
 int platform_file_delete(const char* path) {
     if (!path) return -1;
+    thumb_cache_invalidate(path);
 #ifdef _WIN32
     WCHAR wpath[PATH_MAX];
     if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_MAX) == 0) return -1;
@@ -205,6 +240,18 @@ int platform_file_exists(const char* path) {
 #endif
 }
 
+int platform_is_symlink(const char* path) {
+    if (!path) return 0;
+#ifdef _WIN32
+    WCHAR wpath[PATH_MAX];
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_MAX) == 0) return 0;
+    DWORD attrib = GetFileAttributesW(wpath);
+    return (attrib != INVALID_FILE_ATTRIBUTES && (attrib & FILE_ATTRIBUTE_REPARSE_POINT));
+#else
+    struct stat st; return (lstat(path, &st) == 0 && S_ISLNK(st.st_mode));
+#endif
+}
+
 FILE* platform_popen(const char* cmd, const char* mode) {
 #if 1
     if (cmd) { platform_record_command(cmd); LOG_DEBUG("platform_popen: %s", cmd); }
@@ -235,111 +282,354 @@ int platform_pclose(FILE* f) {
 #endif
 }
 
-typedef struct {FILE* f; HANDLE proc; int is_ffprobe;} PHandleMap;
-static PHandleMap g_ph[32];
-static int g_phc=0;
-static atomic_int ffprobe_active = ATOMIC_VAR_INIT(0);
-#define MAX_FFPROBE 4
+/* Child processes are started from an argv vector, never through a shell.
+ * On POSIX posix_spawnp() lets libc use vfork/CLONE_VM, so launching does
+ * not copy the server's page tables the way fork() did; on Linux the child
+ * is awaited through a pidfd in the same poll() that drains its pipes. */
+static void spawn_format_argv(const char* const* argv, char* dst, size_t dstlen) {
+    size_t di = 0;
+    dst[0] = '\0';
+    for (size_t i = 0; argv[i] && di + 1 < dstlen; ++i) {
+        int r = snprintf(dst + di, dstlen - di, i ? " %s" : "%s", argv[i]);
+        if (r < 0) break;
+        di += (size_t)r;
+    }
+}
+
+static void spawn_buf_append(char** buf, size_t* len, size_t* cap, const char* src, size_t n) {
+    if (*len + n > PLATFORM_SPAWN_CAPTURE_MAX) n = PLATFORM_SPAWN_CAPTURE_MAX - *len;
+    if (n == 0) return;
+    if (*len + n + 1 > *cap) {
+        size_t ncap = *cap ? *cap * 2 : 4096;
+        while (ncap < *len + n + 1) ncap *= 2;
+        char* nb = realloc(*buf, ncap);
+        if (!nb) return;
+        *buf = nb;
+        *cap = ncap;
+    }
+    memcpy(*buf + *len, src, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+}
+
+void platform_spawn_result_free(platform_spawn_result_t* res) {
+    if (!res) return;
+    free(res->out);
+    free(res->err);
+    res->out = res->err = NULL;
+    res->out_len = res->err_len = 0;
+}
 
-FILE* platform_popen_direct(const char* cmd,const char* mode){
-    if (cmd) { platform_record_command(cmd); LOG_DEBUG("platform_popen_direct: %s", cmd); }
 #ifdef _WIN32
-    if(!cmd||!mode)return NULL;
-    SECURITY_ATTRIBUTES sa;ZeroMemory(&sa,sizeof(sa));sa.nLength=sizeof(sa);sa.bInheritHandle=TRUE;
-    HANDLE hR=NULL,hW=NULL;
-    if(!CreatePipe(&hR,&hW,&sa,0)){
-        DWORD err = GetLastError();
-        LOG_ERROR("platform_popen_direct: CreatePipe failed err=%lu", err);
-        return NULL;
+/* Quotes one argument so that CommandLineToArgvW() hands it back unchanged. */
+static size_t spawn_quote_arg(const WCHAR* a, WCHAR* dst, size_t di, size_t cap) {
+    int needs = a[0] == L'\0';
+    for (const WCHAR* p = a; *p; ++p) if (*p == L' ' || *p == L'\t' || *p == L'"') needs = 1;
+    if (!needs) {
+        for (const WCHAR* p = a; *p && di + 1 < cap; ++p) dst[di++] = *p;
+        return di;
     }
-    if(!SetHandleInformation(hR,HANDLE_FLAG_INHERIT,0)){CloseHandle(hR);CloseHandle(hW);return NULL;}
-    STARTUPINFOW si;PROCESS_INFORMATION pi;
-    ZeroMemory(&si,sizeof(si));ZeroMemory(&pi,sizeof(pi));
-    si.cb=sizeof(si);si.dwFlags=STARTF_USESTDHANDLES;
-    si.hStdOutput=hW;si.hStdError=hW;si.hStdInput=GetStdHandle(STD_INPUT_HANDLE);
-    WCHAR wcmd[4096];
-    if (MultiByteToWideChar(CP_UTF8, 0, cmd, -1, wcmd, 4096) == 0) {
-        CloseHandle(hW); CloseHandle(hR); return NULL;
+    if (di + 1 < cap) dst[di++] = L'"';
+    for (const WCHAR* p = a;; ++p) {
+        size_t bs = 0;
+        while (*p == L'\\') { bs++; p++; }
+        size_t reps = (*p == L'\0') ? bs * 2 : (*p == L'"') ? bs * 2 + 1 : bs;
+        while (reps-- && di + 1 < cap) dst[di++] = L'\\';
+        if (*p == L'\0') break;
+        if (di + 1 < cap) dst[di++] = *p;
     }
-    BOOL ok=CreateProcessW(NULL,wcmd,NULL,NULL,TRUE,CREATE_NO_WINDOW,NULL,NULL,&si,&pi);
-    CloseHandle(hW);
-    if(!ok){
-        DWORD err = GetLastError();
-        LOG_ERROR("platform_popen_direct: CreateProcessW failed for '%s' err=%lu", cmd ? cmd : "(null)", err);
-        CloseHandle(hR);
-        return NULL;
+    if (di + 1 < cap) dst[di++] = L'"';
+    return di;
+}
+
+static void spawn_drain_handle(HANDLE h, char** buf, size_t* len, size_t* cap) {
+    DWORD avail = 0;
+    char tmp[4096];
+    while (h && PeekNamedPipe(h, NULL, 0, NULL, &avail, NULL) && avail > 0) {
+        DWORD got = 0;
+        if (!ReadFile(h, tmp, avail < sizeof(tmp) ? avail : (DWORD)sizeof(tmp), &got, NULL) || got == 0) break;
+        spawn_buf_append(buf, len, cap, tmp, got);
+    }
+}
+
+int platform_spawn(const char* const* argv, const char* out_err_path, int timeout_ms, platform_spawn_result_t* capture) {
+    if (!argv || !argv[0]) return -1;
+    char line[1024];
+    spawn_format_argv(argv, line, sizeof(line));
+    platform_record_command(line);
+    LOG_DEBUG("platform_spawn: %s", line);
+    if (capture) memset(capture, 0, sizeof(*capture));
+
+    /* Per call: worker, HLS and probe threads spawn concurrently. */
+    WCHAR* wcmd = malloc(PLATFORM_SPAWN_CMDLINE_MAX * sizeof(WCHAR));
+    WCHAR warg[4096];
+    size_t wi = 0;
+    if (!wcmd) return -1;
+    for (size_t i = 0; argv[i]; ++i) {
+        if (MultiByteToWideChar(CP_UTF8, 0, argv[i], -1, warg, 4096) == 0) { free(wcmd); return -1; }
+        if (i && wi + 1 < PLATFORM_SPAWN_CMDLINE_MAX) wcmd[wi++] = L' ';
+        wi = spawn_quote_arg(warg, wcmd, wi, PLATFORM_SPAWN_CMDLINE_MAX);
+    }
+    wcmd[wi] = L'\0';
+
+    SECURITY_ATTRIBUTES sa; ZeroMemory(&sa, sizeof(sa)); sa.nLength = sizeof(sa); sa.bInheritHandle = TRUE;
+    HANDLE hIn = CreateFileW(L"NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, NULL);
+    HANDLE hOut = INVALID_HANDLE_VALUE, hErr = INVALID_HANDLE_VALUE;
+    HANDLE outR = NULL, errR = NULL;
+    if (capture) {
+        if (!CreatePipe(&outR, &hOut, &sa, 0) || !CreatePipe(&errR, &hErr, &sa, 0)) {
+            LOG_ERROR("platform_spawn: CreatePipe failed err=%lu", GetLastError());
+            if (outR) { CloseHandle(outR); CloseHandle(hOut); }
+            CloseHandle(hIn);
+            free(wcmd);
+            return -1;
+        }
+        SetHandleInformation(outR, HANDLE_FLAG_INHERIT, 0);
+        SetHandleInformation(errR, HANDLE_FLAG_INHERIT, 0);
+    } else {
+        WCHAR wout[PATH_MAX];
+        const char* target = out_err_path ? out_err_path : platform_devnull();
+        if (MultiByteToWideChar(CP_UTF8, 0, target, -1, wout, PATH_MAX) == 0) { CloseHandle(hIn); free(wcmd); return -1; }
+        hOut = CreateFileW(wout, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hOut == INVALID_HANDLE_VALUE) {
+            LOG_ERROR("platform_spawn: CreateFileW failed for '%s' err=%lu", target, GetLastError());
+            CloseHandle(hIn);
+            free(wcmd);
+            return -1;
+        }
+    }
+
+    STARTUPINFOW si; PROCESS_INFORMATION pi;
+    ZeroMemory(&si, sizeof(si)); ZeroMemory(&pi, sizeof(pi));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESHOWWINDOW | STARTF_USESTDHANDLES;
+    si.wShowWindow = SW_HIDE;
+    si.hStdInput = hIn; si.hStdOutput = hOut; si.hStdError = capture ? hErr : hOut;
+    BOOL ok = CreateProcessW(NULL, wcmd, NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+    DWORD err = ok ? 0 : GetLastError();
+    free(wcmd);
+    CloseHandle(hIn); CloseHandle(hOut);
+    if (hErr != INVALID_HANDLE_VALUE) CloseHandle(hErr);
+    if (!ok) {
+        LOG_ERROR("platform_spawn: CreateProcessW failed for '%s' err=%lu", argv[0], err);
+        if (outR) CloseHandle(outR);
+        if (errR) CloseHandle(errR);
+        return -1;
     }
-    int fd=_open_osfhandle((intptr_t)hR,_O_RDONLY|_O_BINARY);
-    if(fd==-1){
-        DWORD err = GetLastError();
-        LOG_ERROR("platform_popen_direct: _open_osfhandle failed err=%lu", err);
-        CloseHandle(hR);CloseHandle(pi.hProcess);CloseHandle(pi.hThread);return NULL;}
-    FILE* f=_fdopen(fd,mode);
-    if(!f){
-        LOG_ERROR("platform_popen_direct: _fdopen failed");
-        _close(fd);CloseHandle(pi.hProcess);CloseHandle(pi.hThread);return NULL;}
     CloseHandle(pi.hThread);
-    {
-        int is_ff = (strstr(cmd, "ffprobe") != NULL) ? 1 : 0;
-        while (g_phc >= 32) platform_sleep_ms(10);
-        if (g_phc < 32) {
-            g_ph[g_phc].f = f;
-            g_ph[g_phc].proc = pi.hProcess;
-            g_ph[g_phc].is_ffprobe = is_ff ? 1 : 0;
-            g_phc++;
-            if (is_ff) atomic_fetch_add(&ffprobe_active, 1);
-        } else {
-            CloseHandle(pi.hProcess); CloseHandle(pi.hThread); CloseHandle(hR);
-            fclose(f); return NULL;
+
+    char* bufs[2] = { NULL, NULL };
+    size_t lens[2] = { 0, 0 }, caps[2] = { 0, 0 };
+    uint64_t deadline = timeout_ms > 0 ? platform_monotonic_ms() + (uint64_t)timeout_ms : 0;
+    int timed_out = 0;
+    for (;;) {
+        DWORD slice = INFINITE;
+        if (capture) slice = PLATFORM_SPAWN_POLL_MS;
+        if (deadline) {
+            uint64_t now = platform_monotonic_ms();
+            if (now >= deadline) { timed_out = 1; break; }
+            if (slice == INFINITE || deadline - now < slice) slice = (DWORD)(deadline - now);
         }
+        DWORD w = WaitForSingleObject(pi.hProcess, slice);
+        spawn_drain_handle(outR, &bufs[0], &lens[0], &caps[0]);
+        spawn_drain_handle(errR, &bufs[1], &lens[1], &caps[1]);
+        if (w == WAIT_OBJECT_0) break;
+        if (w != WAIT_TIMEOUT) break;
     }
-    setvbuf(f,NULL,_IONBF,0);
-    return f;
-#else
-    int is_ff = (cmd && strstr(cmd, "ffprobe") != NULL) ? 1 : 0;
-    if (is_ff) {
-        while (atomic_load(&ffprobe_active) >= MAX_FFPROBE) platform_sleep_ms(50);
-        atomic_fetch_add(&ffprobe_active, 1);
+    DWORD exit_code = (DWORD)-1;
+    if (timed_out) {
+        TerminateProcess(pi.hProcess, 1);
+        WaitForSingleObject(pi.hProcess, INFINITE);
+        LOG_WARN("platform_spawn: '%s' killed after %d ms", argv[0], timeout_ms);
+    } else {
+        GetExitCodeProcess(pi.hProcess, &exit_code);
     }
-    FILE* f = popen(cmd,mode);
-    if (!f) {
-        LOG_WARN("platform_popen_direct: popen failed for '%s' err=%s", cmd ? cmd : "(null)", strerror(errno));
-        if (is_ff) atomic_fetch_sub(&ffprobe_active, 1);
+    CloseHandle(pi.hProcess);
+    if (outR) CloseHandle(outR);
+    if (errR) CloseHandle(errR);
+    int rc = timed_out ? -1 : (int)exit_code;
+    if (capture) {
+        capture->out = bufs[0]; capture->out_len = lens[0];
+        capture->err = bufs[1]; capture->err_len = lens[1];
+        capture->exit_code = rc;
+        capture->timed_out = timed_out;
     }
-    return f;
+    return rc;
+}
+#else
+extern char** environ;
+
+#if defined(__linux__)
+static int spawn_pipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+#define spawn_fd_lock() ((void)0)
+#define spawn_fd_unlock() ((void)0)
+#else
+/* Without pipe2() the pipe is briefly inheritable before FD_CLOEXEC is set,
+ * so creating pipes and spawning are serialized. */
+static pthread_mutex_t spawn_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void spawn_fd_lock(void) { pthread_mutex_lock(&spawn_fd_mutex); }
+static void spawn_fd_unlock(void) { pthread_mutex_unlock(&spawn_fd_mutex); }
+
+static int spawn_pipe(int fds[2]) {
+    if (pipe(fds) != 0) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+#endif
+
+static int spawn_pidfd_open(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
 #endif
 }
 
-int platform_pclose_direct(FILE* f){
-#ifdef _WIN32
-    if(!f)return-1;
-    HANDLE hProc=NULL;
-    for(int i=0;i<g_phc;i++){
-        if(g_ph[i].f==f){
-            hProc=g_ph[i].proc;
-            int was_ff = g_ph[i].is_ffprobe;
-            g_ph[i]=g_ph[--g_phc];
-            if (was_ff) atomic_fetch_sub(&ffprobe_active, 1);
+/* Reads whatever is buffered; returns 0 once the write end has gone away. */
+static int spawn_drain_fd(int fd, char** buf, size_t* len, size_t* cap) {
+    char tmp[4096];
+    for (;;) {
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if (n > 0) { spawn_buf_append(buf, len, cap, tmp, (size_t)n); continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return 1;
+        return 0;
+    }
+}
+
+int platform_spawn(const char* const* argv, const char* out_err_path, int timeout_ms, platform_spawn_result_t* capture) {
+    if (!argv || !argv[0]) return -1;
+    char line[1024];
+    spawn_format_argv(argv, line, sizeof(line));
+    platform_record_command(line);
+    LOG_DEBUG("platform_spawn: %s", line);
+    if (capture) memset(capture, 0, sizeof(*capture));
+
+    int pipes[2][2] = { { -1, -1 }, { -1, -1 } };
+    spawn_fd_lock();
+    if (capture && (spawn_pipe(pipes[0]) != 0 || spawn_pipe(pipes[1]) != 0)) {
+        LOG_ERROR("platform_spawn: pipe failed: %s", strerror(errno));
+        for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j) if (pipes[i][j] >= 0) close(pipes[i][j]);
+        spawn_fd_unlock();
+        return -1;
+    }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (capture) {
+        posix_spawn_file_actions_adddup2(&fa, pipes[0][1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&fa, pipes[1][1], STDERR_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, out_err_path ? out_err_path : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        posix_spawn_file_actions_adddup2(&fa, STDOUT_FILENO, STDERR_FILENO);
+    }
+
+    /* The child starts with no blocked signals and default SIGPIPE even if
+     * the spawning thread masks or ignores them. */
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask, defs;
+    sigemptyset(&mask);
+    sigemptyset(&defs);
+    sigaddset(&defs, SIGPIPE);
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defs);
+
+    pid_t pid = -1;
+    int serr = posix_spawnp(&pid, argv[0], &fa, &attr, (char* const*)argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (capture) { close(pipes[0][1]); close(pipes[1][1]); }
+    spawn_fd_unlock();
+    if (serr != 0) {
+        LOG_ERROR("platform_spawn: posix_spawnp failed for '%s': %s", argv[0], strerror(serr));
+        if (capture) { close(pipes[0][0]); close(pipes[1][0]); }
+        return -1;
+    }
+
+    int fds[2] = { pipes[0][0], pipes[1][0] };
+    char* bufs[2] = { NULL, NULL };
+    size_t lens[2] = { 0, 0 }, caps[2] = { 0, 0 };
+    int pidfd = spawn_pidfd_open(pid);
+    uint64_t deadline = timeout_ms > 0 ? platform_monotonic_ms() + (uint64_t)timeout_ms : 0;
+    int status = 0, reaped = 0, timed_out = 0;
+
+    while (!reaped) {
+        if (pidfd < 0 && !deadline && fds[0] < 0 && fds[1] < 0) {
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+            reaped = 1;
             break;
         }
+        struct pollfd pf[3];
+        int slot[3];
+        int n = 0;
+        if (pidfd >= 0) { pf[n].fd = pidfd; pf[n].events = POLLIN; pf[n].revents = 0; slot[n++] = -1; }
+        for (int i = 0; i < 2; ++i)
+            if (fds[i] >= 0) { pf[n].fd = fds[i]; pf[n].events = POLLIN; pf[n].revents = 0; slot[n++] = i; }
+        int wait_ms = -1;
+        if (deadline) {
+            uint64_t now = platform_monotonic_ms();
+            if (now >= deadline) { timed_out = 1; break; }
+            wait_ms = (int)(deadline - now);
+        }
+        if (pidfd < 0 && (wait_ms < 0 || wait_ms > PLATFORM_SPAWN_POLL_MS)) wait_ms = PLATFORM_SPAWN_POLL_MS;
+        int pr = poll(pf, (nfds_t)n, wait_ms);
+        if (pr < 0 && errno != EINTR) {
+            LOG_WARN("platform_spawn: poll failed: %s", strerror(errno));
+            if (pidfd >= 0) { close(pidfd); pidfd = -1; }
+            continue;
+        }
+        for (int i = 0; pr > 0 && i < n; ++i) {
+            if (slot[i] < 0 || !pf[i].revents) continue;
+            int k = slot[i];
+            if (!spawn_drain_fd(fds[k], &bufs[k], &lens[k], &caps[k])) { close(fds[k]); fds[k] = -1; }
+        }
+        if (pidfd < 0 || (pr > 0 && pf[0].revents)) {
+            pid_t w = waitpid(pid, &status, WNOHANG);
+            if (w == pid || (w < 0 && errno == ECHILD)) reaped = 1;
+        }
     }
-    fclose(f);
-    if(hProc){
-        WaitForSingleObject(hProc,INFINITE);
-        DWORD code=0;GetExitCodeProcess(hProc,&code);
-        CloseHandle(hProc);
-        return (int)code;
+    if (timed_out) {
+        kill(pid, SIGKILL);
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        LOG_WARN("platform_spawn: '%s' killed after %d ms", argv[0], timeout_ms);
     }
-    return 0;
-#else
-    return pclose(f);
-#endif
+    if (pidfd >= 0) close(pidfd);
+    for (int k = 0; k < 2; ++k) {
+        if (fds[k] < 0) continue;
+        spawn_drain_fd(fds[k], &bufs[k], &lens[k], &caps[k]);
+        close(fds[k]);
+    }
+    int rc = (!timed_out && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+    if (capture) {
+        capture->out = bufs[0]; capture->out_len = lens[0];
+        capture->err = bufs[1]; capture->err_len = lens[1];
+        capture->exit_code = rc;
+        capture->timed_out = timed_out;
+    }
+    return rc;
 }
+#endif
+
 int platform_run_command(const char* cmd, int timeout_seconds) {
     if (!cmd) return -1;
+#ifdef _WIN32
     platform_record_command(cmd);
     LOG_DEBUG("platform_run_command: %s", cmd);
-#ifdef _WIN32
     STARTUPINFOW si; PROCESS_INFORMATION pi; ZeroMemory(&si, sizeof(si)); si.cb = sizeof(si); si.dwFlags = STARTF_USESHOWWINDOW; si.wShowWindow = SW_HIDE; ZeroMemory(&pi, sizeof(pi));
     WCHAR wcmd[4096];
     WCHAR warg[4096];
@@ -363,35 +653,8 @@ int platform_run_command(const char* cmd, int timeout_seconds) {
     CloseHandle(pi.hProcess); CloseHandle(pi.hThread);
     return (int)exit_code;
 #else
-    pid_t pid = fork();
-    if (pid < 0) {
-        LOG_ERROR("platform_run_command: fork failed: %s", strerror(errno));
-        return -1;
-    }
-    if (pid == 0) {
-        execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
-        _exit(127);
-    }
-    int status = -1;
-    if (timeout_seconds > 0) {
-        int elapsed = 0; int rc;
-        while (elapsed < timeout_seconds) {
-            rc = waitpid(pid, &status, WNOHANG);
-            if (rc == pid) break;
-            sleep(1);
-            elapsed++;
-        }
-        if (elapsed >= timeout_seconds) {
-            kill(pid, SIGKILL);
-            waitpid(pid, &status, 0);
-        } else if (rc == 0) {
-            waitpid(pid, &status, 0);
-        }
-    } else {
-        waitpid(pid, &status, 0);
-    }
-    if (WIFEXITED(status)) return WEXITSTATUS(status);
-    return -1;
+    const char* argv[] = { "/bin/sh", "-c", cmd, NULL };
+    return platform_spawn(argv, NULL, timeout_seconds > 0 ? timeout_seconds * 1000 : 0, NULL);
 #endif
 }
 
@@ -443,12 +706,468 @@ int platform_pid_is_running(int pid) {
 #endif
 }
 
+#if defined(__linux__) || defined(_WIN32)
+/* Events waiting out their PLATFORM_WATCH_COALESCE_MS quiet period, one per
+ * owner and path. Each watcher thread keeps its own list. */
+typedef struct watch_pending {
+    char* path;
+    void* owner;
+    int flags;
+    uint64_t due_ms;
+    struct watch_pending* next;
+} watch_pending_t;
+
+/* A later change or removal replaces the earlier one, and every event
+ * pushes the path's deadline back. */
+static void watch_pending_add(watch_pending_t** head, void* owner, const char* path, int flags) {
+    uint64_t due = platform_monotonic_ms() + PLATFORM_WATCH_COALESCE_MS;
+    for (watch_pending_t* p = *head; p; p = p->next) {
+        if (p->owner == owner && strcmp(p->path, path) == 0) {
+            if (flags & (PLATFORM_WATCH_CHANGED | PLATFORM_WATCH_REMOVED))
+                p->flags &= ~(PLATFORM_WATCH_CHANGED | PLATFORM_WATCH_REMOVED);
+            p->flags |= flags;
+            p->due_ms = due;
+            return;
+        }
+    }
+    watch_pending_t* p = calloc(1, sizeof(watch_pending_t));
+    if (!p || !(p->path = strdup(path))) { free(p); return; }
+    p->owner = owner;
+    p->flags = flags;
+    p->due_ms = due;
+    p->next = *head;
+    *head = p;
+}
+
+/* Unlinks and returns the entries due by now; next_due gets the earliest
+ * deadline left, or 0 when nothing is pending. */
+static watch_pending_t* watch_pending_take_due(watch_pending_t** head, uint64_t now, uint64_t* next_due) {
+    watch_pending_t* ready = NULL;
+    *next_due = 0;
+    watch_pending_t** pp = head;
+    while (*pp) {
+        watch_pending_t* p = *pp;
+        if (p->due_ms <= now) { *pp = p->next; p->next = ready; ready = p; }
+        else {
+            if (!*next_due || p->due_ms < *next_due) *next_due = p->due_ms;
+            pp = &p->next;
+        }
+    }
+    return ready;
+}
+#endif
+
+#if defined(__linux__)
+/* All watches share one inotify instance serviced by a single epoll thread.
+ * Events are coalesced per path for PLATFORM_WATCH_COALESCE_MS before the
+ * callback runs, so a file that is still being copied is reported once. On
+ * IN_Q_OVERFLOW only directories whose mtime moved since they were last seen
+ * are reported for resync. */
+#define WATCH_MASK (IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_CLOSE_WRITE | IN_ATTRIB)
+#define WATCH_BUCKETS 1024
+#define WATCH_MAX_DEPTH 64
+
+typedef struct watch_root {
+    char* path;
+    int recursive;
+    platform_watch_event_cb_t cb;
+    platform_watcher_callback_t dir_cb;
+    void* ctx;
+} watch_root_t;
+
+typedef struct watch_dir {
+    int wd;
+    char* path;
+    watch_root_t* root;
+    time_t mtime;
+    int dirty;
+    struct watch_dir* next;
+} watch_dir_t;
+
+static thread_mutex_t watch_mutex;
+static int watch_inotify_fd = -1;
+static int watch_epoll_fd = -1;
+static int watch_state;
+static int watch_space_warned;
+static watch_dir_t* watch_dirs[WATCH_BUCKETS];
+static watch_pending_t* watch_pending;
+
+static int watch_skip_name(const char* name) {
+    return !name || !strcmp(name, ".") || !strcmp(name, "..") || !strcmp(name, "thumbs");
+}
+
+static void watch_queue(watch_root_t* root, const char* path, int flags);
+
+/* When announce is set the directory appeared after registration, so files
+ * created in its subdirectories before their watches existed are reported
+ * through a resync of each one. */
+static int watch_add_dir_locked(watch_root_t* root, const char* path, int depth, int announce) {
+    int wd = inotify_add_watch(watch_inotify_fd, path, WATCH_MASK | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd < 0) {
+        if (errno == ENOSPC && !watch_space_warned) {
+            watch_space_warned = 1;
+            LOG_WARN("inotify watch limit reached at %s; raise fs.inotify.max_user_watches", path);
+        }
+        return -1;
+    }
+    watch_dir_t* d = calloc(1, sizeof(watch_dir_t));
+    if (!d || !(d->path = strdup(path))) { free(d); inotify_rm_watch(watch_inotify_fd, wd); return -1; }
+    d->wd = wd;
+    d->root = root;
+    struct stat st;
+    if (stat(path, &st) == 0) d->mtime = st.st_mtime;
+    d->next = watch_dirs[wd % WATCH_BUCKETS];
+    watch_dirs[wd % WATCH_BUCKETS] = d;
+    if (!root->recursive || depth >= WATCH_MAX_DEPTH) return 0;
+    DIR* dir = opendir(path);
+    if (!dir) return 0;
+    struct dirent* de;
+    while ((de = readdir(dir))) {
+        if (watch_skip_name(de->d_name)) continue;
+        char child[PATH_MAX];
+        if (snprintf(child, sizeof(child), "%s/%s", path, de->d_name) >= (int)sizeof(child)) continue;
+        struct stat cst;
+        if (lstat(child, &cst) != 0 || !S_ISDIR(cst.st_mode)) continue;
+        if (watch_add_dir_locked(root, child, depth + 1, announce) == 0 && announce)
+            watch_queue(root, child, PLATFORM_WATCH_RESYNC | PLATFORM_WATCH_DIR);
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int path_is_under(const char* path, const char* base) {
+    size_t bl = strlen(base);
+    return strncmp(path, base, bl) == 0 && (path[bl] == '\0' || path[bl] == '/');
+}
+
+/* Drops the watches for a directory that was moved away or deleted, since
+ * their stored paths are no longer valid. */
+static void watch_remove_tree_locked(const char* path) {
+    for (int b = 0; b < WATCH_BUCKETS; b++) {
+        watch_dir_t** pp = &watch_dirs[b];
+        while (*pp) {
+            watch_dir_t* d = *pp;
+            if (path_is_under(d->path, path)) {
+                *pp = d->next;
+                inotify_rm_watch(watch_inotify_fd, d->wd);
+                free(d->path);
+                free(d);
+            } else pp = &d->next;
+        }
+    }
+}
+
+static void watch_remove_wd_locked(int wd) {
+    watch_dir_t** pp = &watch_dirs[wd % WATCH_BUCKETS];
+    while (*pp) {
+        watch_dir_t* d = *pp;
+        if (d->wd == wd) { *pp = d->next; free(d->path); free(d); }
+        else pp = &d->next;
+    }
+}
+
+static void watch_queue(watch_root_t* root, const char* path, int flags) {
+    watch_pending_add(&watch_pending, root, path, flags);
+}
+
+/* Non-recursive roots registered through platform_start_dir_watcher() only
+ * want to hear that something in the directory changed. */
+static void watch_queue_for(watch_dir_t* d, const char* path, int flags) {
+    if (d->root->dir_cb) watch_queue(d->root, d->root->path, PLATFORM_WATCH_CHANGED);
+    else watch_queue(d->root, path, flags);
+}
+
+static void watch_handle_overflow(void) {
+    LOG_WARN("inotify queue overflowed; resyncing changed directories");
+    thread_mutex_lock(&watch_mutex);
+    for (int b = 0; b < WATCH_BUCKETS; b++) {
+        for (watch_dir_t* d = watch_dirs[b]; d; d = d->next) {
+            struct stat st;
+            if (stat(d->path, &st) != 0 || st.st_mtime != d->mtime) {
+                d->mtime = st.st_mtime;
+                watch_queue_for(d, d->path, PLATFORM_WATCH_RESYNC | PLATFORM_WATCH_DIR);
+            }
+        }
+    }
+    thread_mutex_unlock(&watch_mutex);
+}
+
+static void watch_handle_event(const struct inotify_event* ev) {
+    if (ev->mask & IN_Q_OVERFLOW) { watch_handle_overflow(); return; }
+    thread_mutex_lock(&watch_mutex);
+    if (ev->mask & IN_IGNORED) { watch_remove_wd_locked(ev->wd); thread_mutex_unlock(&watch_mutex); return; }
+    const char* name = ev->len > 0 ? ev->name : NULL;
+    if (!name || watch_skip_name(name)) { thread_mutex_unlock(&watch_mutex); return; }
+    watch_dir_t* matches[8];
+    int nmatch = 0;
+    for (watch_dir_t* d = watch_dirs[ev->wd % WATCH_BUCKETS]; d && nmatch < 8; d = d->next)
+        if (d->wd == ev->wd) matches[nmatch++] = d;
+    for (int i = 0; i < nmatch; i++) {
+        watch_dir_t* d = matches[i];
+        char full[PATH_MAX];
+        if (snprintf(full, sizeof(full), "%s/%s", d->path, name) >= (int)sizeof(full)) continue;
+        d->dirty = 1;
+        if (ev->mask & IN_ISDIR) {
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if (d->root->recursive) watch_add_dir_locked(d->root, full, 0, 1);
+                watch_queue_for(d, full, PLATFORM_WATCH_RESYNC | PLATFORM_WATCH_DIR);
+            } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                watch_remove_tree_locked(full);
+                watch_queue_for(d, full, PLATFORM_WATCH_REMOVED | PLATFORM_WATCH_DIR);
+            }
+            continue;
+        }
+        watch_queue_for(d, full, (ev->mask & (IN_DELETE | IN_MOVED_FROM)) ? PLATFORM_WATCH_REMOVED : PLATFORM_WATCH_CHANGED);
+    }
+    thread_mutex_unlock(&watch_mutex);
+}
+
+/* Runs the callbacks for every pending path whose quiet period has passed
+ * and returns the epoll timeout until the next one is due. */
+static int watch_dispatch_due(void) {
+    uint64_t now = platform_monotonic_ms();
+    uint64_t next_due;
+    watch_pending_t* ready = watch_pending_take_due(&watch_pending, now, &next_due);
+    if (ready) {
+        thread_mutex_lock(&watch_mutex);
+        for (int b = 0; b < WATCH_BUCKETS; b++) {
+            for (watch_dir_t* d = watch_dirs[b]; d; d = d->next) {
+                struct stat st;
+                if (d->dirty && stat(d->path, &st) == 0) d->mtime = st.st_mtime;
+                d->dirty = 0;
+            }
+        }
+        thread_mutex_unlock(&watch_mutex);
+    }
+    while (ready) {
+        watch_pending_t* p = ready;
+        ready = p->next;
+        watch_root_t* root = (watch_root_t*)p->owner;
+        LOG_DEBUG("Watcher dispatch flags=%d path=%s", p->flags, p->path);
+        if (root->dir_cb) root->dir_cb(root->path);
+        else root->cb(root->path, p->path, p->flags, root->ctx);
+        free(p->path);
+        free(p);
+    }
+    if (!next_due) return -1;
+    return next_due > now ? (int)(next_due - now) : 0;
+}
+
+static void* watch_loop_thread(void* arg) {
+    (void)arg;
+    char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int timeout = -1;
+    for (;;) {
+        struct epoll_event evs[4];
+        int n = epoll_wait(watch_epoll_fd, evs, 4, timeout);
+        if (n < 0 && errno != EINTR) {
+            LOG_ERROR("epoll_wait failed for watcher: %s", strerror(errno));
+            platform_sleep_ms(1000);
+        }
+        for (;;) {
+            ssize_t len = read(watch_inotify_fd, buf, sizeof(buf));
+            if (len <= 0) break;
+            for (ssize_t off = 0; off < len; ) {
+                const struct inotify_event* ev = (const struct inotify_event*)(buf + off);
+                watch_handle_event(ev);
+                off += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+            }
+        }
+        timeout = watch_dispatch_due();
+    }
+    return NULL;
+}
+
+static int watch_ensure_started(void) {
+    static atomic_int init_lock = ATOMIC_VAR_INIT(0);
+    while (atomic_exchange(&init_lock, 1)) platform_sleep_ms(1);
+    if (watch_state == 0) {
+        watch_state = -1;
+        thread_mutex_init(&watch_mutex);
+        watch_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        watch_epoll_fd = watch_inotify_fd >= 0 ? epoll_create1(EPOLL_CLOEXEC) : -1;
+        struct epoll_event ev = { 0 };
+        ev.events = EPOLLIN;
+        if (watch_epoll_fd >= 0 && epoll_ctl(watch_epoll_fd, EPOLL_CTL_ADD, watch_inotify_fd, &ev) == 0
+            && thread_create_detached(watch_loop_thread, NULL) == 0) {
+            watch_state = 1;
+        } else {
+            LOG_ERROR("Failed to start inotify watcher: %s", strerror(errno));
+            if (watch_epoll_fd >= 0) close(watch_epoll_fd);
+            if (watch_inotify_fd >= 0) close(watch_inotify_fd);
+            watch_epoll_fd = watch_inotify_fd = -1;
+        }
+    }
+    atomic_store(&init_lock, 0);
+    return watch_state == 1 ? 0 : -1;
+}
+
+static int watch_register(const char* dir, int recursive, platform_watch_event_cb_t cb, platform_watcher_callback_t dir_cb, void* ctx) {
+    if (watch_ensure_started() != 0) return -1;
+    watch_root_t* root = calloc(1, sizeof(watch_root_t));
+    if (!root || !(root->path = strdup(dir))) { free(root); return -1; }
+    size_t rl = strlen(root->path);
+    while (rl > 1 && root->path[rl - 1] == '/') root->path[--rl] = '\0';
+    root->recursive = recursive;
+    root->cb = cb;
+    root->dir_cb = dir_cb;
+    root->ctx = ctx;
+    thread_mutex_lock(&watch_mutex);
+    int rc = watch_add_dir_locked(root, root->path, 0, 0);
+    thread_mutex_unlock(&watch_mutex);
+    if (rc != 0) {
+        LOG_ERROR("inotify_add_watch failed for %s: %s", dir, strerror(errno));
+        free(root->path);
+        free(root);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+#if !defined(__linux__)
+typedef struct {
+    char* root;
+    platform_watch_event_cb_t cb;
+    void* ctx;
+} tree_watch_arg_t;
+
+#ifdef _WIN32
+static int watch_path_has_thumbs(const char* rel) {
+    for (const char* p = rel; *p; ) {
+        size_t n = strcspn(p, "\\/");
+        if (n == 6 && strncmp(p, "thumbs", 6) == 0) return 1;
+        p += n;
+        if (*p) p++;
+    }
+    return 0;
+}
+
+/* The read is overlapped so the thread can wake when the next pending path
+ * is due; events are coalesced per path just like the inotify watcher. */
+static void* tree_watch_thread(void* arg) {
+    tree_watch_arg_t* a = (tree_watch_arg_t*)arg;
+    WCHAR wdir[PATH_MAX];
+    HANDLE hDir = INVALID_HANDLE_VALUE;
+    if (MultiByteToWideChar(CP_UTF8, 0, a->root, -1, wdir, PATH_MAX) != 0)
+        hDir = CreateFileW(wdir, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    if (hDir != INVALID_HANDLE_VALUE) ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (hDir == INVALID_HANDLE_VALUE || !ov.hEvent) {
+        LOG_ERROR("CreateFileW failed for tree watcher on %s", a->root);
+        a->cb(a->root, a->root, PLATFORM_WATCH_RESYNC | PLATFORM_WATCH_DIR, a->ctx);
+        if (hDir != INVALID_HANDLE_VALUE) CloseHandle(hDir);
+        free(a->root); free(a);
+        return NULL;
+    }
+    DWORD buffer[16384];
+    watch_pending_t* pending = NULL;
+    int armed = 0;
+    for (;;) {
+        if (!armed) {
+            ResetEvent(ov.hEvent);
+            if (!ReadDirectoryChangesW(hDir, buffer, sizeof(buffer), TRUE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &ov, NULL)) {
+                LOG_WARN("ReadDirectoryChangesW failed for %s with %lu", a->root, GetLastError());
+                break;
+            }
+            armed = 1;
+        }
+        uint64_t now = platform_monotonic_ms(), next_due;
+        watch_pending_t* ready = watch_pending_take_due(&pending, now, &next_due);
+        while (ready) {
+            watch_pending_t* p = ready;
+            ready = p->next;
+            LOG_DEBUG("Watcher dispatch flags=%d path=%s", p->flags, p->path);
+            a->cb(a->root, p->path, p->flags, a->ctx);
+            free(p->path);
+            free(p);
+        }
+        DWORD wait = WaitForSingleObject(ov.hEvent, next_due ? (DWORD)(next_due - now) : INFINITE);
+        if (wait == WAIT_TIMEOUT) continue;
+        if (wait != WAIT_OBJECT_0) {
+            LOG_WARN("Tree watcher wait failed for %s with %lu", a->root, GetLastError());
+            break;
+        }
+        DWORD bytesReturned = 0;
+        armed = 0;
+        if (!GetOverlappedResult(hDir, &ov, &bytesReturned, FALSE)) {
+            LOG_WARN("ReadDirectoryChangesW failed for %s with %lu", a->root, GetLastError());
+            break;
+        }
+        if (bytesReturned == 0) {
+            LOG_WARN("Watcher buffer overflowed for %s; resyncing", a->root);
+            watch_pending_add(&pending, NULL, a->root, PLATFORM_WATCH_RESYNC | PLATFORM_WATCH_DIR);
+            continue;
+        }
+        FILE_NOTIFY_INFORMATION* fni = (FILE_NOTIFY_INFORMATION*)buffer;
+        for (;;) {
+            char rel[1024];
+            int conv = WideCharToMultiByte(CP_UTF8, 0, fni->FileName, (int)(fni->FileNameLength / sizeof(WCHAR)), rel, (int)sizeof(rel) - 1, NULL, NULL);
+            rel[conv > 0 ? conv : 0] = '\0';
+            if (rel[0] && !watch_path_has_thumbs(rel)) {
+                char full[PATH_MAX];
+                snprintf(full, sizeof(full), "%s\\%s", a->root, rel);
+                int removed = fni->Action == FILE_ACTION_REMOVED || fni->Action == FILE_ACTION_RENAMED_OLD_NAME;
+                int flags = removed ? PLATFORM_WATCH_REMOVED : PLATFORM_WATCH_CHANGED;
+                if (!removed && platform_is_dir(full)) flags = PLATFORM_WATCH_RESYNC | PLATFORM_WATCH_DIR;
+                watch_pending_add(&pending, NULL, full, flags);
+            }
+            if (fni->NextEntryOffset == 0) break;
+            fni = (FILE_NOTIFY_INFORMATION*)((char*)fni + fni->NextEntryOffset);
+        }
+    }
+    if (armed) {
+        DWORD ignored;
+        CancelIo(hDir);
+        GetOverlappedResult(hDir, &ov, &ignored, TRUE);
+    }
+    while (pending) {
+        watch_pending_t* p = pending;
+        pending = p->next;
+        free(p->path);
+        free(p);
+    }
+    CloseHandle(ov.hEvent);
+    CloseHandle(hDir);
+    free(a->root);
+    free(a);
+    return NULL;
+}
+#else
+/* Without a native notification API the tree and directory watchers are
+ * periodic timers on the shared wheel that report a resync each period. */
+static void tree_poll_fire(void* arg) {
+    tree_watch_arg_t* a = (tree_watch_arg_t*)arg;
+    a->cb(a->root, a->root, PLATFORM_WATCH_RESYNC | PLATFORM_WATCH_DIR, a->ctx);
+}
+#endif
+#endif
+
+int platform_watch_tree(const char* root, platform_watch_event_cb_t cb, void* ctx) {
+    if (!root || !cb) return -1;
+#if defined(__linux__)
+    return watch_register(root, 1, cb, NULL, ctx);
+#else
+    tree_watch_arg_t* a = calloc(1, sizeof(tree_watch_arg_t));
+    if (!a || !(a->root = strdup(root))) { free(a); return -1; }
+    a->cb = cb;
+    a->ctx = ctx;
+#ifdef _WIN32
+    if (thread_create_detached(tree_watch_thread, a) != 0) { free(a->root); free(a); return -1; }
+#else
+    if (!timer_add_periodic(PLATFORM_WATCH_POLL_MS, tree_poll_fire, a)) { free(a->root); free(a); return -1; }
+#endif
+    return 0;
+#endif
+}
+
+#ifdef _WIN32
 static void watcher_trampoline(void* arg) {
     void** a = (void**)arg;
     char* dir = (char*)a[0];
     platform_watcher_callback_t cb = (platform_watcher_callback_t)a[1];
     free(arg);
-#ifdef _WIN32
     WCHAR wdir[PATH_MAX];
     if (MultiByteToWideChar(CP_UTF8, 0, dir, -1, wdir, PATH_MAX) == 0) {
         LOG_ERROR("Failed to convert dir to wide char for watcher: %s", dir);
@@ -486,48 +1205,19 @@ static void watcher_trampoline(void* arg) {
     }
     CloseHandle(hDir);
     free(dir);
-#else
-#if defined(__linux__)
-    int fd = inotify_init1(IN_NONBLOCK);
-    if (fd < 0) { cb(dir); free(dir); return; }
-    int wd = inotify_add_watch(fd, dir, IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_CLOSE_WRITE | IN_ATTRIB);
-    if (wd < 0) { close(fd); cb(dir); free(dir); return; }
-    char buf[4096];
-    for (;;) {
-        int len = read(fd, buf, sizeof(buf));
-        if (len > 0) {
-            int off = 0;
-            while (off < len) {
-                struct inotify_event* ev = (struct inotify_event*)(buf + off);
-                const char* name = (ev->len > 0) ? ev->name : NULL;
-                LOG_DEBUG("inotify event mask=%u name=%s dir=%s", ev->mask, name ? name : "(nil)", dir);
-                if ((ev->mask & (IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_CLOSE_WRITE | IN_ATTRIB))) {
-                    if (name && strcmp(name, "thumbs") == 0) {
-                        LOG_DEBUG("Ignoring inotify event for thumbs directory: %s", name);
-                    } else {
-                        cb(dir);
-                        break;
-                    }
-                }
-                off += sizeof(struct inotify_event) + ev->len;
-            }
-        }
-        platform_sleep_ms(1000);
-    }
-    inotify_rm_watch(fd, wd);
-    close(fd);
-    free(dir);
-#else
-    for (;;) {
-        platform_sleep_ms(1000);
-        cb(dir);
-    }
-#endif
-#endif
 }
+#elif !defined(__linux__)
+static void dir_poll_fire(void* arg) {
+    void** a = (void**)arg;
+    ((platform_watcher_callback_t)a[1])((const char*)a[0]);
+}
+#endif
 
 int platform_start_dir_watcher(const char* dir, platform_watcher_callback_t cb) {
     if (!dir || !cb) return -1;
+#if defined(__linux__)
+    return watch_register(dir, 0, NULL, cb, NULL);
+#else
     char* d = strdup(dir);
     if (!d) return -1;
     void** arg = malloc(sizeof(void*) * 2);
@@ -537,8 +1227,13 @@ int platform_start_dir_watcher(const char* dir, platform_watcher_callback_t cb)
         return -1;
     }
     arg[0] = d; arg[1] = (void*)cb;
+#ifdef _WIN32
     if (thread_create_detached((void*(*)(void*))watcher_trampoline, arg) != 0) { free(d); free(arg); return -1; }
+#else
+    if (!timer_add_periodic(1000, dir_poll_fire, arg)) { free(d); free(arg); return -1; }
+#endif
     return 0;
+#endif
 }
 
 int platform_stat(const char* path, struct stat* st) {
@@ -573,81 +1268,270 @@ const char* platform_devnull(void) {
 #endif
 }
 
-int platform_stream_file_payload(int client_socket, const char* path, long start, long len, int is_range) {
-    (void)start; (void)len; (void)is_range;
 #ifdef _WIN32
-    WCHAR wpath[PATH_MAX];
-    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_MAX) == 0) return -1;
-    HANDLE hFile = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (hFile == INVALID_HANDLE_VALUE) return -1;
-    register_stream(path, client_socket);
-    WSAPROTOCOL_INFO pi; int pi_len = sizeof(pi);
+/* A shared handle (pack files, the fd cache) is read only at explicit
+ * OVERLAPPED offsets and never through its file pointer, which concurrent
+ * requests would race on; TransmitFile is kept for handles this call owns. */
+static int stream_handle_payload(int client_socket, HANDLE hFile, const char* path, long start, long len, int shared) {
     DWORD file_size = GetFileSize(hFile, NULL);
     long rem = len;
     if (rem <= 0) {
         if (file_size > (DWORD)start) rem = (long)(file_size - (DWORD)start);
         else rem = 0;
     }
-    if ((long)start >= (long)file_size) { CloseHandle(hFile); return -1; }
-    SetFilePointer(hFile, (LONG)start, NULL, FILE_BEGIN);
+    if ((long)start >= (long)file_size) return -1;
+    register_stream(path, client_socket);
     WSAPROTOCOL_INFO pi2; int pi2_len = sizeof(pi2);
-    if (getsockopt(client_socket, SOL_SOCKET, SO_PROTOCOL_INFO, (char*)&pi2, &pi2_len) == 0) {
+    if (!shared && !bw_enabled() && SetFilePointer(hFile, (LONG)start, NULL, FILE_BEGIN) != INVALID_SET_FILE_POINTER && getsockopt(client_socket, SOL_SOCKET, SO_PROTOCOL_INFO, (char*)&pi2, &pi2_len) == 0) {
         DWORD toWrite = (rem > 0 && rem <= (long)0xFFFFFFFF) ? (DWORD)rem : 0;
-        if (toWrite > 0) {
-            if (TransmitFile((SOCKET)client_socket, hFile, toWrite, 0, NULL, NULL, 0)) { CloseHandle(hFile); unregister_stream_by_sock(client_socket); return 0; }
-        } else {
-            if (TransmitFile((SOCKET)client_socket, hFile, 0, 0, NULL, NULL, 0)) { CloseHandle(hFile); unregister_stream_by_sock(client_socket); return 0; }
-        }
+        if (TransmitFile((SOCKET)client_socket, hFile, toWrite, 0, NULL, NULL, 0)) { unregister_stream_by_sock(client_socket); return 0; }
     }
     char buf[65536];
-    size_t total = 0;
+    uint64_t pos = (uint64_t)start;
+    bw_flow_t flow; bw_flow_open(&flow, client_socket, path);
     while (rem > 0) {
         DWORD toread = (rem < (long)sizeof(buf) ? (DWORD)rem : (DWORD)sizeof(buf));
-        DWORD rd = 0; if (!ReadFile(hFile, buf, toread, &rd, NULL) || rd == 0) break;
+        OVERLAPPED ov = { 0 };
+        ov.Offset = (DWORD)(pos & 0xFFFFFFFFu);
+        ov.OffsetHigh = (DWORD)(pos >> 32);
+        DWORD rd = 0; if (!ReadFile(hFile, buf, toread, &rd, &ov) || rd == 0) break;
+        bw_flow_throttle(&flow, rd);
         int snt = send(client_socket, buf, (int)rd, 0);
         if (snt <= 0) break;
-        rem -= snt; total += snt;
+        pos += (uint64_t)snt;
+        rem -= snt;
     }
-    CloseHandle(hFile);
+    bw_flow_close(&flow);
     unregister_stream_by_sock(client_socket);
     return (rem > 0) ? -1 : 0;
+}
 #else
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) return -1;
+static int stream_fd_payload(int client_socket, int fd, const char* path, long start, long len) {
     register_stream(path, client_socket);
     off_t offset = start;
     long remain = len; if (remain <= 0) {
         struct stat st; if (fstat(fd, &st) == 0) remain = (long)st.st_size - start; else remain = 0;
     }
     char buf[65536];
+    int rc = 0;
+    bw_flow_t flow; bw_flow_open(&flow, client_socket, path);
+#if defined(__linux__)
     while (remain > 0) {
+        size_t chunk = (remain < (long)sizeof(buf)) ? (size_t)remain : sizeof(buf);
+        bw_flow_throttle(&flow, chunk);
+        ssize_t snt = sendfile(client_socket, fd, &offset, chunk);
+        if (snt < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            if (errno != EINVAL && errno != ENOSYS) rc = -1;
+            break;
+        }
+        if (snt == 0) { rc = -1; break; }
+        remain -= snt;
+    }
+#endif
+    while (remain > 0 && rc == 0) {
         size_t toread = (remain < (long)sizeof(buf)) ? (size_t)remain : sizeof(buf);
-        if (lseek(fd, offset, SEEK_SET) == (off_t)-1) { close(fd); return -1; }
-        ssize_t rd = read(fd, buf, toread);
-        if (rd <= 0) { if (errno == EINTR) continue; close(fd); return -1; }
+        ssize_t rd = pread(fd, buf, toread, offset);
+        if (rd <= 0) { if (rd < 0 && errno == EINTR) continue; rc = -1; break; }
+        bw_flow_throttle(&flow, (size_t)rd);
         ssize_t sent_total = 0;
         while (sent_total < rd) {
             ssize_t snt = send(client_socket, buf + sent_total, (int)(rd - sent_total), 0);
             if (snt <= 0) {
                 if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) continue;
-                close(fd); return -1;
+                rc = -1; break;
             }
             sent_total += snt;
             offset += snt;
             remain -= snt;
         }
     }
-    close(fd);
+    bw_flow_close(&flow);
     unregister_stream_by_sock(client_socket);
-    return 0;
+    return rc;
+}
+#endif
+
+int platform_stream_file_payload(int client_socket, const char* path, long start, long len, int is_range) {
+    (void)is_range;
+#ifdef _WIN32
+    WCHAR wpath[PATH_MAX];
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_MAX) == 0) return -1;
+    HANDLE hFile = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return -1;
+    int rc = stream_handle_payload(client_socket, hFile, path, start, len, 0);
+    CloseHandle(hFile);
+    return rc;
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int rc = stream_fd_payload(client_socket, fd, path, start, len);
+    close(fd);
+    return rc;
+#endif
+}
+
+int platform_stream_fd_payload(int client_socket, int fd, const char* path, long start, long len) {
+    if (fd < 0) return -1;
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    if (h == INVALID_HANDLE_VALUE) return -1;
+    return stream_handle_payload(client_socket, h, path, start, len, 1);
+#else
+    return stream_fd_payload(client_socket, fd, path, start, len);
+#endif
+}
+
+int platform_open_dir(const char* path) {
+    if (!path) return -1;
+#ifdef _WIN32
+    errno = ENOSYS;
+    return -1;
+#else
+    return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+}
+
+void platform_close_fd(int fd) {
+    if (fd < 0) return;
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+int platform_open_rw(const char* path, int create) {
+    if (!path) return -1;
+#ifdef _WIN32
+    WCHAR wpath[PATH_MAX];
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_MAX) == 0) return -1;
+    return _wopen(wpath, _O_RDWR | _O_BINARY | _O_NOINHERIT | (create ? _O_CREAT : 0), _S_IREAD | _S_IWRITE);
+#else
+    return open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+#endif
+}
+
+/* Positional reads and writes that never depend on the file offset, so
+ * several threads can share one descriptor. On Windows a synchronous handle
+ * still advances its file pointer after an OVERLAPPED-offset transfer, so
+ * every user of a shared descriptor must go through these (or equivalent
+ * explicit-offset calls) rather than seek-then-read. */
+long platform_pread(int fd, void* buf, size_t len, uint64_t off) {
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    if (h == INVALID_HANDLE_VALUE) return -1;
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD)(off & 0xFFFFFFFFu);
+    ov.OffsetHigh = (DWORD)(off >> 32);
+    DWORD got = 0;
+    if (!ReadFile(h, buf, (DWORD)len, &got, &ov)) return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    return (long)got;
+#else
+    ssize_t r;
+    do r = pread(fd, buf, len, (off_t)off); while (r < 0 && errno == EINTR);
+    return (long)r;
+#endif
+}
+
+long platform_pwrite(int fd, const void* buf, size_t len, uint64_t off) {
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    if (h == INVALID_HANDLE_VALUE) return -1;
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD)(off & 0xFFFFFFFFu);
+    ov.OffsetHigh = (DWORD)(off >> 32);
+    DWORD put = 0;
+    if (!WriteFile(h, buf, (DWORD)len, &put, &ov)) return -1;
+    return (long)put;
+#else
+    ssize_t r;
+    do r = pwrite(fd, buf, len, (off_t)off); while (r < 0 && errno == EINTR);
+    return (long)r;
+#endif
+}
+
+#ifndef _WIN32
+static int open_beneath_walk(int dir_fd, const char* rel) {
+    char comp[NAME_MAX + 1];
+    int cur = dir_fd;
+    const char* p = rel;
+    for (;;) {
+        while (*p == '/') p++;
+        const char* end = strchr(p, '/');
+        size_t n = end ? (size_t)(end - p) : strlen(p);
+        if (n == 0 || n > NAME_MAX) { errno = n ? ENAMETOOLONG : EISDIR; break; }
+        memcpy(comp, p, n); comp[n] = '\0';
+        p += n;
+        while (*p == '/') p++;
+        if (strcmp(comp, ".") == 0 && *p) continue;
+        if (strcmp(comp, "..") == 0) { errno = EXDEV; break; }
+        int last = *p == '\0';
+        int next = openat(cur, comp, O_RDONLY | O_NOFOLLOW | O_CLOEXEC | (last ? 0 : O_DIRECTORY));
+        if (next < 0) {
+            int err = errno;
+            struct stat ls;
+            if ((err == ELOOP || err == ENOTDIR) && fstatat(cur, comp, &ls, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(ls.st_mode)) err = ELOOP;
+            errno = err;
+            break;
+        }
+        if (cur != dir_fd) close(cur);
+        cur = next;
+        if (last) return cur;
+    }
+    if (cur != dir_fd) { int err = errno; close(cur); errno = err; }
+    return -1;
+}
+#endif
+
+int platform_open_beneath(int dir_fd, const char* rel, struct stat* st) {
+    if (dir_fd < 0 || !rel || !st) { errno = EINVAL; return -1; }
+#ifdef _WIN32
+    errno = ENOSYS;
+    return -1;
+#else
+    if (rel[0] == '/') { errno = EXDEV; return -1; }
+    int fd = -1;
+#if defined(__linux__) && defined(SYS_openat2) && __has_include(<linux/openat2.h>)
+    static atomic_int openat2_missing = ATOMIC_VAR_INIT(0);
+    if (!atomic_load(&openat2_missing)) {
+        struct open_how how = { 0 };
+        how.flags = O_RDONLY | O_CLOEXEC | O_NOCTTY;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        for (int tries = 0; tries < 4; tries++) {
+            fd = (int)syscall(SYS_openat2, dir_fd, rel, &how, sizeof(how));
+            if (fd >= 0 || errno != EAGAIN) break;
+        }
+        if (fd < 0 && (errno == ENOSYS || errno == EPERM)) {
+            LOG_DEBUG("openat2 unavailable (%s), using openat walk", strerror(errno));
+            atomic_store(&openat2_missing, 1);
+        } else if (fd < 0) {
+            return -1;
+        }
+    }
+#endif
+    if (fd < 0) fd = open_beneath_walk(dir_fd, rel);
+    if (fd < 0) return -1;
+    if (fstat(fd, st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if (!S_ISREG(st->st_mode)) {
+        close(fd);
+        errno = S_ISDIR(st->st_mode) ? EISDIR : ENOENT;
+        return -1;
+    }
+    return fd;
 #endif
 }
 
 int platform_run_command_redirect(const char* cmd, const char* out_err_path, int timeout_seconds) {
     if (!cmd) return -1;
+#ifdef _WIN32
     platform_record_command(cmd);
     LOG_DEBUG("platform_run_command_redirect: %s -> %s", cmd, out_err_path ? out_err_path : "(null)");
-#ifdef _WIN32
     STARTUPINFOW si; PROCESS_INFORMATION pi; ZeroMemory(&si, sizeof(si)); si.cb = sizeof(si); si.dwFlags = STARTF_USESHOWWINDOW | STARTF_USESTDHANDLES; si.wShowWindow = SW_HIDE; ZeroMemory(&pi, sizeof(pi));
     WCHAR wout[PATH_MAX];
     if (MultiByteToWideChar(CP_UTF8, 0, out_err_path, -1, wout, PATH_MAX) == 0) return -1;
@@ -665,35 +1549,10 @@ int platform_run_command_redirect(const char* cmd, const char* out_err_path, int
     LOG_DEBUG("platform_run_command_redirect: exit_code=%d", (int)exit_code);
     return (int)exit_code;
 #else
-    pid_t pid = fork();
-    if (pid < 0) { LOG_ERROR("platform_run_command_redirect: fork failed: %s", strerror(errno)); return -1; }
-    if (pid == 0) {
-        int fd = open(out_err_path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
-        if (fd >= 0) {
-            dup2(fd, STDOUT_FILENO); dup2(fd, STDERR_FILENO); close(fd);
-        } else {
-            LOG_WARN("platform_run_command_redirect: open failed for '%s' err=%s", out_err_path ? out_err_path : "(null)", strerror(errno));
-        }
-        execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
-        _exit(127);
-    }
-    int status = -1;
-    if (timeout_seconds > 0) {
-        int elapsed = 0; int rc;
-        while (elapsed < timeout_seconds) {
-            rc = waitpid(pid, &status, WNOHANG);
-            if (rc == pid) break;
-            sleep(1);
-            elapsed++;
-        }
-        if (elapsed >= timeout_seconds) { kill(pid, SIGKILL); waitpid(pid, &status, 0); }
-        else if (rc == 0) { waitpid(pid, &status, 0); }
-    } else {
-        waitpid(pid, &status, 0);
-    }
-    if (WIFEXITED(status)) return WEXITSTATUS(status);
-    LOG_DEBUG("platform_run_command_redirect: child status not exited WIFEXITED(status)=%d", WIFEXITED(status));
-    return -1;
+    const char* argv[] = { "/bin/sh", "-c", cmd, NULL };
+    int rc = platform_spawn(argv, out_err_path, timeout_seconds > 0 ? timeout_seconds * 1000 : 0, NULL);
+    LOG_DEBUG("platform_run_command_redirect: exit_code=%d", rc);
+    return rc;
 #endif
 }
 
@@ -750,49 +1609,6 @@ int platform_fsync(int fd) {
 #endif
 }
 
-void platform_escape_path_for_cmd(const char* src, char* dst, size_t dstlen) {
-    if (!src || !dst || dstlen == 0) return;
-    for (size_t i = 0; src[i]; ++i) {
-        unsigned char c = (unsigned char)src[i];
-        if (!(isalnum(c) || c == '/' || c == '\\' ||
-            c == '_' || c == '-' || c == '.' || c == ':' || c == ' ' ||
-            c == '(' || c == ')' || c == '[' || c == ']' ||
-            c == '{' || c == '}' || c == ',' || c == '+' || c == '=' ||
-            c == '#')) {
-            dst[0] = '\0';
-            return;
-        }
-    }
-
-    size_t di = 0;
-
-#ifdef _WIN32
-    if (di < dstlen - 1) dst[di++] = '"';
-    for (size_t i = 0; src[i] && di + 2 < dstlen; ++i) {
-        char c = src[i];
-        if (c == '"') continue;         
-        if (c == '%') {                
-            if (di + 1 < dstlen) dst[di++] = '%';
-            else break;
-}
-        dst[di++] = c;
-    }
-    if (di < dstlen - 1) dst[di++] = '"';
-#else
-    if (di < dstlen - 1) dst[di++] = '"';
-    for (size_t i = 0; src[i] && di + 2 < dstlen; ++i) {
-        char c = src[i];
-        if (c == '\\' || c == '"' || c == '$' || c == '`') {
-            if (di + 1 < dstlen) dst[di++] = '\\';
-            else break;
-        }
-        dst[di++] = c;
-    }
-    if (di < dstlen - 1) dst[di++] = '"';
-#endif
-    dst[di] = '\0';
-}
-
 int platform_maximize_window(void) {
 #ifdef _WIN32
     HWND h = GetConsoleWindow();
@@ -859,6 +1675,19 @@ int platform_move_file(const char* src, const char* dst) {
 #endif
 }
 
+int platform_set_mtime(const char* path, time_t mtime) {
+    if (!path) return -1;
+#ifdef _WIN32
+    WCHAR wpath[PATH_MAX];
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_MAX) == 0) return -1;
+    struct _utimbuf ut = { mtime, mtime };
+    return _wutime(wpath, &ut);
+#else
+    struct timespec ts[2] = { { 0, UTIME_OMIT }, { mtime, 0 } };
+    return utimensat(AT_FDCWD, path, ts, 0);
+#endif
+}
+
 int platform_localtime(time_t t, struct tm* tm_buf) {
 #ifdef _WIN32
     return localtime_s(tm_buf, &t) == 0 ? 0 : -1;
@@ -909,6 +1738,30 @@ int platform_get_cpu_count(void) {
 #endif
 }
 
+long platform_get_available_memory_mb(void) {
+#ifdef _WIN32
+    MEMORYSTATUSEX st; st.dwLength = sizeof(st); if (GlobalMemoryStatusEx(&st)) return (long)(st.ullAvailPhys / (1024 * 1024)); return -1;
+#elif defined(__linux__)
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (f) {
+        char line[128];
+        long kb = -1;
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "MemAvailable:", 13) == 0) { kb = atol(line + 13); break; }
+        }
+        fclose(f);
+        if (kb >= 0) return kb / 1024;
+    }
+    struct sysinfo si;
+    if (sysinfo(&si) == 0) return (long)(((uint64_t)si.freeram + si.bufferram) * si.mem_unit / (1024 * 1024));
+    return -1;
+#else
+    long pages = sysconf(_SC_AVPHYS_PAGES); long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0) return (long)((pages * page_size) / (1024 * 1024));
+    return -1;
+#endif
+}
+
 long platform_get_physical_memory_mb(void) {
 #ifdef _WIN32
     MEMORYSTATUSEX st; st.dwLength = sizeof(st); if (GlobalMemoryStatusEx(&st)) return (long)(st.ullTotalPhys / (1024 * 1024)); return -1;
@@ -951,6 +1804,62 @@ void platform_set_socket_options(int sock) {
 #endif
 }
 
+int platform_send_vec(int sock, platform_iovec_t* iov, int count, int more) {
+    if (!iov || count <= 0) return 0;
+    int idx = 0;
+    while (idx < count && iov[idx].len == 0) idx++;
+#ifdef _WIN32
+    (void)more;
+    WSABUF bufs[PLATFORM_IOV_MAX];
+    while (idx < count) {
+        int n = 0;
+        for (int i = idx; i < count && n < PLATFORM_IOV_MAX; ++i, ++n) {
+            bufs[n].buf = (char*)iov[i].base;
+            bufs[n].len = (ULONG)iov[i].len;
+        }
+        DWORD snt = 0;
+        if (WSASend((SOCKET)sock, bufs, (DWORD)n, &snt, 0, NULL, NULL) != 0) return -1;
+        if (snt == 0) return -1;
+#else
+    struct iovec vec[PLATFORM_IOV_MAX];
+    int flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+    if (more) flags |= MSG_MORE;
+#else
+    (void)more;
+#endif
+    while (idx < count) {
+        int n = 0;
+        for (int i = idx; i < count && n < PLATFORM_IOV_MAX; ++i, ++n) {
+            vec[n].iov_base = (void*)iov[i].base;
+            vec[n].iov_len = iov[i].len;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vec;
+        msg.msg_iovlen = (size_t)n;
+        ssize_t snt = sendmsg(sock, &msg, flags);
+        if (snt < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (snt == 0) return -1;
+#endif
+        size_t left = (size_t)snt;
+        while (idx < count && left >= iov[idx].len) {
+            left -= iov[idx].len;
+            iov[idx].len = 0;
+            idx++;
+        }
+        if (idx < count && left > 0) {
+            iov[idx].base = (const char*)iov[idx].base + left;
+            iov[idx].len -= left;
+        }
+        while (idx < count && iov[idx].len == 0) idx++;
+    }
+    return 0;
+}
+
 bool platform_is_file(const char* p) {
 #ifdef _WIN32
     WCHAR wpath[PATH_MAX];
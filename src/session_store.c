@@ -2,17 +2,44 @@
 #include "logging.h"
 #include "common.h"
 #include "thread_pool.h"
+#include "platform.h"
+#include "timer_wheel.h"
 typedef struct session_node {
     char id[64];
     uint64_t last;
+    uint64_t seen_ms;
     struct session_node* next;
 } session_node_t;
 
 static session_node_t* sessions = NULL;
 static thread_mutex_t sessions_mutex;
+static timer_id_t sweep_timer;
+
+/* Drops sessions that have not been touched for SESSION_IDLE_TTL_MS. */
+static void session_sweep(void* arg) {
+    (void)arg;
+    uint64_t now = platform_monotonic_ms();
+    size_t dropped = 0;
+    thread_mutex_lock(&sessions_mutex);
+    session_node_t** pp = &sessions;
+    while (*pp) {
+        session_node_t* cur = *pp;
+        if (now - cur->seen_ms > SESSION_IDLE_TTL_MS) {
+            *pp = cur->next;
+            free(cur);
+            dropped++;
+        } else {
+            pp = &cur->next;
+        }
+    }
+    thread_mutex_unlock(&sessions_mutex);
+    if (dropped) LOG_DEBUG("Session sweep expired %zu idle session(s)", dropped);
+}
 
 void session_store_init(void) {
     thread_mutex_init(&sessions_mutex);
+    sweep_timer = timer_add_periodic(SESSION_SWEEP_MS, session_sweep, NULL);
+    if (!sweep_timer) LOG_WARN("Failed to arm session sweep timer; idle sessions will not expire");
 }
 
 static char* make_session_id(void) {
@@ -40,6 +67,7 @@ char* session_create(void) {
     }
     strncpy(n->id, id, sizeof(n->id)-1); n->id[sizeof(n->id)-1] = '\0';
     n->last = 0;
+    n->seen_ms = platform_monotonic_ms();
     thread_mutex_lock(&sessions_mutex);
     n->next = sessions; sessions = n;
     thread_mutex_unlock(&sessions_mutex);
@@ -52,7 +80,7 @@ uint64_t session_get_last(const char* session_id) {
     thread_mutex_lock(&sessions_mutex);
     session_node_t* cur = sessions;
     while (cur) {
-        if (strcmp(cur->id, session_id) == 0) { out = cur->last; break; }
+        if (strcmp(cur->id, session_id) == 0) { out = cur->last; cur->seen_ms = platform_monotonic_ms(); break; }
         cur = cur->next;
     }
     thread_mutex_unlock(&sessions_mutex);
@@ -64,7 +92,7 @@ void session_set_last(const char* session_id, uint64_t last) {
     thread_mutex_lock(&sessions_mutex);
     session_node_t* cur = sessions;
     while (cur) {
-        if (strcmp(cur->id, session_id) == 0) { cur->last = last; break; }
+        if (strcmp(cur->id, session_id) == 0) { cur->last = last; cur->seen_ms = platform_monotonic_ms(); break; }
         cur = cur->next;
     }
     thread_mutex_unlock(&sessions_mutex);
@@ -82,6 +110,8 @@ void session_clear(const char* session_id) {
 }
 
 void session_store_shutdown(void) {
+    timer_cancel(sweep_timer);
+    sweep_timer = 0;
     thread_mutex_lock(&sessions_mutex);
     session_node_t* cur = sessions;
     while (cur) {
@@ -0,0 +1,134 @@
+#include "startup.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "config.h"
+#include "thumbs.h"
+#include "websocket.h"
+#include "io_budget.h"
+
+/* The listener is bound before any gallery work happens; watcher
+ * registration, thumbdb loading and the missing-thumbnail scan then run on
+ * one background thread, which then crawls the galleries in full (skipped
+ * when the phases have to run inline). Offsets are milliseconds since
+ * startup_begin(), with 0 meaning the milestone has not been reached yet. */
+static uint64_t start_ms;
+static atomic_int phase = ATOMIC_VAR_INIT(STARTUP_PHASE_BIND);
+static atomic_size_t phase_done = ATOMIC_VAR_INIT(0);
+static atomic_size_t phase_total = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t listen_ms = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t first_ok_ms = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t ready_ms = ATOMIC_VAR_INIT(0);
+
+static const char* phase_names[] = { "bind", "watchers", "thumbdb", "scan", "ready" };
+
+static uint64_t elapsed_ms(void) {
+    uint64_t now = platform_monotonic_ms();
+    uint64_t ms = now > start_ms ? now - start_ms : 0;
+    return ms ? ms : 1;
+}
+
+const char* startup_phase_name(startup_phase_t p) {
+    return (unsigned)p <= STARTUP_PHASE_READY ? phase_names[p] : "unknown";
+}
+
+void startup_begin(void) {
+    start_ms = platform_monotonic_ms();
+}
+
+void startup_mark_listening(void) {
+    uint64_t ms = elapsed_ms();
+    atomic_store(&listen_ms, ms);
+    LOG_INFO("Startup: listening %llu ms after launch", (unsigned long long)ms);
+}
+
+void startup_note_ok_response(void) {
+    if (atomic_load_explicit(&first_ok_ms, memory_order_relaxed)) return;
+    uint_fast64_t expected = 0;
+    uint64_t ms = elapsed_ms();
+    if (!atomic_compare_exchange_strong(&first_ok_ms, &expected, ms)) return;
+    if (ms > STARTUP_FIRST_RESPONSE_BUDGET_MS)
+        LOG_WARN("Startup: first 200 OK took %llu ms (budget %d ms)", (unsigned long long)ms, STARTUP_FIRST_RESPONSE_BUDGET_MS);
+    else
+        LOG_INFO("Startup: first 200 OK %llu ms after launch", (unsigned long long)ms);
+}
+
+bool startup_is_ready(void) {
+    return atomic_load(&phase) == STARTUP_PHASE_READY;
+}
+
+void startup_get_status(startup_status_t* out) {
+    if (!out) return;
+    out->phase = (startup_phase_t)atomic_load(&phase);
+    out->done = atomic_load(&phase_done);
+    out->total = atomic_load(&phase_total);
+    out->uptime_ms = elapsed_ms();
+    out->listen_ms = atomic_load(&listen_ms);
+    out->first_ok_ms = atomic_load(&first_ok_ms);
+    out->ready_ms = atomic_load(&ready_ms);
+}
+
+static void broadcast_progress(void) {
+    startup_status_t st;
+    startup_get_status(&st);
+    char msg[160];
+    int r = snprintf(msg, sizeof(msg), "{\"type\":\"startup\",\"phase\":\"%s\",\"done\":%zu,\"total\":%zu,\"ready\":%s}",
+        startup_phase_name(st.phase), st.done, st.total, st.phase == STARTUP_PHASE_READY ? "true" : "false");
+    if (r > 0 && (size_t)r < sizeof(msg)) websocket_broadcast(msg);
+}
+
+static void enter_phase(startup_phase_t p, size_t total) {
+    atomic_store(&phase_done, 0);
+    atomic_store(&phase_total, total);
+    atomic_store(&phase, p);
+    LOG_DEBUG("Startup: phase %s (%zu folder(s)) at %llu ms", startup_phase_name(p), total, (unsigned long long)elapsed_ms());
+    broadcast_progress();
+}
+
+static void step_done(void) {
+    atomic_fetch_add(&phase_done, 1);
+    broadcast_progress();
+}
+
+static void* startup_thread(void* arg) {
+    io_budget_set_background(1);
+    size_t count = 0;
+    char** folders = get_gallery_folders(&count);
+    if (!folders) count = 0;
+    if (count == 0) LOG_WARN("No gallery folders configured.");
+
+    enter_phase(STARTUP_PHASE_WATCHERS, count);
+    for (size_t i = 0; i < count; ++i) {
+        LOG_DEBUG("startup: registering watcher for folder[%zu]=%s", i, folders[i]);
+        start_auto_thumb_watcher(folders[i]);
+        step_done();
+    }
+
+    enter_phase(STARTUP_PHASE_THUMBDB, count);
+    for (size_t i = 0; i < count; ++i) {
+        load_thumbdb_for_folder(folders[i]);
+        step_done();
+    }
+
+    enter_phase(STARTUP_PHASE_SCAN, count);
+    for (size_t i = 0; i < count; ++i) {
+        scan_folder_for_missing_thumbs(folders[i]);
+        step_done();
+    }
+
+    uint64_t ms = elapsed_ms();
+    atomic_store(&ready_ms, ms);
+    enter_phase(STARTUP_PHASE_READY, 0);
+    LOG_INFO("Startup: background phases finished %llu ms after launch", (unsigned long long)ms);
+    if (arg && count) scan_and_generate_missing_thumbs();
+    return NULL;
+}
+
+int startup_run_background(void) {
+    static int crawl_after_ready = 1;
+    if (thread_create_detached(startup_thread, &crawl_after_ready) == 0) return 0;
+    LOG_WARN("Startup: could not start background thread, running phases inline");
+    startup_thread(NULL);
+    return -1;
+}
@@ -2,6 +2,8 @@
 #include "api_handlers.h"
 #include "logging.h"
 #include "http.h"
+#include "arena.h"
+#include "governor.h"
 #include "common.h"
 #define QUEUE_CAP 1024
 
@@ -212,7 +214,11 @@ static void* worker_thread(void* arg) {
                 }
             }
 
+            size_t arena_chunks = arena_chunk_count();
+            governor_request_begin();
             int keep_socket = handle_single_request(c, headers_copy, body, headers_len, content_length, true);
+            governor_request_end();
+            LOG_DEBUG("Request on socket %d needed %zu new arena chunk(s)", c, arena_chunk_count() - arena_chunks);
 
             if (headers_copy != stack_headers) free(headers_copy);
             if (body != stack_body && body != NULL) free(body);
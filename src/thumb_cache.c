@@ -0,0 +1,315 @@
+#include "thumb_cache.h"
+#include "common.h"
+#include "logging.h"
+#include "directory.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "http.h"
+#include "thumb_pack.h"
+
+#define SKETCH_WIDTH (1u << THUMB_CACHE_SKETCH_BITS)
+#define SKETCH_ROWS 4
+#define SKETCH_MAX 15
+#define SKETCH_SAMPLE (SKETCH_WIDTH * 8)
+
+typedef struct thumb_entry {
+    char* key;
+    uint32_t hash;
+    unsigned char* data;
+    size_t len;
+    char etag[48];
+    char lm[40];
+    int referenced;
+    atomic_int refs;
+    struct thumb_entry* hnext;
+    struct thumb_entry* cprev;
+    struct thumb_entry* cnext;
+    struct thumb_entry* vnext;
+} thumb_entry_t;
+
+/* Each shard evicts with CLOCK and admits through a TinyLFU count-min
+ * sketch: a newcomer only displaces the CLOCK victim when it has been seen
+ * more often, so a burst of one-off thumbnails cannot flush the hot set. */
+typedef struct thumb_shard {
+    thread_mutex_t mu;
+    thumb_entry_t* buckets[THUMB_CACHE_BUCKETS];
+    thumb_entry_t* hand;
+    size_t bytes;
+    size_t count;
+    uint8_t sketch[SKETCH_ROWS][SKETCH_WIDTH];
+    uint32_t sketch_ops;
+} thumb_shard_t;
+
+static thumb_shard_t shards[THUMB_CACHE_SHARDS];
+static size_t shard_budget;
+static atomic_int cache_enabled = ATOMIC_VAR_INIT(0);
+static atomic_size_t stat_hits = ATOMIC_VAR_INIT(0);
+static atomic_size_t stat_misses = ATOMIC_VAR_INIT(0);
+static atomic_size_t stat_rejected = ATOMIC_VAR_INIT(0);
+
+static const uint32_t sketch_seeds[SKETCH_ROWS] = { 0x9E3779B1u, 0x85EBCA77u, 0xC2B2AE3Du, 0x27D4EB2Fu };
+
+static uint32_t key_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static thumb_shard_t* shard_for(uint32_t h) {
+    return &shards[(h >> 24) % THUMB_CACHE_SHARDS];
+}
+
+static uint32_t sketch_index(uint32_t h, int row) {
+    return (h * sketch_seeds[row]) >> (32 - THUMB_CACHE_SKETCH_BITS);
+}
+
+static int sketch_estimate_locked(const thumb_shard_t* s, uint32_t h) {
+    int f = SKETCH_MAX;
+    for (int r = 0; r < SKETCH_ROWS; r++) {
+        int v = s->sketch[r][sketch_index(h, r)];
+        if (v < f) f = v;
+    }
+    return f;
+}
+
+static void sketch_increment_locked(thumb_shard_t* s, uint32_t h) {
+    int f = sketch_estimate_locked(s, h);
+    if (f < SKETCH_MAX) {
+        for (int r = 0; r < SKETCH_ROWS; r++) {
+            uint8_t* c = &s->sketch[r][sketch_index(h, r)];
+            if (*c == f) (*c)++;
+        }
+    }
+    if (++s->sketch_ops >= SKETCH_SAMPLE) {
+        for (int r = 0; r < SKETCH_ROWS; r++)
+            for (uint32_t i = 0; i < SKETCH_WIDTH; i++) s->sketch[r][i] >>= 1;
+        s->sketch_ops = 0;
+    }
+}
+
+static void entry_free(thumb_entry_t* e) {
+    free(e->key);
+    free(e->data);
+    free(e);
+}
+
+static void entry_release(thumb_entry_t* e) {
+    if (e && atomic_fetch_sub(&e->refs, 1) == 1) entry_free(e);
+}
+
+static thumb_entry_t* find_locked(thumb_shard_t* s, const char* key, uint32_t h) {
+    for (thumb_entry_t* e = s->buckets[h % THUMB_CACHE_BUCKETS]; e; e = e->hnext)
+        if (e->hash == h && strcmp(e->key, key) == 0) return e;
+    return NULL;
+}
+
+static void ring_insert_locked(thumb_shard_t* s, thumb_entry_t* e) {
+    if (!s->hand) {
+        e->cnext = e->cprev = e;
+        s->hand = e;
+        return;
+    }
+    e->cnext = s->hand;
+    e->cprev = s->hand->cprev;
+    s->hand->cprev->cnext = e;
+    s->hand->cprev = e;
+}
+
+static void unlink_locked(thumb_shard_t* s, thumb_entry_t* e) {
+    thumb_entry_t** pp = &s->buckets[e->hash % THUMB_CACHE_BUCKETS];
+    while (*pp && *pp != e) pp = &(*pp)->hnext;
+    if (*pp) *pp = e->hnext;
+    if (e->cnext == e) s->hand = NULL;
+    else {
+        e->cprev->cnext = e->cnext;
+        e->cnext->cprev = e->cprev;
+        if (s->hand == e) s->hand = e->cnext;
+    }
+    e->cnext = e->cprev = NULL;
+    e->hnext = NULL;
+    s->bytes -= e->len;
+    s->count--;
+}
+
+/* Picks CLOCK victims until len more bytes fit, unreferenced entries first
+ * as the hand would, without touching the ring. Returns 0 when a victim is
+ * seen at least as often as h, and then nothing is evicted; otherwise, with
+ * commit set, the victims are unlinked onto *dead. skip is left out. */
+static int admit_locked(thumb_shard_t* s, uint32_t h, size_t len, const thumb_entry_t* skip, int commit, thumb_entry_t** dead) {
+    size_t bytes = s->bytes - (skip ? skip->len : 0);
+    if (bytes + len <= shard_budget) return 1;
+    if (!s->hand) return 0;
+    int freq = sketch_estimate_locked(s, h);
+    size_t freed = 0;
+    thumb_entry_t* victims = NULL;
+    int pass = 0;
+    for (; pass < 2 && bytes - freed + len > shard_budget; pass++) {
+        thumb_entry_t* e = s->hand;
+        do {
+            if (e != skip && (e->referenced != 0) == (pass != 0)) {
+                if (sketch_estimate_locked(s, e->hash) >= freq) return 0;
+                freed += e->len;
+                e->vnext = victims;
+                victims = e;
+                if (bytes - freed + len <= shard_budget) break;
+            }
+            e = e->cnext;
+        } while (e != s->hand);
+    }
+    if (bytes - freed + len > shard_budget) return 0;
+    if (!commit) return 1;
+    if (pass > 1) {
+        thumb_entry_t* e = s->hand;
+        do { e->referenced = 0; e = e->cnext; } while (e != s->hand);
+    }
+    while (victims) {
+        thumb_entry_t* v = victims;
+        victims = v->vnext;
+        unlink_locked(s, v);
+        v->hnext = *dead;
+        *dead = v;
+    }
+    return 1;
+}
+
+static int is_small_thumb(const char* key) {
+    return strstr(key, THUMB_CACHE_SMALL_TAG) != NULL;
+}
+
+int thumb_cache_serve(int c, const char* key, int keep_alive) {
+    if (!key || !atomic_load(&cache_enabled) || !is_small_thumb(key)) return 0;
+    uint32_t h = key_hash(key);
+    thumb_shard_t* s = shard_for(h);
+    thread_mutex_lock(&s->mu);
+    sketch_increment_locked(s, h);
+    thumb_entry_t* e = find_locked(s, key, h);
+    if (e) {
+        e->referenced = 1;
+        atomic_fetch_add(&e->refs, 1);
+    }
+    thread_mutex_unlock(&s->mu);
+    if (!e) { atomic_fetch_add(&stat_misses, 1); return 0; }
+    atomic_fetch_add(&stat_hits, 1);
+    char extra[160];
+    snprintf(extra, sizeof(extra), "Accept-Ranges: bytes\r\nETag: %s\r\nLast-Modified: %s\r\n", e->etag, e->lm);
+    platform_iovec_t part = { e->data, e->len };
+    send_response_parts(c, 200, "OK", mime_for(key), &part, 1, keep_alive, extra, 0);
+    entry_release(e);
+    return 1;
+}
+
+/* Takes ownership of data. Returns 1 if the entry was admitted. */
+static int cache_insert(const char* key, unsigned char* data, size_t len, const struct stat* st) {
+    thumb_entry_t* e = calloc(1, sizeof(thumb_entry_t));
+    if (!e || !(e->key = strdup(key))) { free(e); free(data); return 0; }
+    e->hash = key_hash(key);
+    e->data = data;
+    e->len = len;
+    http_format_validators(st, e->etag, sizeof(e->etag), e->lm, sizeof(e->lm));
+    atomic_init(&e->refs, 1);
+
+    thumb_shard_t* s = shard_for(e->hash);
+    thumb_entry_t* dead = NULL;
+    int admitted;
+    thread_mutex_lock(&s->mu);
+    thumb_entry_t* old = find_locked(s, key, e->hash);
+    if (old) { unlink_locked(s, old); old->hnext = dead; dead = old; }
+    admitted = admit_locked(s, e->hash, len, NULL, 1, &dead);
+    if (admitted) {
+        e->hnext = s->buckets[e->hash % THUMB_CACHE_BUCKETS];
+        s->buckets[e->hash % THUMB_CACHE_BUCKETS] = e;
+        ring_insert_locked(s, e);
+        s->bytes += len;
+        s->count++;
+    }
+    thread_mutex_unlock(&s->mu);
+    while (dead) { thumb_entry_t* n = dead->hnext; entry_release(dead); dead = n; }
+    if (!admitted) { atomic_fetch_add(&stat_rejected, 1); entry_free(e); }
+    return admitted;
+}
+
+static int cacheable(const char* key, const struct stat* st) {
+    return atomic_load(&cache_enabled) && is_small_thumb(key) && S_ISREG(st->st_mode)
+        && st->st_size > 0 && st->st_size <= THUMB_CACHE_MAX_ITEM && (size_t)st->st_size <= shard_budget;
+}
+
+void thumb_cache_offer_fd(const char* key, int fd, uint64_t off, const struct stat* st) {
+    if (!key || fd < 0 || !st || !cacheable(key, st)) return;
+    uint32_t h = key_hash(key);
+    thumb_shard_t* s = shard_for(h);
+    thread_mutex_lock(&s->mu);
+    int worth = admit_locked(s, h, (size_t)st->st_size, find_locked(s, key, h), 0, NULL);
+    thread_mutex_unlock(&s->mu);
+    if (!worth) return;
+    size_t len = (size_t)st->st_size;
+    unsigned char* data = malloc(len);
+    if (!data) return;
+    size_t got = 0;
+    while (got < len) {
+        long rd = platform_pread(fd, data + got, len - got, off + got);
+        if (rd <= 0) break;
+        got += (size_t)rd;
+    }
+    if (got != len) { free(data); return; }
+    cache_insert(key, data, len, st);
+}
+
+void thumb_cache_put_file(const char* path) {
+    if (!path || !atomic_load(&cache_enabled)) return;
+    char key[PATH_MAX];
+    snprintf(key, sizeof(key), "%s", path);
+    normalize_path(key);
+    struct stat st;
+    size_t len = 0;
+    unsigned char* data = thumb_read(key, THUMB_CACHE_MAX_ITEM, &len, &st);
+    if (!data) return;
+    if (!cacheable(key, &st)) { free(data); return; }
+    uint32_t h = key_hash(key);
+    thumb_shard_t* s = shard_for(h);
+    thread_mutex_lock(&s->mu);
+    sketch_increment_locked(s, h);
+    thread_mutex_unlock(&s->mu);
+    if (cache_insert(key, data, len, &st)) LOG_DEBUG("Thumb cache: preloaded %s (%zu bytes)", key, len);
+}
+
+void thumb_cache_invalidate(const char* path) {
+    if (!path || !atomic_load(&cache_enabled)) return;
+    char key[PATH_MAX];
+    snprintf(key, sizeof(key), "%s", path);
+    normalize_path(key);
+    uint32_t h = key_hash(key);
+    thumb_shard_t* s = shard_for(h);
+    thread_mutex_lock(&s->mu);
+    thumb_entry_t* e = find_locked(s, key, h);
+    if (e) unlink_locked(s, e);
+    thread_mutex_unlock(&s->mu);
+    entry_release(e);
+}
+
+void thumb_cache_get_stats(thumb_cache_stats_t* out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    out->hits = atomic_load(&stat_hits);
+    out->misses = atomic_load(&stat_misses);
+    out->rejected = atomic_load(&stat_rejected);
+    if (!atomic_load(&cache_enabled)) return;
+    out->budget = shard_budget * THUMB_CACHE_SHARDS;
+    for (int i = 0; i < THUMB_CACHE_SHARDS; i++) {
+        thread_mutex_lock(&shards[i].mu);
+        out->entries += shards[i].count;
+        out->bytes += shards[i].bytes;
+        thread_mutex_unlock(&shards[i].mu);
+    }
+}
+
+void thumb_cache_init(long budget_bytes) {
+    if (atomic_load(&cache_enabled)) return;
+    if (budget_bytes <= 0) {
+        LOG_INFO("Thumb cache disabled");
+        return;
+    }
+    for (int i = 0; i < THUMB_CACHE_SHARDS; i++) thread_mutex_init(&shards[i].mu);
+    shard_budget = (size_t)budget_bytes / THUMB_CACHE_SHARDS;
+    atomic_store(&cache_enabled, 1);
+    LOG_INFO("Thumb cache: %ld bytes across %d shards", budget_bytes, THUMB_CACHE_SHARDS);
+}
@@ -0,0 +1,704 @@
+#include "thumb_pack.h"
+#include "common.h"
+#include "logging.h"
+#include "directory.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "http.h"
+#include "utils.h"
+#include "config.h"
+#include "thumb_cache.h"
+#include "thumbs.h"
+
+/* A pack is one append-only blob file per thumbs directory plus an index
+ * log of fixed records followed by the thumb name. Later records override
+ * earlier ones and tombstones drop a name. Both files carry a generation
+ * stamped by compaction, so an index that does not belong to its pack is
+ * discarded instead of pointing at the wrong bytes. */
+#define PACK_MAGIC "GTPK"
+#define INDEX_MAGIC "GTPX"
+#define PACK_HEADER_SIZE 8
+#define REC_MAGIC 0x31434552u
+#define REC_TOMBSTONE 1
+#define PACK_INITIAL_BUCKETS 64
+
+typedef struct {
+    uint32_t magic;
+    uint16_t name_len;
+    uint16_t flags;
+    uint32_t len;
+    uint32_t hash;
+    uint64_t off;
+    int64_t mtime;
+} pack_rec_t;
+
+typedef struct pack_entry {
+    char* name;
+    uint32_t name_hash;
+    uint32_t len;
+    uint32_t hash;
+    uint64_t off;
+    int64_t mtime;
+    int verified;
+    struct pack_entry* next;
+} pack_entry_t;
+
+/* Readers take a reference on the blob file so compaction can swap in a new
+ * one while a response is still streaming from the old descriptor. */
+typedef struct pack_file {
+    int fd;
+    atomic_int refs;
+} pack_file_t;
+
+typedef struct thumb_pack {
+    char dir[PATH_MAX];
+    pack_file_t* file;
+    int idx_fd;
+    uint32_t gen;
+    uint64_t end;
+    uint64_t idx_end;
+    uint64_t live;
+    pack_entry_t** buckets;
+    size_t nbuckets;
+    size_t count;
+    uint64_t probed_ms;
+    uint64_t last_use;
+    int users;
+    thread_mutex_t mu;
+} thumb_pack_t;
+
+static thumb_pack_t* packs[THUMB_PACK_MAX_OPEN];
+static int pack_count;
+static uint64_t use_tick;
+static thread_mutex_t packs_mutex;
+static atomic_int pack_inited = ATOMIC_VAR_INIT(0);
+
+static uint32_t fnv1a(const void* data, size_t n) {
+    const unsigned char* p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) { h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+static int split_thumb_path(const char* path, char* dir, size_t dirlen, const char** name) {
+    const char* s = strrchr(path, DIR_SEP);
+    if (!s || s == path || !s[1] || (size_t)(s - path) >= dirlen) return -1;
+    memcpy(dir, path, (size_t)(s - path));
+    dir[s - path] = '\0';
+    *name = s + 1;
+    return 0;
+}
+
+static int io_full(int fd, void* buf, size_t len, uint64_t off, int write) {
+    size_t done = 0;
+    while (done < len) {
+        long n = write ? platform_pwrite(fd, (const char*)buf + done, len - done, off + done)
+            : platform_pread(fd, (char*)buf + done, len - done, off + done);
+        if (n <= 0) return -1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static int truncate_fd(int fd, uint64_t len) {
+#ifdef _WIN32
+    return _chsize_s(fd, (long long)len) == 0 ? 0 : -1;
+#else
+    return ftruncate(fd, (off_t)len);
+#endif
+}
+
+static void file_release(pack_file_t* f) {
+    if (f && atomic_fetch_sub(&f->refs, 1) == 1) {
+        platform_close_fd(f->fd);
+        free(f);
+    }
+}
+
+static pack_file_t* file_wrap(int fd) {
+    pack_file_t* f = malloc(sizeof(pack_file_t));
+    if (!f) return NULL;
+    f->fd = fd;
+    atomic_init(&f->refs, 1);
+    return f;
+}
+
+static pack_entry_t* find_locked(thumb_pack_t* p, const char* name) {
+    if (!p->buckets) return NULL;
+    uint32_t h = fnv1a(name, strlen(name));
+    for (pack_entry_t* e = p->buckets[h & (p->nbuckets - 1)]; e; e = e->next)
+        if (e->name_hash == h && strcmp(e->name, name) == 0) return e;
+    return NULL;
+}
+
+static void clear_entries_locked(thumb_pack_t* p) {
+    for (size_t i = 0; p->buckets && i < p->nbuckets; i++) {
+        pack_entry_t* e = p->buckets[i];
+        while (e) { pack_entry_t* n = e->next; free(e->name); free(e); e = n; }
+    }
+    free(p->buckets);
+    p->buckets = NULL;
+    p->nbuckets = 0;
+    p->count = 0;
+    p->live = 0;
+}
+
+static int grow_locked(thumb_pack_t* p) {
+    size_t nb = p->nbuckets ? p->nbuckets * 2 : PACK_INITIAL_BUCKETS;
+    pack_entry_t** nbk = calloc(nb, sizeof(pack_entry_t*));
+    if (!nbk) return -1;
+    for (size_t i = 0; i < p->nbuckets; i++) {
+        pack_entry_t* e = p->buckets[i];
+        while (e) {
+            pack_entry_t* n = e->next;
+            e->next = nbk[e->name_hash & (nb - 1)];
+            nbk[e->name_hash & (nb - 1)] = e;
+            e = n;
+        }
+    }
+    free(p->buckets);
+    p->buckets = nbk;
+    p->nbuckets = nb;
+    return 0;
+}
+
+static int upsert_locked(thumb_pack_t* p, const char* name, const pack_rec_t* r) {
+    pack_entry_t* e = find_locked(p, name);
+    if (e) {
+        p->live -= e->len;
+    } else {
+        if (p->count >= p->nbuckets && grow_locked(p) != 0 && !p->buckets) return -1;
+        e = calloc(1, sizeof(pack_entry_t));
+        if (!e || !(e->name = strdup(name))) { free(e); return -1; }
+        e->name_hash = fnv1a(name, strlen(name));
+        e->next = p->buckets[e->name_hash & (p->nbuckets - 1)];
+        p->buckets[e->name_hash & (p->nbuckets - 1)] = e;
+        p->count++;
+    }
+    e->len = r->len;
+    e->hash = r->hash;
+    e->off = r->off;
+    e->mtime = r->mtime;
+    e->verified = 0;
+    p->live += e->len;
+    return 0;
+}
+
+static void remove_locked(thumb_pack_t* p, const char* name) {
+    if (!p->buckets) return;
+    uint32_t h = fnv1a(name, strlen(name));
+    pack_entry_t** pp = &p->buckets[h & (p->nbuckets - 1)];
+    while (*pp && !((*pp)->name_hash == h && strcmp((*pp)->name, name) == 0)) pp = &(*pp)->next;
+    if (!*pp) return;
+    pack_entry_t* e = *pp;
+    *pp = e->next;
+    p->live -= e->len;
+    p->count--;
+    free(e->name);
+    free(e);
+}
+
+static int append_rec_locked(thumb_pack_t* p, const char* name, const pack_rec_t* r) {
+    size_t nl = strlen(name);
+    if (nl > 0xFFFF) return -1;
+    unsigned char buf[sizeof(pack_rec_t) + PATH_MAX];
+    if (nl >= PATH_MAX) return -1;
+    pack_rec_t rec = *r;
+    rec.magic = REC_MAGIC;
+    rec.name_len = (uint16_t)nl;
+    memcpy(buf, &rec, sizeof(rec));
+    memcpy(buf + sizeof(rec), name, nl);
+    if (io_full(p->idx_fd, buf, sizeof(rec) + nl, p->idx_end, 1) != 0) return -1;
+    p->idx_end += sizeof(rec) + nl;
+    return 0;
+}
+
+static void write_header(unsigned char* h, const char* magic, uint32_t gen) {
+    memcpy(h, magic, 4);
+    memcpy(h + 4, &gen, 4);
+}
+
+static void unload_locked(thumb_pack_t* p) {
+    clear_entries_locked(p);
+    file_release(p->file);
+    p->file = NULL;
+    platform_close_fd(p->idx_fd);
+    p->idx_fd = -1;
+}
+
+static void replay_index_locked(thumb_pack_t* p, const unsigned char* buf, uint64_t size) {
+    uint64_t pos = PACK_HEADER_SIZE;
+    char name[PATH_MAX];
+    while (pos + sizeof(pack_rec_t) <= size) {
+        pack_rec_t r;
+        memcpy(&r, buf + pos, sizeof(r));
+        if (r.magic != REC_MAGIC || r.name_len == 0 || r.name_len >= sizeof(name)
+            || pos + sizeof(r) + r.name_len > size) break;
+        memcpy(name, buf + pos + sizeof(r), r.name_len);
+        name[r.name_len] = '\0';
+        pos += sizeof(r) + r.name_len;
+        if (r.flags & REC_TOMBSTONE) remove_locked(p, name);
+        else if (r.off >= PACK_HEADER_SIZE && r.off + r.len <= p->end) upsert_locked(p, name, &r);
+    }
+    if (pos < size) {
+        LOG_WARN("thumb pack: dropping %llu trailing index bytes in %s", (unsigned long long)(size - pos), p->dir);
+        truncate_fd(p->idx_fd, pos);
+    }
+    p->idx_end = pos;
+}
+
+static int load_locked(thumb_pack_t* p, int create) {
+    char pack_path[PATH_MAX], idx_path[PATH_MAX];
+    snprintf(pack_path, sizeof(pack_path), "%s" DIR_SEP_STR THUMB_PACK_FILE, p->dir);
+    snprintf(idx_path, sizeof(idx_path), "%s" DIR_SEP_STR THUMB_PACK_INDEX, p->dir);
+    p->probed_ms = platform_monotonic_ms();
+    if (!create && !platform_file_exists(pack_path)) return -1;
+    int fd = platform_open_rw(pack_path, create);
+    if (fd < 0) return -1;
+    struct stat st;
+    unsigned char hdr[PACK_HEADER_SIZE];
+    if (fstat(fd, &st) != 0) { platform_close_fd(fd); return -1; }
+    if (st.st_size < PACK_HEADER_SIZE) {
+        p->gen = 1;
+        write_header(hdr, PACK_MAGIC, p->gen);
+        if (truncate_fd(fd, 0) != 0 || io_full(fd, hdr, sizeof(hdr), 0, 1) != 0) { platform_close_fd(fd); return -1; }
+        p->end = PACK_HEADER_SIZE;
+    } else {
+        if (io_full(fd, hdr, sizeof(hdr), 0, 0) != 0 || memcmp(hdr, PACK_MAGIC, 4) != 0) {
+            LOG_WARN("thumb pack: %s is not a pack file", pack_path);
+            platform_close_fd(fd);
+            return -1;
+        }
+        memcpy(&p->gen, hdr + 4, 4);
+        p->end = (uint64_t)st.st_size;
+    }
+    p->idx_fd = platform_open_rw(idx_path, 1);
+    if (p->idx_fd < 0 || fstat(p->idx_fd, &st) != 0) {
+        platform_close_fd(p->idx_fd);
+        p->idx_fd = -1;
+        platform_close_fd(fd);
+        return -1;
+    }
+    p->file = file_wrap(fd);
+    if (!p->file) { unload_locked(p); platform_close_fd(fd); return -1; }
+    uint64_t size = (uint64_t)st.st_size;
+    unsigned char* buf = size ? malloc((size_t)size) : NULL;
+    int valid = buf && size >= PACK_HEADER_SIZE && io_full(p->idx_fd, buf, (size_t)size, 0, 0) == 0
+        && memcmp(buf, INDEX_MAGIC, 4) == 0 && memcmp(buf + 4, &p->gen, 4) == 0;
+    if (valid) {
+        replay_index_locked(p, buf, size);
+    } else {
+        if (size > 0) LOG_WARN("thumb pack: index %s does not match its pack, starting empty", idx_path);
+        write_header(hdr, INDEX_MAGIC, p->gen);
+        if (truncate_fd(p->idx_fd, 0) != 0 || io_full(p->idx_fd, hdr, sizeof(hdr), 0, 1) != 0) {
+            free(buf);
+            unload_locked(p);
+            return -1;
+        }
+        p->idx_end = PACK_HEADER_SIZE;
+    }
+    free(buf);
+    LOG_DEBUG("thumb pack: loaded %s (%zu entries, %llu live of %llu bytes)", p->dir, p->count,
+        (unsigned long long)p->live, (unsigned long long)p->end);
+    return 0;
+}
+
+static void pack_free(thumb_pack_t* p) {
+    unload_locked(p);
+    thread_mutex_destroy(&p->mu);
+    free(p);
+}
+
+/* Returns the pack for dir with its mutex held, loading it from disk when
+ * needed; release with pack_put. Directories outside the thumbs root never
+ * have packs. */
+static thumb_pack_t* pack_get(const char* dir, int create) {
+    if (!atomic_load(&pack_inited)) return NULL;
+    char thumbs_root[PATH_MAX];
+    get_thumbs_root(thumbs_root, sizeof(thumbs_root));
+    if (!safe_under(thumbs_root, dir) || strcmp(thumbs_root, dir) == 0) return NULL;
+    thumb_pack_t* p = NULL;
+    thread_mutex_lock(&packs_mutex);
+    for (int i = 0; i < pack_count; i++) if (strcmp(packs[i]->dir, dir) == 0) { p = packs[i]; break; }
+    if (!p) {
+        /* Users only hold a pack for one short operation and never take a
+         * second one meanwhile, so waiting for an idle slot always ends. */
+        while (pack_count >= THUMB_PACK_MAX_OPEN) {
+            int victim = -1;
+            for (int i = 0; i < pack_count; i++)
+                if (packs[i]->users == 0 && (victim < 0 || packs[i]->last_use < packs[victim]->last_use)) victim = i;
+            if (victim >= 0) {
+                pack_free(packs[victim]);
+                packs[victim] = packs[--pack_count];
+                break;
+            }
+            thread_mutex_unlock(&packs_mutex);
+            platform_sleep_ms(1);
+            thread_mutex_lock(&packs_mutex);
+            for (int i = 0; i < pack_count; i++) if (strcmp(packs[i]->dir, dir) == 0) { p = packs[i]; break; }
+            if (p) break;
+        }
+        if (!p && (p = calloc(1, sizeof(thumb_pack_t)))) {
+            snprintf(p->dir, sizeof(p->dir), "%s", dir);
+            p->idx_fd = -1;
+            thread_mutex_init(&p->mu);
+            packs[pack_count++] = p;
+        }
+    }
+    if (p) {
+        p->users++;
+        p->last_use = ++use_tick;
+    }
+    thread_mutex_unlock(&packs_mutex);
+    if (!p) return NULL;
+    thread_mutex_lock(&p->mu);
+    if (!p->file && (create || p->probed_ms == 0 || platform_monotonic_ms() - p->probed_ms >= THUMB_PACK_PROBE_MS))
+        load_locked(p, create);
+    return p;
+}
+
+static void pack_put(thumb_pack_t* p) {
+    if (!p) return;
+    thread_mutex_unlock(&p->mu);
+    thread_mutex_lock(&packs_mutex);
+    p->users--;
+    thread_mutex_unlock(&packs_mutex);
+}
+
+/* A blob whose bytes no longer match the hash recorded at import is
+ * tombstoned, so the thumbnail reads as missing and gets regenerated. */
+static void drop_corrupt_locked(thumb_pack_t* p, const char* name) {
+    LOG_WARN("thumb pack: %s in %s fails its hash check, dropping it", name, p->dir);
+    pack_rec_t r = { 0 };
+    r.flags = REC_TOMBSTONE;
+    append_rec_locked(p, name, &r);
+    remove_locked(p, name);
+}
+
+static int verify_locked(thumb_pack_t* p, pack_entry_t* e) {
+    if (e->verified) return 0;
+    unsigned char* buf = malloc(e->len ? e->len : 1);
+    int ok = buf && io_full(p->file->fd, buf, e->len, e->off, 0) == 0 && fnv1a(buf, e->len) == e->hash;
+    free(buf);
+    if (!ok) return -1;
+    e->verified = 1;
+    return 0;
+}
+
+/* Looks name up in the pack for dir and takes a reference on its blob file.
+ * With verify, the blob is hashed once before it is first handed out. */
+static pack_file_t* lookup(const char* path, pack_rec_t* out, int verify) {
+    char dir[PATH_MAX];
+    const char* name;
+    if (split_thumb_path(path, dir, sizeof(dir), &name) != 0) return NULL;
+    thumb_pack_t* p = pack_get(dir, 0);
+    if (!p) return NULL;
+    pack_file_t* f = NULL;
+    pack_entry_t* e = p->file ? find_locked(p, name) : NULL;
+    if (e && verify && verify_locked(p, e) != 0) {
+        drop_corrupt_locked(p, name);
+        e = NULL;
+    }
+    if (e) {
+        out->len = e->len;
+        out->hash = e->hash;
+        out->off = e->off;
+        out->mtime = e->mtime;
+        f = p->file;
+        atomic_fetch_add(&f->refs, 1);
+    }
+    pack_put(p);
+    return f;
+}
+
+static void fill_stat(const pack_rec_t* r, struct stat* st) {
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFREG | 0644;
+    st->st_size = (off_t)r->len;
+    st->st_mtime = (time_t)r->mtime;
+    st->st_nlink = 1;
+}
+
+int thumb_stat(const char* thumb_path, struct stat* st) {
+    if (!thumb_path || !st) return -1;
+    if (platform_stat(thumb_path, st) == 0) return 0;
+    pack_rec_t r;
+    pack_file_t* f = lookup(thumb_path, &r, 0);
+    if (!f) return -1;
+    file_release(f);
+    fill_stat(&r, st);
+    return 0;
+}
+
+bool thumb_exists(const char* thumb_path) {
+    struct stat st;
+    return thumb_stat(thumb_path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+unsigned char* thumb_read(const char* thumb_path, size_t max_len, size_t* out_len, struct stat* st) {
+    if (!thumb_path || !out_len || !st) return NULL;
+    unsigned char* data = NULL;
+    if (platform_stat(thumb_path, st) == 0) {
+        if (!S_ISREG(st->st_mode) || st->st_size <= 0 || (uint64_t)st->st_size > max_len) return NULL;
+        FILE* fp = platform_fopen(thumb_path, "rb");
+        if (!fp) return NULL;
+        size_t len = (size_t)st->st_size;
+        data = malloc(len);
+        if (data && fread(data, 1, len, fp) != len) { free(data); data = NULL; }
+        fclose(fp);
+        if (data) *out_len = len;
+        return data;
+    }
+    pack_rec_t r;
+    pack_file_t* f = lookup(thumb_path, &r, 0);
+    if (!f) return NULL;
+    if (r.len > 0 && r.len <= max_len && (data = malloc(r.len))) {
+        if (io_full(f->fd, data, r.len, r.off, 0) == 0 && fnv1a(data, r.len) == r.hash) {
+            fill_stat(&r, st);
+            *out_len = r.len;
+        } else {
+            free(data);
+            data = NULL;
+        }
+    }
+    file_release(f);
+    return data;
+}
+
+int thumb_delete(const char* thumb_path) {
+    if (!thumb_path) return -1;
+    int rc = platform_file_delete(thumb_path);
+    char dir[PATH_MAX];
+    const char* name;
+    if (split_thumb_path(thumb_path, dir, sizeof(dir), &name) != 0) return rc;
+    thumb_pack_t* p = pack_get(dir, 0);
+    if (!p) return rc;
+    if (p->file && find_locked(p, name)) {
+        pack_rec_t r = { 0 };
+        r.flags = REC_TOMBSTONE;
+        if (append_rec_locked(p, name, &r) == 0) remove_locked(p, name);
+        else {
+            LOG_WARN("thumb pack: failed to record removal of %s", thumb_path);
+            rc = -1;
+        }
+    }
+    pack_put(p);
+    return rc;
+}
+
+int thumb_pack_import(const char* thumb_path) {
+    if (!thumb_path) return -1;
+    struct stat st;
+    if (platform_stat(thumb_path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size > THUMB_PACK_MAX_BLOB) return -1;
+    char dir[PATH_MAX];
+    const char* name;
+    if (split_thumb_path(thumb_path, dir, sizeof(dir), &name) != 0) return -1;
+    size_t len = (size_t)st.st_size;
+    unsigned char* data = malloc(len);
+    FILE* fp = data ? platform_fopen(thumb_path, "rb") : NULL;
+    int ok = fp && fread(data, 1, len, fp) == len;
+    if (fp) fclose(fp);
+    if (!ok) { free(data); return -1; }
+    pack_rec_t r = { 0 };
+    r.len = (uint32_t)len;
+    r.hash = fnv1a(data, len);
+    r.mtime = (int64_t)st.st_mtime;
+    int rc = -1;
+    thumb_pack_t* p = pack_get(dir, 1);
+    if (p && p->file) {
+        pack_entry_t* e = find_locked(p, name);
+        if (e && e->len == r.len && e->hash == r.hash) {
+            rc = 0;
+        } else {
+            r.off = p->end;
+            /* The blob reaches disk before the record that points at it. */
+            if (io_full(p->file->fd, data, len, r.off, 1) == 0 && platform_fsync(p->file->fd) == 0) {
+                p->end += len;
+                if (append_rec_locked(p, name, &r) == 0 && upsert_locked(p, name, &r) == 0) rc = 0;
+            }
+        }
+    }
+    pack_put(p);
+    free(data);
+    if (rc != 0) {
+        LOG_WARN("thumb pack: failed to import %s", thumb_path);
+        return -1;
+    }
+    if (platform_file_delete(thumb_path) != 0) LOG_DEBUG("thumb pack: imported %s but could not remove it yet", thumb_path);
+    return 0;
+}
+
+int thumb_pack_serve(int c, const char* thumb_path, const char* range, const char* if_range, int keep_alive) {
+    if (!thumb_path) return 0;
+    pack_rec_t r;
+    pack_file_t* f = lookup(thumb_path, &r, 1);
+    if (!f) return 0;
+    struct stat st;
+    fill_stat(&r, &st);
+    send_file_fd_at(c, f->fd, (long)r.off, &st, thumb_path, range, if_range, keep_alive);
+    if (!range) thumb_cache_offer_fd(thumb_path, f->fd, r.off, &st);
+    file_release(f);
+    return 1;
+}
+
+bool thumb_pack_find(const char* dir, const char* prefix, const char* tag, char* out, size_t outlen) {
+    if (!dir || !prefix || !tag || !out || outlen == 0) return false;
+    thumb_pack_t* p = pack_get(dir, 0);
+    if (!p) return false;
+    bool found = false;
+    size_t pl = strlen(prefix);
+    for (size_t i = 0; p->buckets && i < p->nbuckets && !found; i++)
+        for (pack_entry_t* e = p->buckets[i]; e; e = e->next)
+            if (strncmp(e->name, prefix, pl) == 0 && strstr(e->name, tag)) {
+                snprintf(out, outlen, "%s", e->name);
+                found = true;
+                break;
+            }
+    pack_put(p);
+    return found;
+}
+
+char** thumb_pack_list(const char* dir, size_t* count) {
+    if (count) *count = 0;
+    if (!dir || !count) return NULL;
+    thumb_pack_t* p = pack_get(dir, 0);
+    if (!p) return NULL;
+    char** names = p->count ? malloc(p->count * sizeof(char*)) : NULL;
+    size_t n = 0;
+    for (size_t i = 0; names && i < p->nbuckets; i++)
+        for (pack_entry_t* e = p->buckets[i]; e; e = e->next)
+            if ((names[n] = strdup(e->name))) n++;
+    pack_put(p);
+    *count = n;
+    return names;
+}
+
+size_t thumb_pack_migrate_dir(const char* dir) {
+    if (!dir || !thumb_pack_enabled) return 0;
+    diriter it;
+    if (!dir_open(&it, dir)) return 0;
+    size_t cap = 0, n = 0;
+    char** names = NULL;
+    const char* name;
+    while ((name = dir_next(&it))) {
+        if (!strstr(name, "-small.") && !strstr(name, "-large.")) continue;
+        if (is_media_sidecar_name(name)) continue;
+        if (n == cap) {
+            size_t nc = cap ? cap * 2 : 64;
+            char** tmp = realloc(names, nc * sizeof(char*));
+            if (!tmp) break;
+            names = tmp;
+            cap = nc;
+        }
+        if ((names[n] = strdup(name))) n++;
+    }
+    dir_close(&it);
+    size_t moved = 0;
+    for (size_t i = 0; i < n; i++) {
+        char full[PATH_MAX];
+        path_join(full, dir, names[i]);
+        if (is_file(full) && thumb_pack_import(full) == 0) moved++;
+        free(names[i]);
+    }
+    free(names);
+    if (moved) LOG_INFO("thumb pack: migrated %zu loose thumbnails into %s", moved, dir);
+    return moved;
+}
+
+/* Rewrites the pack with only live blobs once more than half of it is
+ * garbage. The pack mutex is held for the copy, which stalls lookups in
+ * this one directory for the duration. */
+int thumb_pack_compact(const char* dir, int force) {
+    if (!dir) return -1;
+    thumb_pack_t* p = pack_get(dir, 0);
+    if (!p) return 0;
+    if (!p->file) { pack_put(p); return 0; }
+    uint64_t garbage = p->end - PACK_HEADER_SIZE - p->live;
+    if (!force && (garbage < THUMB_PACK_COMPACT_MIN_BYTES || garbage < p->live)) { pack_put(p); return 0; }
+    char pack_path[PATH_MAX], idx_path[PATH_MAX], pack_tmp[PATH_MAX], idx_tmp[PATH_MAX];
+    snprintf(pack_path, sizeof(pack_path), "%s" DIR_SEP_STR THUMB_PACK_FILE, dir);
+    snprintf(idx_path, sizeof(idx_path), "%s" DIR_SEP_STR THUMB_PACK_INDEX, dir);
+    snprintf(pack_tmp, sizeof(pack_tmp), "%s.tmp", pack_path);
+    snprintf(idx_tmp, sizeof(idx_tmp), "%s.tmp", idx_path);
+    thumb_pack_t np;
+    memset(&np, 0, sizeof(np));
+    np.gen = p->gen + 1;
+    int pfd = platform_open_rw(pack_tmp, 1);
+    np.idx_fd = platform_open_rw(idx_tmp, 1);
+    uint64_t* offs = p->count ? malloc(p->count * sizeof(uint64_t)) : NULL;
+    unsigned char hdr[PACK_HEADER_SIZE];
+    int ok = pfd >= 0 && np.idx_fd >= 0 && (offs || !p->count)
+        && truncate_fd(pfd, 0) == 0 && truncate_fd(np.idx_fd, 0) == 0;
+    if (ok) {
+        write_header(hdr, PACK_MAGIC, np.gen);
+        ok = io_full(pfd, hdr, sizeof(hdr), 0, 1) == 0;
+        write_header(hdr, INDEX_MAGIC, np.gen);
+        ok = ok && io_full(np.idx_fd, hdr, sizeof(hdr), 0, 1) == 0;
+    }
+    np.end = np.idx_end = PACK_HEADER_SIZE;
+    unsigned char* buf = NULL;
+    size_t bufcap = 0, k = 0;
+    for (size_t i = 0; ok && i < p->nbuckets; i++) {
+        for (pack_entry_t* e = p->buckets[i]; ok && e; e = e->next) {
+            if (e->len > bufcap) {
+                unsigned char* nb = realloc(buf, e->len);
+                if (!nb) { ok = 0; break; }
+                buf = nb;
+                bufcap = e->len;
+            }
+            pack_rec_t r = { 0 };
+            r.len = e->len;
+            r.hash = e->hash;
+            r.off = np.end;
+            r.mtime = e->mtime;
+            ok = io_full(p->file->fd, buf, e->len, e->off, 0) == 0 && fnv1a(buf, e->len) == e->hash
+                && io_full(pfd, buf, e->len, r.off, 1) == 0 && append_rec_locked(&np, e->name, &r) == 0;
+            if (!ok) LOG_WARN("thumb pack: compaction of %s stopped at %s", dir, e->name);
+            offs[k++] = r.off;
+            np.end += e->len;
+        }
+    }
+    free(buf);
+    ok = ok && platform_fsync(pfd) == 0 && platform_fsync(np.idx_fd) == 0;
+    pack_file_t* nf = ok ? file_wrap(pfd) : NULL;
+    int moved_pack = nf && platform_move_file(pack_tmp, pack_path) == 0;
+    int moved_idx = moved_pack && platform_move_file(idx_tmp, idx_path) == 0;
+    if (moved_idx) {
+        k = 0;
+        for (size_t i = 0; i < p->nbuckets; i++)
+            for (pack_entry_t* e = p->buckets[i]; e; e = e->next) e->off = offs[k++];
+        LOG_INFO("thumb pack: compacted %s from %llu to %llu bytes", dir, (unsigned long long)p->end, (unsigned long long)np.end);
+        file_release(p->file);
+        p->file = nf;
+        platform_close_fd(p->idx_fd);
+        p->idx_fd = np.idx_fd;
+        p->gen = np.gen;
+        p->end = np.end;
+        p->idx_end = np.idx_end;
+    } else {
+        if (nf) file_release(nf); else platform_close_fd(pfd);
+        platform_close_fd(np.idx_fd);
+        if (!moved_pack) platform_file_delete(pack_tmp);
+        platform_file_delete(idx_tmp);
+        if (moved_pack) {
+            /* The new pack is in place without its index; reload so the
+             * generation check discards the stale one instead of serving
+             * wrong offsets. */
+            LOG_WARN("thumb pack: could not replace %s, reloading %s", idx_path, dir);
+            unload_locked(p);
+            load_locked(p, 0);
+        } else if (ok) {
+            LOG_WARN("thumb pack: could not replace %s, keeping the old pack", pack_path);
+        }
+        ok = 0;
+    }
+    free(offs);
+    pack_put(p);
+    return ok ? 1 : -1;
+}
+
+void thumb_pack_init(void) {
+    if (atomic_load(&pack_inited)) return;
+    thread_mutex_init(&packs_mutex);
+    atomic_store(&pack_inited, 1);
+}
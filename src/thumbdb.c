@@ -11,6 +11,8 @@
 #include "config.h"
 #include "thumbs.h"
 #include "robinhood_hash.h"
+#include "thumb_pack.h"
+#include "io_budget.h"
 
 #define DB_FILENAME "thumbs.db"
 #define LINE_MAX 4096
@@ -192,7 +194,7 @@ static int find_thumb_filename_for_base_in_dir(const char* dir, const char* base
         }
     }
     dir_close(&it);
-    return 0;
+    return thumb_pack_find(dir, base, want_small ? "-small." : "-large.", out, outlen) ? 1 : 0;
 }
 
 static int find_thumb_filename_for_base(const char* base, int want_small, char* out, size_t outlen) {
@@ -510,8 +512,8 @@ static void populate_db_from_existing_thumbs(void) {
                     snprintf(small_path, sizeof(small_path), "%s" DIR_SEP_STR "%s", per_thumbs_root, small_rel);
                     snprintf(large_path, sizeof(large_path), "%s" DIR_SEP_STR "%s", per_thumbs_root, large_rel);
                     
-                    if (is_file(small_path)) strncpy(small_tok, "small", sizeof(small_tok) - 1);
-                    if (is_file(large_path)) strncpy(large_tok, "large", sizeof(large_tok) - 1);
+                    if (thumb_exists(small_path)) strncpy(small_tok, "small", sizeof(small_tok) - 1);
+                    if (thumb_exists(large_path)) strncpy(large_tok, "large", sizeof(large_tok) - 1);
                     strncpy(media, media_full, sizeof(media) - 1);
                     media[sizeof(media) - 1] = '\0';
                     ht_set_internal(base, media);
@@ -724,6 +726,7 @@ static int rebuild_record_cb(const char* key, const char* value, void* ctx) {
 
 static void* rebuild_worker(void* arg) {
     (void)arg;
+    io_budget_set_background(1);
     struct stat st;
     if (platform_stat(db_path, &st) != 0) return NULL;
 
@@ -1286,7 +1289,7 @@ static void sweep_cb(const char* key, const char* value, void* ctx) {
             if (db_path[0]) {
                 strncpy(thumb_dir, db_path, sizeof(thumb_dir) - 1); thumb_dir[sizeof(thumb_dir) - 1] = '\0'; char* last = strrchr(thumb_dir, DIR_SEP); if (last) *last = '\0'; else strncpy(thumb_dir, ".", sizeof(thumb_dir) - 1);
                 snprintf(thumb_path, sizeof(thumb_path), "%s" DIR_SEP_STR "%s", thumb_dir, found);
-                if (is_file(thumb_path)) { if (platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; } else LOG_WARN("thumbdb: failed to remove thumb %s", thumb_path); }
+                if (thumb_exists(thumb_path)) { if (thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; } else LOG_WARN("thumbdb: failed to remove thumb %s", thumb_path); }
             }
         }
         if (!removed && find_thumb_filename_for_base(key, 0, found, sizeof(found))) {
@@ -1294,7 +1297,7 @@ static void sweep_cb(const char* key, const char* value, void* ctx) {
             if (db_path[0]) {
                 strncpy(thumb_dir, db_path, sizeof(thumb_dir) - 1); thumb_dir[sizeof(thumb_dir) - 1] = '\0'; char* last = strrchr(thumb_dir, DIR_SEP); if (last) *last = '\0'; else strncpy(thumb_dir, ".", sizeof(thumb_dir) - 1);
                 snprintf(thumb_path, sizeof(thumb_path), "%s" DIR_SEP_STR "%s", thumb_dir, found);
-                if (is_file(thumb_path)) { if (platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; } else LOG_WARN("thumbdb: failed to remove thumb %s", thumb_path); }
+                if (thumb_exists(thumb_path)) { if (thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; } else LOG_WARN("thumbdb: failed to remove thumb %s", thumb_path); }
             }
         }
 
@@ -1309,11 +1312,11 @@ static void sweep_cb(const char* key, const char* value, void* ctx) {
                     if (!is_dir(sub)) continue;
                     if (find_thumb_filename_for_base_in_dir(sub, key, 1, found, sizeof(found))) {
                         snprintf(thumb_path, sizeof(thumb_path), "%s" DIR_SEP_STR "%s", sub, found);
-                        if (is_file(thumb_path) && platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; break; }
+                        if (thumb_exists(thumb_path) && thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; break; }
                     }
                     if (find_thumb_filename_for_base_in_dir(sub, key, 0, found, sizeof(found))) {
                         snprintf(thumb_path, sizeof(thumb_path), "%s" DIR_SEP_STR "%s", sub, found);
-                        if (is_file(thumb_path) && platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; break; }
+                        if (thumb_exists(thumb_path) && thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; break; }
                     }
                 }
                 dir_close(&dit);
@@ -1376,8 +1379,8 @@ int thumbdb_sweep_orphans(void) {
         snprintf(thumb_path, sizeof(thumb_path), "%s" DIR_SEP_STR "%s", thumb_dir, key);
         if (!is_file(media)) {
             if (find_thumb_filename_for_base(key, 1, thumb_path, sizeof(thumb_path))) {
-                if (is_file(thumb_path)) {
-                    if (platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; }
+                if (thumb_exists(thumb_path)) {
+                    if (thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; }
                     else LOG_WARN("thumbdb: failed to remove thumb %s", thumb_path);
                 }
             }
@@ -1385,10 +1388,10 @@ int thumbdb_sweep_orphans(void) {
             if (!removed) {
                 char thumbs_root[PATH_MAX]; get_thumbs_root(thumbs_root, sizeof(thumbs_root));
                 if (find_thumb_filename_for_base(key, 1, thumb_path, sizeof(thumb_path))) {
-                    if (is_file(thumb_path) && platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; }
+                    if (thumb_exists(thumb_path) && thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; }
                 }
                 if (!removed && find_thumb_filename_for_base(key, 0, thumb_path, sizeof(thumb_path))) {
-                    if (is_file(thumb_path) && platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; }
+                    if (thumb_exists(thumb_path) && thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; }
                 }
                 if (!removed) {
                     diriter dit; if (dir_open(&dit, thumbs_root)) {
@@ -1399,11 +1402,11 @@ int thumbdb_sweep_orphans(void) {
                             if (!is_dir(sub)) continue;
                             if (find_thumb_filename_for_base_in_dir(sub, key, 1, thumb_path, sizeof(thumb_path))) {
                                 snprintf(thumb_path, sizeof(thumb_path), "%s" DIR_SEP_STR "%s", sub, thumb_path);
-                                if (is_file(thumb_path) && platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; break; }
+                                if (thumb_exists(thumb_path) && thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; break; }
                             }
                             if (find_thumb_filename_for_base_in_dir(sub, key, 0, thumb_path, sizeof(thumb_path))) {
                                 snprintf(thumb_path, sizeof(thumb_path), "%s" DIR_SEP_STR "%s", sub, thumb_path);
-                                if (is_file(thumb_path) && platform_file_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; break; }
+                                if (thumb_exists(thumb_path) && thumb_delete(thumb_path) == 0) { LOG_DEBUG("thumbdb: removed thumb %s because media missing: %s", thumb_path, media); removed = true; break; }
                             }
                         }
                         dir_close(&dit);
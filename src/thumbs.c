@@ -10,9 +10,18 @@
 #include "config.h"
 #include "common.h"
 #include "websocket.h"
+#include "thumb_cache.h"
+#include "thumb_pack.h"
+#include "timer_wheel.h"
+#include "crawler.h"
+#include "governor.h"
+#include "io_budget.h"
+#include "mp4_faststart.h"
+#include "media_info.h"
 atomic_int ffmpeg_active = ATOMIC_VAR_INIT(0);
 static atomic_int magick_active = ATOMIC_VAR_INIT(0);
-#define MAX_MAGICK 2
+static atomic_int ffprobe_active = ATOMIC_VAR_INIT(0);
+#define MAX_FFPROBE 4
 #define WAL_DIR_NAME "wal"
 #define WAL_CHUNK_FMT "chunk-%lld-%u-%u.wal"
 static atomic_uint wal_chunk_seq = ATOMIC_VAR_INIT(0);
@@ -27,6 +36,12 @@ typedef struct {
 static void record_thumb_job_completion(const thumb_job_t* job);
 static void run_thumb_job(thumb_job_t* job);
 static void generate_thumb_inline_and_record(const char* input, const char* output, int scale, int q, int index, int total);
+static void debounce_generation_fire(void* args);
+static void run_generation_flight(const char* dir_path);
+static void gen_flight_mark_dirty(const char* dir);
+static int clean_orphan_thumb_name(const char* dir, const char* thumbs_path, const char* tname, char** expects, size_t expect_count, progress_t* prog);
+static void thumbs_crawl_full(const char* const* roots, size_t nroots);
+static void thumbs_dir_pass(const char* dir, int flags, progress_t* prog, crawler_worker_t* w, thumb_pass_result_t* out);
 static void sleep_ms(int ms) { platform_sleep_ms(ms); }
 static atomic_int thumb_workers_active = ATOMIC_VAR_INIT(0);
 
@@ -123,103 +138,111 @@ static void process_wal_chunks(const char* per_thumbs_root) {
     dir_close(&it);
 }
 
-static int execute_command_with_limits(const char* cmd, const char* out_log, int timeout, int uses_ffmpeg) {
-    int ret;
-    if (!cmd) return -1;
+#define THUMB_CMD_MAX_ARGS 32
+#define THUMB_CMD_MAX_FMT 8
 
-    size_t cmdlen = strlen(cmd);
-    if (cmdlen == 0 || cmdlen > 4096) {
-        LOG_ERROR("execute_command_with_limits: refusing to execute invalid or overly long command (len=%zu)", cmdlen);
-        return -1;
-    }
+/* An argv vector plus storage for the arguments that had to be formatted. */
+typedef struct {
+    const char* argv[THUMB_CMD_MAX_ARGS + 1];
+    char fmt[THUMB_CMD_MAX_FMT][64];
+    int argc;
+    int fmtc;
+} thumb_cmd_t;
+
+static void cmd_arg(thumb_cmd_t* c, const char* a) {
+    if (c->argc < THUMB_CMD_MAX_ARGS) c->argv[c->argc++] = a;
+    c->argv[c->argc] = NULL;
+}
 
-    for (size_t i = 0; i < cmdlen; ++i) {
-        unsigned char c = (unsigned char)cmd[i];
-        if (c < 32 || c > 126) {
-            LOG_ERROR("execute_command_with_limits: rejecting command with non-printable char at index %zu", i);
-            return -1;
-        }
-        switch (c) {
-        case ';': case '&': case '|': case '`':
-        case '$': case '>': case '<': case '!':
-        case '{': case '}':
-        case '\'':
-            LOG_ERROR("execute_command_with_limits: rejecting potentially unsafe command character '%c'", c);
-            return -1;
-        }
-    }
+static void cmd_argf(thumb_cmd_t* c, const char* fmt, ...) {
+    if (c->fmtc >= THUMB_CMD_MAX_FMT) return;
+    char* dst = c->fmt[c->fmtc++];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(dst, sizeof(c->fmt[0]), fmt, ap);
+    va_end(ap);
+    cmd_arg(c, dst);
+}
+
+static void cmd_init(thumb_cmd_t* c, const char* prog) {
+    c->argc = 0;
+    c->fmtc = 0;
+    cmd_arg(c, prog);
+}
+
+int execute_command_with_limits(const char* const* argv, const char* out_log, int timeout, platform_spawn_result_t* capture) {
+    if (!argv || !argv[0]) return -1;
+    atomic_int* active = NULL;
+    int cap = 0;
+    if (strcmp(argv[0], "ffmpeg") == 0) { active = &ffmpeg_active; cap = governor_gen_slots(); }
+    else if (strcmp(argv[0], "ffprobe") == 0) { active = &ffprobe_active; cap = MAX_FFPROBE; }
+    else if (strcmp(argv[0], "magick") == 0) { active = &magick_active; cap = governor_magick_slots(); }
 
-    if (uses_ffmpeg) {
-        while (atomic_load(&ffmpeg_active) >= MAX_FFMPEG)
+    if (active) {
+        while (atomic_load(active) >= cap)
             sleep_ms(50);
-        atomic_fetch_add(&ffmpeg_active, 1);
-        const char* final_out = out_log ? out_log : platform_devnull();
-        platform_record_command(cmd);
-        LOG_DEBUG("execute_command_with_limits: executing: %s", cmd);
-        ret = platform_run_command_redirect(cmd, final_out, timeout);
-        LOG_DEBUG("execute_command_with_limits: command rc=%d cmd=%s", ret, cmd);
-        atomic_fetch_sub(&ffmpeg_active, 1);
-    }
-    else {
-        int is_magick = 0;
-        if (strstr(cmd, "magick") != NULL)
-            is_magick = 1;
-
-        if (is_magick) {
-            while (atomic_load(&magick_active) >= MAX_MAGICK)
-                sleep_ms(50);
-            atomic_fetch_add(&magick_active, 1);
-            const char* final_out = out_log ? out_log : platform_devnull();
-            platform_record_command(cmd);
-            LOG_DEBUG("execute_command_with_limits: executing (magick): %s", cmd);
-            ret = platform_run_command_redirect(cmd, final_out, timeout);
-            LOG_DEBUG("execute_command_with_limits: magick rc=%d cmd=%s", ret, cmd);
-            atomic_fetch_sub(&magick_active, 1);
-        }
-        else {
-            platform_record_command(cmd);
-            ret = platform_run_command_redirect(cmd, out_log ? out_log : platform_devnull(), timeout);
-            LOG_DEBUG("execute_command_with_limits: command rc=%d cmd=%s", ret, cmd);
-        }
+        atomic_fetch_add(active, 1);
     }
-
+    int ret = platform_spawn(argv, out_log, timeout > 0 ? timeout * 1000 : 0, capture);
+    if (active) atomic_fetch_sub(active, 1);
+    LOG_DEBUG("execute_command_with_limits: %s rc=%d", argv[0], ret);
     return ret;
 }
 
 static void generate_thumb_c(const char* input, const char* output, int scale, int q, int index, int total);
+static void generate_anim_preview(const char* input, const char* output);
+
+static void build_magick_resize_cmd(thumb_cmd_t* c, const char* in, int scale, int q, const char* out) {
+    int threads = governor_job_threads();
+    long per_proc_mb = governor_job_mem_mb();
+    cmd_init(c, "magick");
+    cmd_arg(c, "-limit"); cmd_arg(c, "thread"); cmd_argf(c, "%d", threads);
+    cmd_arg(c, "-limit"); cmd_arg(c, "memory"); cmd_argf(c, "%ldMB", per_proc_mb);
+    cmd_arg(c, "-limit"); cmd_arg(c, "map"); cmd_argf(c, "%ldMB", per_proc_mb);
+    cmd_arg(c, in);
+    cmd_arg(c, "-resize"); cmd_argf(c, "%dx", scale);
+    cmd_arg(c, "-quality"); cmd_argf(c, "%d", q);
+    cmd_arg(c, out);
+}
 
-static void build_magick_resize_cmd(char* dst, size_t dstlen, const char* in_esc, int scale, int q, const char* out_esc) {
-    if (!dst || dstlen == 0)return;
-    int threads = platform_get_cpu_count();
-    if (threads < 1) threads = 1;
-    long mem_mb = platform_get_physical_memory_mb();
-    if (mem_mb <= 0) mem_mb = 512;
-    long per_proc_mb = mem_mb / (MAX_MAGICK > 0 ? MAX_MAGICK : 1);
-    if (per_proc_mb < 256) per_proc_mb = 256;
-    snprintf(dst, dstlen, "magick -limit thread %d -limit memory %ldMB -limit map %ldMB %s -resize %dx -quality %d %s",
-        threads, per_proc_mb, per_proc_mb, in_esc, scale, q, out_esc);
-    LOG_DEBUG("Magick CMD: %s", dst);
-}
-
-static void build_ffmpeg_extract_jpg_cmd(char* dst, size_t dstlen, const char* in_esc, const char* tmp_esc, int scale) {
-    if (!dst || dstlen == 0)return;
-    int threads = platform_get_cpu_count(); if (threads < 1) threads = 1;
-    snprintf(dst, dstlen, "ffmpeg -y -threads %d -i %s -vf \"scale=%d:-1\" -vframes 1 -f image2 -c:v mjpeg %s", threads, in_esc, scale, tmp_esc);
-    LOG_DEBUG("FFmpeg Extract CMD: %s", dst);
-}
-
-static void build_ffmpeg_thumb_cmd(char* dst, size_t dstlen, const char* in_esc, int scale, int q, int to_webp, int add_format_rgb, const char* out_esc) {
-    if (!dst || dstlen == 0)return;
-    int threads = platform_get_cpu_count(); if (threads < 1) threads = 1;
-    if (to_webp) {
-        if (add_format_rgb)
-            snprintf(dst, dstlen, "ffmpeg -y -threads %d -i %s -vf \"scale=%d:-1,format=rgb24\" -vframes 1 -q:v %d -c:v libwebp %s", threads, in_esc, scale, q, out_esc);
-        else
-            snprintf(dst, dstlen, "ffmpeg -y -threads %d -i %s -vf \"scale=%d:-1\" -vframes 1 -q:v %d -c:v libwebp %s", threads, in_esc, scale, q, out_esc);
-    }
-    else
-        snprintf(dst, dstlen, "ffmpeg -y -threads %d -i %s -vf \"scale=%d:-1,format=rgb24\" -vframes 1 -q:v %d %s", threads, in_esc, scale, q, out_esc);
-    LOG_DEBUG("FFmpeg Thumb CMD: %s", dst);
+static void build_ffmpeg_extract_jpg_cmd(thumb_cmd_t* c, const char* in, const char* tmp, int scale) {
+    int threads = governor_job_threads();
+    cmd_init(c, "ffmpeg");
+    cmd_arg(c, "-y"); cmd_arg(c, "-threads"); cmd_argf(c, "%d", threads);
+    cmd_arg(c, "-i"); cmd_arg(c, in);
+    cmd_arg(c, "-vf"); cmd_argf(c, "scale=%d:-1", scale);
+    cmd_arg(c, "-vframes"); cmd_arg(c, "1");
+    cmd_arg(c, "-f"); cmd_arg(c, "image2"); cmd_arg(c, "-c:v"); cmd_arg(c, "mjpeg");
+    cmd_arg(c, tmp);
+}
+
+static void build_ffmpeg_thumb_cmd(thumb_cmd_t* c, const char* in, int scale, int q, int to_webp, int add_format_rgb, const char* out) {
+    int threads = governor_job_threads();
+    cmd_init(c, "ffmpeg");
+    cmd_arg(c, "-y"); cmd_arg(c, "-threads"); cmd_argf(c, "%d", threads);
+    cmd_arg(c, "-i"); cmd_arg(c, in);
+    cmd_arg(c, "-vf");
+    if (!to_webp || add_format_rgb) cmd_argf(c, "scale=%d:-1,format=rgb24", scale);
+    else cmd_argf(c, "scale=%d:-1", scale);
+    cmd_arg(c, "-vframes"); cmd_arg(c, "1");
+    cmd_arg(c, "-q:v"); cmd_argf(c, "%d", q);
+    if (to_webp) { cmd_arg(c, "-c:v"); cmd_arg(c, "libwebp"); }
+    cmd_arg(c, out);
+}
+
+static void build_ffmpeg_preview_cmd(thumb_cmd_t* c, const char* in, const char* out) {
+    int threads = governor_job_threads();
+    cmd_init(c, "ffmpeg");
+    cmd_arg(c, "-y"); cmd_arg(c, "-threads"); cmd_argf(c, "%d", threads);
+    cmd_arg(c, "-i"); cmd_arg(c, in);
+    cmd_arg(c, "-an");
+    cmd_arg(c, "-vf"); cmd_argf(c, "scale='trunc(min(%d,iw)/2)*2':-2,format=yuv420p", ANIM_PREVIEW_MAX_WIDTH);
+    cmd_arg(c, "-c:v"); cmd_arg(c, "libx264");
+    cmd_arg(c, "-preset"); cmd_arg(c, "slow");
+    cmd_arg(c, "-crf"); cmd_argf(c, "%d", ANIM_PREVIEW_CRF);
+    cmd_arg(c, "-movflags"); cmd_arg(c, "+faststart");
+    cmd_arg(c, "-f"); cmd_arg(c, "mp4");
+    cmd_arg(c, out);
 }
 
 static int is_path_safe(const char* path) {
@@ -314,6 +337,39 @@ static int is_animated_webp(const char* path) {
     fclose(f);
     return 0;
 }
+static int skip_gif_sub_blocks(FILE* f) {
+    for (;;) {
+        int n = fgetc(f);
+        if (n == EOF) return -1;
+        if (n == 0) return 0;
+        if (fseek(f, n, SEEK_CUR) != 0) return -1;
+    }
+}
+static int is_animated_gif(const char* path) {
+    if (!path) return 0;
+    FILE* f = platform_fopen(path, "rb");
+    if (!f) return 0;
+    unsigned char hdr[13];
+    int frames = 0;
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, "GIF", 3) != 0) { fclose(f); return 0; }
+    if ((hdr[10] & 0x80) && fseek(f, 3L << ((hdr[10] & 7) + 1), SEEK_CUR) != 0) { fclose(f); return 0; }
+    for (;;) {
+        int b = fgetc(f);
+        if (b == 0x21) {
+            if (fgetc(f) == EOF || skip_gif_sub_blocks(f) != 0) break;
+        }
+        else if (b == 0x2C) {
+            unsigned char desc[9];
+            if (++frames > 1) break;
+            if (fread(desc, 1, sizeof(desc), f) != sizeof(desc)) break;
+            if ((desc[8] & 0x80) && fseek(f, 3L << ((desc[8] & 7) + 1), SEEK_CUR) != 0) break;
+            if (fgetc(f) == EOF || skip_gif_sub_blocks(f) != 0) break;
+        }
+        else break;
+    }
+    fclose(f);
+    return frames > 1;
+}
 static int output_is_webp(const char* path) {
     if (!path) return 0;
     const char* dot = strrchr(path, '.');
@@ -386,6 +442,9 @@ static void record_thumb_job_completion(const thumb_job_t* job) {
     }
     if (wrote_wal)
         thumbdb_request_compaction();
+    thumb_cache_put_file(job->output);
+    if (thumb_pack_enabled)
+        thumb_pack_import(job->output);
     char parent[PATH_MAX];
     parent[0] = '\0';
     get_parent_dir(job->input, parent, sizeof(parent));
@@ -395,7 +454,18 @@ static void record_thumb_job_completion(const thumb_job_t* job) {
 }
 static void run_thumb_job(thumb_job_t* job) {
     if (!job) return;
+    struct stat st;
+    if (io_budget_is_background() && platform_stat(job->input, &st) == 0) {
+        long charge = st.st_size < IO_BUDGET_DECODE_CHARGE_MAX ? (long)st.st_size : IO_BUDGET_DECODE_CHARGE_MAX;
+        io_budget_acquire((size_t)charge, 1);
+    }
+    if (job->scale == ANIM_PREVIEW_SCALE) {
+        generate_anim_preview(job->input, job->output);
+        io_budget_drop_cache(job->input);
+        return;
+    }
     generate_thumb_c(job->input, job->output, job->scale, job->q, job->index, job->total);
+    io_budget_drop_cache(job->input);
     record_thumb_job_completion(job);
 }
 static void generate_thumb_inline_and_record(const char* input, const char* output, int scale, int q, int index, int total) {
@@ -525,23 +595,20 @@ const char* get_file_ext(const char* path) {
     const char* dot = strrchr(path, '.');
     return dot ? dot + 1 : "";
 }
-const char* get_ffprobe_cmd_for_ext(const char* ext) {
-    if (!ext || ext[0] == '\0') return NULL;
+static int ext_is_video(const char* ext) {
+    if (!ext || ext[0] == '\0') return 0;
     static const char* video_exts[] = {
         "mp4", "mov", "webm", "mkv", "avi", NULL
     };
     for (size_t i = 0; video_exts[i]; ++i) {
-        if (ascii_stricmp(ext, video_exts[i]) == 0) {
-            return "ffprobe -nostdin -hwaccel none -v error -select_streams v:0 -show_entries stream=codec_name -of default=noprint_wrappers=1:nokey=1 %s";
-        }
+        if (ascii_stricmp(ext, video_exts[i]) == 0) return 1;
     }
-    return NULL;
+    return 0;
 }
 int is_decodable(const char* path) {
     if (!is_path_safe(path)) return 0;
     const char* ext = get_file_ext(path);
-    const char* format_cmd = get_ffprobe_cmd_for_ext(ext);
-    if (!format_cmd) {
+    if (!ext_is_video(ext)) {
         static const char* image_exts[] = {
             "jpg", "jpeg", "png", "gif", "webp", NULL
         };
@@ -550,17 +617,8 @@ int is_decodable(const char* path) {
         }
         return 0;
     }
-    char esc_path[PATH_MAX * 2];
-    platform_escape_path_for_cmd(path, esc_path, sizeof(esc_path));
-    char cmd[PATH_MAX * 3];
-    snprintf(cmd, sizeof(cmd), format_cmd, esc_path);
-    FILE* f = platform_popen_direct(cmd, "r");
-    if (!f) return 0;
-    char buf[64];
-    int ok = 0;
-    if (fgets(buf, sizeof(buf), f)) ok = 1;
-    int status = platform_pclose_direct(f);
-    return ok && status == 0;
+    media_info_t mi;
+    return media_info_get(path, &mi) == 0;
 }
 
 int is_valid_media(const char* path) {
@@ -579,6 +637,91 @@ int is_newer(const char* src, const char* dst) {
     if (platform_stat(dst, &d) != 0) return 1;
     return s.st_mtime > d.st_mtime;
 }
+static size_t media_sidecar_suffix_len(const char* name) {
+    if (!name) return 0;
+    if (faststart_is_sidecar_name(name)) return strlen(FASTSTART_SUFFIX);
+    size_t n = strlen(name), s = strlen(ANIM_PREVIEW_SUFFIX);
+    return n > s && ascii_stricmp(name + n - s, ANIM_PREVIEW_SUFFIX) == 0 ? s : 0;
+}
+
+int is_media_sidecar_name(const char* name) {
+    return media_sidecar_suffix_len(name) > 0;
+}
+
+int anim_preview_path(const char* media_full, char* out, size_t outlen) {
+    if (!media_full || !out || outlen == 0) return -1;
+    char media[PATH_MAX];
+    snprintf(media, sizeof(media), "%s", media_full);
+    normalize_path(media);
+    char* sep = strrchr(media, DIR_SEP);
+    if (!sep) return -1;
+    *sep = '\0';
+    char thumbs_root[PATH_MAX];
+    get_thumbs_root(thumbs_root, sizeof(thumbs_root));
+    char safe_dir_name[PATH_MAX];
+    make_safe_dir_name_from(media, safe_dir_name, sizeof(safe_dir_name));
+    int n = snprintf(out, outlen, "%s" DIR_SEP_STR "%s" DIR_SEP_STR "%s" ANIM_PREVIEW_SUFFIX, thumbs_root, safe_dir_name, sep + 1);
+    return n > 0 && (size_t)n < outlen ? 0 : -1;
+}
+
+bool anim_preview_lookup(const char* media_full, char* name_out, size_t name_len) {
+    const char* ext = media_full ? strrchr(media_full, '.') : NULL;
+    if (!ext || (ascii_stricmp(ext, ".gif") != 0 && ascii_stricmp(ext, ".webp") != 0)) return false;
+    char preview[PATH_MAX];
+    struct stat st_media, st_preview;
+    if (anim_preview_path(media_full, preview, sizeof(preview)) != 0) return false;
+    if (platform_stat(preview, &st_preview) != 0 || st_preview.st_size == 0) return false;
+    if (platform_stat(media_full, &st_media) != 0) return false;
+    if (st_preview.st_mtime < st_media.st_mtime || st_preview.st_size >= st_media.st_size) return false;
+    const char* bn = strrchr(preview, DIR_SEP);
+    int n = snprintf(name_out, name_len, "%s", bn ? bn + 1 : preview);
+    return n > 0 && (size_t)n < name_len;
+}
+
+static int anim_preview_due(const char* full, const char* name, const struct stat* st_media, const char* preview) {
+    const char* ext = strrchr(name, '.');
+    if (!ext || st_media->st_size < ANIM_PREVIEW_MIN_BYTES) return 0;
+    int gif = ascii_stricmp(ext, ".gif") == 0;
+    if (!gif && ascii_stricmp(ext, ".webp") != 0) return 0;
+    struct stat st_preview;
+    if (platform_stat(preview, &st_preview) == 0 && st_preview.st_mtime >= st_media->st_mtime) return 0;
+    return gif ? is_animated_gif(full) : is_animated_webp(full);
+}
+
+static void generate_anim_preview(const char* input, const char* output) {
+    if (!is_path_safe(input) || !is_valid_media(input)) return;
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", output);
+    thumb_cmd_t cmd;
+    build_ffmpeg_preview_cmd(&cmd, input, tmp);
+    uint64_t t0 = platform_monotonic_ms();
+    int ret = execute_command_with_limits(cmd.argv, NULL, ANIM_PREVIEW_TIMEOUT_SEC, NULL);
+    const char* ext = strrchr(input, '.');
+    if (ret != 0 && ext && ascii_stricmp(ext, ".webp") == 0) {
+        char tmp_gif[PATH_MAX];
+        snprintf(tmp_gif, sizeof(tmp_gif), "%s.tmp.gif", output);
+        thumb_cmd_t unpack;
+        cmd_init(&unpack, "magick");
+        cmd_arg(&unpack, input); cmd_arg(&unpack, "-coalesce"); cmd_arg(&unpack, tmp_gif);
+        if (execute_command_with_limits(unpack.argv, NULL, ANIM_PREVIEW_TIMEOUT_SEC, NULL) == 0) {
+            build_ffmpeg_preview_cmd(&cmd, tmp_gif, tmp);
+            ret = execute_command_with_limits(cmd.argv, NULL, ANIM_PREVIEW_TIMEOUT_SEC, NULL);
+        }
+        platform_file_delete(tmp_gif);
+    }
+    if (ret != 0 || platform_move_file(tmp, output) != 0) {
+        platform_file_delete(tmp);
+        LOG_WARN("Animated preview failed for %s (rc=%d)", input, ret);
+        FILE* f = platform_fopen(output, "wb");
+        if (f) fclose(f);
+        return;
+    }
+    struct stat st_in, st_out;
+    if (platform_stat(input, &st_in) == 0 && platform_stat(output, &st_out) == 0)
+        LOG_INFO("Animated preview for %s: %lld -> %lld bytes in %llu ms", input, (long long)st_in.st_size, (long long)st_out.st_size,
+            (unsigned long long)(platform_monotonic_ms() - t0));
+}
+
 static void generate_thumb_c(const char* input, const char* output, int scale, int q, int index, int total) {
     LOG_DEBUG("generate_thumb_c: enter input=%s output=%s scale=%d q=%d index=%d total=%d", input ? input : "(null)", output ? output : "(null)", scale, q, index, total);
 
@@ -612,13 +755,6 @@ static void generate_thumb_c(const char* input, const char* output, int scale, i
         strncpy(in_path_with_frame, in_path, sizeof(in_path_with_frame) - 1);
         in_path_with_frame[sizeof(in_path_with_frame) - 1] = '\0';
     }
-    char esc_in[PATH_MAX * 2], esc_out[PATH_MAX * 2];
-    esc_in[0] = '\0'; esc_out[0] = '\0';
-    platform_escape_path_for_cmd(in_path, esc_in, sizeof(esc_in));
-    platform_escape_path_for_cmd(out_path, esc_out, sizeof(esc_out));
-    char esc_in_with_frame[PATH_MAX * 2];
-    esc_in_with_frame[0] = '\0';
-    platform_escape_path_for_cmd(in_path_with_frame, esc_in_with_frame, sizeof(esc_in_with_frame));
     if (ext && ascii_stricmp(ext, ".webp") == 0) {
         if (input_is_animated_webp) {
             LOG_DEBUG("[%d/%d] Animated webp detected, using ffmpeg extraction: %s", index, total, in_path);
@@ -626,28 +762,23 @@ static void generate_thumb_c(const char* input, const char* output, int scale, i
             char tmp_jpg[PATH_MAX];
             snprintf(tmp_jpg, sizeof(tmp_jpg), "%s.tmp.jpg", out_path);
 
-            char esc_tmp[PATH_MAX * 2];
-            esc_tmp[0] = '\0';
-            platform_escape_path_for_cmd(tmp_jpg, esc_tmp, sizeof(esc_tmp));
-            char ffcmd[1024];
-            build_ffmpeg_extract_jpg_cmd(ffcmd, sizeof(ffcmd), esc_in, esc_tmp, scale);
+            thumb_cmd_t ffcmd;
+            build_ffmpeg_extract_jpg_cmd(&ffcmd, in_path, tmp_jpg, scale);
 
-            LOG_DEBUG("generate_thumb_c: executing webp ffmpeg cmd: %s", ffcmd);
-            int ret_png = execute_command_with_limits(ffcmd, NULL, 30, 1);
+            LOG_DEBUG("generate_thumb_c: extracting webp frame: %s", tmp_jpg);
+            int ret_png = execute_command_with_limits(ffcmd.argv, NULL, 30, NULL);
 
             if (ret_png == 0) {
-                char convert_cmd[PATH_MAX * 3];
+                thumb_cmd_t convert_cmd;
                 if (output_is_webp(out_path) && input_is_animated_webp) {
-                    snprintf(convert_cmd, sizeof(convert_cmd),
-                        "ffmpeg -y -threads 1 -i \"%s\" -vf \"scale=%d:-1,format=rgb24\" -vframes 1 -q:v %d -c:v libwebp \"%s\"",
-                        esc_tmp, scale, q, esc_out);
+                    build_ffmpeg_thumb_cmd(&convert_cmd, tmp_jpg, scale, q, 1, 1, out_path);
                 }
                 else {
-                    build_magick_resize_cmd(convert_cmd, sizeof(convert_cmd), esc_tmp, scale, q, esc_out);
+                    build_magick_resize_cmd(&convert_cmd, tmp_jpg, scale, q, out_path);
                 }
 
-                LOG_DEBUG("generate_thumb_c: executing png conversion cmd: %s", convert_cmd);
-                int cret = execute_command_with_limits(convert_cmd, NULL, 20, 0);
+                LOG_DEBUG("generate_thumb_c: converting frame with %s", convert_cmd.argv[0]);
+                int cret = execute_command_with_limits(convert_cmd.argv, NULL, 20, NULL);
                 platform_file_delete(tmp_jpg);
 
                 if (cret == 0) return;
@@ -660,17 +791,17 @@ static void generate_thumb_c(const char* input, const char* output, int scale, i
         }
         LOG_DEBUG("[%d/%d] Using CPU/image commands for webp: %s", index, total, in_path);
 
-        char magick_cmd[1024];
-        build_magick_resize_cmd(magick_cmd, sizeof(magick_cmd), esc_in_with_frame, scale, q, esc_out);
+        thumb_cmd_t magick_cmd;
+        build_magick_resize_cmd(&magick_cmd, in_path_with_frame, scale, q, out_path);
 
-        int mret = execute_command_with_limits(magick_cmd, NULL, 20, 0);
+        int mret = execute_command_with_limits(magick_cmd.argv, NULL, 20, NULL);
         if (mret == 0) {
             LOG_INFO("[%d/%d] magick succeeded for %s", index, total, in_path);
             return;
         }
         char magick_log[PATH_MAX];
         snprintf(magick_log, sizeof(magick_log), "%s.magick.log", out_path);
-        int mret2 = execute_command_with_limits(magick_cmd, magick_log, 20, 0);
+        int mret2 = execute_command_with_limits(magick_cmd.argv, magick_log, 20, NULL);
 
         if (mret2 == 0) {
             LOG_INFO("[%d/%d] magick succeeded on retry for %s", index, total, in_path);
@@ -704,26 +835,22 @@ static void generate_thumb_c(const char* input, const char* output, int scale, i
         char tmp_jpg[PATH_MAX];
         snprintf(tmp_jpg, sizeof(tmp_jpg), "%s.tmp.jpg", out_path);
 
-        char esc_tmp[PATH_MAX * 2];
-        esc_tmp[0] = '\0';
-        platform_escape_path_for_cmd(tmp_jpg, esc_tmp, sizeof(esc_tmp));
-
         {
-            char extract_cmd[1024];
-            build_ffmpeg_extract_jpg_cmd(extract_cmd, sizeof(extract_cmd), esc_in, esc_tmp, scale);
-            LOG_DEBUG("generate_thumb_c: executing video extraction cmd: %s", extract_cmd);
-            int ret_png = execute_command_with_limits(extract_cmd, NULL, 60, 1);
+            thumb_cmd_t extract_cmd;
+            build_ffmpeg_extract_jpg_cmd(&extract_cmd, in_path, tmp_jpg, scale);
+            LOG_DEBUG("generate_thumb_c: extracting video frame: %s", tmp_jpg);
+            int ret_png = execute_command_with_limits(extract_cmd.argv, NULL, 60, NULL);
 
             if (ret_png == 0) {
-                char convert_cmd[1024];
+                thumb_cmd_t convert_cmd;
                 if (output_is_webp(out_path) && input_is_animated_webp) {
-                    build_ffmpeg_thumb_cmd(convert_cmd, sizeof(convert_cmd), esc_tmp, scale, q, 1, 1, esc_out);
+                    build_ffmpeg_thumb_cmd(&convert_cmd, tmp_jpg, scale, q, 1, 1, out_path);
                 }
-        else {
-            build_magick_resize_cmd(convert_cmd, sizeof(convert_cmd), esc_tmp, scale, q, esc_out);
-        }
-        LOG_DEBUG("generate_thumb_c: executing video conversion cmd: %s", convert_cmd);
-                int cret = execute_command_with_limits(convert_cmd, NULL, 20, 0);
+                else {
+                    build_magick_resize_cmd(&convert_cmd, tmp_jpg, scale, q, out_path);
+                }
+                LOG_DEBUG("generate_thumb_c: converting video frame with %s", convert_cmd.argv[0]);
+                int cret = execute_command_with_limits(convert_cmd.argv, NULL, 20, NULL);
                 platform_file_delete(tmp_jpg);
 
                 if (cret == 0) return;
@@ -736,19 +863,17 @@ static void generate_thumb_c(const char* input, const char* output, int scale, i
         }
     }
     {
-        char final_cmd[2048];
+        thumb_cmd_t final_cmd;
         if (input_is_animated_webp) {
             int to_webp = output_is_webp(out_path) ? 1 : 0;
             int add_rgb = (ext && (ascii_stricmp(ext, ".gif") == 0 || ascii_stricmp(ext, ".png") == 0)) ? 1 : 0;
-            build_ffmpeg_thumb_cmd(final_cmd, sizeof(final_cmd), esc_in, scale, q, to_webp, add_rgb, esc_out);
-            LOG_DEBUG("generate_thumb_c: executing final ffmpeg cmd: %s", final_cmd);
-            int ret = execute_command_with_limits(final_cmd, NULL, 30, 1);
+            build_ffmpeg_thumb_cmd(&final_cmd, in_path, scale, q, to_webp, add_rgb, out_path);
+            int ret = execute_command_with_limits(final_cmd.argv, NULL, 30, NULL);
             if (ret != 0) LOG_WARN("[%d/%d] ffmpeg failed rc=%d", index, total, ret);
         }
         else {
-            build_magick_resize_cmd(final_cmd, sizeof(final_cmd), esc_in_with_frame, scale, q, esc_out);
-            LOG_DEBUG("generate_thumb_c: executing final magick cmd: %s", final_cmd);
-            int ret = execute_command_with_limits(final_cmd, NULL, 30, 0);
+            build_magick_resize_cmd(&final_cmd, in_path_with_frame, scale, q, out_path);
+            int ret = execute_command_with_limits(final_cmd.argv, NULL, 30, NULL);
             if (ret != 0) LOG_WARN("[%d/%d] magick/ffmpeg failed rc=%d", index, total, ret);
         }
     }
@@ -809,13 +934,12 @@ int dir_has_missing_thumbs_common(const char* dir, int videos_only, int shallow)
         LOG_DEBUG("dir_has_missing_thumbs%s: checking media=%s small=%s large=%s",
             shallow ? "_shallow" : "", full, small_fs, large_fs);
 
-        int small_exists = is_file(small_fs);
-        int large_exists = is_file(large_fs);
-
         struct stat st_media, st_small, st_large;
         int media_stat = platform_stat(full, &st_media);
-        int small_stat = platform_stat(small_fs, &st_small);
-        int large_stat = platform_stat(large_fs, &st_large);
+        int small_stat = thumb_stat(small_fs, &st_small);
+        int large_stat = thumb_stat(large_fs, &st_large);
+        int small_exists = small_stat == 0;
+        int large_exists = large_stat == 0;
 
         if (!small_exists) {
             dir_close(&it);
@@ -857,19 +981,37 @@ int dir_has_missing_thumbs_shallow(const char* dir, int videos_only) {
 typedef struct watcher_node {
     char dir[PATH_MAX];
     int scheduled;
+    timer_id_t debounce_timer;
     struct watcher_node* next;
 } watcher_node_t;
 static watcher_node_t* watcher_head = NULL;
 static thread_mutex_t watcher_mutex;
 static int watcher_mutex_inited = 0;
 
-typedef struct running_node {
+typedef struct watch_work {
+    char* path;
+    int flags;
+    struct watch_work* next;
+} watch_work_t;
+static watch_work_t* watch_work_head = NULL;
+static watch_work_t* watch_work_tail = NULL;
+static thread_mutex_t watch_work_mutex;
+static int watch_work_mutex_inited = 0;
+static int watch_work_running = 0;
+
+/* Single-flight registry: one generation run per directory at a time. */
+typedef struct gen_flight {
     char dir[PATH_MAX];
-    struct running_node* next;
-} running_node_t;
-static running_node_t* running_head = NULL;
-static thread_mutex_t running_mutex;
-static int running_mutex_inited = 0;
+    int busy;
+    int rerun;
+    int force;
+    unsigned attached;
+    uint64_t clean_ms;
+    struct gen_flight* next;
+} gen_flight_t;
+static gen_flight_t* gen_flight_head = NULL;
+static thread_mutex_t gen_flight_mutex;
+static int gen_flight_mutex_inited = 0;
 typedef struct warn_node {
     char dir[PATH_MAX];
     time_t last_log;
@@ -935,8 +1077,37 @@ static void remove_watcher_node(const char* dir) {
     }
     thread_mutex_unlock(&watcher_mutex);
 }
+static void queue_stale_thumbs(const char* full, const char* thumb_small, const char* thumb_large, progress_t* prog) {
+    struct stat st_media, st_small, st_large;
+    int need_small = 0, need_large = 0, need_preview = 0;
+    char preview[PATH_MAX];
+    if (platform_stat(full, &st_media) == 0) {
+        if (anim_preview_path(full, preview, sizeof(preview)) == 0)
+            need_preview = anim_preview_due(full, full, &st_media, preview);
+        if (thumb_stat(thumb_small, &st_small) != 0 || st_small.st_mtime < st_media.st_mtime)
+            need_small = 1;
+        if (thumb_stat(thumb_large, &st_large) != 0 || st_large.st_mtime < st_media.st_mtime)
+            need_large = 1;
+    } else {
+        need_small = !thumb_exists(thumb_small);
+        need_large = !thumb_exists(thumb_large);
+    }
+
+    if (need_small) {
+        schedule_or_generate_thumb(full, thumb_small, prog, THUMB_SMALL_SCALE, THUMB_SMALL_QUALITY);
+    }
+
+    if (need_large) {
+        schedule_or_generate_thumb(full, thumb_large, prog, THUMB_LARGE_SCALE, THUMB_LARGE_QUALITY);
+    }
+
+    if (need_preview) {
+        schedule_or_generate_thumb(full, preview, prog, ANIM_PREVIEW_SCALE, 0);
+    }
+}
 static void thumb_watcher_cb(const char* dir) {
     if (!dir) return;
+    gen_flight_mark_dirty(dir);
     thread_mutex_lock(&watcher_mutex);
     watcher_node_t* cur = watcher_head;
     while (cur) {
@@ -951,6 +1122,7 @@ static void thumb_watcher_cb(const char* dir) {
     }
 
     if (cur->scheduled) {
+        timer_rearm(cur->debounce_timer, DEBOUNCE_MS);
         thread_mutex_unlock(&watcher_mutex);
         return;
     }
@@ -994,25 +1166,7 @@ static void thumb_watcher_cb(const char* dir) {
                 snprintf(thumb_small, sizeof(thumb_small), "%s" DIR_SEP_STR "%s", per_thumbs_root, thumb_small_rel);
                 snprintf(thumb_large, sizeof(thumb_large), "%s" DIR_SEP_STR "%s", per_thumbs_root, thumb_large_rel);
 
-                struct stat st_media, st_small, st_large;
-                int need_small = 0, need_large = 0;
-                if (platform_stat(full, &st_media) == 0) {
-                    if (!is_file(thumb_small) || platform_stat(thumb_small, &st_small) != 0 || st_small.st_mtime < st_media.st_mtime)
-                        need_small = 1;
-                    if (!is_file(thumb_large) || platform_stat(thumb_large, &st_large) != 0 || st_large.st_mtime < st_media.st_mtime)
-                        need_large = 1;
-                } else {
-                    need_small = !is_file(thumb_small);
-                    need_large = !is_file(thumb_large);
-                }
-
-                if (need_small) {
-                    schedule_or_generate_thumb(full, thumb_small, &quick_prog, THUMB_SMALL_SCALE, THUMB_SMALL_QUALITY);
-                }
-
-                if (need_large) {
-                    schedule_or_generate_thumb(full, thumb_large, &quick_prog, THUMB_LARGE_SCALE, THUMB_LARGE_QUALITY);
-                }
+                queue_stale_thumbs(full, thumb_small, thumb_large, &quick_prog);
             }
             dir_close(&it);
         }
@@ -1027,41 +1181,214 @@ static void thumb_watcher_cb(const char* dir) {
         return;
     }
 
-    if (thread_create_detached((void* (*)(void*))debounce_generation_thread, (void*)dcopy) != 0) {
-        LOG_ERROR("Failed to spawn debounced generation thread for %s", dir);
-        free(dcopy);
-        thread_mutex_lock(&watcher_mutex);
+    thread_mutex_lock(&watcher_mutex);
+    cur->debounce_timer = timer_add(DEBOUNCE_MS, debounce_generation_fire, dcopy);
+    if (!cur->debounce_timer) {
+        LOG_ERROR("Failed to arm debounced generation timer for %s", dir);
         cur->scheduled = 0;
         thread_mutex_unlock(&watcher_mutex);
+        free(dcopy);
         return;
     }
+    thread_mutex_unlock(&watcher_mutex);
 }
 
-static void* debounce_generation_thread(void* args) {
-    char* dcopy = (char*)args;
-    if (!dcopy) {
-        return NULL;
+static void process_watch_event(const char* path, int flags) {
+    char parent[PATH_MAX];
+    get_parent_dir(path, parent, sizeof(parent));
+    if (flags & PLATFORM_WATCH_RESYNC) {
+        LOG_DEBUG("Watcher resync for %s", path);
+        api_invalidate_dir_caches(path);
+        if (parent[0]) api_invalidate_dir_caches(parent);
+        thumb_watcher_cb(path);
+        return;
     }
+    if (parent[0]) api_invalidate_dir_caches(parent);
+    if (flags & PLATFORM_WATCH_DIR) {
+        api_invalidate_dir_caches(path);
+        return;
+    }
+    const char* name = path;
+    for (const char* p = path; *p; ++p)
+        if (*p == '/' || *p == '\\') name = p + 1;
+    if (!(has_ext(name, IMAGE_EXTS) || has_ext(name, VIDEO_EXTS))) return;
+    if ((flags & PLATFORM_WATCH_REMOVED) || !is_file(path)) {
+        LOG_DEBUG("Watcher: media removed %s", path);
+        return;
+    }
+    char thumb_small[PATH_MAX], thumb_large[PATH_MAX];
+    make_thumb_fs_paths(path, name, thumb_small, sizeof(thumb_small), thumb_large, sizeof(thumb_large));
+    progress_t prog;
+    memset(&prog, 0, sizeof(prog));
+    prog.total_files = 1;
+    LOG_DEBUG("Watcher: media changed %s", path);
+    queue_stale_thumbs(path, thumb_small, thumb_large, &prog);
+    if (faststart_is_candidate(name)) faststart_ensure(path);
+}
+
+static void* watch_work_thread(void* args) {
+    (void)args;
+    io_budget_set_background(1);
+    for (;;) {
+        thread_mutex_lock(&watch_work_mutex);
+        watch_work_t* w = watch_work_head;
+        if (!w) {
+            watch_work_running = 0;
+            thread_mutex_unlock(&watch_work_mutex);
+            return NULL;
+        }
+        watch_work_head = w->next;
+        if (!watch_work_head) watch_work_tail = NULL;
+        thread_mutex_unlock(&watch_work_mutex);
+        process_watch_event(w->path, w->flags);
+        free(w->path);
+        free(w);
+    }
+}
 
-    platform_sleep_ms(DEBOUNCE_MS);
+static void thumb_watch_event_cb(const char* root, const char* path, int flags, void* ctx) {
+    (void)root; (void)ctx;
+    if (!path) return;
+    watch_work_t* w = malloc(sizeof(watch_work_t));
+    if (!w || !(w->path = strdup(path))) {
+        free(w);
+        LOG_ERROR("Failed to queue watcher event for %s", path);
+        return;
+    }
+    w->flags = flags;
+    w->next = NULL;
+    thread_mutex_lock(&watch_work_mutex);
+    if (watch_work_tail) watch_work_tail->next = w;
+    else watch_work_head = w;
+    watch_work_tail = w;
+    int spawn = !watch_work_running;
+    if (spawn) watch_work_running = 1;
+    thread_mutex_unlock(&watch_work_mutex);
+    if (spawn && thread_create_detached(watch_work_thread, NULL) != 0) {
+        LOG_ERROR("Failed to spawn watcher worker thread, processing inline");
+        watch_work_thread(NULL);
+    }
+}
+
+static void* debounce_generation_thread(void* args) {
+    char* dcopy = (char*)args;
+    if (!dcopy) return NULL;
+    io_budget_set_background(1);
     start_background_thumb_generation(dcopy);
+    free(dcopy);
+    return NULL;
+}
+
+static void debounce_generation_fire(void* args) {
+    char* dcopy = (char*)args;
+    if (!dcopy) return;
+
     thread_mutex_lock(&watcher_mutex);
     watcher_node_t* cur = watcher_head;
     while (cur) {
         if (strcmp(cur->dir, dcopy) == 0) {
             cur->scheduled = 0;
+            cur->debounce_timer = 0;
             break;
         }
         cur = cur->next;
     }
     thread_mutex_unlock(&watcher_mutex);
-    free(dcopy);
+    if (thread_create_detached((void* (*)(void*))debounce_generation_thread, (void*)dcopy) != 0) {
+        LOG_ERROR("Failed to spawn debounced generation thread for %s", dcopy);
+        free(dcopy);
+    }
+}
 
-    return NULL;
+static gen_flight_t* gen_flight_find_locked(const char* dir, int create) {
+    char key[PATH_MAX];
+    strncpy(key, dir, PATH_MAX - 1);
+    key[PATH_MAX - 1] = '\0';
+    strip_trailing_sep(key);
+    for (gen_flight_t* f = gen_flight_head; f; f = f->next)
+        if (strcmp(f->dir, key) == 0) return f;
+    if (!create) return NULL;
+    gen_flight_t* f = calloc(1, sizeof(gen_flight_t));
+    if (!f) {
+        LOG_ERROR("Failed to allocate generation flight for directory %s", dir);
+        return NULL;
+    }
+    strcpy(f->dir, key);
+    f->next = gen_flight_head;
+    gen_flight_head = f;
+    return f;
+}
+
+static void gen_flight_lock(void) {
+    if (!gen_flight_mutex_inited) {
+        if (thread_mutex_init(&gen_flight_mutex) == 0) gen_flight_mutex_inited = 1;
+    }
+    thread_mutex_lock(&gen_flight_mutex);
+}
+
+/* Returns 1 when the caller now owns the flight and must finish it with gen_flight_end(). */
+static int gen_flight_begin(const char* dir, int force) {
+    uint64_t now = platform_monotonic_ms();
+    int own = 0;
+    gen_flight_lock();
+    gen_flight_t* f = gen_flight_find_locked(dir, 1);
+    if (!f) {
+        own = 1;
+    } else if (f->busy) {
+        f->attached++;
+        if (force) { f->rerun = 1; f->force = 1; }
+    } else if (force || !f->clean_ms || now - f->clean_ms >= GEN_CLEAN_TTL_MS) {
+        f->busy = 1;
+        f->rerun = 0;
+        f->force = force;
+        own = 1;
+    }
+    thread_mutex_unlock(&gen_flight_mutex);
+    return own;
+}
+
+/* Returns 1 when a change arrived during the pass and dir must be checked again. */
+static int gen_flight_end(const char* dir, int clean) {
+    int again = 0;
+    gen_flight_lock();
+    gen_flight_t* f = gen_flight_find_locked(dir, 0);
+    if (f && f->rerun) {
+        f->rerun = 0;
+        again = 1;
+    } else if (f) {
+        if (f->attached)
+            LOG_DEBUG("Generation for %s absorbed %u concurrent trigger(s)", f->dir, f->attached);
+        f->busy = 0;
+        f->force = 0;
+        f->attached = 0;
+        f->clean_ms = clean ? platform_monotonic_ms() : 0;
+    }
+    thread_mutex_unlock(&gen_flight_mutex);
+    return again;
+}
+
+static int gen_flight_take_force(const char* dir) {
+    gen_flight_lock();
+    gen_flight_t* f = gen_flight_find_locked(dir, 0);
+    int force = f ? f->force : 0;
+    if (f) f->force = 0;
+    thread_mutex_unlock(&gen_flight_mutex);
+    return force;
+}
+
+static void gen_flight_mark_dirty(const char* dir) {
+    gen_flight_lock();
+    gen_flight_t* f = gen_flight_find_locked(dir, 0);
+    if (f) {
+        f->clean_ms = 0;
+        if (f->busy) f->rerun = 1;
+    }
+    thread_mutex_unlock(&gen_flight_mutex);
 }
 
 static void* thumbnail_generation_thread(void* args) {
     thread_args_t* thread_args = (thread_args_t*)args;
+    io_budget_set_background(1);
     char dir_path[PATH_MAX];
     strncpy(dir_path, thread_args->dir_path, PATH_MAX - 1);
     dir_path[PATH_MAX - 1] = '\0';
@@ -1071,28 +1398,14 @@ static void* thumbnail_generation_thread(void* args) {
     run_thumb_generation(dir_path);
     strip_trailing_sep(dir_path);
     LOG_INFO("Background thumbnail generation finished for: %s", dir_path);
-    if (!running_mutex_inited && thread_mutex_init(&running_mutex) == 0) running_mutex_inited = 1;
-    if (running_mutex_inited) {
-        thread_mutex_lock(&running_mutex);
-        running_node_t* prev = NULL;
-        running_node_t* cur = running_head;
-        while (cur) {
-            if (strcmp(cur->dir, dir_path) == 0) {
-                if (prev) prev->next = cur->next; else running_head = cur->next;
-                free(cur);
-                break;
-            }
-            prev = cur;
-            cur = cur->next;
-        }
-        thread_mutex_unlock(&running_mutex);
-    }
+    if (gen_flight_end(dir_path, 1)) run_generation_flight(dir_path);
     return NULL;
 }
 
 static void* thumb_job_thread(void* args) {
     if (!args) return NULL;
     thumb_job_t* job = (thumb_job_t*)args;
+    io_budget_set_background(1);
     LOG_DEBUG("thumb_job_thread: starting generation for %s -> %s", job->input, job->output);
     run_thumb_job(job);
     LOG_DEBUG("thumb_job_thread: broadcasting and finishing for %s", job->input);
@@ -1100,86 +1413,70 @@ static void* thumb_job_thread(void* args) {
     atomic_fetch_sub(&thumb_workers_active, 1);
     return NULL;
 }
+static atomic_int thumb_maintenance_running = ATOMIC_VAR_INIT(0);
 static void* thumb_maintenance_thread(void* args) {
-    int interval = args ? *((int*)args) : 300;
-    int ival = interval;
-    free(args);
-    for (;;) {
-        platform_sleep_ms(1000 * ival);
-        LOG_INFO("Periodic thumb maintenance: running migration and orphan cleanup");
-
-        size_t gf_count = 0;
-        char** gfolders = get_gallery_folders(&gf_count);
-        if (gf_count == 0) continue;
-
-        for (size_t gi = 0; gi < gf_count; ++gi) {
-            char* gallery = gfolders[gi];
-            char thumbs_root[PATH_MAX];
-            get_thumbs_root(thumbs_root, sizeof(thumbs_root));
-            char safe_dir_name[PATH_MAX];
-            make_safe_dir_name_from(gallery, safe_dir_name, sizeof(safe_dir_name));
-            char per_thumbs_root[PATH_MAX];
-            snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir_name);
-            if (!is_dir(per_thumbs_root)) platform_make_dir(per_thumbs_root);
-            char per_db[PATH_MAX];
-            snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", per_thumbs_root);
-            thumbdb_open_for_dir(per_db);
-
-            diriter it;
-            if (!dir_open(&it, gallery)) {
-                continue;
-            }
-
-            const char* mname;
-            while ((mname = dir_next(&it))) {
-                if (!strcmp(mname, ".") || !strcmp(mname, "..") || !strcmp(mname, "thumbs")) continue;
-
-                char media_full[PATH_MAX];
-                path_join(media_full, gallery, mname);
-                if (!is_file(media_full)) continue;
-                if (!(has_ext(mname, IMAGE_EXTS) || has_ext(mname, VIDEO_EXTS))) continue;
-
-                char small_rel[PATH_MAX], large_rel[PATH_MAX];
-                get_thumb_rel_names(media_full, mname, small_rel, sizeof(small_rel), large_rel, sizeof(large_rel));
-
-                char desired_small[PATH_MAX], desired_large[PATH_MAX];
-                snprintf(desired_small, sizeof(desired_small), "%s" DIR_SEP_STR "%s", per_thumbs_root, small_rel);
-                snprintf(desired_large, sizeof(desired_large), "%s" DIR_SEP_STR "%s", per_thumbs_root, large_rel);
-            }
+    (void)args;
+    io_budget_set_background(1);
+    LOG_INFO("Periodic thumb maintenance: running migration and orphan cleanup");
+
+    size_t gf_count = 0;
+    char** gfolders = get_gallery_folders(&gf_count);
+    if (gf_count == 0) {
+        atomic_store(&thumb_maintenance_running, 0);
+        return NULL;
+    }
+    thumbs_crawl_full((const char* const*)gfolders, gf_count);
 
-            dir_close(&it);
-            ensure_thumbs_in_dir(gallery, NULL);
-            clean_orphan_thumbs(gallery, NULL);
+    for (size_t gi = 0; gi < gf_count; ++gi) {
+        char* gallery = gfolders[gi];
+        char thumbs_root[PATH_MAX];
+        get_thumbs_root(thumbs_root, sizeof(thumbs_root));
+        char safe_dir_name[PATH_MAX];
+        make_safe_dir_name_from(gallery, safe_dir_name, sizeof(safe_dir_name));
+        char per_thumbs_root[PATH_MAX];
+        snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir_name);
+        if (!is_dir(per_thumbs_root)) platform_make_dir(per_thumbs_root);
+        char per_db[PATH_MAX];
+        snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", per_thumbs_root);
+        thumbdb_open_for_dir(per_db);
 
-            if (thumbdb_tx_begin() == 0) {
-                thumbdb_sweep_orphans();
-                if (thumbdb_tx_commit() != 0) {
-                    LOG_WARN("thumbs: failed to commit tx for gallery %s, aborting", gallery);
-                    thumbdb_tx_abort();
-                }
-            } else {
-                LOG_WARN("thumbs: failed to start tx for database maintenance in gallery %s", gallery);
+        if (thumbdb_tx_begin() == 0) {
+            thumbdb_sweep_orphans();
+            if (thumbdb_tx_commit() != 0) {
+                LOG_WARN("thumbs: failed to commit tx for gallery %s, aborting", gallery);
+                thumbdb_tx_abort();
             }
+        } else {
+            LOG_WARN("thumbs: failed to start tx for database maintenance in gallery %s", gallery);
         }
-
-        thumbdb_sweep_orphans();
-        if (!thumbdb_perform_requested_compaction())
-            thumbdb_compact();
     }
+
+    thumbdb_sweep_orphans();
+    if (!thumbdb_perform_requested_compaction())
+        thumbdb_compact();
+    atomic_store(&thumb_maintenance_running, 0);
     return NULL;
 }
-void start_periodic_thumb_maintenance(int interval_seconds) {
-    int* arg = malloc(sizeof(int));
-    if (!arg) {
-        LOG_ERROR("Failed to allocate interval argument for thumb maintenance thread");
+static void thumb_maintenance_fire(void* args) {
+    (void)args;
+    if (atomic_exchange(&thumb_maintenance_running, 1)) {
+        LOG_DEBUG("Periodic thumb maintenance: previous pass still running, skipping");
         return;
     }
-    *arg = interval_seconds > 0 ? interval_seconds : 300;
-    thread_create_detached((void* (*)(void*))thumb_maintenance_thread, arg);
+    if (thread_create_detached((void* (*)(void*))thumb_maintenance_thread, NULL) != 0) {
+        LOG_ERROR("Failed to spawn thumb maintenance thread");
+        atomic_store(&thumb_maintenance_running, 0);
+    }
+}
+void start_periodic_thumb_maintenance(int interval_seconds) {
+    int ival = interval_seconds > 0 ? interval_seconds : 300;
+    if (!timer_add_periodic((uint64_t)ival * 1000, thumb_maintenance_fire, NULL))
+        LOG_ERROR("Failed to arm periodic thumb maintenance timer");
 }
 void start_auto_thumb_watcher(const char* dir_path) {
     if (!dir_path) return;
     if (!watcher_mutex_inited && thread_mutex_init(&watcher_mutex) == 0) watcher_mutex_inited = 1;
+    if (!watch_work_mutex_inited && thread_mutex_init(&watch_work_mutex) == 0) watch_work_mutex_inited = 1;
     
     thread_mutex_lock(&watcher_mutex);
     watcher_node_t* cur = watcher_head;
@@ -1203,9 +1500,10 @@ void start_auto_thumb_watcher(const char* dir_path) {
     node->next = watcher_head;
     watcher_head = node;
     node->scheduled = 0;
+    node->debounce_timer = 0;
     thread_mutex_unlock(&watcher_mutex);
 
-    if (platform_start_dir_watcher(dir_path, thumb_watcher_cb) != 0) {
+    if (platform_watch_tree(dir_path, thumb_watch_event_cb, NULL) != 0) {
         LOG_ERROR("Failed to create watcher for %s", dir_path);
         remove_watcher_node(dir_path);
     }
@@ -1308,21 +1606,17 @@ void run_thumb_generation(const char* dir) {
         process_wal_chunks(per_thumbs_root);
     }
 
-    count_media_in_dir(dir_used, &prog);
+    thumb_pass_result_t res;
+    thumbs_dir_pass(dir_used, THUMB_PASS_GENERATE | THUMB_PASS_CLEAN, &prog, NULL, &res);
     {
         char dir_used_clean[PATH_MAX]; strncpy(dir_used_clean, dir_used, sizeof(dir_used_clean) - 1); dir_used_clean[sizeof(dir_used_clean) - 1] = '\0';
         strip_trailing_sep(dir_used_clean);
-        LOG_INFO("Found %zu media files in %s", prog.total_files, dir_used_clean);
+        LOG_INFO("Found %zu media files in %s (%zu thumbs queued, %zu orphans removed)", res.media, dir_used_clean, res.missing, res.orphans);
     }
-    LOG_DEBUG("run_thumb_generation: calling ensure_thumbs_in_dir for %s (found %zu)", dir_used, prog.total_files);
 
-    ensure_thumbs_in_dir(dir_used, &prog);
     wait_for_thumb_workers();
     process_wal_chunks(per_thumbs_root);
-    LOG_DEBUG("run_thumb_generation: ensure_thumbs_in_dir completed, processed %zu files", prog.processed_files);
-
-    clean_orphan_thumbs(dir_used, &prog);
-    LOG_DEBUG("run_thumb_generation: clean_orphan_thumbs completed");
+    LOG_DEBUG("run_thumb_generation: directory pass completed, processed %zu files", prog.processed_files);
 
     print_skips(&prog);
     LOG_DEBUG("run_thumb_generation: print_skips completed");
@@ -1397,13 +1691,13 @@ bool check_thumb_exists(const char* media_path, char* thumb_path, size_t thumb_p
         snprintf(thumb_path, thumb_path_len, "%s", small_rel);
     }
 
-    if (is_file(small_fs)) {
+    if (thumb_exists(small_fs)) {
         if (thumb_path_len > 0)
             snprintf(thumb_path, thumb_path_len, "%s", small_rel);
         return true;
     }
 
-    if (is_file(large_fs)) {
+    if (thumb_exists(large_fs)) {
         if (thumb_path_len > 0)
             snprintf(thumb_path, thumb_path_len, "%s", large_rel);
         return true;
@@ -1411,29 +1705,16 @@ bool check_thumb_exists(const char* media_path, char* thumb_path, size_t thumb_p
 
     return false;
 }
-void start_background_thumb_generation(const char* dir_path) {
-    LOG_DEBUG("start_background_thumb_generation: checking for missing thumbs (shallow) in %s", dir_path);
-
-    if (!dir_has_missing_thumbs_shallow(dir_path, 0)) {
-        LOG_INFO("No missing thumbnails (shallow) for: %s", dir_path);
-        start_auto_thumb_watcher(dir_path);
-        return;
-    }
-
+static void get_per_thumbs_root(const char* dir, char* out, size_t outlen) {
     char thumbs_root[PATH_MAX];
     get_thumbs_root(thumbs_root, sizeof(thumbs_root));
     if (!is_dir(thumbs_root)) platform_make_dir(thumbs_root);
-
     char safe_dir_name[PATH_MAX];
-    make_safe_dir_name_from(dir_path, safe_dir_name, sizeof(safe_dir_name));
-
-    char per_thumbs_root[PATH_MAX];
-    snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir_name);
-    if (!is_dir(per_thumbs_root)) platform_make_dir(per_thumbs_root);
-
-    char lock_path[PATH_MAX];
-    snprintf(lock_path, sizeof(lock_path), "%s" DIR_SEP_STR ".thumbs.lock", per_thumbs_root);
+    make_safe_dir_name_from(dir, safe_dir_name, sizeof(safe_dir_name));
+    snprintf(out, outlen, "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir_name);
+}
 
+static int acquire_dir_lock(const char* dir_path, const char* lock_path) {
     int lock_ret = platform_create_lockfile_exclusive(lock_path);
     if (lock_ret == 1) {
         struct stat st;
@@ -1450,7 +1731,12 @@ void start_background_thumb_generation(const char* dir_path) {
             int owner_alive = 0;
             if (owner_pid > 0) owner_alive = platform_pid_is_running(owner_pid);
 
-            if (owner_alive) {
+            if (owner_alive && (unsigned int)owner_pid == platform_get_pid()) {
+                LOG_WARN("Lockfile %s left behind by this process with no run in flight; removing", lock_path);
+                platform_file_delete(lock_path);
+                lock_ret = platform_create_lockfile_exclusive(lock_path);
+            }
+            else if (owner_alive) {
                 if (now > st.st_mtime && (now - st.st_mtime) > STALE_LOCK_SECONDS) {
                     LOG_WARN("Stale lock file detected %s age=%llds (owner pid %d still alive), removing", lock_path, (long long)(now - st.st_mtime), owner_pid);
                     platform_file_delete(lock_path);
@@ -1458,8 +1744,7 @@ void start_background_thumb_generation(const char* dir_path) {
                 }
                 else {
                     warn_maybe_log_already_running(dir_path);
-                    start_auto_thumb_watcher(dir_path);
-                    return;
+                    return 1;
                 }
             }
             else {
@@ -1472,42 +1757,35 @@ void start_background_thumb_generation(const char* dir_path) {
 
     if (lock_ret != 0) {
         LOG_WARN("Failed to create lock file %s", lock_path);
-        return;
+        return -1;
     }
+    return 0;
+}
+
+static int begin_generation_pass(const char* dir_path) {
+    LOG_DEBUG("start_background_thumb_generation: checking for missing thumbs (shallow) in %s", dir_path);
+
+    if (!gen_flight_take_force(dir_path) && !dir_has_missing_thumbs_shallow(dir_path, 0)) {
+        LOG_INFO("No missing thumbnails (shallow) for: %s", dir_path);
+        return 0;
+    }
+
+    char per_thumbs_root[PATH_MAX];
+    get_per_thumbs_root(dir_path, per_thumbs_root, sizeof(per_thumbs_root));
+    if (!is_dir(per_thumbs_root)) platform_make_dir(per_thumbs_root);
+
+    char lock_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s" DIR_SEP_STR ".thumbs.lock", per_thumbs_root);
+
+    if (acquire_dir_lock(dir_path, lock_path) != 0) return -1;
 
     LOG_DEBUG("start_background_thumb_generation: acquired lock %s", lock_path);
 
     thread_args_t* args = malloc(sizeof(thread_args_t));
     if (!args) {
         LOG_ERROR("Failed to allocate memory for thread arguments for directory %s", dir_path);
-        return;
-    }
-
-    if (!running_mutex_inited) {
-        if (thread_mutex_init(&running_mutex) == 0) running_mutex_inited = 1;
-    }
-    if (running_mutex_inited) {
-        thread_mutex_lock(&running_mutex);
-        running_node_t* cur = running_head;
-        while (cur) {
-            if (strcmp(cur->dir, dir_path) == 0) {
-                thread_mutex_unlock(&running_mutex);
-                start_auto_thumb_watcher(dir_path);
-                free(args);
-                return;
-            }
-            cur = cur->next;
-        }
-        running_node_t* rn = malloc(sizeof(running_node_t));
-        if (!rn) {
-            LOG_ERROR("Failed to allocate running node for directory %s", dir_path);
-        } else if (rn) {
-            strncpy(rn->dir, dir_path, PATH_MAX - 1);
-            rn->dir[PATH_MAX - 1] = '\0';
-            rn->next = running_head;
-            running_head = rn;
-        }
-        thread_mutex_unlock(&running_mutex);
+        platform_file_delete(lock_path);
+        return -1;
     }
 
     strncpy(args->dir_path, dir_path, PATH_MAX - 1);
@@ -1516,10 +1794,51 @@ void start_background_thumb_generation(const char* dir_path) {
     if (thread_create_detached((void* (*)(void*))thumbnail_generation_thread, args) != 0) {
         LOG_ERROR("Failed to create thumbnail generation thread for %s", dir_path);
         free(args);
+        platform_file_delete(lock_path);
+        return -1;
     }
+    return 1;
+}
+
+static void run_generation_flight(const char* dir_path) {
+    int rc;
+    do {
+        rc = begin_generation_pass(dir_path);
+    } while (rc != 1 && gen_flight_end(dir_path, 0));
+}
 
+void start_background_thumb_generation(const char* dir_path) {
+    if (!dir_path) return;
+    if (gen_flight_begin(dir_path, 0))
+        run_generation_flight(dir_path);
+    else
+        LOG_DEBUG("start_background_thumb_generation: %s already in flight or recently clean", dir_path);
     start_auto_thumb_watcher(dir_path);
 }
+
+static void* generation_flight_thread(void* args) {
+    char* dir = (char*)args;
+    if (!dir) return NULL;
+    io_budget_set_background(1);
+    run_generation_flight(dir);
+    start_auto_thumb_watcher(dir);
+    free(dir);
+    return NULL;
+}
+
+/* Runs a flight the caller already owns on a thread of its own. */
+static void spawn_generation_flight(const char* dir_path) {
+    char* dcopy = strdup(dir_path);
+    if (dcopy && thread_create_detached(generation_flight_thread, dcopy) == 0) return;
+    LOG_ERROR("Failed to spawn generation thread for %s", dir_path);
+    free(dcopy);
+    while (gen_flight_end(dir_path, 0)) {}
+}
+
+void request_background_thumb_generation(const char* dir_path, int force) {
+    if (!dir_path || !gen_flight_begin(dir_path, force)) return;
+    spawn_generation_flight(dir_path);
+}
 void add_skip(progress_t * prog, const char* reason, const char* path) {
     if (!reason || !path) return;
 
@@ -1572,8 +1891,11 @@ void print_skips(progress_t * prog) {
     prog->skip_head = NULL;
 }
 int get_media_dimensions(const char* path, int* width, int* height) {
-    (void)path; (void)width; (void)height;
-    return 0;
+    media_info_t mi;
+    int ok = media_info_get(path, &mi) == 0;
+    if (width) *width = ok ? mi.width : 0;
+    if (height) *height = ok ? mi.height : 0;
+    return ok;
 }
 void count_media_in_dir(const char* dir, progress_t * prog) {
     diriter it;
@@ -1592,114 +1914,272 @@ void count_media_in_dir(const char* dir, progress_t * prog) {
     }
     dir_close(&it);
 }
-void ensure_thumbs_in_dir(const char* dir, progress_t* prog) {
-    if (!dir || !*dir) {
-        LOG_ERROR("ensure_thumbs_in_dir: invalid dir");
-        return;
+static void convert_m4s_segment(const char* full) {
+    char mp4path[PATH_MAX];
+    strncpy(mp4path, full, sizeof(mp4path) - 1);
+    mp4path[sizeof(mp4path) - 1] = '\0';
+    char* dotp = strrchr(mp4path, '.');
+    if (dotp)
+        snprintf(dotp, sizeof(mp4path) - (dotp - mp4path), ".mp4");
+    else
+        strncat(mp4path, ".mp4", sizeof(mp4path) - strlen(mp4path) - 1);
+    if (!is_newer(full, mp4path)) return;
+    int threads = governor_job_threads();
+    thumb_cmd_t cmd;
+    cmd_init(&cmd, "ffmpeg");
+    cmd_arg(&cmd, "-y"); cmd_arg(&cmd, "-threads"); cmd_argf(&cmd, "%d", threads);
+    cmd_arg(&cmd, "-i"); cmd_arg(&cmd, full);
+    cmd_arg(&cmd, "-c"); cmd_arg(&cmd, "copy");
+    cmd_arg(&cmd, mp4path);
+    LOG_INFO("Converting .m4s -> .mp4: %s -> %s", full, mp4path);
+    int rc = execute_command_with_limits(cmd.argv, NULL, 120, NULL);
+    if (rc != 0) {
+        LOG_WARN("Failed to convert %s -> %s (rc=%d)", full, mp4path, rc);
     }
+    else {
+        LOG_INFO("Conversion succeeded: %s -> %s", full, mp4path);
+        if (platform_file_delete(full) == 0)
+            LOG_INFO("Deleted original segment file: %s", full);
+        else
+            LOG_WARN("Failed to delete original segment file: %s", full);
+    }
+}
 
-    LOG_DEBUG("ensure_thumbs_in_dir: enter for %s", dir);
+static int cmp_name_ci(const void* a, const void* b) {
+    return ascii_stricmp(*(const char* const*)a, *(const char* const*)b);
+}
 
-    if (!prog) {
-        int quick = dir_has_missing_thumbs_shallow(dir, 0);
-        if (quick)
-            start_background_thumb_generation(dir);
-        else
-            start_auto_thumb_watcher(dir);
-        return;
+static int expects_contain(char** expects, size_t expect_count, const char* name) {
+    return expect_count && bsearch(&name, expects, expect_count, sizeof(char*), cmp_name_ci) != NULL;
+}
+
+static int expects_add(char*** expects, size_t* count, size_t* cap, const char* name) {
+    if (*count == *cap) {
+        size_t nc = *cap ? *cap * 2 : 256;
+        char** tmp = realloc(*expects, nc * sizeof(char*));
+        if (!tmp) return -1;
+        *expects = tmp;
+        *cap = nc;
+    }
+    char* copy = strdup(name);
+    if (!copy) return -1;
+    (*expects)[(*count)++] = copy;
+    return 0;
+}
+
+static int orphan_candidate(const char* tname, char** expects, size_t expect_count) {
+    if (is_media_sidecar_name(tname)) return 0;
+    if (strstr(tname, "-small-") || strstr(tname, "-large-")) return 1;
+    if (!strstr(tname, "-small.") && !strstr(tname, "-large.")) return 0;
+    return !expects_contain(expects, expect_count, tname);
+}
+
+static thread_mutex_t orphan_db_mutex;
+static atomic_int orphan_db_mutex_state = ATOMIC_VAR_INIT(0);
+
+static void orphan_db_lock(void) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&orphan_db_mutex_state, &expected, 1)) {
+        thread_mutex_init(&orphan_db_mutex);
+        atomic_store(&orphan_db_mutex_state, 2);
     }
+    while (atomic_load(&orphan_db_mutex_state) != 2) platform_sleep_ms(1);
+    thread_mutex_lock(&orphan_db_mutex);
+}
 
-    LOG_DEBUG("ensure_thumbs_in_dir: prog total_files=%zu processed=%zu", prog->total_files, prog->processed_files);
+typedef struct thumb_need {
+    char* input;
+    char* output;
+    int scale;
+    int q;
+} thumb_need_t;
+
+static int needs_add(thumb_need_t** needs, size_t* count, size_t* cap, const char* input, const char* output, int scale, int q) {
+    if (*count == *cap) {
+        size_t nc = *cap ? *cap * 2 : 32;
+        thumb_need_t* tmp = realloc(*needs, nc * sizeof(thumb_need_t));
+        if (!tmp) return -1;
+        *needs = tmp;
+        *cap = nc;
+    }
+    thumb_need_t* n = &(*needs)[*count];
+    n->input = strdup(input);
+    n->output = strdup(output);
+    if (!n->input || !n->output) {
+        free(n->input);
+        free(n->output);
+        return -1;
+    }
+    n->scale = scale;
+    n->q = q;
+    (*count)++;
+    return 0;
+}
+
+static void thumbs_dir_pass(const char* dir, int flags, progress_t* prog, crawler_worker_t* w, thumb_pass_result_t* out) {
+    thumb_pass_result_t res;
+    memset(&res, 0, sizeof(res));
+    if (out) *out = res;
+
+    char thumbs_root[PATH_MAX];
+    get_thumbs_root(thumbs_root, sizeof(thumbs_root));
+    char safe_dir_name[PATH_MAX];
+    make_safe_dir_name_from(dir, safe_dir_name, sizeof(safe_dir_name));
+    char per_thumbs_root[PATH_MAX];
+    snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir_name);
+    int have_thumbs_dir = is_dir(per_thumbs_root);
+    if (flags == THUMB_PASS_CLEAN && !have_thumbs_dir) return;
 
     diriter it;
     if (!dir_open(&it, dir)) {
-        LOG_WARN("ensure_thumbs_in_dir: failed to open dir %s", dir);
+        LOG_WARN("thumbs_dir_pass: failed to open dir %s", dir);
         return;
     }
-    LOG_DEBUG("ensure_thumbs_in_dir: scanning directory %s", dir);
+    LOG_DEBUG("thumbs_dir_pass: scanning %s (flags=%d)", dir, flags);
+
+    char** expects = NULL;
+    size_t expect_count = 0, expect_cap = 0;
+    int expects_complete = 1;
+    thumb_need_t* needs = NULL;
+    size_t need_count = 0, need_cap = 0;
+
     const char* name;
     while ((name = dir_next(&it))) {
-        if (!name || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (!strcmp(name, ".") || !strcmp(name, "..") || !strcmp(name, "thumbs")) continue;
         char full[PATH_MAX];
         path_join(full, dir, name);
-        if (is_dir(full)) continue;
-        const char* ext_check = strrchr(name, '.');
-        if (ext_check && ascii_stricmp(ext_check, ".m4s") == 0) {
-            char mp4path[PATH_MAX];
-            strncpy(mp4path, full, sizeof(mp4path) - 1);
-            mp4path[sizeof(mp4path) - 1] = '\0';
-            char* dotp = strrchr(mp4path, '.');
-            if (dotp)
-                snprintf(dotp, sizeof(mp4path) - (dotp - mp4path), ".mp4");
-            else
-                strncat(mp4path, ".mp4", sizeof(mp4path) - strlen(mp4path) - 1);
-            if (is_newer(full, mp4path)) {
-                char esc_in[PATH_MAX * 2] = { 0 };
-                char esc_out[PATH_MAX * 2] = { 0 };
-                platform_escape_path_for_cmd(full, esc_in, sizeof(esc_in));
-                platform_escape_path_for_cmd(mp4path, esc_out, sizeof(esc_out));
-                int threads = platform_get_cpu_count();
-                if (threads < 1) threads = 1;
-                char cmd[PATH_MAX * 3];
-                snprintf(cmd, sizeof(cmd), "ffmpeg -y -threads %d -i %s -c copy %s", threads, esc_in, esc_out);
-                LOG_INFO("Converting .m4s -> .mp4: %s -> %s", full, mp4path);
-                int rc = execute_command_with_limits(cmd, NULL, 120, 1);
-                if (rc != 0) {
-                    LOG_WARN("Failed to convert %s -> %s (rc=%d)", full, mp4path, rc);
-                }
-                else {
-                    LOG_INFO("Conversion succeeded: %s -> %s", full, mp4path);
-                    if (platform_file_delete(full) == 0)
-                        LOG_INFO("Deleted original segment file: %s", full);
-                    else
-                        LOG_WARN("Failed to delete original segment file: %s", full);
-                }
-            }
+        if (is_dir(full)) {
+            /* Linked directories are left out so a link back up the tree
+             * cannot send the crawl round in a loop. */
+            if (w && (flags & THUMB_PASS_RECURSE) && !platform_is_symlink(full)) crawler_push(w, full);
             continue;
         }
         const char* ext = strrchr(name, '.');
         if (!ext) continue;
-        bool is_media = has_ext(name, IMAGE_EXTS) || has_ext(name, VIDEO_EXTS);
-        if (!is_media) continue;
-        struct stat st;
-        if (platform_stat(full, &st) != 0) {
-            add_skip(prog, "STAT_FAIL", full);
+        if (ascii_stricmp(ext, ".m4s") == 0) {
+            if (flags & THUMB_PASS_GENERATE) convert_m4s_segment(full);
             continue;
         }
-        char thumb_small_rel[PATH_MAX];
-        char thumb_large_rel[PATH_MAX];
-        get_thumb_rel_names(full, name, thumb_small_rel, sizeof(thumb_small_rel), thumb_large_rel, sizeof(thumb_large_rel));
-        char thumbs_root[PATH_MAX];
-        get_thumbs_root(thumbs_root, sizeof(thumbs_root));
-        char safe_dir_name[PATH_MAX];
-        make_safe_dir_name_from(dir, safe_dir_name, sizeof(safe_dir_name));
-        char per_thumbs_root[PATH_MAX];
-        snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir_name);
-        if (!is_dir(per_thumbs_root)) platform_make_dir(per_thumbs_root);
+        if (!(has_ext(name, IMAGE_EXTS) || has_ext(name, VIDEO_EXTS))) continue;
+        struct stat st_media;
+        if (platform_stat(full, &st_media) != 0) {
+            if (flags & THUMB_PASS_GENERATE) add_skip(prog, "STAT_FAIL", full);
+            continue;
+        }
+        res.media++;
+        if (faststart_is_candidate(name)) {
+            if (flags & THUMB_PASS_GENERATE) faststart_ensure(full);
+            else res.sidecars += (size_t)faststart_due(full);
+        }
+
+        char small_rel[PATH_MAX];
+        char large_rel[PATH_MAX];
+        get_thumb_rel_names(full, name, small_rel, sizeof(small_rel), large_rel, sizeof(large_rel));
+        if (expects_add(&expects, &expect_count, &expect_cap, small_rel) != 0 ||
+            expects_add(&expects, &expect_count, &expect_cap, large_rel) != 0) {
+            LOG_ERROR("Failed to grow expected thumb list for %s, skipping orphan check", dir);
+            expects_complete = 0;
+        }
+
         char thumb_small[PATH_MAX];
         char thumb_large[PATH_MAX];
-        snprintf(thumb_small, sizeof(thumb_small), "%s" DIR_SEP_STR "%s", per_thumbs_root, thumb_small_rel);
-        snprintf(thumb_large, sizeof(thumb_large), "%s" DIR_SEP_STR "%s", per_thumbs_root, thumb_large_rel);
-        struct stat st_media, st_small, st_large;
-        int need_small = 0, need_large = 0;
-        if (platform_stat(full, &st_media) == 0) {
-            if (!is_file(thumb_small) || platform_stat(thumb_small, &st_small) != 0 || st_small.st_mtime < st_media.st_mtime)
-                need_small = 1;
-            if (!is_file(thumb_large) || platform_stat(thumb_large, &st_large) != 0 || st_large.st_mtime < st_media.st_mtime)
-                need_large = 1;
+        snprintf(thumb_small, sizeof(thumb_small), "%s" DIR_SEP_STR "%s", per_thumbs_root, small_rel);
+        snprintf(thumb_large, sizeof(thumb_large), "%s" DIR_SEP_STR "%s", per_thumbs_root, large_rel);
+        struct stat st_small, st_large;
+        int need_small = thumb_stat(thumb_small, &st_small) != 0 || st_small.st_mtime < st_media.st_mtime;
+        int need_large = thumb_stat(thumb_large, &st_large) != 0 || st_large.st_mtime < st_media.st_mtime;
+        LOG_DEBUG("thumbs_dir_pass: media=%s need_small=%d need_large=%d", full, need_small, need_large);
+        res.missing += (size_t)need_small + (size_t)need_large;
+        char preview[PATH_MAX];
+        snprintf(preview, sizeof(preview), "%s" DIR_SEP_STR "%s" ANIM_PREVIEW_SUFFIX, per_thumbs_root, name);
+        int need_preview = anim_preview_due(full, name, &st_media, preview);
+        res.previews += (size_t)need_preview;
+        if (!(flags & THUMB_PASS_GENERATE)) continue;
+        if ((need_small && needs_add(&needs, &need_count, &need_cap, full, thumb_small, THUMB_SMALL_SCALE, THUMB_SMALL_QUALITY) != 0) ||
+            (need_large && needs_add(&needs, &need_count, &need_cap, full, thumb_large, THUMB_LARGE_SCALE, THUMB_LARGE_QUALITY) != 0))
+            LOG_ERROR("Failed to queue thumbnail work for %s", full);
+        if (need_preview && needs_add(&needs, &need_count, &need_cap, full, preview, ANIM_PREVIEW_SCALE, 0) != 0)
+            LOG_ERROR("Failed to queue animated preview for %s", full);
+    }
+    dir_close(&it);
+
+    if (expect_count) qsort(expects, expect_count, sizeof(char*), cmp_name_ci);
+    if (have_thumbs_dir && expects_complete) {
+        if (flags & THUMB_PASS_CLEAN) {
+            orphan_db_lock();
+            char per_db[PATH_MAX];
+            snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", per_thumbs_root);
+            thumbdb_open_for_dir(per_db);
+            diriter tit;
+            if (dir_open(&tit, per_thumbs_root)) {
+                const char* tname;
+                while ((tname = dir_next(&tit)))
+                    res.orphans += (size_t)clean_orphan_thumb_name(dir, per_thumbs_root, tname, expects, expect_count, prog);
+                dir_close(&tit);
+            }
+            size_t packed_count = 0;
+            char** packed = thumb_pack_list(per_thumbs_root, &packed_count);
+            for (size_t i = 0; i < packed_count; ++i) {
+                res.orphans += (size_t)clean_orphan_thumb_name(dir, per_thumbs_root, packed[i], expects, expect_count, prog);
+                free(packed[i]);
+            }
+            free(packed);
+            if (thumb_pack_enabled) thumb_pack_migrate_dir(per_thumbs_root);
+            thumb_pack_compact(per_thumbs_root, 0);
+            thread_mutex_unlock(&orphan_db_mutex);
         }
         else {
-            need_small = !is_file(thumb_small);
-            need_large = !is_file(thumb_large);
+            diriter tit;
+            if (dir_open(&tit, per_thumbs_root)) {
+                const char* tname;
+                while ((tname = dir_next(&tit)))
+                    res.orphans += (size_t)orphan_candidate(tname, expects, expect_count);
+                dir_close(&tit);
+            }
+            size_t packed_count = 0;
+            char** packed = thumb_pack_list(per_thumbs_root, &packed_count);
+            for (size_t i = 0; i < packed_count; ++i) {
+                res.orphans += (size_t)orphan_candidate(packed[i], expects, expect_count);
+                free(packed[i]);
+            }
+            free(packed);
         }
-        LOG_DEBUG("ensure_thumbs_in_dir: media=%s need_small=%d need_large=%d", full, need_small, need_large);
-        if (need_small)
-            schedule_or_generate_thumb(full, thumb_small, prog, THUMB_SMALL_SCALE, THUMB_SMALL_QUALITY);
-        if (need_large)
-            schedule_or_generate_thumb(full, thumb_large, prog, THUMB_LARGE_SCALE, THUMB_LARGE_QUALITY);
     }
-    dir_close(&it);
-    LOG_DEBUG("ensure_thumbs_in_dir: completed scanning %s", dir);
+    for (size_t i = 0; i < expect_count; ++i) free(expects[i]);
+    free(expects);
+
+    if (need_count) {
+        if (!have_thumbs_dir) platform_make_dir(per_thumbs_root);
+        if (prog && prog->total_files < res.media) prog->total_files = res.media;
+        for (size_t i = 0; i < need_count; ++i) {
+            schedule_or_generate_thumb(needs[i].input, needs[i].output, prog, needs[i].scale, needs[i].q);
+            free(needs[i].input);
+            free(needs[i].output);
+        }
+    }
+    free(needs);
+    LOG_DEBUG("thumbs_dir_pass: %s media=%zu missing=%zu orphans=%zu", dir, res.media, res.missing, res.orphans);
+    if (out) *out = res;
+}
+
+void ensure_thumbs_in_dir(const char* dir, progress_t* prog) {
+    if (!dir || !*dir) {
+        LOG_ERROR("ensure_thumbs_in_dir: invalid dir");
+        return;
+    }
+
+    LOG_DEBUG("ensure_thumbs_in_dir: enter for %s", dir);
+
+    if (!prog) {
+        int quick = dir_has_missing_thumbs_shallow(dir, 0);
+        if (quick)
+            start_background_thumb_generation(dir);
+        else
+            start_auto_thumb_watcher(dir);
+        return;
+    }
+
+    thumbs_dir_pass(dir, THUMB_PASS_GENERATE, prog, NULL, NULL);
 }
 
 void schedule_or_generate_thumb(const char* input, const char* output, progress_t* prog, int scale, int q) {
@@ -1723,7 +2203,7 @@ void schedule_or_generate_thumb(const char* input, const char* output, progress_
     job->index = (int)prog->processed_files;
     job->total = (int)prog->total_files;
     
-    while (atomic_load(&thumb_workers_active) >= MAX_THUMB_WORKERS) sleep_ms(50);
+    while (atomic_load(&thumb_workers_active) >= governor_gen_slots()) sleep_ms(50);
     atomic_fetch_add(&thumb_workers_active, 1);
     
     if (thread_create_detached((void* (*)(void*))thumb_job_thread, job) != 0) {
@@ -1734,134 +2214,233 @@ void schedule_or_generate_thumb(const char* input, const char* output, progress_
     }
 }
 
+static int clean_orphan_thumb_name(const char* dir, const char* thumbs_path, const char* tname, char** expects, size_t expect_count, progress_t* prog) {
+    char tname_copy[PATH_MAX];
+    strncpy(tname_copy, tname, sizeof(tname_copy) - 1);
+    tname_copy[sizeof(tname_copy) - 1] = '\0';
+    if (ascii_stricmp(tname_copy, ".") == 0 || ascii_stricmp(tname_copy, "..") == 0 ||
+        ascii_stricmp(tname_copy, "skipped.log") == 0 || ascii_stricmp(tname_copy, ".nogallery") == 0 ||
+        ascii_stricmp(tname_copy, ".thumbs.lock") == 0) return 0;
+    size_t side_len = media_sidecar_suffix_len(tname_copy);
+    if (side_len) {
+        char media[PATH_MAX];
+        path_join(media, dir, tname_copy);
+        media[strlen(media) - side_len] = '\0';
+        if (is_file(media)) return 0;
+        char side_full[PATH_MAX];
+        path_join(side_full, thumbs_path, tname_copy);
+        if (platform_file_delete(side_full) != 0) { LOG_WARN("Failed to delete orphan sidecar: %s", side_full); return 0; }
+        LOG_INFO("Removed orphan sidecar (media missing): %s", side_full);
+        add_skip(prog, "ORPHAN_REMOVED", side_full);
+        return 1;
+    }
+    if (strstr(tname_copy, "-small-") || strstr(tname_copy, "-large-")) {
+        char thumb_full_m[PATH_MAX];
+        path_join(thumb_full_m, thumbs_path, tname_copy);
+        if (thumb_delete(thumb_full_m) != 0) LOG_WARN("Failed to delete malformed thumb: %s", thumb_full_m);
+        else {
+            LOG_DEBUG("Removed malformed thumb: %s", thumb_full_m);
+            add_skip(prog, "MALFORMED_REMOVED", thumb_full_m);
+            return 1;
+        }
+        return 0;
+    }
+    if (!strstr(tname_copy, "-small.") && !strstr(tname_copy, "-large.")) return 0;
+    int removed = 0;
+    if (!expects_contain(expects, expect_count, tname_copy)) {
+        char thumb_full[PATH_MAX];
+        path_join(thumb_full, thumbs_path, tname_copy);
+        char* bn_del = tname_copy;
+        char mapped_media[PATH_MAX];
+        int r = thumbdb_get(bn_del, mapped_media, sizeof(mapped_media));
+        if (r != 0) {
+            if (thumb_delete(thumb_full) != 0) LOG_WARN("Failed to delete orphan thumb: %s", thumb_full);
+            else { LOG_INFO("Removed orphan thumb (no DB entry): %s", thumb_full); removed = 1; }
+            add_skip(prog, "ORPHAN_REMOVED", thumb_full);
+        }
+        else {
+            size_t dlen = strlen(dir);
+            if (strncmp(mapped_media, dir, dlen) == 0 &&
+                (mapped_media[dlen] == '\0' || mapped_media[dlen] == '/' || mapped_media[dlen] == '\\')) {
+                if (!is_file(mapped_media)) {
+                    thumbdb_delete(bn_del);
+                    if (thumb_delete(thumb_full) != 0) LOG_WARN("Failed to delete orphan thumb: %s", thumb_full);
+                    else { LOG_INFO("Removed orphan thumb (media missing): %s", thumb_full); removed = 1; }
+                    add_skip(prog, "ORPHAN_REMOVED", thumb_full);
+                }
+                else {
+                    LOG_DEBUG("Thumb %s maps to existing media in this gallery, keeping: %s", thumb_full, mapped_media);
+                }
+            }
+            else {
+                LOG_DEBUG("Skipping thumb %s mapped to other gallery media: %s", thumb_full, mapped_media);
+            }
+        }
+    }
+    size_t len = strlen(tname_copy);
+    if (len > 10 && strcmp(tname_copy + len - 10, "-small.jpg") != 0 && strcmp(tname_copy + len - 10, "-large.jpg") != 0) {
+        char thumb_full[PATH_MAX];
+        path_join(thumb_full, thumbs_path, tname_copy);
+        if (thumb_delete(thumb_full) != 0) LOG_WARN("Failed to delete invalid thumb: %s", thumb_full);
+        else { LOG_INFO("Removed invalid thumb: %s", thumb_full); removed = 1; }
+        add_skip(prog, "INVALID_REMOVED", thumb_full);
+    }
+    return removed;
+}
 void clean_orphan_thumbs(const char* dir, progress_t * prog) {
     if (!dir) return;
+    thumbs_dir_pass(dir, THUMB_PASS_CLEAN, prog, NULL, NULL);
+}
+int load_thumbdb_for_folder(const char* dir) {
+    if (!dir || !*dir) return -1;
+    char dir_real[PATH_MAX];
+    const char* dir_used = real_path(dir, dir_real) ? dir_real : dir;
     char thumbs_root[PATH_MAX];
     get_thumbs_root(thumbs_root, sizeof(thumbs_root));
+    if (!is_dir(thumbs_root)) platform_make_dir(thumbs_root);
     char safe_dir_name[PATH_MAX];
-    make_safe_dir_name_from(dir, safe_dir_name, sizeof(safe_dir_name));
-    char thumbs_path[PATH_MAX];
-    snprintf(thumbs_path, sizeof(thumbs_path), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir_name);
-    if (!is_dir(thumbs_path)) return;
-    diriter mit;
-    if (!dir_open(&mit, dir)) return;
-    size_t expect_cap = 256;
-    size_t expect_count = 0;
-    char** expects = malloc(expect_cap * sizeof(char*));
-    if (!expects) {
-        LOG_ERROR("Failed to allocate expects array for orphan cleanup");
-        dir_close(&mit);
+    make_safe_dir_name_from(dir_used, safe_dir_name, sizeof(safe_dir_name));
+    char per_thumbs_root[PATH_MAX];
+    snprintf(per_thumbs_root, sizeof(per_thumbs_root), "%s" DIR_SEP_STR "%s", thumbs_root, safe_dir_name);
+    if (!is_dir(per_thumbs_root)) platform_make_dir(per_thumbs_root);
+    char per_db[PATH_MAX];
+    snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", per_thumbs_root);
+    int rc = thumbdb_open_for_dir(per_db);
+    if (rc != 0) LOG_WARN("load_thumbdb_for_folder: thumbdb_open_for_dir failed for %s (rc=%d)", per_db, rc);
+    return rc;
+}
+void scan_folder_for_missing_thumbs(const char* dir) {
+    if (!dir || !*dir) return;
+    char tmpf[PATH_MAX]; strncpy(tmpf, dir, sizeof(tmpf) - 1); tmpf[sizeof(tmpf) - 1] = '\0'; strip_trailing_sep(tmpf);
+    LOG_INFO("Scanning and generating missing thumbs for: %s", tmpf);
+    ensure_thumbs_in_dir(dir, NULL);
+}
+typedef struct thumb_crawl {
+    thread_mutex_t mutex;
+    char** dirs;
+    size_t count;
+    size_t cap;
+    atomic_size_t media;
+    atomic_size_t missing;
+    atomic_size_t orphans;
+    atomic_size_t sidecars;
+    atomic_size_t previews;
+} thumb_crawl_t;
+
+static void thumb_crawl_init(thumb_crawl_t* tc) {
+    memset(tc, 0, sizeof(*tc));
+    thread_mutex_init(&tc->mutex);
+    atomic_init(&tc->media, 0);
+    atomic_init(&tc->missing, 0);
+    atomic_init(&tc->orphans, 0);
+    atomic_init(&tc->sidecars, 0);
+    atomic_init(&tc->previews, 0);
+}
+
+static void thumb_crawl_free(thumb_crawl_t* tc) {
+    for (size_t i = 0; i < tc->count; ++i) free(tc->dirs[i]);
+    free(tc->dirs);
+    thread_mutex_destroy(&tc->mutex);
+}
+
+static void thumb_crawl_collect(thumb_crawl_t* tc, const char* dir) {
+    char* copy = strdup(dir);
+    if (!copy) return;
+    thread_mutex_lock(&tc->mutex);
+    if (tc->count == tc->cap) {
+        size_t nc = tc->cap ? tc->cap * 2 : 64;
+        char** tmp = realloc(tc->dirs, nc * sizeof(char*));
+        if (!tmp) {
+            thread_mutex_unlock(&tc->mutex);
+            LOG_ERROR("Failed to grow crawl result list, dropping %s", dir);
+            free(copy);
+            return;
+        }
+        tc->dirs = tmp;
+        tc->cap = nc;
+    }
+    tc->dirs[tc->count++] = copy;
+    thread_mutex_unlock(&tc->mutex);
+}
+
+static void thumb_detect_visit(crawler_worker_t* w, const char* dir, void* ctx) {
+    thumb_crawl_t* tc = (thumb_crawl_t*)ctx;
+    thumb_pass_result_t res;
+    thumbs_dir_pass(dir, THUMB_PASS_RECURSE, NULL, w, &res);
+    atomic_fetch_add(&tc->media, res.media);
+    atomic_fetch_add(&tc->missing, res.missing);
+    atomic_fetch_add(&tc->orphans, res.orphans);
+    atomic_fetch_add(&tc->sidecars, res.sidecars);
+    atomic_fetch_add(&tc->previews, res.previews);
+    if (res.missing || res.orphans || res.sidecars || res.previews) thumb_crawl_collect(tc, dir);
+}
+
+static void thumb_generate_visit(crawler_worker_t* w, const char* dir, void* ctx) {
+    (void)w;
+    thumb_crawl_t* tc = (thumb_crawl_t*)ctx;
+    if (!gen_flight_begin(dir, 1)) {
+        LOG_DEBUG("thumb crawl: %s already in flight, leaving it to that run", dir);
         return;
     }
-    const char* mname;
-    while ((mname = dir_next(&mit))) {
-        if (!strcmp(mname, ".") || !strcmp(mname, "..") || !strcmp(mname, "thumbs")) continue;
-        char media_full[PATH_MAX];
-        path_join(media_full, dir, mname);
-        if (!is_file(media_full)) continue;
-        if (!(has_ext(mname, IMAGE_EXTS) || has_ext(mname, VIDEO_EXTS))) continue;
-        char small_rel[PATH_MAX];
-        char large_rel[PATH_MAX];
-        get_thumb_rel_names(media_full, mname, small_rel, sizeof(small_rel), large_rel, sizeof(large_rel));
-        if (expect_count + 2 > expect_cap) {
-            size_t nc = expect_cap * 2;
-            char** tmp = realloc(expects, nc * sizeof(char*));
-            if (!tmp) {
-                LOG_ERROR("Failed to realloc expects array, breaking early");
-                break;
-            }
-            expects = tmp;
-            expect_cap = nc;
-        }
-        expects[expect_count++] = strdup(small_rel);
-        expects[expect_count++] = strdup(large_rel);
-    }
-    dir_close(&mit);
-    diriter tit;
-    if (!dir_open(&tit, thumbs_path)) {
-        for (size_t i = 0; i < expect_count; ++i) free(expects[i]);
-        free(expects);
+    char per_thumbs_root[PATH_MAX];
+    get_per_thumbs_root(dir, per_thumbs_root, sizeof(per_thumbs_root));
+    if (!is_dir(per_thumbs_root)) platform_make_dir(per_thumbs_root);
+    char lock_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s" DIR_SEP_STR ".thumbs.lock", per_thumbs_root);
+    if (acquire_dir_lock(dir, lock_path) != 0) {
+        while (gen_flight_end(dir, 0)) {}
         return;
     }
-    char per_db[PATH_MAX];
-    snprintf(per_db, sizeof(per_db), "%s" DIR_SEP_STR "thumbs.db", thumbs_path);
-    thumbdb_open_for_dir(per_db);
-    const char* tname;
-    char tname_copy[PATH_MAX];
-    while ((tname = dir_next(&tit))) {
-        if (!tname) continue;
-        strncpy(tname_copy, tname, sizeof(tname_copy) - 1);
-        tname_copy[sizeof(tname_copy) - 1] = '\0';
-        if (ascii_stricmp(tname_copy, ".") == 0 || ascii_stricmp(tname_copy, "..") == 0 ||
-            ascii_stricmp(tname_copy, "skipped.log") == 0 || ascii_stricmp(tname_copy, ".nogallery") == 0 ||
-            ascii_stricmp(tname_copy, ".thumbs.lock") == 0) continue;
-        if (strstr(tname_copy, "-small-") || strstr(tname_copy, "-large-")) {
-            char thumb_full_m[PATH_MAX];
-            path_join(thumb_full_m, thumbs_path, tname_copy);
-            if (platform_file_delete(thumb_full_m) != 0) LOG_WARN("Failed to delete malformed thumb: %s", thumb_full_m);
-            else {
-                LOG_DEBUG("Removed malformed thumb: %s", thumb_full_m);
-                add_skip(prog, "MALFORMED_REMOVED", thumb_full_m);
-            }
-            continue;
-        }
-        if (!strstr(tname_copy, "-small.") && !strstr(tname_copy, "-large.")) continue;
-        bool found = false;
-        for (size_t ei = 0; ei < expect_count; ++ei) if (ascii_stricmp(tname, expects[ei]) == 0) { found = true; break; }
-        if (!found) {
-            char thumb_full[PATH_MAX];
-            path_join(thumb_full, thumbs_path, tname_copy);
-            char* bn_del = tname_copy;
-            char mapped_media[PATH_MAX];
-            int r = thumbdb_get(bn_del, mapped_media, sizeof(mapped_media));
-            if (r != 0) {
-                if (platform_file_delete(thumb_full) != 0) LOG_WARN("Failed to delete orphan thumb: %s", thumb_full);
-                else LOG_INFO("Removed orphan thumb (no DB entry): %s", thumb_full);
-                add_skip(prog, "ORPHAN_REMOVED", thumb_full);
-            }
-            else {
-                size_t dlen = strlen(dir);
-                if (strncmp(mapped_media, dir, dlen) == 0 &&
-                    (mapped_media[dlen] == '\0' || mapped_media[dlen] == '/' || mapped_media[dlen] == '\\')) {
-                    if (!is_file(mapped_media)) {
-                        thumbdb_delete(bn_del);
-                        if (platform_file_delete(thumb_full) != 0) LOG_WARN("Failed to delete orphan thumb: %s", thumb_full);
-                        else LOG_INFO("Removed orphan thumb (media missing): %s", thumb_full);
-                        add_skip(prog, "ORPHAN_REMOVED", thumb_full);
-                    }
-                    else {
-                        LOG_DEBUG("Thumb %s maps to existing media in this gallery, keeping: %s", thumb_full, mapped_media);
-                    }
-                }
-                else {
-                    LOG_DEBUG("Skipping thumb %s mapped to other gallery media: %s", thumb_full, mapped_media);
-                }
-            }
-        }
-        size_t len = strlen(tname_copy);
-        if (len > 10 && strcmp(tname_copy + len - 10, "-small.jpg") != 0 && strcmp(tname_copy + len - 10, "-large.jpg") != 0) {
-            char thumb_full[PATH_MAX];
-            path_join(thumb_full, thumbs_path, tname_copy);
-            if (platform_file_delete(thumb_full) != 0) LOG_WARN("Failed to delete invalid thumb: %s", thumb_full);
-            else LOG_INFO("Removed invalid thumb: %s", thumb_full);
-            add_skip(prog, "INVALID_REMOVED", thumb_full);
+    progress_t prog;
+    memset(&prog, 0, sizeof(prog));
+    strncpy(prog.thumbs_dir, per_thumbs_root, PATH_MAX - 1);
+    prog.thumbs_dir[PATH_MAX - 1] = '\0';
+    thumb_pass_result_t res;
+    thumbs_dir_pass(dir, THUMB_PASS_GENERATE | THUMB_PASS_CLEAN, &prog, NULL, &res);
+    print_skips(&prog);
+    atomic_fetch_add(&tc->missing, res.missing);
+    atomic_fetch_add(&tc->orphans, res.orphans);
+    thumb_crawl_collect(tc, dir);
+}
+
+static void thumbs_crawl_full(const char* const* roots, size_t nroots) {
+    thumb_crawl_t detect;
+    thumb_crawl_init(&detect);
+    crawler_stats_t st;
+    memset(&st, 0, sizeof(st));
+    crawler_run(roots, nroots, 0, thumb_detect_visit, &detect, &st);
+    LOG_INFO("Thumb scan: %zu director%s, %zu media, %zu missing, %zu orphan(s), %zu sidecar(s) and %zu preview(s) due in %llu ms with %d worker(s)",
+        st.visited, st.visited == 1 ? "y" : "ies", atomic_load(&detect.media), atomic_load(&detect.missing),
+        atomic_load(&detect.orphans), atomic_load(&detect.sidecars), atomic_load(&detect.previews), (unsigned long long)st.elapsed_ms, st.workers);
+
+    if (detect.count) {
+        thumb_crawl_t gen;
+        thumb_crawl_init(&gen);
+        crawler_run((const char* const*)detect.dirs, detect.count, 0, thumb_generate_visit, &gen, &st);
+        wait_for_thumb_workers();
+        for (size_t i = 0; i < gen.count; ++i) {
+            char per_thumbs_root[PATH_MAX];
+            get_per_thumbs_root(gen.dirs[i], per_thumbs_root, sizeof(per_thumbs_root));
+            process_wal_chunks(per_thumbs_root);
+            char lock_path[PATH_MAX];
+            snprintf(lock_path, sizeof(lock_path), "%s" DIR_SEP_STR ".thumbs.lock", per_thumbs_root);
+            platform_file_delete(lock_path);
+            if (gen_flight_end(gen.dirs[i], 1)) spawn_generation_flight(gen.dirs[i]);
         }
+        LOG_INFO("Thumb scan: regenerated %zu missing and removed %zu orphan(s) across %zu director%s",
+            atomic_load(&gen.missing), atomic_load(&gen.orphans), gen.count, gen.count == 1 ? "y" : "ies");
+        thumb_crawl_free(&gen);
+        thumbdb_sweep_orphans();
+        if (!thumbdb_perform_requested_compaction())
+            thumbdb_compact();
     }
-    dir_close(&tit);
-    for (size_t i = 0; i < expect_count; ++i) free(expects[i]);
-    free(expects);
+    thumb_crawl_free(&detect);
 }
 void scan_and_generate_missing_thumbs(void) {
     size_t count = 0;
     char** folders = get_gallery_folders(&count);
     if (!folders || count == 0) return;
-    for (size_t i = 0; i < count; ++i) {
-        {
-            char tmpf[PATH_MAX]; strncpy(tmpf, folders[i], sizeof(tmpf) - 1); tmpf[sizeof(tmpf) - 1] = '\0'; strip_trailing_sep(tmpf);
-            LOG_INFO("Scanning and generating missing thumbs for: %s", tmpf);
-        }
-        ensure_thumbs_in_dir(folders[i], NULL);
-    }
+    thumbs_crawl_full((const char* const*)folders, count);
 }
 static void save_wal_chunk(int chunk_id, const char* data) {
     char chunk_path[PATH_MAX];
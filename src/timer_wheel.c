@@ -0,0 +1,294 @@
+#include "timer_wheel.h"
+#include "common.h"
+#include "logging.h"
+#include "platform.h"
+#include "thread_pool.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_SPAN_TICKS ((uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+
+enum { TIMER_PENDING, TIMER_FIRING, TIMER_CANCELLED };
+
+typedef struct wheel_timer {
+    timer_id_t id;
+    uint64_t expires;
+    uint64_t period_ticks;
+    timer_cb_t cb;
+    void* arg;
+    int state;
+    struct wheel_timer** head;
+    struct wheel_timer* prev;
+    struct wheel_timer* next;
+    struct wheel_timer* hnext;
+} wheel_timer_t;
+
+/* Level n holds timers due within 64^(n+1) ticks, bucketed by the level's
+ * digit of the expiry tick. A level-0 slot fires; a higher slot is
+ * re-inserted one level down whenever the digit below it wraps. */
+static wheel_timer_t* wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static wheel_timer_t* by_id[TIMER_WHEEL_ID_BUCKETS];
+static thread_mutex_t wheel_mutex;
+static uint64_t base_ms;
+static uint64_t cur_tick;
+static timer_id_t next_id = 1;
+static size_t timer_count;
+static atomic_int wheel_state = ATOMIC_VAR_INIT(0);
+#ifdef _WIN32
+static HANDLE wheel_wake;
+#else
+static pthread_cond_t wheel_cond;
+#endif
+
+static uint64_t now_tick(void) {
+    return (platform_monotonic_ms() - base_ms) / TIMER_WHEEL_TICK_MS;
+}
+
+static void slot_insert_locked(wheel_timer_t* t) {
+    uint64_t delta = t->expires > cur_tick ? t->expires - cur_tick : 0;
+    uint64_t when = delta >= MAX_SPAN_TICKS ? cur_tick + MAX_SPAN_TICKS - 1 : t->expires;
+    if (when < cur_tick) when = cur_tick;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) level++;
+    wheel_timer_t** head = &wheel[level][(when >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK];
+    t->head = head;
+    t->prev = NULL;
+    t->next = *head;
+    if (*head) (*head)->prev = t;
+    *head = t;
+}
+
+static void slot_unlink_locked(wheel_timer_t* t) {
+    if (!t->head) return;
+    if (t->prev) t->prev->next = t->next;
+    else *t->head = t->next;
+    if (t->next) t->next->prev = t->prev;
+    t->head = NULL;
+    t->prev = t->next = NULL;
+}
+
+static wheel_timer_t* find_locked(timer_id_t id) {
+    for (wheel_timer_t* t = by_id[id % TIMER_WHEEL_ID_BUCKETS]; t; t = t->hnext)
+        if (t->id == id) return t;
+    return NULL;
+}
+
+static void forget_locked(wheel_timer_t* t) {
+    wheel_timer_t** pp = &by_id[t->id % TIMER_WHEEL_ID_BUCKETS];
+    while (*pp && *pp != t) pp = &(*pp)->hnext;
+    if (*pp) *pp = t->hnext;
+    timer_count--;
+}
+
+static void cascade_locked(int level) {
+    wheel_timer_t** head = &wheel[level][(cur_tick >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK];
+    wheel_timer_t* t = *head;
+    *head = NULL;
+    while (t) {
+        wheel_timer_t* n = t->next;
+        t->head = NULL;
+        slot_insert_locked(t);
+        t = n;
+    }
+}
+
+/* Advances cur_tick up to target and moves every expired timer onto the
+ * returned list, marked as firing. */
+static wheel_timer_t* collect_expired_locked(uint64_t target) {
+    wheel_timer_t* fired = NULL;
+    while (cur_tick < target) {
+        cur_tick++;
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (cur_tick & ((((uint64_t)1) << (TIMER_WHEEL_SLOT_BITS * level)) - 1)) break;
+            cascade_locked(level);
+        }
+        wheel_timer_t** head = &wheel[0][cur_tick & SLOT_MASK];
+        wheel_timer_t* t = *head;
+        *head = NULL;
+        while (t) {
+            wheel_timer_t* n = t->next;
+            t->head = NULL;
+            if (t->expires > cur_tick) {
+                slot_insert_locked(t);
+            } else {
+                t->state = TIMER_FIRING;
+                t->prev = NULL;
+                t->next = fired;
+                fired = t;
+            }
+            t = n;
+        }
+    }
+    return fired;
+}
+
+/* Milliseconds until the next level-0 slot with timers, or until the next
+ * cascade when only higher levels are populated; -1 when idle. */
+static long next_wait_ms_locked(void) {
+    if (timer_count == 0) return -1;
+    uint64_t ticks = 0;
+    for (uint64_t i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+        if (((cur_tick + i) & SLOT_MASK) == 0 || wheel[0][(cur_tick + i) & SLOT_MASK]) { ticks = i; break; }
+    }
+    if (!ticks) ticks = 1;
+    uint64_t due_ms = base_ms + (cur_tick + ticks) * TIMER_WHEEL_TICK_MS;
+    uint64_t now = platform_monotonic_ms();
+    return due_ms > now ? (long)(due_ms - now) : 0;
+}
+
+static void wake_locked(void) {
+#ifdef _WIN32
+    SetEvent(wheel_wake);
+#else
+    pthread_cond_signal(&wheel_cond);
+#endif
+}
+
+static void wait_locked(long ms) {
+#ifdef _WIN32
+    thread_mutex_unlock(&wheel_mutex);
+    WaitForSingleObject(wheel_wake, ms < 0 ? INFINITE : (DWORD)ms);
+    thread_mutex_lock(&wheel_mutex);
+#else
+    if (ms < 0) {
+        pthread_cond_wait(&wheel_cond, &wheel_mutex);
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+    pthread_cond_timedwait(&wheel_cond, &wheel_mutex, &ts);
+#endif
+}
+
+static void* timer_thread(void* arg) {
+    (void)arg;
+    thread_mutex_lock(&wheel_mutex);
+    for (;;) {
+        wheel_timer_t* fired = collect_expired_locked(now_tick());
+        if (fired) {
+            thread_mutex_unlock(&wheel_mutex);
+            for (wheel_timer_t* t = fired; t; t = t->next) t->cb(t->arg);
+            thread_mutex_lock(&wheel_mutex);
+            while (fired) {
+                wheel_timer_t* t = fired;
+                fired = t->next;
+                t->next = NULL;
+                if (t->period_ticks && t->state == TIMER_FIRING) {
+                    t->state = TIMER_PENDING;
+                    t->expires = cur_tick + t->period_ticks;
+                    slot_insert_locked(t);
+                } else {
+                    forget_locked(t);
+                    free(t);
+                }
+            }
+            continue;
+        }
+        wait_locked(next_wait_ms_locked());
+    }
+    return NULL;
+}
+
+void timer_wheel_init(void) {
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&wheel_state, &expected, 1)) {
+        while (atomic_load(&wheel_state) == 1) platform_sleep_ms(1);
+        return;
+    }
+    thread_mutex_init(&wheel_mutex);
+    base_ms = platform_monotonic_ms();
+#ifdef _WIN32
+    wheel_wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&wheel_cond, &ca);
+    pthread_condattr_destroy(&ca);
+#endif
+    if (thread_create_detached(timer_thread, NULL) != 0) {
+        LOG_ERROR("Failed to start timer wheel thread");
+        atomic_store(&wheel_state, -1);
+        return;
+    }
+    atomic_store(&wheel_state, 2);
+}
+
+static timer_id_t add_timer(uint64_t delay_ms, uint64_t period_ms, timer_cb_t cb, void* arg) {
+    if (!cb) return 0;
+    if (atomic_load(&wheel_state) != 2) timer_wheel_init();
+    if (atomic_load(&wheel_state) != 2) return 0;
+    wheel_timer_t* t = calloc(1, sizeof(wheel_timer_t));
+    if (!t) {
+        LOG_ERROR("Failed to allocate timer");
+        return 0;
+    }
+    t->cb = cb;
+    t->arg = arg;
+    t->period_ticks = period_ms ? (period_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS : 0;
+    uint64_t delay_ticks = (delay_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    thread_mutex_lock(&wheel_mutex);
+    uint64_t now = now_tick();
+    if (timer_count == 0 && now > cur_tick) cur_tick = now;
+    t->id = next_id++;
+    t->expires = now + (delay_ticks ? delay_ticks : 1);
+    t->hnext = by_id[t->id % TIMER_WHEEL_ID_BUCKETS];
+    by_id[t->id % TIMER_WHEEL_ID_BUCKETS] = t;
+    timer_count++;
+    slot_insert_locked(t);
+    wake_locked();
+    thread_mutex_unlock(&wheel_mutex);
+    return t->id;
+}
+
+timer_id_t timer_add(uint64_t delay_ms, timer_cb_t cb, void* arg) {
+    return add_timer(delay_ms, 0, cb, arg);
+}
+
+timer_id_t timer_add_periodic(uint64_t period_ms, timer_cb_t cb, void* arg) {
+    return add_timer(period_ms, period_ms ? period_ms : TIMER_WHEEL_TICK_MS, cb, arg);
+}
+
+int timer_rearm(timer_id_t id, uint64_t delay_ms) {
+    if (!id || atomic_load(&wheel_state) != 2) return -1;
+    uint64_t delay_ticks = (delay_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    int rc = -1;
+    thread_mutex_lock(&wheel_mutex);
+    wheel_timer_t* t = find_locked(id);
+    if (t && t->state == TIMER_PENDING) {
+        slot_unlink_locked(t);
+        t->expires = now_tick() + (delay_ticks ? delay_ticks : 1);
+        slot_insert_locked(t);
+        wake_locked();
+        rc = 0;
+    }
+    thread_mutex_unlock(&wheel_mutex);
+    return rc;
+}
+
+int timer_cancel(timer_id_t id) {
+    if (!id || atomic_load(&wheel_state) != 2) return -1;
+    int rc = -1;
+    thread_mutex_lock(&wheel_mutex);
+    wheel_timer_t* t = find_locked(id);
+    if (t && t->state == TIMER_PENDING) {
+        slot_unlink_locked(t);
+        forget_locked(t);
+        free(t);
+        rc = 0;
+    } else if (t && t->state == TIMER_FIRING) {
+        t->state = TIMER_CANCELLED;
+    }
+    thread_mutex_unlock(&wheel_mutex);
+    return rc;
+}
+
+size_t timer_wheel_count(void) {
+    if (atomic_load(&wheel_state) != 2) return 0;
+    thread_mutex_lock(&wheel_mutex);
+    size_t n = timer_count;
+    thread_mutex_unlock(&wheel_mutex);
+    return n;
+}
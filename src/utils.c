@@ -90,35 +90,43 @@ void url_decode(char* s) {
 	*o = '\0';
 }
 
-char* query_get(char* qs, const char* key) {
-	char* p = qs;
+static const char* query_find(const char* qs, const char* key, size_t* vlen) {
+	size_t kl = strlen(key);
+	const char* p = qs;
 	while (p && *p) {
-		char* amp = strchr(p, '&');
-		if (amp) *amp = '\0';
-		char* eq = strchr(p, '=');
-		if (eq) {
-			*eq = '\0';
-			if (strcmp(p, key) == 0) {
-				char* val = eq + 1;
-				char* decoded_val = strdup(val);
-				url_decode(decoded_val);
-				if (amp) *amp = '&';
-				if (eq) *eq = '=';
-				return decoded_val;
-			}
-			if (eq) *eq = '=';
-		}
-		if (amp) {
-			*amp = '&';
-			p = amp + 1;
-		}
-		else {
-			break;
+		const char* amp = strchr(p, '&');
+		const char* end = amp ? amp : p + strlen(p);
+		const char* eq = memchr(p, '=', (size_t)(end - p));
+		if (eq && (size_t)(eq - p) == kl && strncmp(p, key, kl) == 0) {
+			*vlen = (size_t)(end - eq - 1);
+			return eq + 1;
 		}
+		p = amp ? amp + 1 : NULL;
 	}
 	return NULL;
 }
 
+char* query_get(char* qs, const char* key) {
+	size_t vlen = 0;
+	const char* val = query_find(qs, key, &vlen);
+	if (!val) return NULL;
+	char* decoded_val = malloc(vlen + 1);
+	if (!decoded_val) return NULL;
+	memcpy(decoded_val, val, vlen);
+	decoded_val[vlen] = '\0';
+	url_decode(decoded_val);
+	return decoded_val;
+}
+
+char* query_get_arena(arena_t* a, const char* qs, const char* key) {
+	size_t vlen = 0;
+	const char* val = query_find(qs, key, &vlen);
+	if (!val) return NULL;
+	char* decoded_val = arena_strndup(a, val, vlen);
+	if (decoded_val) url_decode(decoded_val);
+	return decoded_val;
+}
+
 int p_strcmp(const void* a, const void* b) {
 	const char* s1 = *(const char* const*)a;
 	const char* s2 = *(const char* const*)b;